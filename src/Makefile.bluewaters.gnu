@@ -31,7 +31,7 @@ CFLAGS	= -O3 -g
 GFLAGS	= $(CUDA_HOME)bin/nvcc -use_fast_math -arch=sm_35
 
 INCDIR  = -I$(CUDA_HOME)include
-OBJECTS	= command.o pmcl3d.o grid.o source.o mesh.o cerjan.o swap.o kernel.o io.o
+OBJECTS	= command.o pmcl3d.o grid.o source.o mesh.o cerjan.o swap.o kernel.o kernel_cpu.o io.o
 LIB	= -lm -ldl -L$(CUDA_HOME)lib64 -lcudart -lstdc++
 
 pmcl3d:	$(OBJECTS)
@@ -64,5 +64,8 @@ swap.o:		swap.c
 kernel.o:	kernel.cu
 	$(GFLAGS) $(INCDIR) -c -o	kernel.o	kernel.cu
 
+kernel_cpu.o:	kernel_cpu.c
+	$(CC) $(CFLAGS) $(INCDIR) -c -o kernel_cpu.o	kernel_cpu.c
+
 clean:
 	rm -f *.o pmcl3d
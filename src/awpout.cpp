@@ -0,0 +1,237 @@
+/**
+@section LICENSE
+Copyright (c) 2013-2016, Regents of the University of California
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+/*
+********************************************************************************
+* awpout.cpp                                                                   *
+* reader of the output container (OUTFMT=1, COMPRESS)                          *
+*                                                                              *
+*   awpout FILE            header, window index and tiles                      *
+*   awpout FILE DIR        every window as the files of OUTFMT=0 in DIR        *
+*                          (SX%07ld, SY, SZ or STX, STY, STZ)                  *
+*   awpout FILE DIR -c     compare with those files instead, the largest       *
+*                          difference of each component (exit 1 if not equal,  *
+*                          or above tol for COMPRESS=2)                        *
+*   awpout -t              round trip of zpack and zunpack on made up tiles    *
+*                          (make check)                                        *
+*                                                                              *
+* the tiles of a compressed window are decoded in parallel (zunpack)           *
+********************************************************************************
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pmcl3d.h"
+
+static int readat(FILE *f, long long off, void *buf, long long n) {
+  if (fseeko(f, off, SEEK_SET)) return -1;
+  return fread(buf, 1, n, f) == (size_t)n ? 0 : -1;
+}
+
+// write the n floats of v to name, or compare them with it; returns the largest difference
+static double putbox(char *name, float *v, long int n, int cmp) {
+  FILE *f;
+  float *ref;
+  long int i;
+  double d = 0.0;
+
+  if (!cmp) {
+    f = fopen(name, "wb");
+    if (!f || fwrite(v, sizeof(float), n, f) != (size_t)n) {
+      printf("cannot write %s\n", name);
+      exit(-1);
+    }
+    fclose(f);
+    return 0.0;
+  }
+  ref = (float *)malloc(sizeof(float) * (n + 1));
+  f = fopen(name, "rb");
+  if (!f || fread(ref, sizeof(float), n, f) != (size_t)n) {
+    printf("cannot read %s\n", name);
+    exit(-1);
+  }
+  fclose(f);
+  for (i = 0; i < n; i++) d = fmax(d, fabs((double)v[i] - ref[i]));
+  free(ref);
+  return d;
+}
+
+// zpack and zunpack of tiles of waves of about 23 m/s, an empty one and one with extreme values;
+// returns the number of failed round trips
+static int selftest() {
+  const long tm[4] = {0, 1, 37, 3000};
+  const float ttol[3] = {1e-3f, 1e-6f, 1e-9f};
+  float *v, *u;
+  unsigned char *z;
+  long m, n, i, len, rd;
+  int a, k, codec, bad = 0;
+  double d;
+
+  for (a = 0; a < 4; a++) {
+    m = tm[a];
+    n = m * 10;
+    v = (float *)malloc(sizeof(float) * (n + 1));
+    u = (float *)malloc(sizeof(float) * (n + 1));
+    z = (unsigned char *)malloc(zbound(n));
+    for (i = 0; i < n; i++) v[i] = 23.f * sin(0.01 * (i % m) + 0.3 * (i / m)) * exp(-0.001 * (i % m));
+    if (m == 37) {
+      v[3] = 1e30f;
+      v[4] = -1e-40f;
+      v[5] = 0.f;
+    }
+    for (codec = 1; codec <= 2; codec++) {
+      for (k = 0; k < (codec == 2 ? 3 : 1); k++) {
+        len = zpack(v, m, 10, codec, ttol[k], z);
+        rd = zunpack(z, m, 10, codec, ttol[k], u);
+        for (d = 0.0, i = 0; i < n; i++) d = fmax(d, fabs((double)u[i] - v[i]));
+        if (len > zbound(n) || rd != len || d > (codec == 2 ? ttol[k] : 0.f)) {
+          printf("codec %d tol %g, %ld points: %ld bytes of %ld, %ld read, largest difference %g\n", codec, ttol[k], m, len, zbound(n), rd, d);
+          bad++;
+        }
+      }
+    }
+    free(z);
+    free(u);
+    free(v);
+  }
+  printf("%s\n", bad ? "zpack round trip failed" : "zpack round trip ok");
+  return bad;
+}
+
+int main(int argc, char **argv) {
+  OutHeader hdr;
+  FILE *f;
+  long long *index, *zlen, *zoff;
+  int *tile = NULL, w, c, t, cmp, bad = 0;
+  long int box, n;
+  unsigned char *zbuf = NULL;
+  float *v;
+  double d, dmax[3] = {0.0, 0.0, 0.0};
+  char name[512];
+  const char *comp[3] = {"X", "Y", "Z"};
+
+  if (argc > 1 && !strcmp(argv[1], "-t")) return selftest() > 0;
+  if (argc < 2) {
+    printf("usage: %s FILE [DIR [-c]] | -t\n", argv[0]);
+    return -1;
+  }
+  cmp = (argc > 3 && !strcmp(argv[3], "-c"));
+  f = fopen(argv[1], "rb");
+  if (!f || readat(f, 0, &hdr, sizeof(OutHeader)) || strcmp(hdr.magic, "AWPOUT1")) {
+    printf("%s is not an output container\n", argv[1]);
+    return -1;
+  }
+  box = (long int)hdr.rec_n[0] * hdr.rec_n[1] * hdr.rec_n[2];
+  printf("%s: %s, %d components, mesh %d x %d x %d, dh %g, dt %g, every %d steps (%g s)\n", argv[1], hdr.kind ? "stations" : "box", hdr.ncomp, hdr.nx, hdr.ny, hdr.nz, hdr.dh, hdr.dt, hdr.ntiskp, hdr.dts);
+  if (hdr.kind)
+    printf("%d stations, %d samples\n", hdr.rec_n[0], hdr.nsamp);
+  else
+    printf("box %d:%d:%d x %d:%d:%d x %d:%d:%d = %d x %d x %d, %d windows of %d samples, codec %d tol %g\n", hdr.nbg[0], hdr.ned[0], hdr.nskp[0], hdr.nbg[1], hdr.ned[1], hdr.nskp[1], hdr.nbg[2], hdr.ned[2], hdr.nskp[2], hdr.rec_n[0], hdr.rec_n[1], hdr.rec_n[2], hdr.nwin, hdr.write_step, hdr.codec, hdr.tol);
+  index = (long long *)malloc(sizeof(long long) * 2 * (hdr.nwin + 1));
+  if (readat(f, hdr.index, index, sizeof(long long) * 2 * hdr.nwin)) {
+    printf("cannot read the window index\n");
+    return -1;
+  }
+  if (hdr.codec) {
+    tile = (int *)malloc(sizeof(int) * 6 * hdr.ntile);
+    if (readat(f, hdr.tiles, tile, sizeof(int) * 6 * hdr.ntile)) {
+      printf("cannot read the tile records\n");
+      return -1;
+    }
+    printf("%d tiles\n", hdr.ntile);
+  }
+  if (argc < 3) {
+    for (w = 0; w < hdr.nwin; w++) printf("window %d: step %lld at %lld\n", w, index[2 * w], index[2 * w + 1]);
+    return 0;
+  }
+
+  // stations: one chunk per component holds the STX file
+  if (hdr.kind) {
+    n = box * hdr.nsamp;
+    v = (float *)malloc(sizeof(float) * (n + 1));
+    for (c = 0; c < hdr.ncomp; c++) {
+      if (readat(f, hdr.data + c * hdr.chunk, v, sizeof(float) * n)) {
+        printf("cannot read component %s\n", comp[c]);
+        return -1;
+      }
+      snprintf(name, sizeof(name), "%s/ST%s", argv[2], comp[c]);
+      dmax[c] = putbox(name, v, n, cmp);
+    }
+    free(v);
+  } else {
+    n = box * hdr.write_step;
+    v = (float *)malloc(sizeof(float) * (n + 1));
+    zlen = (long long *)malloc(sizeof(long long) * (3 * hdr.ntile + 1));
+    zoff = (long long *)malloc(sizeof(long long) * (hdr.ntile + 1));
+    for (w = 0; w < hdr.nwin; w++) {
+      if (hdr.codec && readat(f, index[2 * w + 1], zlen, sizeof(long long) * 3 * hdr.ntile)) {
+        printf("cannot read the tile sizes of window %d\n", w);
+        return -1;
+      }
+      zoff[0] = index[2 * w + 1] + sizeof(long long) * 3 * hdr.ntile;
+      for (c = 0; c < hdr.ncomp; c++) {
+        if (!hdr.codec) {
+          if (readat(f, index[2 * w + 1] + c * hdr.chunk, v, sizeof(float) * n)) {
+            printf("cannot read window %d\n", w);
+            return -1;
+          }
+        } else {
+          // the coded tiles of this component one after the other, then each decoded into the box
+          for (t = 0; t < hdr.ntile; t++) zoff[t + 1] = zoff[t] + zlen[3 * t + c];
+          zbuf = (unsigned char *)realloc(zbuf, zoff[hdr.ntile] - zoff[0] + 1);
+          if (readat(f, zoff[0], zbuf, zoff[hdr.ntile] - zoff[0])) {
+            printf("cannot read window %d\n", w);
+            return -1;
+          }
+#pragma omp parallel for schedule(dynamic)
+          for (t = 0; t < hdr.ntile; t++) {
+            int *tl = tile + 6 * t, s, z, y;
+            long int m = (long int)tl[3] * tl[4] * tl[5];
+            float *tv = (float *)malloc(sizeof(float) * (m * hdr.write_step + 1));
+
+            zunpack(zbuf + zoff[t] - zoff[0], m, hdr.write_step, hdr.codec, hdr.tol, tv);
+            for (s = 0; s < hdr.write_step; s++)
+              for (z = 0; z < tl[5]; z++)
+                for (y = 0; y < tl[4]; y++)
+                  memcpy(v + s * box + ((long int)(tl[2] + z) * hdr.rec_n[1] + tl[1] + y) * hdr.rec_n[0] + tl[0], tv + ((long int)(s * tl[5] + z) * tl[4] + y) * tl[3], sizeof(float) * tl[3]);
+            free(tv);
+          }
+          zoff[0] = zoff[hdr.ntile];
+        }
+        snprintf(name, sizeof(name), "%s/S%s%07lld", argv[2], comp[c], index[2 * w]);
+        d = putbox(name, v, n, cmp);
+        dmax[c] = fmax(dmax[c], d);
+      }
+    }
+    free(zoff);
+    free(zlen);
+    free(zbuf);
+    free(v);
+  }
+  fclose(f);
+
+  if (cmp) {
+    for (c = 0; c < hdr.ncomp; c++) {
+      printf("%s: largest difference %g\n", comp[c], dmax[c]);
+      if (dmax[c] > (hdr.codec == 2 ? hdr.tol : 0.f)) bad = 1;
+    }
+  }
+  free(tile);
+  free(index);
+  return bad;
+}
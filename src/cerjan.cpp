@@ -17,48 +17,94 @@ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
 
 #include "pmcl3d.h"
 
-void inicrj(float ARBC, int *coords, int nxt, int nyt, int nzt, int NX, int NY, int ND, Grid1D dcrjx, Grid1D dcrjy, Grid1D dcrjz) {
+// offs: global index of the first interior point in x and y, and its depth below the free surface
+// (z rank 0 on top). the damping follows the global index, ghost points included, so the stress
+// a neighbour's slab computes redundantly is damped like its owner's
+void inicrj(float ARBC, int *offs, int nxt, int nyt, int nzt, int NX, int NY, int NZ, int ND, Grid1D dcrjx, Grid1D dcrjy, Grid1D dcrjz) {
   int nxp, nyp, nzp;
   int i, j, k;
   float alpha;
   alpha = sqrt(-log(ARBC)) / ND;
 
-  nxp = nxt * coords[0] + 1;
-  if (nxp <= ND) {
-    for (i = 0; i < ND; i++) {
-      nxp = i + 1;
-      dcrjx[i + 2 + 4 * loop] = dcrjx[i + 2 + 4 * loop] * (exp(-((alpha * (ND - nxp + 1)) * (alpha * (ND - nxp + 1)))));
-    }
+  for (i = 0; i < nxt + 4 + 8 * loop; i++) {
+    nxp = offs[0] + i - 2 - 4 * loop + 1;
+    if (nxp >= 1 && nxp <= ND)
+      dcrjx[i] = dcrjx[i] * (exp(-((alpha * (ND - nxp + 1)) * (alpha * (ND - nxp + 1)))));
+    if (nxp >= NX - ND + 1 && nxp <= NX)
+      dcrjx[i] = dcrjx[i] * (exp(-((alpha * (ND - (NX - nxp))) * (alpha * (ND - (NX - nxp))))));
   }
-  nxp = nxt * coords[0] + 1;
-  if ((nxp + nxt - 1) >= (NX - ND + 1)) {
-    for (i = nxt - ND; i < nxt; i++) {
-      nxp = i + NX - nxt + 1;
-      dcrjx[i + 2 + 4 * loop] = dcrjx[i + 2 + 4 * loop] * (exp(-((alpha * (ND - (NX - nxp))) * (alpha * (ND - (NX - nxp))))));
-    }
+
+  for (j = 0; j < nyt + 4 + 8 * loop; j++) {
+    nyp = offs[1] + j - 2 - 4 * loop + 1;
+    if (nyp >= 1 && nyp <= ND)
+      dcrjy[j] = dcrjy[j] * (exp(-((alpha * (ND - nyp + 1)) * (alpha * (ND - nyp + 1)))));
+    if (nyp >= NY - ND + 1 && nyp <= NY)
+      dcrjy[j] = dcrjy[j] * (exp(-((alpha * (ND - (NY - nyp))) * ((alpha * (ND - (NY - nyp)))))));
+  }
+
+  // z only has the bottom sponge
+  for (k = 0; k < nzt + 2 * align; k++) {
+    nzp = NZ - offs[2] - nzt + k - align + 1;
+    if (nzp >= 1 && nzp <= ND)
+      dcrjz[k] = dcrjz[k] * (exp(-((alpha * (ND - nzp + 1)) * ((alpha * (ND - nzp + 1))))));
   }
+  return;
+}
+
+// weights at depth frac (0 at the inner edge, 1 at the outer boundary) into the slab
+static void pmlcoef(float frac, float d0, float FP, float DT, float *a, float *b) {
+  float d, alpha;
+  d = d0 * frac * frac;
+  alpha = M_PI * FP * (1.0 - frac);
+  *b = exp(-(d + alpha) * DT);
+  *a = d / (d + alpha) * (*b - 1.0);
+}
+
+// convolutional PML (NPC=1) damping profiles: quadratic d(x), alpha(x) falling from pi*FP at the
+// inner edge to 0, kappa=1; R=10^-ARBC is the normal-incidence reflection of the slab. a and b are
+// the recursive convolution weights, psi = b*psi + a*D; a is zero outside the slabs
+void inipml(Grid3D d1, Grid3D mu, Grid3D lam, float ARBC, float FP, float DH, float DT, int *offs, int nxt, int nyt, int nzt, int NX, int NY, int NZ, int ND, MPI_Comm MCW, Grid1D pmlax, Grid1D pmlbx, Grid1D pmlay, Grid1D pmlby, Grid1D pmlaz, Grid1D pmlbz) {
+  int nxp, nyp, nzp;
+  int i, j, k;
+  float vp, vpmax = 0.0, t_vpmax, d0;
+
+  for (i = 2 + 4 * loop; i < nxt + 2 + 4 * loop; i++)
+    for (j = 2 + 4 * loop; j < nyt + 2 + 4 * loop; j++)
+      for (k = align; k < nzt + align; k++) {
+        vp = sqrt((1.0 / G3(lam, i, j, k) + 2.0 / G3(mu, i, j, k)) / G3(d1, i, j, k));
+        if (vp > vpmax) vpmax = vp;
+      }
+  t_vpmax = vpmax;
+  MPI_Allreduce(&t_vpmax, &vpmax, 1, MPI_FLOAT, MPI_MAX, MCW);
+  d0 = 3.0 * vpmax * ARBC * log(10.0) / (2.0 * ND * DH);
 
-  nyp = nyt * coords[1] + 1;
-  if (nyp <= ND) {
-    for (j = 0; j < ND; j++) {
-      nyp = j + 1;
-      dcrjy[j + 2 + 4 * loop] = dcrjy[j + 2 + 4 * loop] * (exp(-((alpha * (ND - nyp + 1)) * (alpha * (ND - nyp + 1)))));
-    }
+  for (i = 0; i < nxt + 4 + 8 * loop; i++) {
+    nxp = offs[0] + i - 2 - 4 * loop + 1;
+    pmlax[i] = 0.0;
+    pmlbx[i] = 1.0;
+    if (nxp >= 1 && nxp <= ND)
+      pmlcoef((float)(ND - nxp + 1) / ND, d0, FP, DT, &pmlax[i], &pmlbx[i]);
+    if (nxp >= NX - ND + 1 && nxp <= NX)
+      pmlcoef((float)(ND - (NX - nxp)) / ND, d0, FP, DT, &pmlax[i], &pmlbx[i]);
   }
-  nyp = nyt * coords[1] + 1;
-  if ((nyp + nyt - 1) >= (NY - ND + 1)) {
-    for (j = nyt - ND; j < nyt; j++) {
-      nyp = j + NY - nyt + 1;
-      dcrjy[j + 2 + 4 * loop] = dcrjy[j + 2 + 4 * loop] * (exp(-((alpha * (ND - (NY - nyp))) * ((alpha * (ND - (NY - nyp)))))));
-    }
+
+  for (j = 0; j < nyt + 4 + 8 * loop; j++) {
+    nyp = offs[1] + j - 2 - 4 * loop + 1;
+    pmlay[j] = 0.0;
+    pmlby[j] = 1.0;
+    if (nyp >= 1 && nyp <= ND)
+      pmlcoef((float)(ND - nyp + 1) / ND, d0, FP, DT, &pmlay[j], &pmlby[j]);
+    if (nyp >= NY - ND + 1 && nyp <= NY)
+      pmlcoef((float)(ND - (NY - nyp)) / ND, d0, FP, DT, &pmlay[j], &pmlby[j]);
   }
 
-  nzp = 1;
-  if (nzp <= ND) {
-    for (k = 0; k < ND; k++) {
-      nzp = k + 1;
-      dcrjz[k + align] = dcrjz[k + align] * (exp(-((alpha * (ND - nzp + 1)) * ((alpha * (ND - nzp + 1))))));
-    }
+  // z only has the bottom slab
+  for (k = 0; k < nzt + 2 * align; k++) {
+    nzp = NZ - offs[2] - nzt + k - align + 1;
+    pmlaz[k] = 0.0;
+    pmlbz[k] = 1.0;
+    if (nzp >= 1 && nzp <= ND)
+      pmlcoef((float)(ND - nzp + 1) / ND, d0, FP, DT, &pmlaz[k], &pmlbz[k]);
   }
   return;
 }
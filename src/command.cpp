@@ -34,11 +34,26 @@ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
 *  READ_STEP    <INTEGER>     -R                                                                               *
 *  READ_STEP_GPU<INTEGER>     -Q              CPU reads larger chunks and sends to GPU at every READ_STEP_GPU  *
 *                                               (IFAULT=2) READ_STEP must be divisible by READ_STEP_GPU        *
+*  BACKEND      <INTEGER>     -b              compute backend (0=GPU, 1=CPU)                                   *
+*  SIMD         <INTEGER>                     CPU backend SIMD level (-1=auto, 0=scalar, 1=AVX2, 2=AVX-512)    *
+*  TBLOCK       <INTEGER>                     CPU temporal blocking depth in time steps (1=off); single rank   *
+*                                               only (PX=PY=PZ=1, NRHS=1, TILE>0): the halos are one step      *
+*                                               deep, other runs with TBLOCK>1 stop with an error              *
+*  TILE         <INTEGER>                     CPU temporal blocking tile edge in i and j (grid points), used   *
+*                                               with TBLOCK>1 on a single rank                                 *
+*  HUGEPAGE     <INTEGER>                     host grids on 2 MB huge pages with parallel first touch (1=on)   *
+*  OVERLAP      <INTEGER>                     overlap halo exchange with interior computation (1=on)           *
+*  SHMEM        <INTEGER>                     CPU halos of on-node neighbours through a shared window (1=on)   *
+*  PART         <INTEGER>                     domain partition (0=even slabs, 1=cost weighted)                 *
+*  MATPAL       <INTEGER>                     CPU media as 16-bit material IDs and a property table (1=on)     *
+*  MEDCOEF      <INTEGER>                     CPU kernels read precomputed staggered media coefficients (1=on) *
+*  NRHS         <INTEGER>                     CPU wavefields per sweep, taken from the ENSEMBLE list (1=off)   *
 *  NX           <INTEGER>     -X              x model dimension in nodes                                       *
 *  NY           <INTEGER>     -Y              y model dimension in nodes                                       *
 *  NZ           <INTEGER>     -Z              z model dimension in nodes                                       *
 *  PX           <INTEGER>     -x              number of procs in the x direction                               *
 *  PY           <INTEGER>     -y              number of procs in the y direction                               *
+*  PZ           <INTEGER>     -z              number of procs in the z direction (CPU backend for PZ > 1)      *
 *  NBGX         <INTEGER>                     index (starts with 1) to start recording points in X             *
 *  NEDX         <INTEGER>                     index to end recording points in X (-1 for all)                  *
 *  NSKPX        <INTEGER>                     #points to skip in recording points in X                         *
@@ -56,10 +71,22 @@ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
 *  NTISKP       <INTEGER>     -r              # timesteps to skip to copy velocities from GPU to CPU           *
 *  WRITE_STEP   <INTEGER>     -W              # timesteps to write the buffer to the files                     *
 *                                               (written timesteps are n*NTISKP*WRITE_STEP for n=1,2,...)      *
+*  OUTFMT       <INTEGER>                     output files (0=SX/SY/SZ per window, 1=one container per run     *
+*                                               with a header and window index, see OutHeader)                 *
+*  COMPRESS     <INTEGER>                     compression of the box output in the container (0=off,           *
+*                                               1=lossless, 2=lossy within CTOL), implies OUTFMT=1             *
+*  CTOL         <FLOAT>                       absolute error bound of COMPRESS=2 (m/s)                         *
+*  IORANKS      <INTEGER>                     ranks past PX*PY*PZ that gather and write the per window box     *
+*                                               files (0=every rank writes its own part), OUTFMT=0 only        *
+*  STRIPE       <INTEGER>                     striping_unit hint of the output files in bytes (0=default)      *
 *  INSRC        <STRING>                      source input file (if IFAULT=2, then this is prefix of tpsrc)    *
 *  INVEL        <STRING>                      mesh input file                                                  *
 *  INSRC_I2     <STRING>                      split source input file prefix for IFAULT=2 option               *
 *  CHKFILE      <STRING>      -c              Checkpoint statistics file to write to                           *
+*  ENSEMBLE     <STRING>                      run list: one "INSRC OUT [INSRC_I2]" line per run on the same    *
+*                                               mesh (empty=single run with INSRC and OUT)                     *
+*  STATIONS     <STRING>                      station list: one "x y z" line of 1-based global indices per     *
+*                                               station, recorded in place of the NBG/NED box (empty=box)      *
 ****************************************************************************************************************
 */
 
@@ -87,6 +114,26 @@ const int def_MEDIASTART = 3;
 const int def_IFAULT = 1;
 const int def_READ_STEP = 2500;
 const int def_READ_STEP_GPU = 2500;
+#ifdef NOCUDA
+const int def_BACKEND = 1;
+#else
+const int def_BACKEND = 0;
+#endif
+const int def_SIMD = -1;  // best supported
+const int def_TBLOCK = 1;
+const int def_TILE = 32;
+const int def_HUGEPAGE = 0;
+const int def_OVERLAP = 0;
+const int def_SHMEM = 0;
+const int def_PART = 0;
+const int def_MATPAL = 0;
+const int def_MEDCOEF = 0;
+const int def_NRHS = 1;
+const int def_OUTFMT = 0;
+const int def_COMPRESS = 0;
+const float def_CTOL = 1.e-6;
+const int def_IORANKS = 0;
+const int def_STRIPE = 0;
 
 const int def_NTISKP = 25;
 const int def_WRITE_STEP = 100;
@@ -97,6 +144,7 @@ const int def_NZ = 1500;
 
 const int def_PX = 25;
 const int def_PY = 10;
+const int def_PZ = 1;
 
 const int def_NBGX = 1;
 const int def_NEDX = -1;  // use -1 for all
@@ -124,8 +172,10 @@ const char def_INSRC_TPSRC[50] = "input_rst/srcpart/tpsrc/tpsrc";
 const char def_INSRC_I2[50] = "input_rst/srcpart/split_faults/fault";
 
 const char def_CHKFILE[50] = "output_ckp/CHKP";
+const char def_ENSEMBLE[50] = "";
+const char def_STATIONS[50] = "";
 
-void command(int argc, char **argv, float *TMAX, float *DH, float *DT, float *ARBC, float *PHT, int *NPC, int *ND, int *NSRC, int *NST, int *NVAR, int *NVE, int *MEDIASTART, int *IFAULT, int *READ_STEP, int *READ_STEP_GPU, int *NTISKP, int *WRITE_STEP, int *NX, int *NY, int *NZ, int *PX, int *PY, int *NBGX, int *NEDX, int *NSKPX, int *NBGY, int *NEDY, int *NSKPY, int *NBGZ, int *NEDZ, int *NSKPZ, float *FL, float *FH, float *FP, int *IDYNA, int *SoCalQ, char *INSRC, char *INVEL, char *OUT, char *INSRC_I2, char *CHKFILE) {
+void command(int argc, char **argv, float *TMAX, float *DH, float *DT, float *ARBC, float *PHT, int *NPC, int *ND, int *NSRC, int *NST, int *NVAR, int *NVE, int *MEDIASTART, int *IFAULT, int *READ_STEP, int *READ_STEP_GPU, int *BACKEND, int *SIMD, int *TBLOCK, int *TILE, int *HUGEPAGE, int *OVERLAP, int *SHMEM, int *PART, int *MATPAL, int *MEDCOEF, int *NRHS, int *NTISKP, int *WRITE_STEP, int *OUTFMT, int *COMPRESS, float *CTOL, int *IORANKS, int *STRIPE, int *NX, int *NY, int *NZ, int *PX, int *PY, int *PZ, int *NBGX, int *NEDX, int *NSKPX, int *NBGY, int *NEDY, int *NSKPY, int *NBGZ, int *NEDZ, int *NSKPZ, float *FL, float *FH, float *FP, int *IDYNA, int *SoCalQ, char *INSRC, char *INVEL, char *OUT, char *INSRC_I2, char *CHKFILE, char *ENSEMBLE, char *STATIONS) {
   // Fill in default values
   *TMAX = def_TMAX;
   *DH = def_DH;
@@ -144,6 +194,22 @@ void command(int argc, char **argv, float *TMAX, float *DH, float *DT, float *AR
   *IFAULT = def_IFAULT;
   *READ_STEP = def_READ_STEP;
   *READ_STEP_GPU = def_READ_STEP_GPU;
+  *BACKEND = def_BACKEND;
+  *SIMD = def_SIMD;
+  *TBLOCK = def_TBLOCK;
+  *TILE = def_TILE;
+  *HUGEPAGE = def_HUGEPAGE;
+  *OVERLAP = def_OVERLAP;
+  *SHMEM = def_SHMEM;
+  *PART = def_PART;
+  *MATPAL = def_MATPAL;
+  *MEDCOEF = def_MEDCOEF;
+  *NRHS = def_NRHS;
+  *OUTFMT = def_OUTFMT;
+  *COMPRESS = def_COMPRESS;
+  *CTOL = def_CTOL;
+  *IORANKS = def_IORANKS;
+  *STRIPE = def_STRIPE;
 
   *NTISKP = def_NTISKP;
   *WRITE_STEP = def_WRITE_STEP;
@@ -153,6 +219,7 @@ void command(int argc, char **argv, float *TMAX, float *DH, float *DT, float *AR
   *NZ = def_NZ;
   *PX = def_PX;
   *PY = def_PY;
+  *PZ = def_PZ;
 
   *NBGX = def_NBGX;
   *NEDX = def_NEDX;
@@ -175,9 +242,11 @@ void command(int argc, char **argv, float *TMAX, float *DH, float *DT, float *AR
   strcpy(OUT, def_OUT);
   strcpy(INSRC_I2, def_INSRC_I2);
   strcpy(CHKFILE, def_CHKFILE);
+  strcpy(ENSEMBLE, def_ENSEMBLE);
+  strcpy(STATIONS, def_STATIONS);
 
   extern char *optarg;
-  static const char *optstring = "-T:H:t:A:P:M:D:S:N:V:B:n:I:R:Q:X:Y:Z:x:y:z:i:l:h:p:s:r:W:1:2:3:11:12:13:21:22:23:100:101:102:o:c:";
+  static const char *optstring = "-T:H:t:A:P:M:D:S:N:V:B:n:I:R:Q:b:X:Y:Z:x:y:z:i:l:h:p:s:r:W:1:2:3:11:12:13:21:22:23:100:101:102:o:c:";
   static struct option long_options[] = {
     {"TMAX", required_argument, NULL, 'T'},
     {"DH", required_argument, NULL, 'H'},
@@ -194,11 +263,28 @@ void command(int argc, char **argv, float *TMAX, float *DH, float *DT, float *AR
     {"IFAULT", required_argument, NULL, 'I'},
     {"READ_STEP", required_argument, NULL, 'R'},
     {"READ_STEP_GPU", required_argument, NULL, 'Q'},
+    {"BACKEND", required_argument, NULL, 'b'},
+    {"SIMD", required_argument, NULL, 31},
+    {"TBLOCK", required_argument, NULL, 32},
+    {"TILE", required_argument, NULL, 33},
+    {"HUGEPAGE", required_argument, NULL, 34},
+    {"OVERLAP", required_argument, NULL, 35},
+    {"SHMEM", required_argument, NULL, 36},
+    {"PART", required_argument, NULL, 37},
+    {"MATPAL", required_argument, NULL, 38},
+    {"MEDCOEF", required_argument, NULL, 39},
+    {"NRHS", required_argument, NULL, 40},
+    {"OUTFMT", required_argument, NULL, 41},
+    {"COMPRESS", required_argument, NULL, 42},
+    {"CTOL", required_argument, NULL, 43},
+    {"IORANKS", required_argument, NULL, 44},
+    {"STRIPE", required_argument, NULL, 45},
     {"NX", required_argument, NULL, 'X'},
     {"NY", required_argument, NULL, 'Y'},
     {"NZ", required_argument, NULL, 'Z'},
     {"PX", required_argument, NULL, 'x'},
     {"PY", required_argument, NULL, 'y'},
+    {"PZ", required_argument, NULL, 'z'},
     {"NBGX", required_argument, NULL, 1},
     {"NEDX", required_argument, NULL, 2},
     {"NSKPX", required_argument, NULL, 3},
@@ -220,6 +306,8 @@ void command(int argc, char **argv, float *TMAX, float *DH, float *DT, float *AR
     {"OUT", required_argument, NULL, 'o'},
     {"INSRC_I2", required_argument, NULL, 102},
     {"CHKFILE", required_argument, NULL, 'c'},
+    {"ENSEMBLE", required_argument, NULL, 103},
+    {"STATIONS", required_argument, NULL, 106},
   };
 
   // If IFAULT=2 and INSRC is not set, then *INSRC = def_INSRC_TPSRC, not def_INSRC
@@ -275,6 +363,54 @@ void command(int argc, char **argv, float *TMAX, float *DH, float *DT, float *AR
         readstepGpuIsSet = 1;
         *READ_STEP_GPU = atoi(optarg);
         break;
+      case 'b':
+        *BACKEND = atoi(optarg);
+        break;
+      case 31:
+        *SIMD = atoi(optarg);
+        break;
+      case 32:
+        *TBLOCK = atoi(optarg);
+        break;
+      case 33:
+        *TILE = atoi(optarg);
+        break;
+      case 34:
+        *HUGEPAGE = atoi(optarg);
+        break;
+      case 35:
+        *OVERLAP = atoi(optarg);
+        break;
+      case 36:
+        *SHMEM = atoi(optarg);
+        break;
+      case 37:
+        *PART = atoi(optarg);
+        break;
+      case 38:
+        *MATPAL = atoi(optarg);
+        break;
+      case 39:
+        *MEDCOEF = atoi(optarg);
+        break;
+      case 40:
+        *NRHS = atoi(optarg);
+        break;
+      case 41:
+        *OUTFMT = atoi(optarg);
+        break;
+      case 42:
+        *COMPRESS = atoi(optarg);
+        break;
+      case 43:
+        *CTOL = atof(optarg);
+        break;
+      case 44:
+        *IORANKS = atoi(optarg);
+        break;
+      case 45:
+        *STRIPE = atoi(optarg);
+        break;
       case 'X':
         *NX = atoi(optarg);
         break;
@@ -290,6 +426,9 @@ void command(int argc, char **argv, float *TMAX, float *DH, float *DT, float *AR
       case 'y':
         *PY = atoi(optarg);
         break;
+      case 'z':
+        *PZ = atoi(optarg);
+        break;
       case 1:
         *NBGX = atoi(optarg);
         break;
@@ -354,13 +493,19 @@ void command(int argc, char **argv, float *TMAX, float *DH, float *DT, float *AR
       case 'c':
         strcpy(CHKFILE, optarg);
         break;
+      case 103:
+        strcpy(ENSEMBLE, optarg);
+        break;
+      case 106:
+        strcpy(STATIONS, optarg);
+        break;
       default:
         printf("Usage: %s \nOptions:\n\t[(-T | --TMAX) <TMAX>]\n\t[(-H | --DH) <DH>]\n\t[(-t | --DT) <DT>]\n\t[(-A | --ARBC) <ARBC>]\n\t[(-P | --PHT) <PHT>]\n\t[(-M | --NPC) <NPC>]\n\t[(-D | --ND) <ND>]\n\t[(-S | --NSRC) <NSRC>]\n\t[(-N | --NST) <NST>]\n", argv[0]);
-        printf("\n\t[(-V | --NVE) <NVE>]\n\t[(-B | --MEDIASTART) <MEDIASTART>]\n\t[(-n | --NVAR) <NVAR>]\n\t[(-I | --IFAULT) <IFAULT>]\n\t[(-R | --READ_STEP) <x READ_STEP for CPU>]\n\t[(-Q | --READ_STEP_GPU) <READ_STEP for GPU>]\n");
+        printf("\n\t[(-V | --NVE) <NVE>]\n\t[(-B | --MEDIASTART) <MEDIASTART>]\n\t[(-n | --NVAR) <NVAR>]\n\t[(-I | --IFAULT) <IFAULT>]\n\t[(-R | --READ_STEP) <x READ_STEP for CPU>]\n\t[(-Q | --READ_STEP_GPU) <READ_STEP for GPU>]\n\t[(-b | --BACKEND) <0=GPU, 1=CPU>]\n\t[--SIMD <-1=auto, 0=scalar, 1=AVX2, 2=AVX-512>]\n\t[--TBLOCK <time steps per block, single rank only>]\n\t[--TILE <tile edge>]\n\t[--HUGEPAGE <0=off, 1=on>]\n\t[--OVERLAP <0=off, 1=on>]\n\t[--SHMEM <0=off, 1=on>]\n\t[--PART <0=even, 1=cost weighted>]\n\t[--MATPAL <0=off, 1=on>]\n\t[--MEDCOEF <0=off, 1=on>]\n\t[--NRHS <wavefields per sweep>]\n");
         printf("\n\t[(-X | --NX) <x length]\n\t[(-Y | --NY) <y length>]\n\t[(-Z | --NZ) <z length]\n\t[(-x | --NPX) <x processors]\n\t[(-y | --NPY) <y processors>]\n\t[(-z | --NPZ) <z processors>]\n");
         printf("\n\t[(-1 | --NBGX) <starting point to record in X>]\n\t[(-2 | --NEDX) <ending point to record in X>]\n\t[(-3 | --NSKPX) <skipping points to record in X>]\n\t[(-11 | --NBGY) <starting point to record in Y>]\n\t[(-12 | --NEDY) <ending point to record in Y>]\n\t[(-13 | --NSKPY) <skipping points to record in Y>]\n\t[(-21 | --NBGZ) <starting point to record in Z>]\n\t[(-22 | --NEDZ) <ending point to record in Z>]\n\t[(-23 | --NSKPZ) <skipping points to record in Z>]\n");
-        printf("\n\t[(-i | --IDYNA) <i IDYNA>]\n\t[(-s | --SoCalQ) <s SoCalQ>]\n\t[(-l | --FL) <l FL>]\n\t[(-h | --FH) <i FH>]\n\t[(-p | --FP) <p FP>]\n\t[(-r | --NTISKP) <time skipping in writing>]\n\t[(-W | --WRITE_STEP) <time aggregation in writing>]\n");
-        printf("\n\t[(-100 | --INSRC) <source file>]\n\t[(-101 | --INVEL) <mesh file>]\n\t[(-o | --OUT) <output file>]\n\t[(-102 | --INSRC_I2) <split source file prefix (IFAULT=2)>]\n\t[(-c | --CHKFILE) <checkpoint file to write statistics>]\n\n");
+        printf("\n\t[(-i | --IDYNA) <i IDYNA>]\n\t[(-s | --SoCalQ) <s SoCalQ>]\n\t[(-l | --FL) <l FL>]\n\t[(-h | --FH) <i FH>]\n\t[(-p | --FP) <p FP>]\n\t[(-r | --NTISKP) <time skipping in writing>]\n\t[(-W | --WRITE_STEP) <time aggregation in writing>]\n\t[--OUTFMT <0=file per window, 1=container per run>]\n\t[--COMPRESS <0=off, 1=lossless, 2=lossy>]\n\t[--CTOL <error bound of COMPRESS=2>]\n\t[--IORANKS <output aggregator ranks>]\n\t[--STRIPE <striping_unit of the output files>]\n");
+        printf("\n\t[(-100 | --INSRC) <source file>]\n\t[(-101 | --INVEL) <mesh file>]\n\t[(-o | --OUT) <output file>]\n\t[(-102 | --INSRC_I2) <split source file prefix (IFAULT=2)>]\n\t[(-c | --CHKFILE) <checkpoint file to write statistics>]\n\t[(-103 | --ENSEMBLE) <run list on the same mesh>]\n\t[(-106 | --STATIONS) <station list>]\n\n");
         exit(-1);
     }
   }
@@ -23,34 +23,201 @@ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
 
 #include "pmcl3d.h"
 
 Grid3D Alloc3D(int nx, int ny, int nz) {
-  int i, j, k;
-  Grid3D U = (Grid3D)malloc(sizeof(float **) * nx + sizeof(float *) * nx * ny + sizeof(float) * nx * ny * nz);
+  long int i;
+  Grid3D U;
 
-  if (!U) {
+  U.data = (float *)malloc(sizeof(float) * nx * ny * nz);
+  if (!U.data) {
     printf("Cannot allocate 3D float array\n");
     exit(-1);
   }
-  for (i = 0; i < nx; i++) {
-    U[i] = ((float **)U) + nx + i * ny;
+  U.nx = nx;
+  U.ny = ny;
+  U.nz = nz;
+  U.yline = nz;
+  U.slice = (long int)ny * nz;
+
+  for (i = 0; i < (long int)nx * ny * nz; i++)
+    U.data[i] = 0.0f;
+
+  return U;
+}
+
+static int h_hugepage = 0;
+// grids on huge pages start a few cache lines into their block, a different number for each grid
+// (17 lines, so successive grids fall in different sets): at the same offset of a 2 MB page all of
+// them map to the same cache sets. the blocks are freed from the table by Delloc3D
+#define HUGEPAGE_SKEW 1088
+static int h_ncall = 0, h_nblock = 0;
+static void **h_block = NULL;
+static float **h_data = NULL;
+
+// allocation mode of AllocPad3D (0=malloc and serial zero fill, 1=2 MB aligned huge pages with parallel first touch)
+void SetAlloc3D(int HUGEPAGE) {
+  h_hugepage = HUGEPAGE;
+  return;
+}
+
+// zero fill a padded grid with the thread to j slab mapping of dvelcx_C/dstrqc_C (static schedule over
+// the interior rows), so each page lands on the NUMA node of the thread that updates it; the first and
+// last thread also take the halo rows next to their slab
+static void FirstTouch3D(Grid3D U, int nyt) {
+  int j, jj, j_s, j_e, i;
+
+#pragma omp parallel for schedule(static) private(jj, j_s, j_e, i)
+  for (j = halo_xy; j < nyt + halo_xy; j++) {
+    j_s = (j == halo_xy) ? 0 : j;
+    j_e = (j == nyt + halo_xy - 1) ? U.ny - 1 : j;
+    for (i = 0; i < U.nx; i++)
+      for (jj = j_s; jj <= j_e; jj++) memset(&G3(U, i, jj, 0), 0, sizeof(float) * U.nz);
   }
 
-  float *Ustart = (float *)(U[nx - 1] + ny);
-  for (i = 0; i < nx; i++)
-    for (j = 0; j < ny; j++)
-      U[i][j] = Ustart + i * ny * nz + j * nz;
+  return;
+}
 
-  for (i = 0; i < nx; i++)
-    for (j = 0; j < ny; j++)
-      for (k = 0; k < nz; k++)
-        U[i][j][k] = 0.0f;
+// wavefield/media grid of nxt x nyt x nzt interior points with halo_xy ghost planes in x and y
+// and halo_z padding in z on each side
+Grid3D AllocPad3D(int nxt, int nyt, int nzt) {
+  long int bytes;
+  void *p;
+  Grid3D U;
+  long int skew;
+
+  if (!h_hugepage) return Alloc3D(nxt + 2 * halo_xy, nyt + 2 * halo_xy, nzt + 2 * halo_z);
+
+  U.nx = nxt + 2 * halo_xy;
+  U.ny = nyt + 2 * halo_xy;
+  U.nz = nzt + 2 * halo_z;
+  U.yline = U.nz;
+  U.slice = (long int)U.ny * U.nz;
+  skew = (h_ncall++ % 32) * HUGEPAGE_SKEW;
+  bytes = sizeof(float) * U.nx * U.slice + skew;
+  // round up so the tail of the grid also sits on a whole huge page
+  bytes = (bytes + HUGEPAGE_SIZE - 1) / HUGEPAGE_SIZE * HUGEPAGE_SIZE;
+  if (posix_memalign(&p, HUGEPAGE_SIZE, bytes)) {
+    printf("Cannot allocate 3D float array\n");
+    exit(-1);
+  }
+  U.data = (float *)((char *)p + skew);
+  h_block = (void **)realloc(h_block, sizeof(void *) * (h_nblock + 1));
+  h_data = (float **)realloc(h_data, sizeof(float *) * (h_nblock + 1));
+  h_block[h_nblock] = p;
+  h_data[h_nblock++] = U.data;
+#ifdef MADV_HUGEPAGE
+  madvise(p, bytes, MADV_HUGEPAGE);
+#endif
+
+  FirstTouch3D(U, nyt);
 
   return U;
 }
 
+// n wavefield grids of nxt x nyt x nzt interior points stacked in x in one allocation, so the kernels
+// step from one to the next by a fixed stride; Rhs3D is the r-th of them. n=1 is AllocPad3D
+Grid3D AllocRhs3D(int n, int nxt, int nyt, int nzt) {
+  return AllocPad3D(n * (nxt + 2 * halo_xy) - 2 * halo_xy, nyt, nzt);
+}
+
+Grid3D Rhs3D(Grid3D U, int r, int nxt) {
+  return View3D(U, r * (nxt + 2 * halo_xy), 0, 0, nxt + 2 * halo_xy, U.ny, U.nz);
+}
+
+// bytes grid q of the n shared grids of node rank srank starts into its huge pages
+static long int ShmSkew(int srank, int n, int q) {
+  return (long int)((srank * n + q + 16) % 32) * HUGEPAGE_SKEW;
+}
+
+// n padded grids in one segment of an MPI-3 shared window over the node communicator MCS, so ranks on
+// the same node can read each other's boundary planes (see SharedQuery3D); released with MPI_Win_free
+void AllocShared3D(Grid3D *U, int n, int nxt, int nyt, int nzt, MPI_Comm MCS, MPI_Win *win) {
+  int q, srank;
+  long int grid;
+  float *p;
+  MPI_Info info;
+
+  U[0].nx = nxt + 2 * halo_xy;
+  U[0].ny = nyt + 2 * halo_xy;
+  U[0].nz = nzt + 2 * halo_z;
+  U[0].yline = U[0].nz;
+  U[0].slice = (long int)U[0].ny * U[0].nz;
+  // keep every grid on its own huge pages, skewed like AllocPad3D by the node rank and the grid
+  // (see ShmSkew), so the grids of a rank and of its neighbours do not share cache sets
+  grid = sizeof(float) * U[0].nx * U[0].slice + 31 * HUGEPAGE_SKEW;
+  grid = (grid + HUGEPAGE_SIZE - 1) / HUGEPAGE_SIZE * HUGEPAGE_SIZE;
+  MPI_Comm_rank(MCS, &srank);
+
+  // segments of different ranks are placed apart, so each rank's first touch decides its own pages
+  MPI_Info_create(&info);
+  MPI_Info_set(info, "alloc_shared_noncontig", "true");
+  if (MPI_Win_allocate_shared(grid * n, sizeof(float), info, MCS, &p, win) != MPI_SUCCESS) {
+    printf("Cannot allocate shared 3D float array\n");
+    exit(-1);
+  }
+  MPI_Info_free(&info);
+
+  for (q = 0; q < n; q++) {
+    U[q] = U[0];
+    U[q].data = p + q * (grid / sizeof(float));
+#ifdef MADV_HUGEPAGE
+    if (((long int)U[q].data & (HUGEPAGE_SIZE - 1)) == 0) madvise(U[q].data, grid, MADV_HUGEPAGE);
+#endif
+    U[q].data += ShmSkew(srank, n, q) / sizeof(float);
+    FirstTouch3D(U[q], nyt);
+  }
+  // passive target epoch for MPI_Win_sync in ShmSync
+  MPI_Win_lock_all(MPI_MODE_NOCHECK, *win);
+
+  return;
+}
+
+void FreeShared3D(MPI_Win *win) {
+  MPI_Win_unlock_all(*win);
+  MPI_Win_free(win);
+  return;
+}
+
+// the n grids of nxt x nyt x nzt interior points that rank shm_rank of the window's node communicator
+// allocated with AllocShared3D
+void SharedQuery3D(MPI_Win win, int shm_rank, int n, int nxt, int nyt, int nzt, Grid3D *V) {
+  int q, disp_unit;
+  long int grid;
+  MPI_Aint size;
+  float *p;
+
+  MPI_Win_shared_query(win, shm_rank, &size, &disp_unit, &p);
+  V[0].nx = nxt + 2 * halo_xy;
+  V[0].ny = nyt + 2 * halo_xy;
+  V[0].nz = nzt + 2 * halo_z;
+  V[0].yline = V[0].nz;
+  V[0].slice = (long int)V[0].ny * V[0].nz;
+  grid = sizeof(float) * V[0].nx * V[0].slice + 31 * HUGEPAGE_SKEW;
+  grid = (grid + HUGEPAGE_SIZE - 1) / HUGEPAGE_SIZE * HUGEPAGE_SIZE;
+  for (q = 0; q < n; q++) {
+    V[q] = V[0];
+    V[q].data = p + q * (grid / sizeof(float)) + ShmSkew(shm_rank, n, q) / sizeof(float);
+  }
+
+  return;
+}
+
+// nx x ny x nz sub-box of U starting at (i0, j0, k0); shares U's storage, never Delloc3D a view
+Grid3D View3D(Grid3D U, int i0, int j0, int k0, int nx, int ny, int nz) {
+  Grid3D V = U;
+
+  V.data = &G3(U, i0, j0, k0);
+  V.nx = nx;
+  V.ny = ny;
+  V.nz = nz;
+
+  return V;
+}
+
 Grid1D Alloc1D(int nx) {
   int i;
   Grid1D U = (Grid1D)malloc(sizeof(float) * nx);
@@ -82,9 +249,19 @@ PosInf Alloc1P(int nx) {
 }
 
 void Delloc3D(Grid3D U) {
-  if (U) {
-    free(U);
-    U = NULL;
+  int b;
+
+  for (b = 0; U.data && b < h_nblock; b++) {
+    if (h_data[b] == U.data) {
+      free(h_block[b]);
+      h_block[b] = h_block[--h_nblock];
+      h_data[b] = h_data[h_nblock];
+      return;
+    }
+  }
+  if (U.data) {
+    free(U.data);
+    U.data = NULL;
   }
 
   return;
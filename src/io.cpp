@@ -12,6 +12,7 @@ Redistribution and use in source and binary forms, with or without modification,
 THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -43,3 +44,506 @@ int writeCHK(char *chkfile, int ntiskp, float dt, float dh, int nxt, int nyt, in
 
   return 0;
 }
+
+// run n (from 0) of the ensemble list: one "INSRC OUT [INSRC_I2]" line per run, blank lines and lines
+// starting with # skipped. rank 0 reads the list and broadcasts it; returns the number of runs, and
+// leaves the names untouched if there is no run n
+int readens(char *ENSEMBLE, int n, MPI_Comm MCW, char *INSRC, char *OUT, char *INSRC_I2) {
+  FILE *fens;
+  char line[256], name[3][50];
+  int rank, nens = 0, nf;
+
+  MPI_Comm_rank(MCW, &rank);
+  if (rank == 0) {
+    fens = fopen(ENSEMBLE, "r");
+    if (fens == NULL) {
+      printf("cannot open ensemble list %s\n", ENSEMBLE);
+    } else {
+      while (fgets(line, sizeof(line), fens)) {
+        nf = sscanf(line, "%49s %49s %49s", name[0], name[1], name[2]);
+        if (nf < 2 || name[0][0] == '#') continue;
+        if (nens == n) {
+          strcpy(INSRC, name[0]);
+          strcpy(OUT, name[1]);
+          if (nf == 3) strcpy(INSRC_I2, name[2]);
+        }
+        nens++;
+      }
+      fclose(fens);
+    }
+  }
+  MPI_Bcast(&nens, 1, MPI_INT, 0, MCW);
+  if (n < nens) {
+    MPI_Bcast(INSRC, 50, MPI_CHAR, 0, MCW);
+    MPI_Bcast(OUT, 50, MPI_CHAR, 0, MCW);
+    MPI_Bcast(INSRC_I2, 50, MPI_CHAR, 0, MCW);
+  }
+  return nens;
+}
+
+// slab c of a part_* split holding the 0-based global index g, by bisection
+static int slabof(int *part, int p, int g) {
+  int lo = 0, hi = p - 1, c;
+
+  while (lo < hi) {
+    c = (lo + hi + 1) / 2;
+    if (part[c] <= g)
+      lo = c;
+    else
+      hi = c - 1;
+  }
+  return lo;
+}
+
+// station list: one "x y z" line of 1-based global grid indices per station, z=1 on the free surface,
+// blank lines and lines starting with # skipped. rank 0 reads the list, drops the stations outside the
+// mesh and broadcasts it. the stations are then bucketed by owning rank, a counting sort over the
+// PX x PY x PZ slabs of part_* keyed by one bisection per axis, and this rank takes its bucket.
+// returns the number of stations on this rank, with their i, j, k in the padded grids in *loc and their
+// index in the list in *gid (ascending); *nsta is the length of the list, -1 if it cannot be read
+int readsta(char *STATIONS, MPI_Comm MCW, int NX, int NY, int NZ, int PX, int PY, int PZ, int *part_x, int *part_y, int *part_z, int *coord, int nzt, int *nsta, PosInf *loc, PosInf *gid) {
+  FILE *fsta;
+  char line[256];
+  int rank, n = 0, nmax = 0, nout = 0, s, c, me, nloc, x, y, z;
+  PosInf sta = NULL, cell, start, order;
+
+  MPI_Comm_rank(MCW, &rank);
+  if (rank == 0) {
+    fsta = fopen(STATIONS, "r");
+    if (fsta == NULL) {
+      printf("cannot open station list %s\n", STATIONS);
+      n = -1;
+    } else {
+      while (fgets(line, sizeof(line), fsta)) {
+        if (sscanf(line, "%d %d %d", &x, &y, &z) != 3 || line[0] == '#') continue;
+        if (x < 1 || x > NX || y < 1 || y > NY || z < 1 || z > NZ) {
+          nout++;
+          continue;
+        }
+        if (n == nmax) {
+          nmax = 2 * nmax + 1024;
+          sta = (PosInf)realloc(sta, sizeof(int) * 3 * nmax);
+        }
+        sta[3 * n] = x - 1;
+        sta[3 * n + 1] = y - 1;
+        sta[3 * n + 2] = z - 1;
+        n++;
+      }
+      fclose(fsta);
+      if (nout) printf("%d stations outside the mesh skipped\n", nout);
+    }
+  }
+  MPI_Bcast(&n, 1, MPI_INT, 0, MCW);
+  *nsta = n;
+  *loc = *gid = NULL;
+  if (n <= 0) {
+    free(sta);
+    return 0;
+  }
+  if (rank != 0) sta = Alloc1P(3 * n);
+  MPI_Bcast(sta, 3 * n, MPI_INT, 0, MCW);
+
+  // bucket of each station and the start of each bucket
+  cell = Alloc1P(n);
+  start = Alloc1P(PX * PY * PZ + 1);
+  for (s = 0; s < n; s++) {
+    cell[s] = (slabof(part_x, PX, sta[3 * s]) * PY + slabof(part_y, PY, sta[3 * s + 1])) * PZ + slabof(part_z, PZ, sta[3 * s + 2]);
+    start[cell[s] + 1]++;
+  }
+  for (c = 0; c < PX * PY * PZ; c++) start[c + 1] += start[c];
+  // stable, so each bucket keeps the order of the list
+  order = Alloc1P(n);
+  for (s = 0; s < n; s++) order[start[cell[s]]++] = s;
+  for (c = PX * PY * PZ; c > 0; c--) start[c] = start[c - 1];
+  start[0] = 0;
+  me = (coord[0] * PY + coord[1]) * PZ + coord[2];
+  nloc = start[me + 1] - start[me];
+
+  *loc = Alloc1P(3 * nloc + 1);
+  *gid = Alloc1P(nloc + 1);
+  for (c = 0; c < nloc; c++) {
+    s = order[start[me] + c];
+    (*loc)[3 * c] = sta[3 * s] - part_x[coord[0]] + 2 + 4 * loop;
+    (*loc)[3 * c + 1] = sta[3 * s + 1] - part_y[coord[1]] + 2 + 4 * loop;
+    (*loc)[3 * c + 2] = nzt + align - 1 - (sta[3 * s + 2] - part_z[coord[2]]);
+    (*gid)[c] = s;
+  }
+  Delloc1P(order);
+  Delloc1P(start);
+  Delloc1P(cell);
+  free(sta);
+  return nloc;
+}
+
+// create the output container name of a run: index and data offsets of hdr are filled in, the
+// file is preallocated for all windows and rank 0 writes the header and the window index. the
+// size of compressed windows is not known ahead, the file is cut to the header and the tile
+// records of tile, and the window index is written with the windows
+int openout(char *name, MPI_Comm MCW, MPI_Info info, OutHeader *hdr, int *tile, MPI_File *fh) {
+  int rank, w, err;
+  long long *index;
+
+  MPI_Comm_rank(MCW, &rank);
+  memcpy(hdr->magic, "AWPOUT1", 8);
+  hdr->index = sizeof(OutHeader);
+  hdr->tiles = hdr->index + 2 * sizeof(long long) * hdr->nwin;
+  // data on a 4 KB boundary
+  hdr->data = (hdr->tiles + (hdr->codec ? 6 * sizeof(int) * hdr->ntile : 0) + 4095) / 4096 * 4096;
+  err = MPI_File_open(MCW, name, MPI_MODE_CREATE | MPI_MODE_WRONLY, info, fh);
+  if (err != MPI_SUCCESS) {
+    if (rank == 0) printf("cannot create output container %s\n", name);
+    return -1;
+  }
+  if (hdr->codec) {
+    MPI_File_set_size(*fh, hdr->data);
+    if (rank == 0) {
+      MPI_File_write_at(*fh, 0, hdr, sizeof(OutHeader), MPI_BYTE, MPI_STATUS_IGNORE);
+      MPI_File_write_at(*fh, hdr->tiles, tile, 6 * hdr->ntile, MPI_INT, MPI_STATUS_IGNORE);
+    }
+    return 0;
+  }
+  MPI_File_preallocate(*fh, hdr->data + hdr->ncomp * hdr->chunk * (hdr->kind == 0 ? hdr->nwin : 1));
+  if (rank == 0) {
+    index = (long long *)malloc(2 * sizeof(long long) * (hdr->nwin + 1));
+    for (w = 0; w < hdr->nwin; w++) {
+      index[2 * w] = (long long)(w + 1) * hdr->write_step * hdr->ntiskp;
+      if (hdr->kind == 0)
+        index[2 * w + 1] = hdr->data + (long long)w * hdr->ncomp * hdr->chunk;
+      else
+        index[2 * w + 1] = hdr->data + (long long)w * hdr->write_step * sizeof(float);
+    }
+    MPI_File_write_at(*fh, 0, hdr, sizeof(OutHeader), MPI_BYTE, MPI_STATUS_IGNORE);
+    MPI_File_write_at(*fh, hdr->index, index, 2 * hdr->nwin, MPI_LONG_LONG, MPI_STATUS_IGNORE);
+    free(index);
+  }
+  return 0;
+}
+
+// hints of the output files: striping_unit of new files (STRIPE > 0) and the number of ranks doing
+// the collective buffering (cbnodes > 0), MPI_INFO_NULL if there is nothing to set
+MPI_Info outinfo(int STRIPE, int cbnodes) {
+  MPI_Info info = MPI_INFO_NULL;
+  char val[32];
+
+  if (STRIPE <= 0 && cbnodes <= 0) return info;
+  MPI_Info_create(&info);
+  if (STRIPE > 0) {
+    sprintf(val, "%d", STRIPE);
+    MPI_Info_set(info, "striping_unit", val);
+  }
+  if (cbnodes > 0) {
+    sprintf(val, "%d", cbnodes);
+    MPI_Info_set(info, "cb_nodes", val);
+    MPI_Info_set(info, "romio_cb_write", "enable");
+  }
+  return info;
+}
+
+// output aggregator (IORANKS), the ranks of MA past the ncr compute ranks of MPI_COMM_WORLD.
+// compute rank 0 sends the box (rec_NX, rec_NY, rec_NZ, WRITE_STEP, runs per sweep) and the tile
+// records of the ranks (see OutHeader). aggregator a takes samples a * WRITE_STEP / na to (a + 1) * WRITE_STEP / na of
+// every window: it receives the tiles of all compute ranks into these whole samples and writes
+// them as one contiguous stripe of the file of each component
+void iorun(MPI_Comm MA, int ncr, MPI_Info info) {
+  int a, na, box[5], *tile, s0, s1, r, c, t, nreq;
+  int sz[4], sub[4], st[4];
+  long int plane;
+  float *slab;
+  MPI_Datatype *ttype;
+  MPI_Request *req;
+  MPI_File fh;
+  IoWin win;
+
+  MPI_Comm_rank(MA, &a);
+  MPI_Comm_size(MA, &na);
+  MPI_Recv(box, 5, MPI_INT, 0, IOTAG, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+  tile = (int *)malloc(sizeof(int) * 6 * ncr);
+  MPI_Recv(tile, 6 * ncr, MPI_INT, 0, IOTAG, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+  s0 = a * box[3] / na;
+  s1 = (a + 1) * box[3] / na;
+  plane = (long int)box[0] * box[1] * box[2];
+  slab = (float *)malloc(sizeof(float) * (plane * (s1 - s0) * 3 * box[4] + 1));
+  req = (MPI_Request *)malloc(sizeof(MPI_Request) * (3 * box[4] * ncr + 1));
+  // where the samples of each tile go in the slab
+  ttype = (MPI_Datatype *)malloc(sizeof(MPI_Datatype) * ncr);
+  for (t = 0; t < ncr; t++) {
+    ttype[t] = MPI_DATATYPE_NULL;
+    if (s1 == s0 || tile[6 * t + 3] * tile[6 * t + 4] * tile[6 * t + 5] == 0) continue;
+    sz[0] = s1 - s0;
+    sz[1] = box[2];
+    sz[2] = box[1];
+    sz[3] = box[0];
+    sub[0] = s1 - s0;
+    st[0] = 0;
+    for (c = 1; c < 4; c++) {
+      sub[c] = tile[6 * t + 6 - c];
+      st[c] = tile[6 * t + 3 - c];
+    }
+    MPI_Type_create_subarray(4, sz, sub, st, MPI_ORDER_C, MPI_FLOAT, &ttype[t]);
+    MPI_Type_commit(&ttype[t]);
+  }
+
+  for (;;) {
+    MPI_Recv(&win, sizeof(IoWin), MPI_BYTE, 0, IOTAG, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    if (win.nrun == 0) break;
+    nreq = 0;
+    for (r = 0; r < win.nrun; r++)
+      for (c = 0; c < 3; c++)
+        for (t = 0; t < ncr; t++)
+          if (ttype[t] != MPI_DATATYPE_NULL) MPI_Irecv(slab + (r * 3 + c) * plane * (s1 - s0), 1, ttype[t], t, 3 * r + c, MPI_COMM_WORLD, &req[nreq++]);
+    MPI_Waitall(nreq, req, MPI_STATUSES_IGNORE);
+    for (r = 0; r < win.nrun; r++) {
+      for (c = 0; c < 3; c++) {
+        MPI_File_open(MA, win.name[r][c], MPI_MODE_CREATE | MPI_MODE_WRONLY, info, &fh);
+        MPI_File_write_at_all(fh, (MPI_Offset)sizeof(float) * plane * s0, slab + (r * 3 + c) * plane * (s1 - s0), plane * (s1 - s0), MPI_FLOAT, MPI_STATUS_IGNORE);
+        MPI_File_close(&fh);
+      }
+    }
+  }
+
+  for (t = 0; t < ncr; t++)
+    if (ttype[t] != MPI_DATATYPE_NULL) MPI_Type_free(&ttype[t]);
+  free(ttype);
+  free(req);
+  free(slab);
+  free(tile);
+}
+
+// coding of the output tiles (COMPRESS): ns samples of m floats, each sample against the previous
+// sample of the same point, the first one against zero.
+// codec 1 (lossless) takes the xor of the float bits and codes each of the 4 byte planes of the
+// residuals on its own: a byte 0 and the plane as is, 1 and the one value of a constant plane, or
+// 2, the 256 16-bit symbol frequencies (sum 1 << ZPROB), the 32-bit size and the rANS stream.
+// codec 2 (lossy) takes the difference of the values quantized to steps of 2 * tol, so that every
+// value comes back within tol, in blocks of ZBLK residuals: a byte of bit width w and ZBLK * w
+// bits, low bits first; w = 64 is a block of raw 64-bit residuals, w = 65 a block of the floats
+// as they are, for values no step brings back within tol once rounded to float
+#define ZBLK 32
+#define ZPROB 12
+#define ZRANSL (1u << 23)
+
+// bytes zpack may need for n floats, the 4 plane bytes of codec 1 even for none
+long zbound(long n) {
+  return 4 + (n + ZBLK - 1) / ZBLK * (1 + 8 * ZBLK);
+}
+
+// step q of v on the grid of 2 * tol whose float, as zunpack makes it, is within tol of v
+static int zstep(float v, float tol, long long *q) {
+  double s = rint(v * (0.5 / tol));
+  int d;
+
+  if (!(fabs(s) < 1e18)) return 0;
+  for (d = 0; d < 3; d++) {
+    *q = (long long)s + (d == 2 ? 1 : -d);
+    if (fabs((float)(*q * 2. * tol) - (double)v) <= tol) return 1;
+  }
+  return 0;
+}
+
+// order-0 rANS of the n bytes of in to out, returns the bytes used or -1 if not below n
+static long zrans(unsigned char *in, long n, unsigned char *out) {
+  unsigned short freq[256];
+  unsigned int cum[257], x, f, len;
+  long cnt[256], i;
+  unsigned char *buf, *ptr;
+  int s, big;
+
+  // the table does not pay off on small planes
+  if (n < 4096) return -1;
+  memset(cnt, 0, sizeof(cnt));
+  for (i = 0; i < n; i++) cnt[in[i]]++;
+  // scaled to 1 << ZPROB, every symbol present keeps at least 1
+  for (cum[0] = 0, s = 0; s < 256; s++) {
+    freq[s] = (cnt[s] ? (cnt[s] << ZPROB) / n : 0);
+    if (cnt[s] && !freq[s]) freq[s] = 1;
+    cum[s + 1] = cum[s] + freq[s];
+  }
+  for (; cum[256] != (1u << ZPROB); cum[256] += (cum[256] < (1u << ZPROB) ? 1 : -1)) {
+    for (big = -1, s = 0; s < 256; s++)
+      if ((cum[256] < (1u << ZPROB) || freq[s] > 1) && (big < 0 || freq[s] > freq[big])) big = s;
+    freq[big] += (cum[256] < (1u << ZPROB) ? 1 : -1);
+  }
+  for (s = 0; s < 256; s++) cum[s + 1] = cum[s] + freq[s];
+
+  // coded from the end, the decoder reads forward
+  buf = (unsigned char *)malloc(n + 8);
+  ptr = buf + n + 8;
+  x = ZRANSL;
+  for (i = n - 1; i >= 0 && ptr - buf > 4; i--) {
+    f = freq[in[i]];
+    for (; x >= ((ZRANSL >> ZPROB) << 8) * f && ptr - buf > 4; x >>= 8) *--ptr = x & 255;
+    x = ((x / f) << ZPROB) + x % f + cum[in[i]];
+  }
+  len = buf + n + 8 - ptr + 4;
+  if (i >= 0 || 512 + 4 + len >= n) {
+    free(buf);
+    return -1;
+  }
+  memcpy(out, freq, 512);
+  memcpy(out + 512, &len, 4);
+  memcpy(out + 516, &x, 4);
+  memcpy(out + 520, ptr, len - 4);
+  free(buf);
+  return 516 + len;
+}
+
+// decode n bytes of zrans from in to out, returns the bytes read
+static long zunrans(unsigned char *in, long n, unsigned char *out) {
+  unsigned short freq[256];
+  unsigned int cum[257], x, slot, len;
+  unsigned char sym[1 << ZPROB];
+  long i;
+  int s;
+
+  memcpy(freq, in, 512);
+  memcpy(&len, in + 512, 4);
+  memcpy(&x, in + 516, 4);
+  for (cum[0] = 0, s = 0; s < 256; s++) {
+    cum[s + 1] = cum[s] + freq[s];
+    memset(sym + cum[s], s, freq[s]);
+  }
+  in += 520;
+  for (i = 0; i < n; i++) {
+    slot = x & ((1u << ZPROB) - 1);
+    out[i] = sym[slot];
+    x = freq[out[i]] * (x >> ZPROB) + slot - cum[out[i]];
+    while (x < ZRANSL) x = (x << 8) | *in++;
+  }
+  return 516 + len;
+}
+
+// code the tile in to out, returns the bytes used
+long zpack(float *in, long m, int ns, int codec, float tol, unsigned char *out) {
+  unsigned long long res[ZBLK], acc, mx;
+  unsigned int *bits = (unsigned int *)in;
+  unsigned char *plane;
+  long n = m * ns, i, b, len = 0, zl;
+  long long q, *qp;
+  int w, l, nb, na;
+
+  if (codec == 1) {
+    plane = (unsigned char *)malloc(n + 1);
+    for (w = 0; w < 4; w++) {
+      for (i = 0; i < n; i++) plane[i] = (bits[i] ^ (i >= m ? bits[i - m] : 0u)) >> (8 * w);
+      for (i = 1; i < n && plane[i] == plane[0]; i++);
+      if (n > 0 && i == n) {
+        out[len++] = 1;
+        out[len++] = plane[0];
+      } else if ((zl = zrans(plane, n, out + len + 1)) > 0) {
+        out[len] = 2;
+        len += 1 + zl;
+      } else {
+        out[len++] = 0;
+        memcpy(out + len, plane, n);
+        len += n;
+      }
+    }
+    free(plane);
+    return len;
+  }
+  // the quantized previous sample of each point, as zunpack keeps it
+  qp = (long long *)calloc(m + 1, sizeof(long long));
+  for (b = 0; b < n; b += ZBLK) {
+    nb = (n - b < ZBLK ? n - b : ZBLK);
+    mx = 0;
+    for (l = 0; l < nb && zstep(in[b + l], tol, &q); l++) {
+      i = (b + l) % m;
+      res[l] = ((unsigned long long)(q - qp[i]) << 1) ^ (unsigned long long)((q - qp[i]) >> 63);
+      qp[i] = q;
+      mx |= res[l];
+    }
+    if (l < nb) {
+      out[len++] = 65;
+      memset(out + len, 0, sizeof(float) * ZBLK);
+      memcpy(out + len, in + b, sizeof(float) * nb);
+      len += sizeof(float) * ZBLK;
+      for (l = 0; l < nb; l++) qp[(b + l) % m] = 0;
+      continue;
+    }
+    for (; l < ZBLK; l++) res[l] = 0;
+    for (w = 0; w < 64 && (mx >> w); w++);
+    if (w > 32) w = 64;
+    out[len++] = w;
+    if (w == 64) {
+      memcpy(out + len, res, sizeof(res));
+      len += sizeof(res);
+      continue;
+    }
+    // at most 7 + 32 bits pending, ZBLK * w bits are whole bytes
+    acc = 0;
+    na = 0;
+    for (l = 0; l < ZBLK; l++) {
+      acc |= res[l] << na;
+      na += w;
+      for (; na >= 8; na -= 8) {
+        out[len++] = acc & 255;
+        acc >>= 8;
+      }
+    }
+  }
+  free(qp);
+  return len;
+}
+
+// decode a tile of zpack from in to out, returns the bytes read
+long zunpack(unsigned char *in, long m, int ns, int codec, float tol, float *out) {
+  unsigned long long res[ZBLK], acc, mask;
+  unsigned int *bits = (unsigned int *)out;
+  unsigned char *plane;
+  long long *q;
+  long n = m * ns, i, b, len = 0;
+  int w, l, nb, na;
+
+  if (codec == 1) {
+    plane = (unsigned char *)malloc(n + 1);
+    memset(bits, 0, sizeof(float) * n);
+    for (w = 0; w < 4; w++) {
+      if (in[len] == 1) {
+        memset(plane, in[len + 1], n);
+        len += 2;
+      } else if (in[len] == 2) {
+        len += 1 + zunrans(in + len + 1, n, plane);
+      } else {
+        memcpy(plane, in + len + 1, n);
+        len += 1 + n;
+      }
+      for (i = 0; i < n; i++) bits[i] |= (unsigned int)plane[i] << (8 * w);
+    }
+    for (i = m; i < n; i++) bits[i] ^= bits[i - m];
+    free(plane);
+    return len;
+  }
+  // the quantized previous sample of each point
+  q = (long long *)calloc(m + 1, sizeof(long long));
+  for (b = 0; b < n; b += ZBLK) {
+    nb = (n - b < ZBLK ? n - b : ZBLK);
+    w = in[len++];
+    if (w == 65) {
+      memcpy(out + b, in + len, sizeof(float) * nb);
+      len += sizeof(float) * ZBLK;
+      for (l = 0; l < nb; l++) q[(b + l) % m] = 0;
+      continue;
+    }
+    if (w == 64) {
+      memcpy(res, in + len, sizeof(res));
+      len += sizeof(res);
+    } else {
+      mask = (w ? ~0ull >> (64 - w) : 0);
+      acc = 0;
+      na = 0;
+      for (l = 0; l < ZBLK; l++) {
+        for (; na < w; na += 8) acc |= (unsigned long long)in[len++] << na;
+        res[l] = acc & mask;
+        acc >>= w;
+        na -= w;
+      }
+    }
+    for (l = 0; l < nb; l++) {
+      i = b + l;
+      q[i % m] += (long long)(res[l] >> 1) ^ -(long long)(res[l] & 1);
+      out[i] = q[i % m] * 2. * tol;
+    }
+  }
+  free(q);
+  return len;
+}
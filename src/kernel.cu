@@ -32,8 +32,9 @@ __constant__ int d_slice_2;
 __constant__ int d_yline_1;
 __constant__ int d_yline_2;
 
-texture<float, 1, cudaReadModeElementType> p_vx1;
-texture<float, 1, cudaReadModeElementType> p_vx2;
+// relaxation weights of the 2x2x2 parity cell, indexed by 4 * itx + 2 * ity + itz (see SetDeviceTau)
+__constant__ float d_tau1[8];
+__constant__ float d_tau2[8];
 
 void SetDeviceConstValue(float DH, float DT, int nxt, int nyt, int nzt) {
   float h_c1, h_c2, h_dth, h_dt1, h_dh1;
@@ -65,16 +66,11 @@ void SetDeviceConstValue(float DH, float DT, int nxt, int nyt, int nzt) {
   return;
 }
 
-void BindArrayToTexture(float* vx1, float* vx2, int memsize) {
-  cudaBindTexture(0, p_vx1, vx1, memsize);
-  cudaBindTexture(0, p_vx2, vx2, memsize);
-  cudaThreadSynchronize();
-  return;
-}
-
-void UnBindArrayFromTexture() {
-  cudaUnbindTexture(p_vx1);
-  cudaUnbindTexture(p_vx2);
+// tau1/tau2: the 8 coarse-grained relaxation weights; dstrqc picks one by the parity of the global
+// x and y index and of the depth below the free surface
+void SetDeviceTau(float* tau1, float* tau2) {
+  cudaMemcpyToSymbol(d_tau1, tau1, sizeof(float) * 8);
+  cudaMemcpyToSymbol(d_tau2, tau2, sizeof(float) * 8);
   return;
 }
 
@@ -108,6 +104,12 @@ void update_bound_y_H(float* u1, float* v1, float* w1, float* f_u1, float* f_v1,
 void dstrqc_H(float* xx, float* yy, float* zz, float* xy, float* xz, float* yz, float* r1, float* r2, float* r3, float* r4, float* r5, float* r6, float* u1, float* v1, float* w1, float* lam, float* mu, float* qp, float* qs, float* dcrjx, float* dcrjy, float* dcrjz, int nyt, int nzt, cudaStream_t St, float* lam_mu, int NX, int rankx, int ranky, int s_i, int e_i, int s_j, int e_j) {
   dim3 block(BLOCK_SIZE_Z, BLOCK_SIZE_Y, 1);
   dim3 grid((nzt + BLOCK_SIZE_Z - 1) / BLOCK_SIZE_Z, (e_j - s_j + 1 + BLOCK_SIZE_Y - 1) / BLOCK_SIZE_Y, 1);
+  // without memory variables (NVE=0) the update is elastic
+  if (r1 == NULL) {
+    cudaFuncSetCacheConfig(dstres, cudaFuncCachePreferL1);
+    dstres<<<grid, block, 0, St>>>(xx, yy, zz, xy, xz, yz, u1, v1, w1, lam, mu, dcrjx, dcrjy, dcrjz, lam_mu, NX, rankx, ranky, s_i, e_i, s_j);
+    return;
+  }
   cudaFuncSetCacheConfig(dstrqc, cudaFuncCachePreferL1);
   dstrqc<<<grid, block, 0, St>>>(xx, yy, zz, xy, xz, yz, r1, r2, r3, r4, r5, r6, u1, v1, w1, lam, mu, qp, qs, dcrjx, dcrjy, dcrjz, lam_mu, NX, rankx, ranky, s_i, e_i, s_j);
   return;
@@ -131,6 +133,24 @@ void addsrc_H(int i, int READ_STEP, int dim, int* psrc, int npsrc, cudaStream_t
   return;
 }
 
+// recording points: u1, v1 and w1 at the n grid offsets idx packed into buf (n each) on the device,
+// then only buf goes to bx, by and bz on the host, point s at s * stride
+void dsamp_H(float* u1, float* v1, float* w1, int* idx, int n, float* buf, cudaStream_t St, int stride, float* bx, float* by, float* bz) {
+  dim3 grid, block;
+  cudaError_t cerr;
+  if (n < 1) return;
+  block.x = 256;
+  grid.x = (n + 255) / 256;
+  dsamp_cu<<<grid, block, 0, St>>>(u1, v1, w1, idx, n, buf);
+  cerr = cudaGetLastError();
+  if (cerr != cudaSuccess) printf("CUDA ERROR: dsamp after kernel: %s\n", cudaGetErrorString(cerr));
+  cudaMemcpy2DAsync(bx, sizeof(float) * stride, buf, sizeof(float), sizeof(float), n, cudaMemcpyDeviceToHost, St);
+  cudaMemcpy2DAsync(by, sizeof(float) * stride, buf + n, sizeof(float), sizeof(float), n, cudaMemcpyDeviceToHost, St);
+  cudaMemcpy2DAsync(bz, sizeof(float) * stride, buf + 2 * n, sizeof(float), sizeof(float), n, cudaMemcpyDeviceToHost, St);
+  cudaStreamSynchronize(St);
+  return;
+}
+
 __global__ void dvelcx(float* u1, float* v1, float* w1, float* xx, float* yy, float* zz, float* xy, float* xz, float* yz, float* dcrjx, float* dcrjy, float* dcrjz, float* d_1, int s_i, int e_i) {
   register int i, j, k, pos, pos_im1, pos_im2;
   register int pos_km2, pos_km1, pos_kp1, pos_kp2;
@@ -325,6 +345,7 @@ __global__ void dstrqc(float* xx, float* yy, float* zz, float* xy, float* xz, fl
   register float xl, xm, xmu1, xmu2, xmu3;
   register float qpa, h, h1, h2, h3;
   register float f_vx1, f_vx2, f_dcrj, f_r, f_dcrjy, f_dcrjz;
+  register int itz, ity, itau;
   register float f_u1, u1_ip1, u1_ip2, u1_im1;
   register float f_v1, v1_im1, v1_ip1, v1_im2;
   register float f_w1, w1_im1, w1_im2, w1_ip1;
@@ -345,9 +366,12 @@ __global__ void dstrqc(float* xx, float* yy, float* zz, float* xy, float* xz, fl
   w1_im2 = w1[pos - d_slice_1];
   f_dcrjz = dcrjz[k];
   f_dcrjy = dcrjy[j];
+  ity = 1 - (d_nyt * ranky + j - 2 - 4 * loop) % 2;
+  itz = 1 - (d_nzt + align - 1 - k) % 2;
   for (i = e_i; i >= s_i; i--) {
-    f_vx1 = tex1Dfetch(p_vx1, pos);
-    f_vx2 = tex1Dfetch(p_vx2, pos);
+    itau = 4 * (1 - (d_nxt * rankx + i - 2 - 4 * loop) % 2) + 2 * ity + itz;
+    f_vx1 = d_tau1[itau];
+    f_vx2 = d_tau2[itau];
     f_dcrj = dcrjx[i] * f_dcrjy * f_dcrjz;
 
     pos_km2 = pos - 2;
@@ -492,6 +516,143 @@ __global__ void dstrqc(float* xx, float* yy, float* zz, float* xy, float* xz, fl
   return;
 }
 
+// elastic stress update (NVE=0): dstrqc without the memory variables and the quality factors
+__global__ void dstres(float* xx, float* yy, float* zz, float* xy, float* xz, float* yz, float* u1, float* v1, float* w1, float* lam, float* mu, float* dcrjx, float* dcrjy, float* dcrjz, float* lam_mu, int NX, int rankx, int ranky, int s_i, int e_i, int s_j) {
+  register int i, j, k, g_i;
+  register int pos, pos_ip1, pos_im2, pos_im1;
+  register int pos_km2, pos_km1, pos_kp1, pos_kp2;
+  register int pos_jm2, pos_jm1, pos_jp1, pos_jp2;
+  register int pos_ik1, pos_jk1, pos_ijk, pos_ijk1;
+  register float vs1, vs2, vs3, tmp;
+  register float xl, xm, xmu1, xmu2, xmu3;
+  register float f_dcrj, f_dcrjy, f_dcrjz;
+  register float f_u1, u1_ip1, u1_ip2, u1_im1;
+  register float f_v1, v1_im1, v1_ip1, v1_im2;
+  register float f_w1, w1_im1, w1_im2, w1_ip1;
+
+  k = blockIdx.x * BLOCK_SIZE_Z + threadIdx.x + align;
+  j = blockIdx.y * BLOCK_SIZE_Y + threadIdx.y + s_j;
+  i = e_i;
+  pos = i * d_slice_1 + j * d_yline_1 + k;
+
+  u1_ip1 = u1[pos + d_slice_2];
+  f_u1 = u1[pos + d_slice_1];
+  u1_im1 = u1[pos];
+  f_v1 = v1[pos + d_slice_1];
+  v1_im1 = v1[pos];
+  v1_im2 = v1[pos - d_slice_1];
+  f_w1 = w1[pos + d_slice_1];
+  w1_im1 = w1[pos];
+  w1_im2 = w1[pos - d_slice_1];
+  f_dcrjz = dcrjz[k];
+  f_dcrjy = dcrjy[j];
+  for (i = e_i; i >= s_i; i--) {
+    f_dcrj = dcrjx[i] * f_dcrjy * f_dcrjz;
+
+    pos_km2 = pos - 2;
+    pos_km1 = pos - 1;
+    pos_kp1 = pos + 1;
+    pos_kp2 = pos + 2;
+    pos_jm2 = pos - d_yline_2;
+    pos_jm1 = pos - d_yline_1;
+    pos_jp1 = pos + d_yline_1;
+    pos_jp2 = pos + d_yline_2;
+    pos_im2 = pos - d_slice_2;
+    pos_im1 = pos - d_slice_1;
+    pos_ip1 = pos + d_slice_1;
+    pos_jk1 = pos - d_yline_1 - 1;
+    pos_ik1 = pos + d_slice_1 - 1;
+    pos_ijk = pos + d_slice_1 - d_yline_1;
+    pos_ijk1 = pos + d_slice_1 - d_yline_1 - 1;
+
+    xl = 8.0 / (lam[pos] + lam[pos_ip1] + lam[pos_jm1] + lam[pos_ijk] + lam[pos_km1] + lam[pos_ik1] + lam[pos_jk1] + lam[pos_ijk1]);
+    xm = 16.0 / (mu[pos] + mu[pos_ip1] + mu[pos_jm1] + mu[pos_ijk] + mu[pos_km1] + mu[pos_ik1] + mu[pos_jk1] + mu[pos_ijk1]);
+    xmu1 = 2.0 / (mu[pos] + mu[pos_km1]);
+    xmu2 = 2.0 / (mu[pos] + mu[pos_jm1]);
+    xmu3 = 2.0 / (mu[pos] + mu[pos_ip1]);
+    xl = xl + xm;
+    xm = xm * d_dth;
+    xmu1 = xmu1 * d_dth;
+    xmu2 = xmu2 * d_dth;
+    xmu3 = xmu3 * d_dth;
+    xl = xl * d_dth;
+
+    u1_ip2 = u1_ip1;
+    u1_ip1 = f_u1;
+    f_u1 = u1_im1;
+    u1_im1 = u1[pos_im1];
+    v1_ip1 = f_v1;
+    f_v1 = v1_im1;
+    v1_im1 = v1_im2;
+    v1_im2 = v1[pos_im2];
+    w1_ip1 = f_w1;
+    f_w1 = w1_im1;
+    w1_im1 = w1_im2;
+    w1_im2 = w1[pos_im2];
+
+    if (k == d_nzt + align - 1) {
+      u1[pos_kp1] = f_u1 - (f_w1 - w1_im1);
+      v1[pos_kp1] = f_v1 - (w1[pos_jp1] - f_w1);
+
+      g_i = d_nxt * rankx + i - 4 * loop - 1;
+
+      if (g_i < NX)
+        vs1 = u1_ip1 - (w1_ip1 - f_w1);
+      else
+        vs1 = 0.0;
+
+      g_i = d_nyt * ranky + j - 4 * loop - 1;
+      if (g_i > 1)
+        vs2 = v1[pos_jm1] - (f_w1 - w1[pos_jm1]);
+      else
+        vs2 = 0.0;
+
+      w1[pos_kp1] = w1[pos_km1] - lam_mu[i * (d_nyt + 4 + 8 * loop) + j] * ((vs1 - u1[pos_kp1]) + (u1_ip1 - f_u1) + (v1[pos_kp1] - vs2) + (f_v1 - v1[pos_jm1]));
+    } else if (k == d_nzt + align - 2) {
+      u1[pos_kp2] = u1[pos_kp1] - (w1[pos_kp1] - w1[pos_im1 + 1]);
+      v1[pos_kp2] = v1[pos_kp1] - (w1[pos_jp1 + 1] - w1[pos_kp1]);
+    }
+
+    vs1 = d_c1 * (u1_ip1 - f_u1) + d_c2 * (u1_ip2 - u1_im1);
+    vs2 = d_c1 * (f_v1 - v1[pos_jm1]) + d_c2 * (v1[pos_jp1] - v1[pos_jm2]);
+    vs3 = d_c1 * (f_w1 - w1[pos_km1]) + d_c2 * (w1[pos_kp1] - w1[pos_km2]);
+
+    tmp = xl * (vs1 + vs2 + vs3);
+    xx[pos] = (xx[pos] + tmp - xm * (vs2 + vs3)) * f_dcrj;
+    yy[pos] = (yy[pos] + tmp - xm * (vs1 + vs3)) * f_dcrj;
+    zz[pos] = (zz[pos] + tmp - xm * (vs1 + vs2)) * f_dcrj;
+
+    vs1 = d_c1 * (u1[pos_jp1] - f_u1) + d_c2 * (u1[pos_jp2] - u1[pos_jm1]);
+    vs2 = d_c1 * (f_v1 - v1_im1) + d_c2 * (v1_ip1 - v1_im2);
+    xy[pos] = (xy[pos] + xmu1 * (vs1 + vs2)) * f_dcrj;
+
+    if (k == d_nzt + align - 1) {
+      zz[pos + 1] = -zz[pos];
+      xz[pos] = 0.0;
+      yz[pos] = 0.0;
+    } else {
+      vs1 = d_c1 * (u1[pos_kp1] - f_u1) + d_c2 * (u1[pos_kp2] - u1[pos_km1]);
+      vs2 = d_c1 * (f_w1 - w1_im1) + d_c2 * (w1_ip1 - w1_im2);
+      xz[pos] = (xz[pos] + xmu2 * (vs1 + vs2)) * f_dcrj;
+
+      vs1 = d_c1 * (v1[pos_kp1] - f_v1) + d_c2 * (v1[pos_kp2] - v1[pos_km1]);
+      vs2 = d_c1 * (w1[pos_jp1] - f_w1) + d_c2 * (w1[pos_jp2] - w1[pos_jm1]);
+      yz[pos] = (yz[pos] + xmu3 * (vs1 + vs2)) * f_dcrj;
+
+      if (k == d_nzt + align - 2) {
+        zz[pos + 3] = -zz[pos];
+        xz[pos + 2] = -xz[pos];
+        yz[pos + 2] = -yz[pos];
+      } else if (k == d_nzt + align - 3) {
+        xz[pos + 4] = -xz[pos];
+        yz[pos + 4] = -yz[pos];
+      }
+    }
+    pos = pos_im1;
+  }
+  return;
+}
+
 __global__ void addsrc_cu(int i, int READ_STEP, int dim, int* psrc, int npsrc, float* axx, float* ayy, float* azz, float* axz, float* ayz, float* axy, float* xx, float* yy, float* zz, float* xy, float* yz, float* xz) {
   register float vtst;
   register int idx, idy, idz, j, pos;
@@ -514,3 +675,13 @@ __global__ void addsrc_cu(int i, int READ_STEP, int dim, int* psrc, int npsrc, f
 
   return;
 }
+
+__global__ void dsamp_cu(float* u1, float* v1, float* w1, int* idx, int n, float* buf) {
+  register int s;
+  s = blockIdx.x * blockDim.x + threadIdx.x;
+  if (s >= n) return;
+  buf[s] = u1[idx[s]];
+  buf[n + s] = v1[idx[s]];
+  buf[2 * n + s] = w1[idx[s]];
+  return;
+}
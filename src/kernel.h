@@ -25,5 +25,9 @@ __global__ void fvelxyz(float* u1, float* v1, float* w1, float* lam_mu, int xls,
 
 __global__ void dstrqc(float* xx, float* yy, float* zz, float* xy, float* xz, float* yz, float* r1, float* r2, float* r3, float* r4, float* r5, float* r6, float* u1, float* v1, float* w1, float* lam, float* mu, float* qp, float* qs, float* dcrjx, float* dcrjy, float* dcrjz, float* lam_mu, int NX, int rankx, int ranky, int s_i, int e_i, int s_j);
 
+__global__ void dstres(float* xx, float* yy, float* zz, float* xy, float* xz, float* yz, float* u1, float* v1, float* w1, float* lam, float* mu, float* dcrjx, float* dcrjy, float* dcrjz, float* lam_mu, int NX, int rankx, int ranky, int s_i, int e_i, int s_j);
+
+__global__ void dsamp_cu(float* u1, float* v1, float* w1, int* idx, int n, float* buf);
+
 __global__ void addsrc_cu(int i, int READ_STEP, int dim, int* psrc, int npsrc, float* axx, float* ayy, float* azz, float* axz, float* ayz, float* axy, float* xx, float* yy, float* zz, float* xy, float* yz, float* xz);
 #endif
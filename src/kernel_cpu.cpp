@@ -0,0 +1,978 @@
+/**
+@section LICENSE
+Copyright (c) 2013-2016, Regents of the University of California
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+********************************************************************************
+* kernel_cpu.cpp                                                               *
+* host (OpenMP) implementation of the velocity/stress kernels in kernel.cu     *
+* same index layout, loop ranges and ghost conventions as the CUDA kernels     *
+********************************************************************************
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "pmcl3d_cons.h"
+
+static float h_c1;
+static float h_c2;
+static float h_dth;
+static float h_dt1;
+static float h_dh1;
+static float h_DT;
+static float h_DH;
+static int h_nxt;
+static int h_nyt;
+static int h_nzt;
+static int h_zls;
+static int h_zre;
+static int h_fs;
+static long int h_slice_1;
+static long int h_slice_2;
+static long int h_yline_1;
+static long int h_yline_2;
+static unsigned short* h_mid = NULL;
+static float* h_co[NCOEF];
+// relaxation weights along a column of (x, y) parity 2 * itx + ity: entry m is the weight of a point
+// with k & 1 == m & 1, so VW lanes from k are at [k & 1] (see SetHostTau)
+static float h_tau1[4][2 + 16];
+static float h_tau2[4][2 + 16];
+static int h_coef = 0;
+static int h_kd = 0;
+// convolutional PML (NPC=1, see SetHostPml): per direction x, y, z the weights a and b along it, the
+// slab index of each padded i, j or k (-1 outside the slabs), the slab width, the k range of the z
+// slab and the memory variables of the slab points
+static int h_pml = 0;
+static float* h_pma[3];
+static float* h_pmb[3];
+static int* h_pmi[3];
+static int h_pmn[3];
+static long int h_pmsz[3];
+static int h_pmk[2];
+static float* h_psi[3][6];
+// wavefields updated per sweep and the distance between them in floats (see SetHostRhs)
+static int h_nrhs = 1;
+static long int h_rhs = 0;
+
+// media point p: with a material palette the media arguments of the kernels are property tables
+#define MED(a, p) (h_mid ? (a)[h_mid[p]] : (a)[p])
+// x times the Cerjan factor f_dcrj, only in a damped span of the kernels (see sponge_run)
+#define DAMP(x) (damp ? (x) * f_dcrj : (x))
+
+// zls/zre: k range of the stress update, 2 ghost layers deeper on a side with a z neighbour; the rank
+// without an upper neighbour holds the free surface
+void SetHostConstValue(float DH, float DT, int nxt, int nyt, int nzt, int zls, int zre) {
+  h_c1 = 9.0 / 8.0;
+  h_c2 = -1.0 / 24.0;
+  h_dth = DT / DH;
+  h_dt1 = 1.0 / DT;
+  h_dh1 = 1.0 / DH;
+  h_DT = DT;
+  h_DH = DH;
+  h_nxt = nxt;
+  h_nyt = nyt;
+  h_nzt = nzt;
+  h_zls = zls;
+  h_zre = zre;
+  h_fs = (zre == nzt + align - 1);
+  h_slice_1 = (long int)(nyt + 4 + 8 * loop) * (nzt + 2 * align);
+  h_slice_2 = h_slice_1 * 2;
+  h_yline_1 = nzt + 2 * align;
+  h_yline_2 = h_yline_1 * 2;
+  return;
+}
+
+// material IDs of the padded grid (see palmesh), NULL for full media arrays; with IDs, d_1, lam, mu,
+// qp and qs passed to the kernels are the matching rows of the property table
+void SetHostMedia(unsigned short* mid) {
+  h_mid = mid;
+  return;
+}
+
+// staggered media coefficients at every point (see dcoef_C), or NULL to average the media each step
+void SetHostCoef(float** co) {
+  int n;
+  h_coef = (co != NULL);
+  for (n = 0; n < NCOEF; n++) h_co[n] = co ? co[n] : NULL;
+  return;
+}
+
+// dcrjz: Cerjan factors in z; the z sponge lies at the bottom, h_kd is the lowest k from which on up to
+// zre dcrjz is 1. call after SetHostConstValue
+void SetHostSponge(float* dcrjz) {
+  for (h_kd = h_zre + 1; h_kd > 0 && dcrjz[h_kd - 1] == 1.0f; h_kd--)
+    ;
+  return;
+}
+
+// columns i..ie of row j with the same x/y damping, up to e_i; returns ie. *kd is the first k in
+// [k_s, k_e] of these columns without damping, k_e + 1 if they are damped all the way up. multiplying
+// by a factor of 1 is exact, so skipping it outside the sponge leaves the results unchanged
+static inline int sponge_run(float* dcrjx, float* dcrjy, int i, int e_i, int j, int k_s, int k_e, int* kd) {
+  int damp = (dcrjx[i] * dcrjy[j] != 1.0f);
+  while (i < e_i && (dcrjx[i + 1] * dcrjy[j] != 1.0f) == damp) i++;
+  *kd = damp ? k_e + 1 : (h_kd > k_s ? h_kd : k_s);
+  return i;
+}
+
+// a, b: PML weights of x, y and z (see inipml), a is 0 outside the slabs. the memory variables are
+// only kept for the slab points, 6 per direction: the derivatives along it in the u1, v1 and w1
+// updates, of the normal velocity and of the two shear stresses that have one (xy, xz in x; xy, yz
+// in y; xz, yz in z), for each wavefield. returns their number; NULL frees them. call after
+// SetHostConstValue and SetHostRhs
+long int SetHostPml(float* ax, float* bx, float* ay, float* by, float* az, float* bz) {
+  int d, n, p, m, len[3];
+  long int size, total = 0;
+
+  len[0] = h_nxt + 4 + 8 * loop;
+  len[1] = h_nyt + 4 + 8 * loop;
+  len[2] = h_nzt + 2 * align;
+  for (d = 0; d < 3 && h_pml; d++) {
+    free(h_pmi[d]);
+    for (n = 0; n < 6; n++) free(h_psi[d][n]);
+  }
+  h_pml = (ax != NULL);
+  if (!h_pml) return 0;
+
+  h_pma[0] = ax;
+  h_pmb[0] = bx;
+  h_pma[1] = ay;
+  h_pmb[1] = by;
+  h_pma[2] = az;
+  h_pmb[2] = bz;
+  h_pmk[0] = len[2];
+  h_pmk[1] = -1;
+  for (d = 0; d < 3; d++) {
+    h_pmi[d] = (int*)malloc(sizeof(int) * len[d]);
+    for (p = 0, m = 0; p < len[d]; p++) {
+      h_pmi[d][p] = (h_pma[d][p] != 0.0f) ? m++ : -1;
+      if (d == 2 && h_pmi[d][p] >= 0) {
+        if (p < h_pmk[0]) h_pmk[0] = p;
+        h_pmk[1] = p;
+      }
+    }
+    h_pmn[d] = m;
+    size = (long int)len[0] * len[1] * len[2] / len[d] * m;
+    h_pmsz[d] = size;
+    size = size * h_nrhs;
+    for (n = 0; n < 6; n++) h_psi[d][n] = (float*)calloc(size > 0 ? size : 1, sizeof(float));
+    total += 6 * size;
+  }
+  return total;
+}
+
+// index of the memory variables of (i, j, k) of wavefield r in direction d, -1 outside its slabs
+static inline long int pml_at(int d, int r, int i, int j, int k) {
+  int p;
+  if (d == 0) return (p = h_pmi[0][i]) < 0 ? -1 : r * h_pmsz[0] + p * h_slice_1 + j * h_yline_1 + k;
+  if (d == 1) return (p = h_pmi[1][j]) < 0 ? -1 : r * h_pmsz[1] + ((long int)i * h_pmn[1] + p) * h_yline_1 + k;
+  return (p = h_pmi[2][k]) < 0 ? -1 : r * h_pmsz[2] + ((long int)i * (h_nyt + 4 + 8 * loop) + j) * h_pmn[2] + p;
+}
+
+// advance memory variable n of direction d at index m by the difference D; x is the i, j or k along d
+static inline float pml_step(int d, int n, long int m, int x, float D) {
+  float* psi = h_psi[d][n] + m;
+  *psi = h_pmb[d][x] * *psi + h_pma[d][x] * D;
+  return *psi;
+}
+
+// k range of the column (i, j) with PML memory variables within [*k_s, *k_e]; 0 if there is none
+static inline int pml_col(int i, int j, int* k_s, int* k_e) {
+  if (h_pmi[0][i] >= 0 || h_pmi[1][j] >= 0) return 1;
+  if (h_pmk[0] > *k_s) *k_s = h_pmk[0];
+  if (h_pmk[1] < *k_e) *k_e = h_pmk[1];
+  return *k_s <= *k_e;
+}
+
+// n wavefields in one sweep of the kernels, each stride floats after the previous one (the grids of
+// Rhs3D); the wavefield arguments of the kernels are those of the first. call before SetHostPml
+void SetHostRhs(int n, long int stride) {
+  h_nrhs = n;
+  h_rhs = stride;
+  return;
+}
+
+// tau1/tau2: the 8 coarse-grained relaxation weights of the 2x2x2 parity cell, indexed by
+// 4 * itx + 2 * ity + itz; the parities follow the global x and y index and the depth below the free
+// surface, offz being the depth of this rank's first point. call after SetHostConstValue
+void SetHostTau(float* tau1, float* tau2, int offz) {
+  int c, m, itz;
+  for (c = 0; c < 4; c++)
+    for (m = 0; m < 2 + 16; m++) {
+      itz = 1 - (offz + h_nzt + align - 1 - m) % 2;
+      h_tau1[c][m] = tau1[2 * c + itz];
+      h_tau2[c][m] = tau2[2 * c + itz];
+    }
+  return;
+}
+
+// parity index of the column (i, j) into h_tau1/h_tau2
+static inline int tau_col(int offx, int offy, int i, int j) {
+  return 2 * (1 - (offx + i - halo_xy) % 2) + 1 - (offy + j - halo_xy) % 2;
+}
+
+// dth over the staggered densities of u1, v1 and w1 at pos
+static inline void dvelcx_coef(float* d_1, long int pos, float* c) {
+  c[0] = 0.25f * (MED(d_1, pos) + MED(d_1, pos - h_yline_1) + MED(d_1, pos - 1) + MED(d_1, pos - h_yline_1 - 1));
+  c[1] = 0.25f * (MED(d_1, pos) + MED(d_1, pos + h_slice_1) + MED(d_1, pos - 1) + MED(d_1, pos + h_slice_1 - 1));
+  c[2] = 0.25f * (MED(d_1, pos) + MED(d_1, pos + h_slice_1) + MED(d_1, pos - h_yline_1) + MED(d_1, pos + h_slice_1 - h_yline_1));
+
+  c[0] = h_dth / c[0];
+  c[1] = h_dth / c[1];
+  c[2] = h_dth / c[2];
+  return;
+}
+
+// elastic moduli at pos: m gets xl (lambda + 2 mu), xm (2 mu) and the edge mu xmu1..3, not yet times dth
+static inline void dstres_moduli(float* lam, float* mu, long int pos, float* m) {
+  long int pos_ip1, pos_jm1, pos_km1, pos_ik1, pos_jk1, pos_ijk, pos_ijk1;
+
+  pos_ip1 = pos + h_slice_1;
+  pos_jm1 = pos - h_yline_1;
+  pos_km1 = pos - 1;
+  pos_ik1 = pos + h_slice_1 - 1;
+  pos_jk1 = pos - h_yline_1 - 1;
+  pos_ijk = pos + h_slice_1 - h_yline_1;
+  pos_ijk1 = pos + h_slice_1 - h_yline_1 - 1;
+
+  m[0] = 8.0f / (MED(lam, pos) + MED(lam, pos_ip1) + MED(lam, pos_jm1) + MED(lam, pos_ijk) + MED(lam, pos_km1) + MED(lam, pos_ik1) + MED(lam, pos_jk1) + MED(lam, pos_ijk1));
+  m[1] = 16.0f / (MED(mu, pos) + MED(mu, pos_ip1) + MED(mu, pos_jm1) + MED(mu, pos_ijk) + MED(mu, pos_km1) + MED(mu, pos_ik1) + MED(mu, pos_jk1) + MED(mu, pos_ijk1));
+  m[2] = 2.0f / (MED(mu, pos) + MED(mu, pos_km1));
+  m[3] = 2.0f / (MED(mu, pos) + MED(mu, pos_jm1));
+  m[4] = 2.0f / (MED(mu, pos) + MED(mu, pos_ip1));
+  m[0] = m[0] + m[1];
+  return;
+}
+
+// moduli of the elastic stress update at pos in the order of CO_XL to CO_XMU3, times dth
+static inline void dstres_coef(float* lam, float* mu, long int pos, float* c) {
+  int n;
+  dstres_moduli(lam, mu, pos, c);
+  for (n = 0; n < 5; n++) c[n] = c[n] * h_dth;
+  return;
+}
+
+// moduli of the stress update at pos in the order of CO_XL to CO_QPA: xl, xm, xmu1..3 times dth, then
+// the anelastic h, h1..3 and qpa before the relaxation weight
+static inline void dstrqc_coef(float* lam, float* mu, float* qp, float* qs, long int pos, float* c) {
+  long int pos_ip1, pos_jm1, pos_km1, pos_ik1, pos_jk1, pos_ijk, pos_ijk1;
+  float xl, xm, xmu1, xmu2, xmu3, qpa, h, h1, h2, h3, m[5];
+
+  pos_ip1 = pos + h_slice_1;
+  pos_jm1 = pos - h_yline_1;
+  pos_km1 = pos - 1;
+  pos_ik1 = pos + h_slice_1 - 1;
+  pos_jk1 = pos - h_yline_1 - 1;
+  pos_ijk = pos + h_slice_1 - h_yline_1;
+  pos_ijk1 = pos + h_slice_1 - h_yline_1 - 1;
+
+  dstres_moduli(lam, mu, pos, m);
+  xl = m[0];
+  xm = m[1];
+  xmu1 = m[2];
+  xmu2 = m[3];
+  xmu3 = m[4];
+  qpa = 0.0625f * (MED(qp, pos) + MED(qp, pos_ip1) + MED(qp, pos_jm1) + MED(qp, pos_ijk) + MED(qp, pos_km1) + MED(qp, pos_ik1) + MED(qp, pos_jk1) + MED(qp, pos_ijk1));
+  h = 0.0625f * (MED(qs, pos) + MED(qs, pos_ip1) + MED(qs, pos_jm1) + MED(qs, pos_ijk) + MED(qs, pos_km1) + MED(qs, pos_ik1) + MED(qs, pos_jk1) + MED(qs, pos_ijk1));
+  h1 = 0.250f * (MED(qs, pos) + MED(qs, pos_km1));
+  h2 = 0.250f * (MED(qs, pos) + MED(qs, pos_jm1));
+  h3 = 0.250f * (MED(qs, pos) + MED(qs, pos_ip1));
+
+  h = -xm * h * h_dh1;
+  h1 = -xmu1 * h1 * h_dh1;
+  h2 = -xmu2 * h2 * h_dh1;
+  h3 = -xmu3 * h3 * h_dh1;
+  qpa = -qpa * xl * h_dh1;
+  c[0] = xl * h_dth;
+  c[1] = xm * h_dth;
+  c[2] = xmu1 * h_dth;
+  c[3] = xmu2 * h_dth;
+  c[4] = xmu3 * h_dth;
+  c[5] = h;
+  c[6] = h1;
+  c[7] = h2;
+  c[8] = h3;
+  c[9] = qpa;
+  return;
+}
+
+// velocity update of the column (i, j) from k_s to k_e (see dvelcx), with the Cerjan damping if damp
+static void dvelcx_col(float* u1, float* v1, float* w1, float* xx, float* yy, float* zz, float* xy, float* xz, float* yz, float* dcrjx, float* dcrjy, float* dcrjz, float* d_1, int i, int j, int k_s, int k_e, int damp) {
+  int k;
+  long int pos;
+  float f_d1, f_d2, f_d3, f_dcrj = 1.0f, f_dcrjxy, c[3];
+  f_dcrjxy = dcrjx[i] * dcrjy[j];
+  for (k = k_s; k <= k_e; k++) {
+    pos = i * h_slice_1 + j * h_yline_1 + k;
+    if (damp) f_dcrj = f_dcrjxy * dcrjz[k];
+    if (h_coef) {
+      f_d1 = h_co[CO_D1][pos];
+      f_d2 = h_co[CO_D2][pos];
+      f_d3 = h_co[CO_D3][pos];
+    } else {
+      dvelcx_coef(d_1, pos, c);
+      f_d1 = c[0];
+      f_d2 = c[1];
+      f_d3 = c[2];
+    }
+
+    u1[pos] = DAMP(u1[pos] + f_d1 * (h_c1 * (xx[pos] - xx[pos - h_slice_1]) + h_c2 * (xx[pos + h_slice_1] - xx[pos - h_slice_2]) + h_c1 * (xy[pos] - xy[pos - h_yline_1]) + h_c2 * (xy[pos + h_yline_1] - xy[pos - h_yline_2]) + h_c1 * (xz[pos] - xz[pos - 1]) + h_c2 * (xz[pos + 1] - xz[pos - 2])));
+    v1[pos] = DAMP(v1[pos] + f_d2 * (h_c1 * (xy[pos + h_slice_1] - xy[pos]) + h_c2 * (xy[pos + h_slice_2] - xy[pos - h_slice_1]) + h_c1 * (yy[pos + h_yline_1] - yy[pos]) + h_c2 * (yy[pos + h_yline_2] - yy[pos - h_yline_1]) + h_c1 * (yz[pos] - yz[pos - 1]) + h_c2 * (yz[pos + 1] - yz[pos - 2])));
+    w1[pos] = DAMP(w1[pos] + f_d3 * (h_c1 * (xz[pos + h_slice_1] - xz[pos]) + h_c2 * (xz[pos + h_slice_2] - xz[pos - h_slice_1]) + h_c1 * (yz[pos] - yz[pos - h_yline_1]) + h_c2 * (yz[pos + h_yline_1] - yz[pos - h_yline_2]) + h_c1 * (zz[pos + 1] - zz[pos]) + h_c2 * (zz[pos + 2] - zz[pos - 1])));
+  }
+  return;
+}
+
+// velocity ghost cells of the column (i, j) above the free surface
+static inline void dfree_col(float* u1, float* v1, float* w1, float* lam_mu, int NX, int offx, int offy, int i, int j) {
+  int g_i;
+  long int pos;
+  float vs1, vs2;
+
+  pos = i * h_slice_1 + j * h_yline_1 + h_nzt + align - 1;
+  u1[pos + 1] = u1[pos] - (w1[pos] - w1[pos - h_slice_1]);
+  v1[pos + 1] = v1[pos] - (w1[pos + h_yline_1] - w1[pos]);
+
+  g_i = offx + i - 4 * loop - 1;
+  if (g_i < NX)
+    vs1 = u1[pos + h_slice_1] - (w1[pos + h_slice_1] - w1[pos]);
+  else
+    vs1 = 0.0;
+
+  g_i = offy + j - 4 * loop - 1;
+  if (g_i > 1)
+    vs2 = v1[pos - h_yline_1] - (w1[pos] - w1[pos - h_yline_1]);
+  else
+    vs2 = 0.0;
+
+  w1[pos + 1] = w1[pos - 1] - lam_mu[i * (h_nyt + 4 + 8 * loop) + j] * ((vs1 - u1[pos + 1]) + (u1[pos + h_slice_1] - u1[pos]) + (v1[pos + 1] - vs2) + (v1[pos] - v1[pos - h_yline_1]));
+  return;
+}
+
+// elastic stress update of the column (i, j) from k_s to k_e (NVE=0, see dstres), with the Cerjan
+// damping if damp
+static void dstres_col(float* xx, float* yy, float* zz, float* xy, float* xz, float* yz, float* u1, float* v1, float* w1, float* lam, float* mu, float* dcrjx, float* dcrjy, float* dcrjz, float* lam_mu, int NX, int offx, int offy, int i, int j, int k_s, int k_e, int damp) {
+  int k;
+  long int pos, pos_ip1, pos_jm1, pos_km1;
+  float vs1, vs2, vs3, tmp, f_dcrj = 1.0f, f_dcrjxy;
+  float xl, xm, xmu1, xmu2, xmu3, c[5];
+
+  f_dcrjxy = dcrjx[i] * dcrjy[j];
+
+  if (h_fs && k_e > h_nzt + align - 4) dfree_col(u1, v1, w1, lam_mu, NX, offx, offy, i, j);
+
+  for (k = k_s; k <= k_e; k++) {
+    pos = i * h_slice_1 + j * h_yline_1 + k;
+    pos_ip1 = pos + h_slice_1;
+    pos_jm1 = pos - h_yline_1;
+    pos_km1 = pos - 1;
+
+    if (damp) f_dcrj = f_dcrjxy * dcrjz[k];
+
+    if (h_coef) {
+      xl = h_co[CO_XL][pos];
+      xm = h_co[CO_XM][pos];
+      xmu1 = h_co[CO_XMU1][pos];
+      xmu2 = h_co[CO_XMU2][pos];
+      xmu3 = h_co[CO_XMU3][pos];
+    } else {
+      dstres_coef(lam, mu, pos, c);
+      xl = c[0];
+      xm = c[1];
+      xmu1 = c[2];
+      xmu2 = c[3];
+      xmu3 = c[4];
+    }
+
+    vs1 = h_c1 * (u1[pos_ip1] - u1[pos]) + h_c2 * (u1[pos + h_slice_2] - u1[pos - h_slice_1]);
+    vs2 = h_c1 * (v1[pos] - v1[pos_jm1]) + h_c2 * (v1[pos + h_yline_1] - v1[pos - h_yline_2]);
+    vs3 = h_c1 * (w1[pos] - w1[pos_km1]) + h_c2 * (w1[pos + 1] - w1[pos - 2]);
+
+    tmp = xl * (vs1 + vs2 + vs3);
+    xx[pos] = DAMP(xx[pos] + tmp - xm * (vs2 + vs3));
+    yy[pos] = DAMP(yy[pos] + tmp - xm * (vs1 + vs3));
+    zz[pos] = DAMP(zz[pos] + tmp - xm * (vs1 + vs2));
+
+    vs1 = h_c1 * (u1[pos + h_yline_1] - u1[pos]) + h_c2 * (u1[pos + h_yline_2] - u1[pos_jm1]);
+    vs2 = h_c1 * (v1[pos] - v1[pos - h_slice_1]) + h_c2 * (v1[pos_ip1] - v1[pos - h_slice_2]);
+    xy[pos] = DAMP(xy[pos] + xmu1 * (vs1 + vs2));
+
+    if (h_fs && k == h_nzt + align - 1) {
+      zz[pos + 1] = -zz[pos];
+      xz[pos] = 0.0;
+      yz[pos] = 0.0;
+    } else {
+      vs1 = h_c1 * (u1[pos + 1] - u1[pos]) + h_c2 * (u1[pos + 2] - u1[pos_km1]);
+      vs2 = h_c1 * (w1[pos] - w1[pos - h_slice_1]) + h_c2 * (w1[pos_ip1] - w1[pos - h_slice_2]);
+      xz[pos] = DAMP(xz[pos] + xmu2 * (vs1 + vs2));
+
+      vs1 = h_c1 * (v1[pos + 1] - v1[pos]) + h_c2 * (v1[pos + 2] - v1[pos_km1]);
+      vs2 = h_c1 * (w1[pos + h_yline_1] - w1[pos]) + h_c2 * (w1[pos + h_yline_2] - w1[pos_jm1]);
+      yz[pos] = DAMP(yz[pos] + xmu3 * (vs1 + vs2));
+
+      if (h_fs && k == h_nzt + align - 2) {
+        zz[pos + 3] = -zz[pos];
+        xz[pos + 2] = -xz[pos];
+        yz[pos + 2] = -yz[pos];
+      } else if (h_fs && k == h_nzt + align - 3) {
+        xz[pos + 4] = -xz[pos];
+        yz[pos + 4] = -yz[pos];
+      }
+    }
+  }
+  return;
+}
+
+// stress and memory variable update of the column (i, j) from k_s to k_e (see dstrqc), with the Cerjan
+// damping if damp
+// on the free surface rank the velocity ghosts of the column are set first; they are only read for k > nzt+align-4
+static void dstrqc_col(float* xx, float* yy, float* zz, float* xy, float* xz, float* yz, float* r1, float* r2, float* r3, float* r4, float* r5, float* r6, float* u1, float* v1, float* w1, float* lam, float* mu, float* qp, float* qs, float* dcrjx, float* dcrjy, float* dcrjz, float* lam_mu, int NX, int offx, int offy, int i, int j, int k_s, int k_e, int damp) {
+  int k;
+  long int pos, pos_ip1, pos_jm1, pos_km1;
+  float vs1, vs2, vs3, a1, tmp, f_vx1, f_vx2, f_dcrj = 1.0f, f_dcrjxy, f_r;
+  float xl, xm, xmu1, xmu2, xmu3, qpa, h, h1, h2, h3, vx, c[10];
+  float *tau1 = h_tau1[tau_col(offx, offy, i, j)], *tau2 = h_tau2[tau_col(offx, offy, i, j)];
+
+  f_dcrjxy = dcrjx[i] * dcrjy[j];
+
+  // free surface: velocity ghost cells above k = nzt+align-1 are set before the column is updated
+  if (h_fs && k_e > h_nzt + align - 4) dfree_col(u1, v1, w1, lam_mu, NX, offx, offy, i, j);
+
+  for (k = k_s; k <= k_e; k++) {
+    pos = i * h_slice_1 + j * h_yline_1 + k;
+    pos_ip1 = pos + h_slice_1;
+    pos_jm1 = pos - h_yline_1;
+    pos_km1 = pos - 1;
+
+    f_vx1 = tau1[k & 1];
+    f_vx2 = tau2[k & 1];
+    if (damp) f_dcrj = f_dcrjxy * dcrjz[k];
+
+    if (h_coef) {
+      xl = h_co[CO_XL][pos];
+      xm = h_co[CO_XM][pos];
+      xmu1 = h_co[CO_XMU1][pos];
+      xmu2 = h_co[CO_XMU2][pos];
+      xmu3 = h_co[CO_XMU3][pos];
+      h = h_co[CO_H][pos];
+      h1 = h_co[CO_H1][pos];
+      h2 = h_co[CO_H2][pos];
+      h3 = h_co[CO_H3][pos];
+      qpa = h_co[CO_QPA][pos];
+    } else {
+      dstrqc_coef(lam, mu, qp, qs, pos, c);
+      xl = c[0];
+      xm = c[1];
+      xmu1 = c[2];
+      xmu2 = c[3];
+      xmu3 = c[4];
+      h = c[5];
+      h1 = c[6];
+      h2 = c[7];
+      h3 = c[8];
+      qpa = c[9];
+    }
+    f_vx2 = f_vx2 * f_vx1;
+    h = h * f_vx1;
+    h1 = h1 * f_vx1;
+    h2 = h2 * f_vx1;
+    h3 = h3 * f_vx1;
+    qpa = qpa * f_vx1;
+
+    xm = xm + h_DT * h;
+    xmu1 = xmu1 + h_DT * h1;
+    xmu2 = xmu2 + h_DT * h2;
+    xmu3 = xmu3 + h_DT * h3;
+    vx = h_DT * (1 + f_vx2);
+
+    vs1 = h_c1 * (u1[pos_ip1] - u1[pos]) + h_c2 * (u1[pos + h_slice_2] - u1[pos - h_slice_1]);
+    vs2 = h_c1 * (v1[pos] - v1[pos_jm1]) + h_c2 * (v1[pos + h_yline_1] - v1[pos - h_yline_2]);
+    vs3 = h_c1 * (w1[pos] - w1[pos_km1]) + h_c2 * (w1[pos + 1] - w1[pos - 2]);
+
+    tmp = xl * (vs1 + vs2 + vs3);
+    a1 = qpa * (vs1 + vs2 + vs3);
+    tmp = tmp + h_DT * a1;
+
+    f_r = r1[pos];
+    xx[pos] = DAMP(xx[pos] + tmp - xm * (vs2 + vs3) + vx * f_r);
+    r1[pos] = f_vx2 * f_r - h * (vs2 + vs3) + a1;
+    f_r = r2[pos];
+    yy[pos] = DAMP(yy[pos] + tmp - xm * (vs1 + vs3) + vx * f_r);
+    r2[pos] = f_vx2 * f_r - h * (vs1 + vs3) + a1;
+    f_r = r3[pos];
+    zz[pos] = DAMP(zz[pos] + tmp - xm * (vs1 + vs2) + vx * f_r);
+    r3[pos] = f_vx2 * f_r - h * (vs1 + vs2) + a1;
+
+    vs1 = h_c1 * (u1[pos + h_yline_1] - u1[pos]) + h_c2 * (u1[pos + h_yline_2] - u1[pos_jm1]);
+    vs2 = h_c1 * (v1[pos] - v1[pos - h_slice_1]) + h_c2 * (v1[pos_ip1] - v1[pos - h_slice_2]);
+    f_r = r4[pos];
+    xy[pos] = DAMP(xy[pos] + xmu1 * (vs1 + vs2) + vx * f_r);
+    r4[pos] = f_vx2 * f_r + h1 * (vs1 + vs2);
+
+    if (h_fs && k == h_nzt + align - 1) {
+      zz[pos + 1] = -zz[pos];
+      xz[pos] = 0.0;
+      yz[pos] = 0.0;
+    } else {
+      vs1 = h_c1 * (u1[pos + 1] - u1[pos]) + h_c2 * (u1[pos + 2] - u1[pos_km1]);
+      vs2 = h_c1 * (w1[pos] - w1[pos - h_slice_1]) + h_c2 * (w1[pos_ip1] - w1[pos - h_slice_2]);
+      f_r = r5[pos];
+      xz[pos] = DAMP(xz[pos] + xmu2 * (vs1 + vs2) + vx * f_r);
+      r5[pos] = f_vx2 * f_r + h2 * (vs1 + vs2);
+
+      vs1 = h_c1 * (v1[pos + 1] - v1[pos]) + h_c2 * (v1[pos + 2] - v1[pos_km1]);
+      vs2 = h_c1 * (w1[pos + h_yline_1] - w1[pos]) + h_c2 * (w1[pos + h_yline_2] - w1[pos_jm1]);
+      f_r = r6[pos];
+      yz[pos] = DAMP(yz[pos] + xmu3 * (vs1 + vs2) + vx * f_r);
+      r6[pos] = f_vx2 * f_r + h3 * (vs1 + vs2);
+
+      if (h_fs && k == h_nzt + align - 2) {
+        zz[pos + 3] = -zz[pos];
+        xz[pos + 2] = -xz[pos];
+        yz[pos + 2] = -yz[pos];
+      } else if (h_fs && k == h_nzt + align - 3) {
+        xz[pos + 4] = -xz[pos];
+        yz[pos + 4] = -yz[pos];
+      }
+    }
+  }
+  return;
+}
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define HOST_SIMD_X86
+#include <immintrin.h>
+// VW media points from p on, gathered through the material IDs with a palette
+#define MLOAD(a, p) (h_mid ? VGATHER(a, h_mid + (p)) : VLOAD((a) + (p)))
+// vector form of DAMP
+#define VDAMP(x) (damp ? VMUL(x, f_dcrj) : (x))
+
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#define VW 8
+#define vf __m256
+#define VLOAD(p) _mm256_loadu_ps(p)
+#define VSTORE(p, v) _mm256_storeu_ps(p, v)
+#define VSET1(x) _mm256_set1_ps(x)
+#define VADD(a, b) _mm256_add_ps(a, b)
+#define VSUB(a, b) _mm256_sub_ps(a, b)
+#define VMUL(a, b) _mm256_mul_ps(a, b)
+#define VDIV(a, b) _mm256_div_ps(a, b)
+#define VGATHER(a, m) _mm256_i32gather_ps(a, _mm256_cvtepu16_epi32(_mm_loadu_si128((__m128i*)(m))), 4)
+#define SIMD_FN(name) name##_avx2
+#include "kernel_cpu_simd.h"
+#undef VW
+#undef vf
+#undef VLOAD
+#undef VSTORE
+#undef VSET1
+#undef VADD
+#undef VSUB
+#undef VMUL
+#undef VDIV
+#undef VGATHER
+#undef SIMD_FN
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx512f")
+// avx512f implies fma; keep mul/add separate so the result matches the scalar and AVX2 paths
+#pragma GCC optimize("fp-contract=off")
+#define VW 16
+#define vf __m512
+#define VLOAD(p) _mm512_loadu_ps(p)
+#define VSTORE(p, v) _mm512_storeu_ps(p, v)
+#define VSET1(x) _mm512_set1_ps(x)
+#define VADD(a, b) _mm512_add_ps(a, b)
+#define VSUB(a, b) _mm512_sub_ps(a, b)
+#define VMUL(a, b) _mm512_mul_ps(a, b)
+#define VDIV(a, b) _mm512_div_ps(a, b)
+#define VGATHER(a, m) _mm512_i32gather_ps(_mm512_cvtepu16_epi32(_mm256_loadu_si256((__m256i*)(m))), a, 4)
+#define SIMD_FN(name) name##_avx512
+#include "kernel_cpu_simd.h"
+#undef VW
+#undef vf
+#undef VLOAD
+#undef VSTORE
+#undef VSET1
+#undef VADD
+#undef VSUB
+#undef VMUL
+#undef VDIV
+#undef VGATHER
+#undef SIMD_FN
+#pragma GCC pop_options
+#endif
+
+static int h_simd = SIMD_SCALAR;
+
+// pick the instruction set for dvelcx_C/dstrqc_C: the requested level (SIMD_AUTO for the best one)
+// capped at what the cpu supports; returns the level in use
+int SetHostSimd(int SIMD) {
+  int best = SIMD_SCALAR;
+#ifdef HOST_SIMD_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f"))
+    best = SIMD_AVX512;
+  else if (__builtin_cpu_supports("avx2"))
+    best = SIMD_AVX2;
+#endif
+  if (SIMD == SIMD_AUTO || SIMD > best)
+    h_simd = best;
+  else if (SIMD < SIMD_SCALAR)
+    h_simd = SIMD_SCALAR;
+  else
+    h_simd = SIMD;
+  return h_simd;
+}
+
+// velocity update of the columns i in [s_i, e_i] of row j from k_s to k_e at the selected SIMD level
+static void dvelcx_span(float* u1, float* v1, float* w1, float* xx, float* yy, float* zz, float* xy, float* xz, float* yz, float* dcrjx, float* dcrjy, float* dcrjz, float* d_1, int s_i, int e_i, int j, int k_s, int k_e, int damp) {
+  int i;
+#ifdef HOST_SIMD_X86
+  if (h_simd == SIMD_AVX512) {
+    dvelcx_row_avx512(u1, v1, w1, xx, yy, zz, xy, xz, yz, dcrjx, dcrjy, dcrjz, d_1, s_i, e_i, j, k_s, k_e, damp);
+    return;
+  }
+  if (h_simd == SIMD_AVX2) {
+    dvelcx_row_avx2(u1, v1, w1, xx, yy, zz, xy, xz, yz, dcrjx, dcrjy, dcrjz, d_1, s_i, e_i, j, k_s, k_e, damp);
+    return;
+  }
+#endif
+  for (i = s_i; i <= e_i; i++) dvelcx_col(u1, v1, w1, xx, yy, zz, xy, xz, yz, dcrjx, dcrjy, dcrjz, d_1, i, j, k_s, k_e, damp);
+  return;
+}
+
+// elastic stress update of the columns i in [s_i, e_i] of row j from k_s to k_e at the selected SIMD level
+static void dstres_span(float* xx, float* yy, float* zz, float* xy, float* xz, float* yz, float* u1, float* v1, float* w1, float* lam, float* mu, float* dcrjx, float* dcrjy, float* dcrjz, float* lam_mu, int NX, int offx, int offy, int s_i, int e_i, int j, int k_s, int k_e, int damp) {
+  int i;
+#ifdef HOST_SIMD_X86
+  if (h_simd == SIMD_AVX512) {
+    dstres_row_avx512(xx, yy, zz, xy, xz, yz, u1, v1, w1, lam, mu, dcrjx, dcrjy, dcrjz, lam_mu, NX, offx, offy, s_i, e_i, j, k_s, k_e, damp);
+    return;
+  }
+  if (h_simd == SIMD_AVX2) {
+    dstres_row_avx2(xx, yy, zz, xy, xz, yz, u1, v1, w1, lam, mu, dcrjx, dcrjy, dcrjz, lam_mu, NX, offx, offy, s_i, e_i, j, k_s, k_e, damp);
+    return;
+  }
+#endif
+  for (i = s_i; i <= e_i; i++) dstres_col(xx, yy, zz, xy, xz, yz, u1, v1, w1, lam, mu, dcrjx, dcrjy, dcrjz, lam_mu, NX, offx, offy, i, j, k_s, k_e, damp);
+  return;
+}
+
+// stress and memory variable update of the columns i in [s_i, e_i] of row j from k_s to k_e at the
+// selected SIMD level
+static void dstrqc_span(float* xx, float* yy, float* zz, float* xy, float* xz, float* yz, float* r1, float* r2, float* r3, float* r4, float* r5, float* r6, float* u1, float* v1, float* w1, float* lam, float* mu, float* qp, float* qs, float* dcrjx, float* dcrjy, float* dcrjz, float* lam_mu, int NX, int offx, int offy, int s_i, int e_i, int j, int k_s, int k_e, int damp) {
+  int i;
+#ifdef HOST_SIMD_X86
+  if (h_simd == SIMD_AVX512) {
+    dstrqc_row_avx512(xx, yy, zz, xy, xz, yz, r1, r2, r3, r4, r5, r6, u1, v1, w1, lam, mu, qp, qs, dcrjx, dcrjy, dcrjz, lam_mu, NX, offx, offy, s_i, e_i, j, k_s, k_e, damp);
+    return;
+  }
+  if (h_simd == SIMD_AVX2) {
+    dstrqc_row_avx2(xx, yy, zz, xy, xz, yz, r1, r2, r3, r4, r5, r6, u1, v1, w1, lam, mu, qp, qs, dcrjx, dcrjy, dcrjz, lam_mu, NX, offx, offy, s_i, e_i, j, k_s, k_e, damp);
+    return;
+  }
+#endif
+  for (i = s_i; i <= e_i; i++) dstrqc_col(xx, yy, zz, xy, xz, yz, r1, r2, r3, r4, r5, r6, u1, v1, w1, lam, mu, qp, qs, dcrjx, dcrjy, dcrjz, lam_mu, NX, offx, offy, i, j, k_s, k_e, damp);
+  return;
+}
+
+// PML terms of the velocity update of row j of wavefield r, added after it: the memory variables of
+// the slab points are advanced with the stress differences of this step and added to them
+static void dpmlv_row(float* u1, float* v1, float* w1, float* xx, float* yy, float* zz, float* xy, float* xz, float* yz, float* d_1, int s_i, int e_i, int j, int r) {
+  int i, k, k_s, k_e;
+  long int pos, m;
+  float p0, p1, p2, c[3];
+
+  for (i = s_i; i <= e_i; i++) {
+    k_s = align;
+    k_e = h_nzt + align - 1;
+    if (!pml_col(i, j, &k_s, &k_e)) continue;
+    for (k = k_s; k <= k_e; k++) {
+      pos = i * h_slice_1 + j * h_yline_1 + k;
+      p0 = p1 = p2 = 0.0f;
+      if ((m = pml_at(0, r, i, j, k)) >= 0) {
+        p0 += pml_step(0, 0, m, i, h_c1 * (xx[pos] - xx[pos - h_slice_1]) + h_c2 * (xx[pos + h_slice_1] - xx[pos - h_slice_2]));
+        p1 += pml_step(0, 1, m, i, h_c1 * (xy[pos + h_slice_1] - xy[pos]) + h_c2 * (xy[pos + h_slice_2] - xy[pos - h_slice_1]));
+        p2 += pml_step(0, 2, m, i, h_c1 * (xz[pos + h_slice_1] - xz[pos]) + h_c2 * (xz[pos + h_slice_2] - xz[pos - h_slice_1]));
+      }
+      if ((m = pml_at(1, r, i, j, k)) >= 0) {
+        p0 += pml_step(1, 0, m, j, h_c1 * (xy[pos] - xy[pos - h_yline_1]) + h_c2 * (xy[pos + h_yline_1] - xy[pos - h_yline_2]));
+        p1 += pml_step(1, 1, m, j, h_c1 * (yy[pos + h_yline_1] - yy[pos]) + h_c2 * (yy[pos + h_yline_2] - yy[pos - h_yline_1]));
+        p2 += pml_step(1, 2, m, j, h_c1 * (yz[pos] - yz[pos - h_yline_1]) + h_c2 * (yz[pos + h_yline_1] - yz[pos - h_yline_2]));
+      }
+      if ((m = pml_at(2, r, i, j, k)) >= 0) {
+        p0 += pml_step(2, 0, m, k, h_c1 * (xz[pos] - xz[pos - 1]) + h_c2 * (xz[pos + 1] - xz[pos - 2]));
+        p1 += pml_step(2, 1, m, k, h_c1 * (yz[pos] - yz[pos - 1]) + h_c2 * (yz[pos + 1] - yz[pos - 2]));
+        p2 += pml_step(2, 2, m, k, h_c1 * (zz[pos + 1] - zz[pos]) + h_c2 * (zz[pos + 2] - zz[pos - 1]));
+      }
+      if (h_coef) {
+        c[0] = h_co[CO_D1][pos];
+        c[1] = h_co[CO_D2][pos];
+        c[2] = h_co[CO_D3][pos];
+      } else
+        dvelcx_coef(d_1, pos, c);
+      u1[pos] += c[0] * p0;
+      v1[pos] += c[1] * p1;
+      w1[pos] += c[2] * p2;
+    }
+  }
+  return;
+}
+
+// PML terms of the stress and memory variable update of row j, added after it like dpmlv_row; the
+// free surface images of the corrected stresses are set again
+static void dpmls_row(float* xx, float* yy, float* zz, float* xy, float* xz, float* yz, float* r1, float* r2, float* r3, float* r4, float* r5, float* r6, float* u1, float* v1, float* w1, float* lam, float* mu, float* qp, float* qs, int offx, int offy, int s_i, int e_i, int j, int r) {
+  int i, k, k_s, k_e, n, top = h_nzt + align - 1;
+  long int pos, m;
+  float p[3], pxy, pxz, pyz, tmp, a1, f_vx1, c[10];
+  float* tau1;
+
+  for (i = s_i; i <= e_i; i++) {
+    k_s = h_zls;
+    k_e = h_zre;
+    if (!pml_col(i, j, &k_s, &k_e)) continue;
+    tau1 = h_tau1[tau_col(offx, offy, i, j)];
+    for (k = k_s; k <= k_e; k++) {
+      pos = i * h_slice_1 + j * h_yline_1 + k;
+      p[0] = p[1] = p[2] = pxy = pxz = pyz = 0.0f;
+      if ((m = pml_at(0, r, i, j, k)) >= 0) {
+        p[0] = pml_step(0, 3, m, i, h_c1 * (u1[pos + h_slice_1] - u1[pos]) + h_c2 * (u1[pos + h_slice_2] - u1[pos - h_slice_1]));
+        pxy += pml_step(0, 4, m, i, h_c1 * (v1[pos] - v1[pos - h_slice_1]) + h_c2 * (v1[pos + h_slice_1] - v1[pos - h_slice_2]));
+        if (!h_fs || k != top) pxz += pml_step(0, 5, m, i, h_c1 * (w1[pos] - w1[pos - h_slice_1]) + h_c2 * (w1[pos + h_slice_1] - w1[pos - h_slice_2]));
+      }
+      if ((m = pml_at(1, r, i, j, k)) >= 0) {
+        p[1] = pml_step(1, 3, m, j, h_c1 * (v1[pos] - v1[pos - h_yline_1]) + h_c2 * (v1[pos + h_yline_1] - v1[pos - h_yline_2]));
+        pxy += pml_step(1, 4, m, j, h_c1 * (u1[pos + h_yline_1] - u1[pos]) + h_c2 * (u1[pos + h_yline_2] - u1[pos - h_yline_1]));
+        if (!h_fs || k != top) pyz += pml_step(1, 5, m, j, h_c1 * (w1[pos + h_yline_1] - w1[pos]) + h_c2 * (w1[pos + h_yline_2] - w1[pos - h_yline_1]));
+      }
+      if ((m = pml_at(2, r, i, j, k)) >= 0) {
+        p[2] = pml_step(2, 3, m, k, h_c1 * (w1[pos] - w1[pos - 1]) + h_c2 * (w1[pos + 1] - w1[pos - 2]));
+        if (!h_fs || k != top) {
+          pxz += pml_step(2, 4, m, k, h_c1 * (u1[pos + 1] - u1[pos]) + h_c2 * (u1[pos + 2] - u1[pos - 1]));
+          pyz += pml_step(2, 5, m, k, h_c1 * (v1[pos + 1] - v1[pos]) + h_c2 * (v1[pos + 2] - v1[pos - 1]));
+        }
+      }
+
+      // the coefficients of dstres_col or dstrqc_col: xl, xm, xmu1..3, then h, h1..3 and qpa
+      if (h_coef)
+        for (n = 0; n < (r1 ? 10 : 5); n++) c[n] = h_co[CO_XL + n][pos];
+      else if (r1)
+        dstrqc_coef(lam, mu, qp, qs, pos, c);
+      else
+        dstres_coef(lam, mu, pos, c);
+      tmp = c[0] * (p[0] + p[1] + p[2]);
+      if (r1) {
+        f_vx1 = tau1[k & 1];
+        for (n = 5; n < 10; n++) c[n] = c[n] * f_vx1;
+        for (n = 1; n < 5; n++) c[n] = c[n] + h_DT * c[n + 4];
+        a1 = c[9] * (p[0] + p[1] + p[2]);
+        tmp = tmp + h_DT * a1;
+        r1[pos] += a1 - c[5] * (p[1] + p[2]);
+        r2[pos] += a1 - c[5] * (p[0] + p[2]);
+        r3[pos] += a1 - c[5] * (p[0] + p[1]);
+        r4[pos] += c[6] * pxy;
+        if (!h_fs || k != top) {
+          r5[pos] += c[7] * pxz;
+          r6[pos] += c[8] * pyz;
+        }
+      }
+      xx[pos] += tmp - c[1] * (p[1] + p[2]);
+      yy[pos] += tmp - c[1] * (p[0] + p[2]);
+      zz[pos] += tmp - c[1] * (p[0] + p[1]);
+      xy[pos] += c[2] * pxy;
+      if (!h_fs || k != top) {
+        xz[pos] += c[3] * pxz;
+        yz[pos] += c[4] * pyz;
+      }
+
+      if (h_fs && k == top) {
+        zz[pos + 1] = -zz[pos];
+      } else if (h_fs && k == top - 1) {
+        zz[pos + 3] = -zz[pos];
+        xz[pos + 2] = -xz[pos];
+        yz[pos + 2] = -yz[pos];
+      } else if (h_fs && k == top - 2) {
+        xz[pos + 4] = -xz[pos];
+        yz[pos + 4] = -yz[pos];
+      }
+    }
+  }
+  return;
+}
+
+// one j row of the velocity update for i in [s_i, e_i], split into sponge spans with the Cerjan
+// damping and spans without. with several wavefields each column is updated for all of them in turn,
+// so its media are read from memory once
+static void dvelcx_row(float* u1, float* v1, float* w1, float* xx, float* yy, float* zz, float* xy, float* xz, float* yz, float* dcrjx, float* dcrjy, float* dcrjz, float* d_1, int s_i, int e_i, int j) {
+  int i, ie, c, ce, r, kd, k_e = h_nzt + align - 1;
+  long int o;
+  for (i = s_i; i <= e_i; i = ie + 1) {
+    ie = sponge_run(dcrjx, dcrjy, i, e_i, j, align, k_e, &kd);
+    for (c = i; c <= ie; c = ce + 1) {
+      ce = h_nrhs > 1 ? c : ie;
+      for (r = 0, o = 0; r < h_nrhs; r++, o += h_rhs) {
+        if (kd > align) dvelcx_span(u1 + o, v1 + o, w1 + o, xx + o, yy + o, zz + o, xy + o, xz + o, yz + o, dcrjx, dcrjy, dcrjz, d_1, c, ce, j, align, kd <= k_e ? kd - 1 : k_e, 1);
+        if (kd <= k_e) dvelcx_span(u1 + o, v1 + o, w1 + o, xx + o, yy + o, zz + o, xy + o, xz + o, yz + o, dcrjx, dcrjy, dcrjz, d_1, c, ce, j, kd, k_e, 0);
+      }
+    }
+  }
+  if (h_pml)
+    for (r = 0, o = 0; r < h_nrhs; r++, o += h_rhs) dpmlv_row(u1 + o, v1 + o, w1 + o, xx + o, yy + o, zz + o, xy + o, xz + o, yz + o, d_1, s_i, e_i, j, r);
+  return;
+}
+
+// one j row of the stress update for i in [s_i, e_i], split like dvelcx_row; elastic without memory
+// variables
+static void dstrqc_row(float* xx, float* yy, float* zz, float* xy, float* xz, float* yz, float* r1, float* r2, float* r3, float* r4, float* r5, float* r6, float* u1, float* v1, float* w1, float* lam, float* mu, float* qp, float* qs, float* dcrjx, float* dcrjy, float* dcrjz, float* lam_mu, int NX, int offx, int offy, int s_i, int e_i, int j) {
+  int i, ie, c, ce, r, kd, k_e;
+  long int o, oq;
+  for (i = s_i; i <= e_i; i = ie + 1) {
+    ie = sponge_run(dcrjx, dcrjy, i, e_i, j, h_zls, h_zre, &kd);
+    k_e = kd <= h_zre ? kd - 1 : h_zre;
+    for (c = i; c <= ie; c = ce + 1) {
+      ce = h_nrhs > 1 ? c : ie;
+      for (r = 0, o = 0; r < h_nrhs; r++, o += h_rhs) {
+        if (r1 == NULL) {
+          if (kd > h_zls) dstres_span(xx + o, yy + o, zz + o, xy + o, xz + o, yz + o, u1 + o, v1 + o, w1 + o, lam, mu, dcrjx, dcrjy, dcrjz, lam_mu, NX, offx, offy, c, ce, j, h_zls, k_e, 1);
+          if (kd <= h_zre) dstres_span(xx + o, yy + o, zz + o, xy + o, xz + o, yz + o, u1 + o, v1 + o, w1 + o, lam, mu, dcrjx, dcrjy, dcrjz, lam_mu, NX, offx, offy, c, ce, j, kd, h_zre, 0);
+        } else {
+          if (kd > h_zls) dstrqc_span(xx + o, yy + o, zz + o, xy + o, xz + o, yz + o, r1 + o, r2 + o, r3 + o, r4 + o, r5 + o, r6 + o, u1 + o, v1 + o, w1 + o, lam, mu, qp, qs, dcrjx, dcrjy, dcrjz, lam_mu, NX, offx, offy, c, ce, j, h_zls, k_e, 1);
+          if (kd <= h_zre) dstrqc_span(xx + o, yy + o, zz + o, xy + o, xz + o, yz + o, r1 + o, r2 + o, r3 + o, r4 + o, r5 + o, r6 + o, u1 + o, v1 + o, w1 + o, lam, mu, qp, qs, dcrjx, dcrjy, dcrjz, lam_mu, NX, offx, offy, c, ce, j, kd, h_zre, 0);
+        }
+      }
+    }
+  }
+  if (h_pml)
+    for (r = 0, o = 0; r < h_nrhs; r++, o += h_rhs) {
+      // the memory variables of an elastic run stay NULL
+      oq = r1 ? o : 0;
+      dpmls_row(xx + o, yy + o, zz + o, xy + o, xz + o, yz + o, r1 + oq, r2 + oq, r3 + oq, r4 + oq, r5 + oq, r6 + oq, u1 + o, v1 + o, w1 + o, lam, mu, qp, qs, offx, offy, s_i, e_i, j, r);
+    }
+  return;
+}
+
+// velocity update for i in [s_i, e_i], j in [s_j, e_j] over the interior z range (see dvelcx)
+void dvelcx_C(float* u1, float* v1, float* w1, float* xx, float* yy, float* zz, float* xy, float* xz, float* yz, float* dcrjx, float* dcrjy, float* dcrjz, float* d_1, int s_i, int e_i, int s_j, int e_j) {
+  int j;
+#pragma omp parallel for schedule(static)
+  for (j = s_j; j <= e_j; j++) dvelcx_row(u1, v1, w1, xx, yy, zz, xy, xz, yz, dcrjx, dcrjy, dcrjz, d_1, s_i, e_i, j);
+  return;
+}
+
+// stress and memory variable update for i in [s_i, e_i], j in [s_j, e_j], k in [zls, zre] including the free surface (see dstrqc)
+// offx, offy: global x and y index of the rank's first interior point (see partition)
+// r1..r6, qp and qs NULL for the elastic update (NVE=0, see dstres)
+void dstrqc_C(float* xx, float* yy, float* zz, float* xy, float* xz, float* yz, float* r1, float* r2, float* r3, float* r4, float* r5, float* r6, float* u1, float* v1, float* w1, float* lam, float* mu, float* qp, float* qs, float* dcrjx, float* dcrjy, float* dcrjz, float* lam_mu, int NX, int offx, int offy, int s_i, int e_i, int s_j, int e_j) {
+  int j;
+#pragma omp parallel for schedule(static)
+  for (j = s_j; j <= e_j; j++) dstrqc_row(xx, yy, zz, xy, xz, yz, r1, r2, r3, r4, r5, r6, u1, v1, w1, lam, mu, qp, qs, dcrjx, dcrjy, dcrjz, lam_mu, NX, offx, offy, s_i, e_i, j);
+  return;
+}
+
+// fill the coefficients set with SetHostCoef at every point whose media stencil lies in the padded grid,
+// from the media as the kernels would average them; call after mediaswap and SetHostMedia.
+// with qp and qs NULL (NVE=0) only the elastic ones up to CO_XMU3 are filled
+void dcoef_C(float* d_1, float* lam, float* mu, float* qp, float* qs) {
+  int i, ncoef = qp ? NCOEF : CO_H;
+#pragma omp parallel for schedule(static)
+  for (i = 0; i < h_nxt + 4 + 8 * loop - 1; i++) {
+    int j, k, n;
+    long int pos;
+    float c[NCOEF];
+    for (j = 1; j < h_nyt + 4 + 8 * loop; j++)
+      for (k = 1; k < h_nzt + 2 * align; k++) {
+        pos = i * h_slice_1 + j * h_yline_1 + k;
+        dvelcx_coef(d_1, pos, c + CO_D1);
+        if (qp)
+          dstrqc_coef(lam, mu, qp, qs, pos, c + CO_XL);
+        else
+          dstres_coef(lam, mu, pos, c + CO_XL);
+        for (n = 0; n < ncoef; n++) h_co[n][pos] = c[n];
+      }
+  }
+  return;
+}
+
+// temporal blocking (time skewing) of nstep full time steps over i in [s_i, e_i], j in [s_j, e_j],
+// for a rank without x/y neighbours, i.e. no halo exchange between the half steps.
+// velocity and stress updates are 2*nstep half steps with a stencil radius of 2 in i and j
+// (free surface ghosts and Cerjan damping are column local). the tile x tile grid is shifted
+// back by 2 cells every half step, so a tile only reads results of tiles with smaller or equal
+// indices and never overwrites a value those still need; tiles on one anti-diagonal run in parallel.
+// sources of step s (if s < src_nstep) are added by the tile owning them right after its stress
+// update, with the same index arithmetic as addsrc for source_step = src_step + s + 1.
+void dtile_C(float* u1, float* v1, float* w1, float* xx, float* yy, float* zz, float* xy, float* xz, float* yz, float* r1, float* r2, float* r3, float* r4, float* r5, float* r6, float* lam, float* mu, float* qp, float* qs, float* dcrjx, float* dcrjy, float* dcrjz, float* d_1, float* lam_mu, int NX, int offx, int offy, int s_i, int e_i, int s_j, int e_j, int nstep, int tile, int src_step, int src_nstep, int npsrc, int* psrc, int dim, int READ_STEP, float* axx, float* ayy, float* azz, float* axz, float* ayz, float* axy, float DH, float DT) {
+  int nlev = 2 * nstep;
+  int nti = (e_i - s_i + 1 + 2 * nlev + tile - 1) / tile;
+  int ntj = (e_j - s_j + 1 + 2 * nlev + tile - 1) / tile;
+  int d, bi;
+  float vtst = (float)DT / (DH * DH * DH);
+
+  for (d = 0; d < nti + ntj - 1; d++) {
+#pragma omp parallel for schedule(dynamic)
+    for (bi = (d < ntj ? 0 : d - ntj + 1); bi <= (d < nti ? d : nti - 1); bi++) {
+      int bj = d - bi;
+      int lev, lo_i, hi_i, lo_j, hi_j, j, n, idx, idy, idz, isrc;
+      long int pos;
+      for (lev = 0; lev < nlev; lev++) {
+        lo_i = s_i + bi * tile - 2 * lev;
+        hi_i = lo_i + tile - 1;
+        lo_j = s_j + bj * tile - 2 * lev;
+        hi_j = lo_j + tile - 1;
+        if (lo_i < s_i) lo_i = s_i;
+        if (hi_i > e_i) hi_i = e_i;
+        if (lo_j < s_j) lo_j = s_j;
+        if (hi_j > e_j) hi_j = e_j;
+        if (lo_i > hi_i || lo_j > hi_j) continue;
+
+        if (lev % 2 == 0) {
+          for (j = lo_j; j <= hi_j; j++) dvelcx_row(u1, v1, w1, xx, yy, zz, xy, xz, yz, dcrjx, dcrjy, dcrjz, d_1, lo_i, hi_i, j);
+          continue;
+        }
+        for (j = lo_j; j <= hi_j; j++) dstrqc_row(xx, yy, zz, xy, xz, yz, r1, r2, r3, r4, r5, r6, u1, v1, w1, lam, mu, qp, qs, dcrjx, dcrjy, dcrjz, lam_mu, NX, offx, offy, lo_i, hi_i, j);
+        if (lev / 2 >= src_nstep) continue;
+        isrc = src_step + lev / 2;
+        for (n = 0; n < npsrc; n++) {
+          idx = psrc[n * dim] + 1 + 4 * loop;
+          idy = psrc[n * dim + 1] + 1 + 4 * loop;
+          idz = psrc[n * dim + 2] + align - 1;
+          if (idx < lo_i || idx > hi_i || idy < lo_j || idy > hi_j) continue;
+          pos = idx * h_slice_1 + idy * h_yline_1 + idz;
+          xx[pos] = xx[pos] - vtst * axx[n * READ_STEP + isrc];
+          yy[pos] = yy[pos] - vtst * ayy[n * READ_STEP + isrc];
+          zz[pos] = zz[pos] - vtst * azz[n * READ_STEP + isrc];
+          xz[pos] = xz[pos] - vtst * axz[n * READ_STEP + isrc];
+          yz[pos] = yz[pos] - vtst * ayz[n * READ_STEP + isrc];
+          xy[pos] = xy[pos] - vtst * axy[n * READ_STEP + isrc];
+        }
+      }
+    }
+  }
+  return;
+}
+
+// recording points: u1, v1 and w1 at the n grid offsets idx (output order, see main) packed into bx,
+// by and bz, point s at s * stride
+void dsamp_C(float* u1, float* v1, float* w1, int* idx, int n, int stride, float* bx, float* by, float* bz) {
+  int s;
+#pragma omp parallel for schedule(static) if (n > 4096)
+  for (s = 0; s < n; s++) {
+    bx[(long int)s * stride] = u1[idx[s]];
+    by[(long int)s * stride] = v1[idx[s]];
+    bz[(long int)s * stride] = w1[idx[s]];
+  }
+  return;
+}
@@ -0,0 +1,389 @@
+/**
+@section LICENSE
+Copyright (c) 2013-2016, Regents of the University of California
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+********************************************************************************
+* kernel_cpu_simd.h                                                            *
+* width generic SIMD bodies of the dvelcx/dstrqc/dstres sweeps over the        *
+* columns i in [s_i, e_i] of one j row from k_s to k_e, with the Cerjan        *
+* damping if damp (VDAMP), included by kernel_cpu.cpp once per instruction     *
+* set with VW, vf, VLOAD, VSTORE, VSET1, VADD, VSUB, VMUL, VDIV, VGATHER and   *
+* SIMD_FN defined                                                              *
+*                                                                              *
+* a vector holds VW consecutive k points of one (i, j) column (the CUDA thread *
+* block along z); i is walked from e_i down to s_i with the same register      *
+* rotation as the CUDA kernels. the operation order matches the scalar code so *
+* all dispatch levels give the same results. with a material palette the       *
+* media loads gather from the property tables by the 16-bit IDs (MLOAD).       *
+********************************************************************************
+*/
+
+static void SIMD_FN(dvelcx_row)(float* u1, float* v1, float* w1, float* xx, float* yy, float* zz, float* xy, float* xz, float* yz, float* dcrjx, float* dcrjy, float* dcrjz, float* d_1, int s_i, int e_i, int j, int k_s, int k_e, int damp) {
+  int i, k;
+  long int pos, pos_im1, pos_im2, pos_ip1, pos_jm1, pos_jm2, pos_jp1, pos_jp2;
+  vf c1 = VSET1(h_c1), c2 = VSET1(h_c2), dth = VSET1(h_dth), quarter = VSET1(0.25f);
+  vf f_xx, xx_im1, xx_ip1, xx_im2;
+  vf f_xy, xy_ip1, xy_ip2, xy_im1;
+  vf f_xz, xz_ip1, xz_ip2, xz_im1;
+  vf f_d1, f_d2, f_d3, f_dcrj = VSET1(1.0f), f_dcrjz = f_dcrj, f_yz, f_d, f_dip1, acc;
+
+  for (k = k_s; k + VW <= k_e + 1; k += VW) {
+    i = e_i;
+    pos = i * h_slice_1 + j * h_yline_1 + k;
+
+    f_xx = VLOAD(xx + pos + h_slice_1);
+    xx_im1 = VLOAD(xx + pos);
+    xx_im2 = VLOAD(xx + pos - h_slice_1);
+    xy_ip1 = VLOAD(xy + pos + h_slice_2);
+    f_xy = VLOAD(xy + pos + h_slice_1);
+    xy_im1 = VLOAD(xy + pos);
+    xz_ip1 = VLOAD(xz + pos + h_slice_2);
+    f_xz = VLOAD(xz + pos + h_slice_1);
+    xz_im1 = VLOAD(xz + pos);
+    if (damp) f_dcrjz = VLOAD(dcrjz + k);
+    for (i = e_i; i >= s_i; i--) {
+      pos_jm2 = pos - h_yline_2;
+      pos_jm1 = pos - h_yline_1;
+      pos_jp1 = pos + h_yline_1;
+      pos_jp2 = pos + h_yline_2;
+      pos_im1 = pos - h_slice_1;
+      pos_im2 = pos - h_slice_2;
+      pos_ip1 = pos + h_slice_1;
+
+      xx_ip1 = f_xx;
+      f_xx = xx_im1;
+      xx_im1 = xx_im2;
+      xx_im2 = VLOAD(xx + pos_im2);
+      xy_ip2 = xy_ip1;
+      xy_ip1 = f_xy;
+      f_xy = xy_im1;
+      xy_im1 = VLOAD(xy + pos_im1);
+      xz_ip2 = xz_ip1;
+      xz_ip1 = f_xz;
+      f_xz = xz_im1;
+      xz_im1 = VLOAD(xz + pos_im1);
+      f_yz = VLOAD(yz + pos);
+
+      if (damp) f_dcrj = VMUL(VSET1(dcrjx[i] * dcrjy[j]), f_dcrjz);
+      if (h_coef) {
+        f_d1 = VLOAD(h_co[CO_D1] + pos);
+        f_d2 = VLOAD(h_co[CO_D2] + pos);
+        f_d3 = VLOAD(h_co[CO_D3] + pos);
+      } else {
+        f_d = MLOAD(d_1, pos);
+        f_dip1 = MLOAD(d_1, pos_ip1);
+        f_d1 = VMUL(quarter, VADD(VADD(VADD(f_d, MLOAD(d_1, pos_jm1)), MLOAD(d_1, pos - 1)), MLOAD(d_1, pos_jm1 - 1)));
+        f_d2 = VMUL(quarter, VADD(VADD(VADD(f_d, f_dip1), MLOAD(d_1, pos - 1)), MLOAD(d_1, pos_ip1 - 1)));
+        f_d3 = VMUL(quarter, VADD(VADD(VADD(f_d, f_dip1), MLOAD(d_1, pos_jm1)), MLOAD(d_1, pos_ip1 - h_yline_1)));
+
+        f_d1 = VDIV(dth, f_d1);
+        f_d2 = VDIV(dth, f_d2);
+        f_d3 = VDIV(dth, f_d3);
+      }
+
+      acc = VMUL(c1, VSUB(f_xx, xx_im1));
+      acc = VADD(acc, VMUL(c2, VSUB(xx_ip1, xx_im2)));
+      acc = VADD(acc, VMUL(c1, VSUB(f_xy, VLOAD(xy + pos_jm1))));
+      acc = VADD(acc, VMUL(c2, VSUB(VLOAD(xy + pos_jp1), VLOAD(xy + pos_jm2))));
+      acc = VADD(acc, VMUL(c1, VSUB(f_xz, VLOAD(xz + pos - 1))));
+      acc = VADD(acc, VMUL(c2, VSUB(VLOAD(xz + pos + 1), VLOAD(xz + pos - 2))));
+      VSTORE(u1 + pos, VDAMP(VADD(VLOAD(u1 + pos), VMUL(f_d1, acc))));
+
+      acc = VMUL(c1, VSUB(xy_ip1, f_xy));
+      acc = VADD(acc, VMUL(c2, VSUB(xy_ip2, xy_im1)));
+      acc = VADD(acc, VMUL(c1, VSUB(VLOAD(yy + pos_jp1), VLOAD(yy + pos))));
+      acc = VADD(acc, VMUL(c2, VSUB(VLOAD(yy + pos_jp2), VLOAD(yy + pos_jm1))));
+      acc = VADD(acc, VMUL(c1, VSUB(f_yz, VLOAD(yz + pos - 1))));
+      acc = VADD(acc, VMUL(c2, VSUB(VLOAD(yz + pos + 1), VLOAD(yz + pos - 2))));
+      VSTORE(v1 + pos, VDAMP(VADD(VLOAD(v1 + pos), VMUL(f_d2, acc))));
+
+      acc = VMUL(c1, VSUB(xz_ip1, f_xz));
+      acc = VADD(acc, VMUL(c2, VSUB(xz_ip2, xz_im1)));
+      acc = VADD(acc, VMUL(c1, VSUB(f_yz, VLOAD(yz + pos_jm1))));
+      acc = VADD(acc, VMUL(c2, VSUB(VLOAD(yz + pos_jp1), VLOAD(yz + pos_jm2))));
+      acc = VADD(acc, VMUL(c1, VSUB(VLOAD(zz + pos + 1), VLOAD(zz + pos))));
+      acc = VADD(acc, VMUL(c2, VSUB(VLOAD(zz + pos + 2), VLOAD(zz + pos - 1))));
+      VSTORE(w1 + pos, VDAMP(VADD(VLOAD(w1 + pos), VMUL(f_d3, acc))));
+
+      pos = pos_im1;
+    }
+  }
+
+  // k points left over from the last full vector
+  if (k <= k_e)
+    for (i = s_i; i <= e_i; i++) dvelcx_col(u1, v1, w1, xx, yy, zz, xy, xz, yz, dcrjx, dcrjy, dcrjz, d_1, i, j, k, k_e, damp);
+  return;
+}
+
+static void SIMD_FN(dstrqc_row)(float* xx, float* yy, float* zz, float* xy, float* xz, float* yz, float* r1, float* r2, float* r3, float* r4, float* r5, float* r6, float* u1, float* v1, float* w1, float* lam, float* mu, float* qp, float* qs, float* dcrjx, float* dcrjy, float* dcrjz, float* lam_mu, int NX, int offx, int offy, int s_i, int e_i, int j, int k_s, int k_e, int damp) {
+  int i, k, k_v;
+  long int pos, pos_ip1, pos_im1, pos_im2, pos_jm1, pos_jm2, pos_jp1, pos_jp2;
+  long int pos_km1, pos_ik1, pos_jk1, pos_ijk, pos_ijk1;
+  vf c1 = VSET1(h_c1), c2 = VSET1(h_c2), dth = VSET1(h_dth), DT = VSET1(h_DT), mdh1 = VSET1(-h_dh1), one = VSET1(1.0f);
+  vf vs1, vs2, vs3, a1, tmp, vx, f_vx1, f_vx2, f_dcrj = VSET1(1.0f), f_dcrjz = f_dcrj, f_r;
+  vf xl, xm, xmu1, xmu2, xmu3, qpa, h, h1, h2, h3, f_mu, f_qs;
+  vf f_u1, u1_ip1, u1_ip2, u1_im1;
+  vf f_v1, v1_im1, v1_ip1, v1_im2;
+  vf f_w1, w1_im1, w1_im2, w1_ip1;
+
+  // the top three k points carry the free surface conditions and stay scalar
+  k_v = (h_fs && k_e > h_nzt + align - 4) ? h_nzt + align - 3 : k_e + 1;
+  for (k = k_s; k + VW <= k_v; k += VW) {
+    i = e_i;
+    pos = i * h_slice_1 + j * h_yline_1 + k;
+
+    u1_ip1 = VLOAD(u1 + pos + h_slice_2);
+    f_u1 = VLOAD(u1 + pos + h_slice_1);
+    u1_im1 = VLOAD(u1 + pos);
+    f_v1 = VLOAD(v1 + pos + h_slice_1);
+    v1_im1 = VLOAD(v1 + pos);
+    v1_im2 = VLOAD(v1 + pos - h_slice_1);
+    f_w1 = VLOAD(w1 + pos + h_slice_1);
+    w1_im1 = VLOAD(w1 + pos);
+    w1_im2 = VLOAD(w1 + pos - h_slice_1);
+    if (damp) f_dcrjz = VLOAD(dcrjz + k);
+    for (i = e_i; i >= s_i; i--) {
+      f_vx1 = VLOAD(h_tau1[tau_col(offx, offy, i, j)] + (k & 1));
+      f_vx2 = VLOAD(h_tau2[tau_col(offx, offy, i, j)] + (k & 1));
+      if (damp) f_dcrj = VMUL(VSET1(dcrjx[i] * dcrjy[j]), f_dcrjz);
+
+      pos_km1 = pos - 1;
+      pos_jm2 = pos - h_yline_2;
+      pos_jm1 = pos - h_yline_1;
+      pos_jp1 = pos + h_yline_1;
+      pos_jp2 = pos + h_yline_2;
+      pos_im2 = pos - h_slice_2;
+      pos_im1 = pos - h_slice_1;
+      pos_ip1 = pos + h_slice_1;
+      pos_jk1 = pos - h_yline_1 - 1;
+      pos_ik1 = pos + h_slice_1 - 1;
+      pos_ijk = pos + h_slice_1 - h_yline_1;
+      pos_ijk1 = pos + h_slice_1 - h_yline_1 - 1;
+
+      if (h_coef) {
+        xl = VLOAD(h_co[CO_XL] + pos);
+        xm = VLOAD(h_co[CO_XM] + pos);
+        xmu1 = VLOAD(h_co[CO_XMU1] + pos);
+        xmu2 = VLOAD(h_co[CO_XMU2] + pos);
+        xmu3 = VLOAD(h_co[CO_XMU3] + pos);
+        h = VLOAD(h_co[CO_H] + pos);
+        h1 = VLOAD(h_co[CO_H1] + pos);
+        h2 = VLOAD(h_co[CO_H2] + pos);
+        h3 = VLOAD(h_co[CO_H3] + pos);
+        qpa = VLOAD(h_co[CO_QPA] + pos);
+      } else {
+        f_mu = MLOAD(mu, pos);
+        f_qs = MLOAD(qs, pos);
+        xl = VDIV(VSET1(8.0f), VADD(VADD(VADD(VADD(VADD(VADD(VADD(MLOAD(lam, pos), MLOAD(lam, pos_ip1)), MLOAD(lam, pos_jm1)), MLOAD(lam, pos_ijk)), MLOAD(lam, pos_km1)), MLOAD(lam, pos_ik1)), MLOAD(lam, pos_jk1)), MLOAD(lam, pos_ijk1)));
+        xm = VDIV(VSET1(16.0f), VADD(VADD(VADD(VADD(VADD(VADD(VADD(f_mu, MLOAD(mu, pos_ip1)), MLOAD(mu, pos_jm1)), MLOAD(mu, pos_ijk)), MLOAD(mu, pos_km1)), MLOAD(mu, pos_ik1)), MLOAD(mu, pos_jk1)), MLOAD(mu, pos_ijk1)));
+        xmu1 = VDIV(VSET1(2.0f), VADD(f_mu, MLOAD(mu, pos_km1)));
+        xmu2 = VDIV(VSET1(2.0f), VADD(f_mu, MLOAD(mu, pos_jm1)));
+        xmu3 = VDIV(VSET1(2.0f), VADD(f_mu, MLOAD(mu, pos_ip1)));
+        xl = VADD(xl, xm);
+        qpa = VMUL(VSET1(0.0625f), VADD(VADD(VADD(VADD(VADD(VADD(VADD(MLOAD(qp, pos), MLOAD(qp, pos_ip1)), MLOAD(qp, pos_jm1)), MLOAD(qp, pos_ijk)), MLOAD(qp, pos_km1)), MLOAD(qp, pos_ik1)), MLOAD(qp, pos_jk1)), MLOAD(qp, pos_ijk1)));
+        h = VMUL(VSET1(0.0625f), VADD(VADD(VADD(VADD(VADD(VADD(VADD(f_qs, MLOAD(qs, pos_ip1)), MLOAD(qs, pos_jm1)), MLOAD(qs, pos_ijk)), MLOAD(qs, pos_km1)), MLOAD(qs, pos_ik1)), MLOAD(qs, pos_jk1)), MLOAD(qs, pos_ijk1)));
+        h1 = VMUL(VSET1(0.250f), VADD(f_qs, MLOAD(qs, pos_km1)));
+        h2 = VMUL(VSET1(0.250f), VADD(f_qs, MLOAD(qs, pos_jm1)));
+        h3 = VMUL(VSET1(0.250f), VADD(f_qs, MLOAD(qs, pos_ip1)));
+
+        h = VMUL(VMUL(xm, h), mdh1);
+        h1 = VMUL(VMUL(xmu1, h1), mdh1);
+        h2 = VMUL(VMUL(xmu2, h2), mdh1);
+        h3 = VMUL(VMUL(xmu3, h3), mdh1);
+        qpa = VMUL(VMUL(qpa, xl), mdh1);
+        xm = VMUL(xm, dth);
+        xmu1 = VMUL(xmu1, dth);
+        xmu2 = VMUL(xmu2, dth);
+        xmu3 = VMUL(xmu3, dth);
+        xl = VMUL(xl, dth);
+      }
+      f_vx2 = VMUL(f_vx2, f_vx1);
+      h = VMUL(h, f_vx1);
+      h1 = VMUL(h1, f_vx1);
+      h2 = VMUL(h2, f_vx1);
+      h3 = VMUL(h3, f_vx1);
+      qpa = VMUL(qpa, f_vx1);
+
+      xm = VADD(xm, VMUL(DT, h));
+      xmu1 = VADD(xmu1, VMUL(DT, h1));
+      xmu2 = VADD(xmu2, VMUL(DT, h2));
+      xmu3 = VADD(xmu3, VMUL(DT, h3));
+      vx = VMUL(DT, VADD(one, f_vx2));
+
+      u1_ip2 = u1_ip1;
+      u1_ip1 = f_u1;
+      f_u1 = u1_im1;
+      u1_im1 = VLOAD(u1 + pos_im1);
+      v1_ip1 = f_v1;
+      f_v1 = v1_im1;
+      v1_im1 = v1_im2;
+      v1_im2 = VLOAD(v1 + pos_im2);
+      w1_ip1 = f_w1;
+      f_w1 = w1_im1;
+      w1_im1 = w1_im2;
+      w1_im2 = VLOAD(w1 + pos_im2);
+
+      vs1 = VADD(VMUL(c1, VSUB(u1_ip1, f_u1)), VMUL(c2, VSUB(u1_ip2, u1_im1)));
+      vs2 = VADD(VMUL(c1, VSUB(f_v1, VLOAD(v1 + pos_jm1))), VMUL(c2, VSUB(VLOAD(v1 + pos_jp1), VLOAD(v1 + pos_jm2))));
+      vs3 = VADD(VMUL(c1, VSUB(f_w1, VLOAD(w1 + pos_km1))), VMUL(c2, VSUB(VLOAD(w1 + pos + 1), VLOAD(w1 + pos - 2))));
+
+      tmp = VMUL(xl, VADD(VADD(vs1, vs2), vs3));
+      a1 = VMUL(qpa, VADD(VADD(vs1, vs2), vs3));
+      tmp = VADD(tmp, VMUL(DT, a1));
+
+      f_r = VLOAD(r1 + pos);
+      VSTORE(xx + pos, VDAMP(VADD(VSUB(VADD(VLOAD(xx + pos), tmp), VMUL(xm, VADD(vs2, vs3))), VMUL(vx, f_r))));
+      VSTORE(r1 + pos, VADD(VSUB(VMUL(f_vx2, f_r), VMUL(h, VADD(vs2, vs3))), a1));
+      f_r = VLOAD(r2 + pos);
+      VSTORE(yy + pos, VDAMP(VADD(VSUB(VADD(VLOAD(yy + pos), tmp), VMUL(xm, VADD(vs1, vs3))), VMUL(vx, f_r))));
+      VSTORE(r2 + pos, VADD(VSUB(VMUL(f_vx2, f_r), VMUL(h, VADD(vs1, vs3))), a1));
+      f_r = VLOAD(r3 + pos);
+      VSTORE(zz + pos, VDAMP(VADD(VSUB(VADD(VLOAD(zz + pos), tmp), VMUL(xm, VADD(vs1, vs2))), VMUL(vx, f_r))));
+      VSTORE(r3 + pos, VADD(VSUB(VMUL(f_vx2, f_r), VMUL(h, VADD(vs1, vs2))), a1));
+
+      vs1 = VADD(VMUL(c1, VSUB(VLOAD(u1 + pos_jp1), f_u1)), VMUL(c2, VSUB(VLOAD(u1 + pos_jp2), VLOAD(u1 + pos_jm1))));
+      vs2 = VADD(VMUL(c1, VSUB(f_v1, v1_im1)), VMUL(c2, VSUB(v1_ip1, v1_im2)));
+      f_r = VLOAD(r4 + pos);
+      VSTORE(xy + pos, VDAMP(VADD(VADD(VLOAD(xy + pos), VMUL(xmu1, VADD(vs1, vs2))), VMUL(vx, f_r))));
+      VSTORE(r4 + pos, VADD(VMUL(f_vx2, f_r), VMUL(h1, VADD(vs1, vs2))));
+
+      vs1 = VADD(VMUL(c1, VSUB(VLOAD(u1 + pos + 1), f_u1)), VMUL(c2, VSUB(VLOAD(u1 + pos + 2), VLOAD(u1 + pos_km1))));
+      vs2 = VADD(VMUL(c1, VSUB(f_w1, w1_im1)), VMUL(c2, VSUB(w1_ip1, w1_im2)));
+      f_r = VLOAD(r5 + pos);
+      VSTORE(xz + pos, VDAMP(VADD(VADD(VLOAD(xz + pos), VMUL(xmu2, VADD(vs1, vs2))), VMUL(vx, f_r))));
+      VSTORE(r5 + pos, VADD(VMUL(f_vx2, f_r), VMUL(h2, VADD(vs1, vs2))));
+
+      vs1 = VADD(VMUL(c1, VSUB(VLOAD(v1 + pos + 1), f_v1)), VMUL(c2, VSUB(VLOAD(v1 + pos + 2), VLOAD(v1 + pos_km1))));
+      vs2 = VADD(VMUL(c1, VSUB(VLOAD(w1 + pos_jp1), f_w1)), VMUL(c2, VSUB(VLOAD(w1 + pos_jp2), VLOAD(w1 + pos_jm1))));
+      f_r = VLOAD(r6 + pos);
+      VSTORE(yz + pos, VDAMP(VADD(VADD(VLOAD(yz + pos), VMUL(xmu3, VADD(vs1, vs2))), VMUL(vx, f_r))));
+      VSTORE(r6 + pos, VADD(VMUL(f_vx2, f_r), VMUL(h3, VADD(vs1, vs2))));
+
+      pos = pos_im1;
+    }
+  }
+
+  // remaining k points, including the free surface, column by column
+  if (k <= k_e)
+    for (i = s_i; i <= e_i; i++) dstrqc_col(xx, yy, zz, xy, xz, yz, r1, r2, r3, r4, r5, r6, u1, v1, w1, lam, mu, qp, qs, dcrjx, dcrjy, dcrjz, lam_mu, NX, offx, offy, i, j, k, k_e, damp);
+  return;
+}
+
+static void SIMD_FN(dstres_row)(float* xx, float* yy, float* zz, float* xy, float* xz, float* yz, float* u1, float* v1, float* w1, float* lam, float* mu, float* dcrjx, float* dcrjy, float* dcrjz, float* lam_mu, int NX, int offx, int offy, int s_i, int e_i, int j, int k_s, int k_e, int damp) {
+  int i, k, k_v;
+  long int pos, pos_ip1, pos_im1, pos_im2, pos_jm1, pos_jm2, pos_jp1, pos_jp2;
+  long int pos_km1, pos_ik1, pos_jk1, pos_ijk, pos_ijk1;
+  vf c1 = VSET1(h_c1), c2 = VSET1(h_c2), dth = VSET1(h_dth);
+  vf vs1, vs2, vs3, tmp, f_dcrj = VSET1(1.0f), f_dcrjz = f_dcrj;
+  vf xl, xm, xmu1, xmu2, xmu3, f_mu;
+  vf f_u1, u1_ip1, u1_ip2, u1_im1;
+  vf f_v1, v1_im1, v1_ip1, v1_im2;
+  vf f_w1, w1_im1, w1_im2, w1_ip1;
+
+  // the top three k points carry the free surface conditions and stay scalar
+  k_v = (h_fs && k_e > h_nzt + align - 4) ? h_nzt + align - 3 : k_e + 1;
+  for (k = k_s; k + VW <= k_v; k += VW) {
+    i = e_i;
+    pos = i * h_slice_1 + j * h_yline_1 + k;
+
+    u1_ip1 = VLOAD(u1 + pos + h_slice_2);
+    f_u1 = VLOAD(u1 + pos + h_slice_1);
+    u1_im1 = VLOAD(u1 + pos);
+    f_v1 = VLOAD(v1 + pos + h_slice_1);
+    v1_im1 = VLOAD(v1 + pos);
+    v1_im2 = VLOAD(v1 + pos - h_slice_1);
+    f_w1 = VLOAD(w1 + pos + h_slice_1);
+    w1_im1 = VLOAD(w1 + pos);
+    w1_im2 = VLOAD(w1 + pos - h_slice_1);
+    if (damp) f_dcrjz = VLOAD(dcrjz + k);
+    for (i = e_i; i >= s_i; i--) {
+      if (damp) f_dcrj = VMUL(VSET1(dcrjx[i] * dcrjy[j]), f_dcrjz);
+
+      pos_km1 = pos - 1;
+      pos_jm2 = pos - h_yline_2;
+      pos_jm1 = pos - h_yline_1;
+      pos_jp1 = pos + h_yline_1;
+      pos_jp2 = pos + h_yline_2;
+      pos_im2 = pos - h_slice_2;
+      pos_im1 = pos - h_slice_1;
+      pos_ip1 = pos + h_slice_1;
+      pos_jk1 = pos - h_yline_1 - 1;
+      pos_ik1 = pos + h_slice_1 - 1;
+      pos_ijk = pos + h_slice_1 - h_yline_1;
+      pos_ijk1 = pos + h_slice_1 - h_yline_1 - 1;
+
+      if (h_coef) {
+        xl = VLOAD(h_co[CO_XL] + pos);
+        xm = VLOAD(h_co[CO_XM] + pos);
+        xmu1 = VLOAD(h_co[CO_XMU1] + pos);
+        xmu2 = VLOAD(h_co[CO_XMU2] + pos);
+        xmu3 = VLOAD(h_co[CO_XMU3] + pos);
+      } else {
+        f_mu = MLOAD(mu, pos);
+        xl = VDIV(VSET1(8.0f), VADD(VADD(VADD(VADD(VADD(VADD(VADD(MLOAD(lam, pos), MLOAD(lam, pos_ip1)), MLOAD(lam, pos_jm1)), MLOAD(lam, pos_ijk)), MLOAD(lam, pos_km1)), MLOAD(lam, pos_ik1)), MLOAD(lam, pos_jk1)), MLOAD(lam, pos_ijk1)));
+        xm = VDIV(VSET1(16.0f), VADD(VADD(VADD(VADD(VADD(VADD(VADD(f_mu, MLOAD(mu, pos_ip1)), MLOAD(mu, pos_jm1)), MLOAD(mu, pos_ijk)), MLOAD(mu, pos_km1)), MLOAD(mu, pos_ik1)), MLOAD(mu, pos_jk1)), MLOAD(mu, pos_ijk1)));
+        xmu1 = VDIV(VSET1(2.0f), VADD(f_mu, MLOAD(mu, pos_km1)));
+        xmu2 = VDIV(VSET1(2.0f), VADD(f_mu, MLOAD(mu, pos_jm1)));
+        xmu3 = VDIV(VSET1(2.0f), VADD(f_mu, MLOAD(mu, pos_ip1)));
+        xl = VADD(xl, xm);
+        xl = VMUL(xl, dth);
+        xm = VMUL(xm, dth);
+        xmu1 = VMUL(xmu1, dth);
+        xmu2 = VMUL(xmu2, dth);
+        xmu3 = VMUL(xmu3, dth);
+      }
+
+      u1_ip2 = u1_ip1;
+      u1_ip1 = f_u1;
+      f_u1 = u1_im1;
+      u1_im1 = VLOAD(u1 + pos_im1);
+      v1_ip1 = f_v1;
+      f_v1 = v1_im1;
+      v1_im1 = v1_im2;
+      v1_im2 = VLOAD(v1 + pos_im2);
+      w1_ip1 = f_w1;
+      f_w1 = w1_im1;
+      w1_im1 = w1_im2;
+      w1_im2 = VLOAD(w1 + pos_im2);
+
+      vs1 = VADD(VMUL(c1, VSUB(u1_ip1, f_u1)), VMUL(c2, VSUB(u1_ip2, u1_im1)));
+      vs2 = VADD(VMUL(c1, VSUB(f_v1, VLOAD(v1 + pos_jm1))), VMUL(c2, VSUB(VLOAD(v1 + pos_jp1), VLOAD(v1 + pos_jm2))));
+      vs3 = VADD(VMUL(c1, VSUB(f_w1, VLOAD(w1 + pos_km1))), VMUL(c2, VSUB(VLOAD(w1 + pos + 1), VLOAD(w1 + pos - 2))));
+
+      tmp = VMUL(xl, VADD(VADD(vs1, vs2), vs3));
+      VSTORE(xx + pos, VDAMP(VSUB(VADD(VLOAD(xx + pos), tmp), VMUL(xm, VADD(vs2, vs3)))));
+      VSTORE(yy + pos, VDAMP(VSUB(VADD(VLOAD(yy + pos), tmp), VMUL(xm, VADD(vs1, vs3)))));
+      VSTORE(zz + pos, VDAMP(VSUB(VADD(VLOAD(zz + pos), tmp), VMUL(xm, VADD(vs1, vs2)))));
+
+      vs1 = VADD(VMUL(c1, VSUB(VLOAD(u1 + pos_jp1), f_u1)), VMUL(c2, VSUB(VLOAD(u1 + pos_jp2), VLOAD(u1 + pos_jm1))));
+      vs2 = VADD(VMUL(c1, VSUB(f_v1, v1_im1)), VMUL(c2, VSUB(v1_ip1, v1_im2)));
+      VSTORE(xy + pos, VDAMP(VADD(VLOAD(xy + pos), VMUL(xmu1, VADD(vs1, vs2)))));
+
+      vs1 = VADD(VMUL(c1, VSUB(VLOAD(u1 + pos + 1), f_u1)), VMUL(c2, VSUB(VLOAD(u1 + pos + 2), VLOAD(u1 + pos_km1))));
+      vs2 = VADD(VMUL(c1, VSUB(f_w1, w1_im1)), VMUL(c2, VSUB(w1_ip1, w1_im2)));
+      VSTORE(xz + pos, VDAMP(VADD(VLOAD(xz + pos), VMUL(xmu2, VADD(vs1, vs2)))));
+
+      vs1 = VADD(VMUL(c1, VSUB(VLOAD(v1 + pos + 1), f_v1)), VMUL(c2, VSUB(VLOAD(v1 + pos + 2), VLOAD(v1 + pos_km1))));
+      vs2 = VADD(VMUL(c1, VSUB(VLOAD(w1 + pos_jp1), f_w1)), VMUL(c2, VSUB(VLOAD(w1 + pos_jp2), VLOAD(w1 + pos_jm1))));
+      VSTORE(yz + pos, VDAMP(VADD(VLOAD(yz + pos), VMUL(xmu3, VADD(vs1, vs2)))));
+
+      pos = pos_im1;
+    }
+  }
+
+  // remaining k points, including the free surface, column by column
+  if (k <= k_e)
+    for (i = s_i; i <= e_i; i++) dstres_col(xx, yy, zz, xy, xz, yz, u1, v1, w1, lam, mu, dcrjx, dcrjy, dcrjz, lam_mu, NX, offx, offy, i, j, k, k_e, damp);
+  return;
+}
@@ -14,10 +14,12 @@ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
 
 #include <math.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "pmcl3d.h"
 
-void inimesh(int MEDIASTART, Grid3D d1, Grid3D mu, Grid3D lam, Grid3D qp, Grid3D qs, float *taumax, float *taumin, int nvar, float FP, float FL, float FH, int nxt, int nyt, int nzt, int PX, int PY, int NX, int NY, int NZ, int *coords, MPI_Comm MCW, int IDYNA, int NVE, int SoCalQ, char *INVEL, float *vse, float *vpe, float *dde) {
+void inimesh(int MEDIASTART, Grid3D d1, Grid3D mu, Grid3D lam, Grid3D qp, Grid3D qs, float *taumax, float *taumin, int nvar, float FP, float FL, float FH, int nxt, int nyt, int nzt, int PX, int PY, int PZ, int NX, int NY, int NZ, int *offs, MPI_Comm MCW, int IDYNA, int NVE, int SoCalQ, char *INVEL, float *vse, float *vpe, float *dde) {
   int merr;
   int rank;
   int i, j, k, err;
@@ -44,13 +46,13 @@ void inimesh(int MEDIASTART, Grid3D d1, Grid3D mu, Grid3D lam, Grid3D qp, Grid3D
     for (i = 0; i < nxt + 4 + 8 * loop; i++)
       for (j = 0; j < nyt + 4 + 8 * loop; j++)
         for (k = 0; k < nzt + 2 * align; k++) {
-          lam[i][j][k] = 1. / (dd * (vp * vp - 2. * vs * vs));
-          mu[i][j][k] = 1. / (dd * vs * vs);
-          d1[i][j][k] = dd;
+          G3(lam, i, j, k) = 1. / (dd * (vp * vp - 2. * vs * vs));
+          G3(mu, i, j, k) = 1. / (dd * vs * vs);
+          G3(d1, i, j, k) = dd;
         }
   } else {
-    Grid3D tmpvp = NULL, tmpvs = NULL, tmpdd = NULL;
-    Grid3D tmppq = NULL, tmpsq = NULL;
+    Grid3D tmpvp = {NULL}, tmpvs = {NULL}, tmpdd = {NULL};
+    Grid3D tmppq = {NULL}, tmpsq = {NULL};
     int var_offset;
 
     tmpvp = Alloc3D(nxt, nyt, nzt);
@@ -59,9 +61,9 @@ void inimesh(int MEDIASTART, Grid3D d1, Grid3D mu, Grid3D lam, Grid3D qp, Grid3D
     for (i = 0; i < nxt; i++)
       for (j = 0; j < nyt; j++)
         for (k = 0; k < nzt; k++) {
-          tmpvp[i][j][k] = 0.0f;
-          tmpvs[i][j][k] = 0.0f;
-          tmpdd[i][j][k] = 0.0f;
+          G3(tmpvp, i, j, k) = 0.0f;
+          G3(tmpvs, i, j, k) = 0.0f;
+          G3(tmpdd, i, j, k) = 0.0f;
         }
 
     if (NVE == 1) {
@@ -70,8 +72,8 @@ void inimesh(int MEDIASTART, Grid3D d1, Grid3D mu, Grid3D lam, Grid3D qp, Grid3D
       for (i = 0; i < nxt; i++)
         for (j = 0; j < nyt; j++)
           for (k = 0; k < nzt; k++) {
-            tmppq[i][j][k] = 0.0f;
-            tmpsq[i][j][k] = 0.0f;
+            G3(tmppq, i, j, k) = 0.0f;
+            G3(tmpsq, i, j, k) = 0.0f;
           }
     }
 
@@ -93,7 +95,7 @@ void inimesh(int MEDIASTART, Grid3D d1, Grid3D mu, Grid3D lam, Grid3D qp, Grid3D
         if (rank % 100 == 0) printf("Rank=%d, reading file=%s\n", rank, filename);
       }
       Grid1D tmpta = Alloc1D(nvar * nxt * nyt * nzt);
-      if (MEDIASTART == 3 || (PX == 1 && PY == 1)) {
+      if (MEDIASTART == 3 || (PX == 1 && PY == 1 && PZ == 1)) {
         FILE *file;
         file = fopen(filename, "rb");
         if (!file) {
@@ -112,9 +114,10 @@ void inimesh(int MEDIASTART, Grid3D d1, Grid3D mu, Grid3D lam, Grid3D qp, Grid3D
         rptype[0] = nzt;
         rptype[1] = nyt;
         rptype[2] = nxt * nvar;
-        roffset[0] = 0;
-        roffset[1] = nyt * coords[1];
-        roffset[2] = nxt * coords[0] * nvar;
+        // the file starts at the free surface, as does z rank 0
+        roffset[0] = offs[2];
+        roffset[1] = offs[1];
+        roffset[2] = offs[0] * nvar;
         err = MPI_Type_create_subarray(3, rmtype, rptype, roffset, MPI_ORDER_C, MPI_FLOAT, &readtype);
         err = MPI_Type_commit(&readtype);
         err = MPI_File_open(MCW, filename, MPI_MODE_RDONLY, MPI_INFO_NULL, &fh);
@@ -125,22 +128,22 @@ void inimesh(int MEDIASTART, Grid3D d1, Grid3D mu, Grid3D lam, Grid3D qp, Grid3D
       for (k = 0; k < nzt; k++)
         for (j = 0; j < nyt; j++)
           for (i = 0; i < nxt; i++) {
-            tmpvp[i][j][k] = tmpta[(k * nyt * nxt + j * nxt + i) * nvar + var_offset];
-            tmpvs[i][j][k] = tmpta[(k * nyt * nxt + j * nxt + i) * nvar + var_offset + 1];
-            tmpdd[i][j][k] = tmpta[(k * nyt * nxt + j * nxt + i) * nvar + var_offset + 2];
-            if (nvar > 3) {
-              tmppq[i][j][k] = tmpta[(k * nyt * nxt + j * nxt + i) * nvar + var_offset + 3];
-              tmpsq[i][j][k] = tmpta[(k * nyt * nxt + j * nxt + i) * nvar + var_offset + 4];
+            G3(tmpvp, i, j, k) = tmpta[(k * nyt * nxt + j * nxt + i) * nvar + var_offset];
+            G3(tmpvs, i, j, k) = tmpta[(k * nyt * nxt + j * nxt + i) * nvar + var_offset + 1];
+            G3(tmpdd, i, j, k) = tmpta[(k * nyt * nxt + j * nxt + i) * nvar + var_offset + 2];
+            if (nvar > 3 && NVE == 1) {
+              G3(tmppq, i, j, k) = tmpta[(k * nyt * nxt + j * nxt + i) * nvar + var_offset + 3];
+              G3(tmpsq, i, j, k) = tmpta[(k * nyt * nxt + j * nxt + i) * nvar + var_offset + 4];
             }
-            /*if(tmpvp[i][j][k]!=tmpvp[i][j][k] ||
-                tmpvs[i][j][k]!=tmpvs[i][j][k] ||
-                tmpdd[i][j][k]!=tmpdd[i][j][k]){
+            /*if(G3(tmpvp, i, j, k)!=G3(tmpvp, i, j, k) ||
+                G3(tmpvs, i, j, k)!=G3(tmpvs, i, j, k) ||
+                G3(tmpdd, i, j, k)!=G3(tmpdd, i, j, k)){
                   printf("%d) tmpvp,vs,dd is NAN!\n");
                   MPI_Abort(MPI_COMM_WORLD,1);
             }*/
           }
-      // printf("%d) vp,vs,dd[0^3]=%f,%f,%f\n",rank,tmpvp[0][0][0],
-      //    tmpvs[0][0][0], tmpdd[0][0][0]);
+      // printf("%d) vp,vs,dd[0^3]=%f,%f,%f\n",rank,G3(tmpvp, 0, 0, 0),
+      //    G3(tmpvs, 0, 0, 0), G3(tmpdd, 0, 0, 0));
       Delloc1D(tmpta);
     }
 
@@ -148,8 +151,8 @@ void inimesh(int MEDIASTART, Grid3D d1, Grid3D mu, Grid3D lam, Grid3D qp, Grid3D
       for (i = 0; i < nxt; i++)
         for (j = 0; j < nyt; j++) {
           for (k = 0; k < nzt; k++) {
-            tmpsq[i][j][k] = 0.05 * tmpvs[i][j][k];
-            tmppq[i][j][k] = 2.0 * tmpsq[i][j][k];
+            G3(tmpsq, i, j, k) = 0.05 * G3(tmpvs, i, j, k);
+            G3(tmppq, i, j, k) = 2.0 * G3(tmpsq, i, j, k);
           }
         }
     }
@@ -175,46 +178,49 @@ void inimesh(int MEDIASTART, Grid3D d1, Grid3D mu, Grid3D lam, Grid3D qp, Grid3D
     for (i = 0; i < nxt; i++)
       for (j = 0; j < nyt; j++)
         for (k = 0; k < nzt; k++) {
-          tmpvs[i][j][k] = tmpvs[i][j][k] * (1 + (log(w2 / w0)) / (pi * tmpsq[i][j][k]));
-          tmpvp[i][j][k] = tmpvp[i][j][k] * (1 + (log(w2 / w0)) / (pi * tmppq[i][j][k]));
+          // the velocities are given at FP; an elastic run (NVE=0) takes them as they are
+          if (NVE == 1) {
+            G3(tmpvs, i, j, k) = G3(tmpvs, i, j, k) * (1 + (log(w2 / w0)) / (pi * G3(tmpsq, i, j, k)));
+            G3(tmpvp, i, j, k) = G3(tmpvp, i, j, k) * (1 + (log(w2 / w0)) / (pi * G3(tmppq, i, j, k)));
+          }
           if (SoCalQ == 1) {
-            vpvs = tmpvp[i][j][k] / tmpvs[i][j][k];
-            if (vpvs < 1.45) tmpvs[i][j][k] = tmpvp[i][j][k] / 1.45;
+            vpvs = G3(tmpvp, i, j, k) / G3(tmpvs, i, j, k);
+            if (vpvs < 1.45) G3(tmpvs, i, j, k) = G3(tmpvp, i, j, k) / 1.45;
           }
-          // if(tmpvs[i][j][k]<400.0)
-          if (tmpvs[i][j][k] < 200.0) {
-            // tmpvs[i][j][k]=400.0;
-            // tmpvp[i][j][k]=1200.0;
-            tmpvs[i][j][k] = 200.0;
-            tmpvp[i][j][k] = 600.0;
+          // if(G3(tmpvs, i, j, k)<400.0)
+          if (G3(tmpvs, i, j, k) < 200.0) {
+            // G3(tmpvs, i, j, k)=400.0;
+            // G3(tmpvp, i, j, k)=1200.0;
+            G3(tmpvs, i, j, k) = 200.0;
+            G3(tmpvp, i, j, k) = 600.0;
           }
-          if (tmpvp[i][j][k] > 6500.0) {
-            tmpvs[i][j][k] = 3752.0;
-            tmpvp[i][j][k] = 6500.0;
+          if (G3(tmpvp, i, j, k) > 6500.0) {
+            G3(tmpvs, i, j, k) = 3752.0;
+            G3(tmpvp, i, j, k) = 6500.0;
           }
-          if (tmpdd[i][j][k] < 1700.0) tmpdd[i][j][k] = 1700.0;
-          mu[i + 2 + 4 * loop][j + 2 + 4 * loop][(nzt + align - 1) - k] = 1. / (tmpdd[i][j][k] * tmpvs[i][j][k] * tmpvs[i][j][k]);
-          lam[i + 2 + 4 * loop][j + 2 + 4 * loop][(nzt + align - 1) - k] = 1. / (tmpdd[i][j][k] * (tmpvp[i][j][k] * tmpvp[i][j][k] - 2. * tmpvs[i][j][k] * tmpvs[i][j][k]));
-          d1[i + 2 + 4 * loop][j + 2 + 4 * loop][(nzt + align - 1) - k] = tmpdd[i][j][k];
+          if (G3(tmpdd, i, j, k) < 1700.0) G3(tmpdd, i, j, k) = 1700.0;
+          G3(mu, i + 2 + 4 * loop, j + 2 + 4 * loop, (nzt + align - 1) - k) = 1. / (G3(tmpdd, i, j, k) * G3(tmpvs, i, j, k) * G3(tmpvs, i, j, k));
+          G3(lam, i + 2 + 4 * loop, j + 2 + 4 * loop, (nzt + align - 1) - k) = 1. / (G3(tmpdd, i, j, k) * (G3(tmpvp, i, j, k) * G3(tmpvp, i, j, k) - 2. * G3(tmpvs, i, j, k) * G3(tmpvs, i, j, k)));
+          G3(d1, i + 2 + 4 * loop, j + 2 + 4 * loop, (nzt + align - 1) - k) = G3(tmpdd, i, j, k);
           if (NVE == 1) {
-            if (tmppq[i][j][k] <= 0.0) {
+            if (G3(tmppq, i, j, k) <= 0.0) {
               qpinv = 0.0;
               qsinv = 0.0;
             } else {
-              qpinv = 1. / tmppq[i][j][k];
-              qsinv = 1. / tmpsq[i][j][k];
+              qpinv = 1. / G3(tmppq, i, j, k);
+              qsinv = 1. / G3(tmpsq, i, j, k);
             }
-            tmppq[i][j][k] = tmp1 * qpinv / (1.0 - tmp2 * qpinv);
-            tmpsq[i][j][k] = tmp1 * qsinv / (1.0 - tmp2 * qsinv);
-            qp[i + 2 + 4 * loop][j + 2 + 4 * loop][(nzt + align - 1) - k] = tmppq[i][j][k];
-            qs[i + 2 + 4 * loop][j + 2 + 4 * loop][(nzt + align - 1) - k] = tmpsq[i][j][k];
+            G3(tmppq, i, j, k) = tmp1 * qpinv / (1.0 - tmp2 * qpinv);
+            G3(tmpsq, i, j, k) = tmp1 * qsinv / (1.0 - tmp2 * qsinv);
+            G3(qp, i + 2 + 4 * loop, j + 2 + 4 * loop, (nzt + align - 1) - k) = G3(tmppq, i, j, k);
+            G3(qs, i + 2 + 4 * loop, j + 2 + 4 * loop, (nzt + align - 1) - k) = G3(tmpsq, i, j, k);
           }
-          if (tmpvs[i][j][k] < vse[0]) vse[0] = tmpvs[i][j][k];
-          if (tmpvs[i][j][k] > vse[1]) vse[1] = tmpvs[i][j][k];
-          if (tmpvp[i][j][k] < vpe[0]) vpe[0] = tmpvp[i][j][k];
-          if (tmpvp[i][j][k] > vpe[1]) vpe[1] = tmpvp[i][j][k];
-          if (tmpdd[i][j][k] < dde[0]) dde[0] = tmpdd[i][j][k];
-          if (tmpdd[i][j][k] > dde[1]) dde[1] = tmpdd[i][j][k];
+          if (G3(tmpvs, i, j, k) < vse[0]) vse[0] = G3(tmpvs, i, j, k);
+          if (G3(tmpvs, i, j, k) > vse[1]) vse[1] = G3(tmpvs, i, j, k);
+          if (G3(tmpvp, i, j, k) < vpe[0]) vpe[0] = G3(tmpvp, i, j, k);
+          if (G3(tmpvp, i, j, k) > vpe[1]) vpe[1] = G3(tmpvp, i, j, k);
+          if (G3(tmpdd, i, j, k) < dde[0]) dde[0] = G3(tmpdd, i, j, k);
+          if (G3(tmpdd, i, j, k) > dde[1]) dde[1] = G3(tmpdd, i, j, k);
         }
     Delloc3D(tmpvp);
     Delloc3D(tmpvs);
@@ -227,112 +233,112 @@ void inimesh(int MEDIASTART, Grid3D d1, Grid3D mu, Grid3D lam, Grid3D qp, Grid3D
     // 5 Planes (except upper XY-plane)
     for (j = 2 + 4 * loop; j < nyt + 2 + 4 * loop; j++)
       for (k = align; k < nzt + align; k++) {
-        lam[1 + 4 * loop][j][k] = lam[2 + 4 * loop][j][k];
-        lam[nxt + 2 + 4 * loop][j][k] = lam[nxt + 1 + 4 * loop][j][k];
-        mu[1 + 4 * loop][j][k] = mu[2 + 4 * loop][j][k];
-        mu[nxt + 2 + 4 * loop][j][k] = mu[nxt + 1 + 4 * loop][j][k];
-        d1[1 + 4 * loop][j][k] = d1[2 + 4 * loop][j][k];
-        d1[nxt + 2 + 4 * loop][j][k] = d1[nxt + 1 + 4 * loop][j][k];
+        G3(lam, 1 + 4 * loop, j, k) = G3(lam, 2 + 4 * loop, j, k);
+        G3(lam, nxt + 2 + 4 * loop, j, k) = G3(lam, nxt + 1 + 4 * loop, j, k);
+        G3(mu, 1 + 4 * loop, j, k) = G3(mu, 2 + 4 * loop, j, k);
+        G3(mu, nxt + 2 + 4 * loop, j, k) = G3(mu, nxt + 1 + 4 * loop, j, k);
+        G3(d1, 1 + 4 * loop, j, k) = G3(d1, 2 + 4 * loop, j, k);
+        G3(d1, nxt + 2 + 4 * loop, j, k) = G3(d1, nxt + 1 + 4 * loop, j, k);
       }
 
     for (i = 2 + 4 * loop; i < nxt + 2 + 4 * loop; i++)
       for (k = align; k < nzt + align; k++) {
-        lam[i][1 + 4 * loop][k] = lam[i][2 + 4 * loop][k];
-        lam[i][nyt + 2 + 4 * loop][k] = lam[i][nyt + 1 + 4 * loop][k];
-        mu[i][1 + 4 * loop][k] = mu[i][2 + 4 * loop][k];
-        mu[i][nyt + 2 + 4 * loop][k] = mu[i][nyt + 1 + 4 * loop][k];
-        d1[i][1 + 4 * loop][k] = d1[i][2 + 4 * loop][k];
-        d1[i][nyt + 2 + 4 * loop][k] = d1[i][nyt + 1 + 4 * loop][k];
+        G3(lam, i, 1 + 4 * loop, k) = G3(lam, i, 2 + 4 * loop, k);
+        G3(lam, i, nyt + 2 + 4 * loop, k) = G3(lam, i, nyt + 1 + 4 * loop, k);
+        G3(mu, i, 1 + 4 * loop, k) = G3(mu, i, 2 + 4 * loop, k);
+        G3(mu, i, nyt + 2 + 4 * loop, k) = G3(mu, i, nyt + 1 + 4 * loop, k);
+        G3(d1, i, 1 + 4 * loop, k) = G3(d1, i, 2 + 4 * loop, k);
+        G3(d1, i, nyt + 2 + 4 * loop, k) = G3(d1, i, nyt + 1 + 4 * loop, k);
       }
 
     for (i = 2 + 4 * loop; i < nxt + 2 + 4 * loop; i++)
       for (j = 2 + 4 * loop; j < nyt + 2 + 4 * loop; j++) {
-        lam[i][j][align - 1] = lam[i][j][align];
-        mu[i][j][align - 1] = mu[i][j][align];
-        d1[i][j][align - 1] = d1[i][j][align];
+        G3(lam, i, j, align - 1) = G3(lam, i, j, align);
+        G3(mu, i, j, align - 1) = G3(mu, i, j, align);
+        G3(d1, i, j, align - 1) = G3(d1, i, j, align);
       }
 
     // 12 border lines
     for (i = 2 + 4 * loop; i < nxt + 2 + 4 * loop; i++) {
-      lam[i][1 + 4 * loop][align - 1] = lam[i][2 + 4 * loop][align];
-      mu[i][1 + 4 * loop][align - 1] = mu[i][2 + 4 * loop][align];
-      d1[i][1 + 4 * loop][align - 1] = d1[i][2 + 4 * loop][align];
-      lam[i][nyt + 2 + 4 * loop][align - 1] = lam[i][nyt + 1 + 4 * loop][align];
-      mu[i][nyt + 2 + 4 * loop][align - 1] = mu[i][nyt + 1 + 4 * loop][align];
-      d1[i][nyt + 2 + 4 * loop][align - 1] = d1[i][nyt + 1 + 4 * loop][align];
-      lam[i][1 + 4 * loop][nzt + align] = lam[i][2 + 4 * loop][nzt + align - 1];
-      mu[i][1 + 4 * loop][nzt + align] = mu[i][2 + 4 * loop][nzt + align - 1];
-      d1[i][1 + 4 * loop][nzt + align] = d1[i][2 + 4 * loop][nzt + align - 1];
-      lam[i][nyt + 2 + 4 * loop][nzt + align] = lam[i][nyt + 1 + 4 * loop][nzt + align - 1];
-      mu[i][nyt + 2 + 4 * loop][nzt + align] = mu[i][nyt + 1 + 4 * loop][nzt + align - 1];
-      d1[i][nyt + 2 + 4 * loop][nzt + align] = d1[i][nyt + 1 + 4 * loop][nzt + align - 1];
+      G3(lam, i, 1 + 4 * loop, align - 1) = G3(lam, i, 2 + 4 * loop, align);
+      G3(mu, i, 1 + 4 * loop, align - 1) = G3(mu, i, 2 + 4 * loop, align);
+      G3(d1, i, 1 + 4 * loop, align - 1) = G3(d1, i, 2 + 4 * loop, align);
+      G3(lam, i, nyt + 2 + 4 * loop, align - 1) = G3(lam, i, nyt + 1 + 4 * loop, align);
+      G3(mu, i, nyt + 2 + 4 * loop, align - 1) = G3(mu, i, nyt + 1 + 4 * loop, align);
+      G3(d1, i, nyt + 2 + 4 * loop, align - 1) = G3(d1, i, nyt + 1 + 4 * loop, align);
+      G3(lam, i, 1 + 4 * loop, nzt + align) = G3(lam, i, 2 + 4 * loop, nzt + align - 1);
+      G3(mu, i, 1 + 4 * loop, nzt + align) = G3(mu, i, 2 + 4 * loop, nzt + align - 1);
+      G3(d1, i, 1 + 4 * loop, nzt + align) = G3(d1, i, 2 + 4 * loop, nzt + align - 1);
+      G3(lam, i, nyt + 2 + 4 * loop, nzt + align) = G3(lam, i, nyt + 1 + 4 * loop, nzt + align - 1);
+      G3(mu, i, nyt + 2 + 4 * loop, nzt + align) = G3(mu, i, nyt + 1 + 4 * loop, nzt + align - 1);
+      G3(d1, i, nyt + 2 + 4 * loop, nzt + align) = G3(d1, i, nyt + 1 + 4 * loop, nzt + align - 1);
     }
 
     for (j = 2 + 4 * loop; j < nyt + 2 + 4 * loop; j++) {
-      lam[1 + 4 * loop][j][align - 1] = lam[2 + 4 * loop][j][align];
-      mu[1 + 4 * loop][j][align - 1] = mu[2 + 4 * loop][j][align];
-      d1[1 + 4 * loop][j][align - 1] = d1[2 + 4 * loop][j][align];
-      lam[nxt + 2 + 4 * loop][j][align - 1] = lam[nxt + 1 + 4 * loop][j][align];
-      mu[nxt + 2 + 4 * loop][j][align - 1] = mu[nxt + 1 + 4 * loop][j][align];
-      d1[nxt + 2 + 4 * loop][j][align - 1] = d1[nxt + 1 + 4 * loop][j][align];
-      lam[1 + 4 * loop][j][nzt + align] = lam[2 + 4 * loop][j][nzt + align - 1];
-      mu[1 + 4 * loop][j][nzt + align] = mu[2 + 4 * loop][j][nzt + align - 1];
-      d1[1 + 4 * loop][j][nzt + align] = d1[2 + 4 * loop][j][nzt + align - 1];
-      lam[nxt + 2 + 4 * loop][j][nzt + align] = lam[nxt + 1 + 4 * loop][j][nzt + align - 1];
-      mu[nxt + 2 + 4 * loop][j][nzt + align] = mu[nxt + 1 + 4 * loop][j][nzt + align - 1];
-      d1[nxt + 2 + 4 * loop][j][nzt + align] = d1[nxt + 1 + 4 * loop][j][nzt + align - 1];
+      G3(lam, 1 + 4 * loop, j, align - 1) = G3(lam, 2 + 4 * loop, j, align);
+      G3(mu, 1 + 4 * loop, j, align - 1) = G3(mu, 2 + 4 * loop, j, align);
+      G3(d1, 1 + 4 * loop, j, align - 1) = G3(d1, 2 + 4 * loop, j, align);
+      G3(lam, nxt + 2 + 4 * loop, j, align - 1) = G3(lam, nxt + 1 + 4 * loop, j, align);
+      G3(mu, nxt + 2 + 4 * loop, j, align - 1) = G3(mu, nxt + 1 + 4 * loop, j, align);
+      G3(d1, nxt + 2 + 4 * loop, j, align - 1) = G3(d1, nxt + 1 + 4 * loop, j, align);
+      G3(lam, 1 + 4 * loop, j, nzt + align) = G3(lam, 2 + 4 * loop, j, nzt + align - 1);
+      G3(mu, 1 + 4 * loop, j, nzt + align) = G3(mu, 2 + 4 * loop, j, nzt + align - 1);
+      G3(d1, 1 + 4 * loop, j, nzt + align) = G3(d1, 2 + 4 * loop, j, nzt + align - 1);
+      G3(lam, nxt + 2 + 4 * loop, j, nzt + align) = G3(lam, nxt + 1 + 4 * loop, j, nzt + align - 1);
+      G3(mu, nxt + 2 + 4 * loop, j, nzt + align) = G3(mu, nxt + 1 + 4 * loop, j, nzt + align - 1);
+      G3(d1, nxt + 2 + 4 * loop, j, nzt + align) = G3(d1, nxt + 1 + 4 * loop, j, nzt + align - 1);
     }
 
     for (k = align; k < nzt + align; k++) {
-      lam[1 + 4 * loop][1 + 4 * loop][k] = lam[2 + 4 * loop][2 + 4 * loop][k];
-      mu[1 + 4 * loop][1 + 4 * loop][k] = mu[2 + 4 * loop][2 + 4 * loop][k];
-      d1[1 + 4 * loop][1 + 4 * loop][k] = d1[2 + 4 * loop][2 + 4 * loop][k];
-      lam[nxt + 2 + 4 * loop][1 + 4 * loop][k] = lam[nxt + 1 + 4 * loop][2 + 4 * loop][k];
-      mu[nxt + 2 + 4 * loop][1 + 4 * loop][k] = mu[nxt + 1 + 4 * loop][2 + 4 * loop][k];
-      d1[nxt + 2 + 4 * loop][1 + 4 * loop][k] = d1[nxt + 1 + 4 * loop][2 + 4 * loop][k];
-      lam[1 + 4 * loop][nyt + 2 + 4 * loop][k] = lam[2 + 4 * loop][nyt + 1 + 4 * loop][k];
-      mu[1 + 4 * loop][nyt + 2 + 4 * loop][k] = mu[2 + 4 * loop][nyt + 1 + 4 * loop][k];
-      d1[1 + 4 * loop][nyt + 2 + 4 * loop][k] = d1[2 + 4 * loop][nyt + 1 + 4 * loop][k];
-      lam[nxt + 2 + 4 * loop][nyt + 2 + 4 * loop][k] = lam[nxt + 1 + 4 * loop][nyt + 1 + 4 * loop][k];
-      mu[nxt + 2 + 4 * loop][nyt + 2 + 4 * loop][k] = mu[nxt + 1 + 4 * loop][nyt + 1 + 4 * loop][k];
-      d1[nxt + 2 + 4 * loop][nyt + 2 + 4 * loop][k] = d1[nxt + 1 + 4 * loop][nyt + 1 + 4 * loop][k];
+      G3(lam, 1 + 4 * loop, 1 + 4 * loop, k) = G3(lam, 2 + 4 * loop, 2 + 4 * loop, k);
+      G3(mu, 1 + 4 * loop, 1 + 4 * loop, k) = G3(mu, 2 + 4 * loop, 2 + 4 * loop, k);
+      G3(d1, 1 + 4 * loop, 1 + 4 * loop, k) = G3(d1, 2 + 4 * loop, 2 + 4 * loop, k);
+      G3(lam, nxt + 2 + 4 * loop, 1 + 4 * loop, k) = G3(lam, nxt + 1 + 4 * loop, 2 + 4 * loop, k);
+      G3(mu, nxt + 2 + 4 * loop, 1 + 4 * loop, k) = G3(mu, nxt + 1 + 4 * loop, 2 + 4 * loop, k);
+      G3(d1, nxt + 2 + 4 * loop, 1 + 4 * loop, k) = G3(d1, nxt + 1 + 4 * loop, 2 + 4 * loop, k);
+      G3(lam, 1 + 4 * loop, nyt + 2 + 4 * loop, k) = G3(lam, 2 + 4 * loop, nyt + 1 + 4 * loop, k);
+      G3(mu, 1 + 4 * loop, nyt + 2 + 4 * loop, k) = G3(mu, 2 + 4 * loop, nyt + 1 + 4 * loop, k);
+      G3(d1, 1 + 4 * loop, nyt + 2 + 4 * loop, k) = G3(d1, 2 + 4 * loop, nyt + 1 + 4 * loop, k);
+      G3(lam, nxt + 2 + 4 * loop, nyt + 2 + 4 * loop, k) = G3(lam, nxt + 1 + 4 * loop, nyt + 1 + 4 * loop, k);
+      G3(mu, nxt + 2 + 4 * loop, nyt + 2 + 4 * loop, k) = G3(mu, nxt + 1 + 4 * loop, nyt + 1 + 4 * loop, k);
+      G3(d1, nxt + 2 + 4 * loop, nyt + 2 + 4 * loop, k) = G3(d1, nxt + 1 + 4 * loop, nyt + 1 + 4 * loop, k);
     }
 
     // 8 Corners
-    lam[1 + 4 * loop][1 + 4 * loop][align - 1] = lam[2 + 4 * loop][2 + 4 * loop][align];
-    mu[1 + 4 * loop][1 + 4 * loop][align - 1] = mu[2 + 4 * loop][2 + 4 * loop][align];
-    d1[1 + 4 * loop][1 + 4 * loop][align - 1] = d1[2 + 4 * loop][2 + 4 * loop][align];
-    lam[nxt + 2 + 4 * loop][1 + 4 * loop][align - 1] = lam[nxt + 1 + 4 * loop][2 + 4 * loop][align];
-    mu[nxt + 2 + 4 * loop][1 + 4 * loop][align - 1] = mu[nxt + 1 + 4 * loop][2 + 4 * loop][align];
-    d1[nxt + 2 + 4 * loop][1 + 4 * loop][align - 1] = d1[nxt + 1 + 4 * loop][2 + 4 * loop][align];
-    lam[1 + 4 * loop][nyt + 2 + 4 * loop][align - 1] = lam[2 + 4 * loop][nyt + 1 + 4 * loop][align];
-    mu[1 + 4 * loop][nyt + 2 + 4 * loop][align - 1] = mu[2 + 4 * loop][nyt + 1 + 4 * loop][align];
-    d1[1 + 4 * loop][nyt + 2 + 4 * loop][align - 1] = d1[2 + 4 * loop][nyt + 1 + 4 * loop][align];
-    lam[1 + 4 * loop][1 + 4 * loop][nzt + align] = lam[2 + 4 * loop][2 + 4 * loop][nzt + align - 1];
-    mu[1 + 4 * loop][1 + 4 * loop][nzt + align] = mu[2 + 4 * loop][2 + 4 * loop][nzt + align - 1];
-    d1[1 + 4 * loop][1 + 4 * loop][nzt + align] = d1[2 + 4 * loop][2 + 4 * loop][nzt + align - 1];
-    lam[nxt + 2 + 4 * loop][1 + 4 * loop][nzt + align] = lam[nxt + 1 + 4 * loop][2 + 4 * loop][nzt + align - 1];
-    mu[nxt + 2 + 4 * loop][1 + 4 * loop][nzt + align] = mu[nxt + 1 + 4 * loop][2 + 4 * loop][nzt + align - 1];
-    d1[nxt + 2 + 4 * loop][1 + 4 * loop][nzt + align] = d1[nxt + 1 + 4 * loop][2 + 4 * loop][nzt + align - 1];
-    lam[nxt + 2 + 4 * loop][nyt + 2 + 4 * loop][align - 1] = lam[nxt + 1 + 4 * loop][nyt + 1 + 4 * loop][align];
-    mu[nxt + 2 + 4 * loop][nyt + 2 + 4 * loop][align - 1] = mu[nxt + 1 + 4 * loop][nyt + 1 + 4 * loop][align];
-    d1[nxt + 2 + 4 * loop][nyt + 2 + 4 * loop][align - 1] = d1[nxt + 1 + 4 * loop][nyt + 1 + 4 * loop][align];
-    lam[1 + 4 * loop][nyt + 2 + 4 * loop][nzt + align] = lam[2 + 4 * loop][nyt + 1 + 4 * loop][nzt + align - 1];
-    mu[1 + 4 * loop][nyt + 2 + 4 * loop][nzt + align] = mu[2 + 4 * loop][nyt + 1 + 4 * loop][nzt + align - 1];
-    d1[1 + 4 * loop][nyt + 2 + 4 * loop][nzt + align] = d1[2 + 4 * loop][nyt + 1 + 4 * loop][nzt + align - 1];
-    lam[nxt + 2 + 4 * loop][nyt + 2 + 4 * loop][nzt + align] = lam[nxt + 1 + 4 * loop][nyt + 1 + 4 * loop][nzt + align - 1];
-    mu[nxt + 2 + 4 * loop][nyt + 2 + 4 * loop][nzt + align] = mu[nxt + 1 + 4 * loop][nyt + 1 + 4 * loop][nzt + align - 1];
-    d1[nxt + 2 + 4 * loop][nyt + 2 + 4 * loop][nzt + align] = d1[nxt + 1 + 4 * loop][nyt + 1 + 4 * loop][nzt + align - 1];
+    G3(lam, 1 + 4 * loop, 1 + 4 * loop, align - 1) = G3(lam, 2 + 4 * loop, 2 + 4 * loop, align);
+    G3(mu, 1 + 4 * loop, 1 + 4 * loop, align - 1) = G3(mu, 2 + 4 * loop, 2 + 4 * loop, align);
+    G3(d1, 1 + 4 * loop, 1 + 4 * loop, align - 1) = G3(d1, 2 + 4 * loop, 2 + 4 * loop, align);
+    G3(lam, nxt + 2 + 4 * loop, 1 + 4 * loop, align - 1) = G3(lam, nxt + 1 + 4 * loop, 2 + 4 * loop, align);
+    G3(mu, nxt + 2 + 4 * loop, 1 + 4 * loop, align - 1) = G3(mu, nxt + 1 + 4 * loop, 2 + 4 * loop, align);
+    G3(d1, nxt + 2 + 4 * loop, 1 + 4 * loop, align - 1) = G3(d1, nxt + 1 + 4 * loop, 2 + 4 * loop, align);
+    G3(lam, 1 + 4 * loop, nyt + 2 + 4 * loop, align - 1) = G3(lam, 2 + 4 * loop, nyt + 1 + 4 * loop, align);
+    G3(mu, 1 + 4 * loop, nyt + 2 + 4 * loop, align - 1) = G3(mu, 2 + 4 * loop, nyt + 1 + 4 * loop, align);
+    G3(d1, 1 + 4 * loop, nyt + 2 + 4 * loop, align - 1) = G3(d1, 2 + 4 * loop, nyt + 1 + 4 * loop, align);
+    G3(lam, 1 + 4 * loop, 1 + 4 * loop, nzt + align) = G3(lam, 2 + 4 * loop, 2 + 4 * loop, nzt + align - 1);
+    G3(mu, 1 + 4 * loop, 1 + 4 * loop, nzt + align) = G3(mu, 2 + 4 * loop, 2 + 4 * loop, nzt + align - 1);
+    G3(d1, 1 + 4 * loop, 1 + 4 * loop, nzt + align) = G3(d1, 2 + 4 * loop, 2 + 4 * loop, nzt + align - 1);
+    G3(lam, nxt + 2 + 4 * loop, 1 + 4 * loop, nzt + align) = G3(lam, nxt + 1 + 4 * loop, 2 + 4 * loop, nzt + align - 1);
+    G3(mu, nxt + 2 + 4 * loop, 1 + 4 * loop, nzt + align) = G3(mu, nxt + 1 + 4 * loop, 2 + 4 * loop, nzt + align - 1);
+    G3(d1, nxt + 2 + 4 * loop, 1 + 4 * loop, nzt + align) = G3(d1, nxt + 1 + 4 * loop, 2 + 4 * loop, nzt + align - 1);
+    G3(lam, nxt + 2 + 4 * loop, nyt + 2 + 4 * loop, align - 1) = G3(lam, nxt + 1 + 4 * loop, nyt + 1 + 4 * loop, align);
+    G3(mu, nxt + 2 + 4 * loop, nyt + 2 + 4 * loop, align - 1) = G3(mu, nxt + 1 + 4 * loop, nyt + 1 + 4 * loop, align);
+    G3(d1, nxt + 2 + 4 * loop, nyt + 2 + 4 * loop, align - 1) = G3(d1, nxt + 1 + 4 * loop, nyt + 1 + 4 * loop, align);
+    G3(lam, 1 + 4 * loop, nyt + 2 + 4 * loop, nzt + align) = G3(lam, 2 + 4 * loop, nyt + 1 + 4 * loop, nzt + align - 1);
+    G3(mu, 1 + 4 * loop, nyt + 2 + 4 * loop, nzt + align) = G3(mu, 2 + 4 * loop, nyt + 1 + 4 * loop, nzt + align - 1);
+    G3(d1, 1 + 4 * loop, nyt + 2 + 4 * loop, nzt + align) = G3(d1, 2 + 4 * loop, nyt + 1 + 4 * loop, nzt + align - 1);
+    G3(lam, nxt + 2 + 4 * loop, nyt + 2 + 4 * loop, nzt + align) = G3(lam, nxt + 1 + 4 * loop, nyt + 1 + 4 * loop, nzt + align - 1);
+    G3(mu, nxt + 2 + 4 * loop, nyt + 2 + 4 * loop, nzt + align) = G3(mu, nxt + 1 + 4 * loop, nyt + 1 + 4 * loop, nzt + align - 1);
+    G3(d1, nxt + 2 + 4 * loop, nyt + 2 + 4 * loop, nzt + align) = G3(d1, nxt + 1 + 4 * loop, nyt + 1 + 4 * loop, nzt + align - 1);
 
     k = nzt + align;
     for (i = 2 + 4 * loop; i < nxt + 2 + 4 * loop; i++)
       for (j = 2 + 4 * loop; j < nyt + 2 + 4 * loop; j++) {
-        d1[i][j][k] = d1[i][j][k - 1];
-        mu[i][j][k] = mu[i][j][k - 1];
-        lam[i][j][k] = lam[i][j][k - 1];
+        G3(d1, i, j, k) = G3(d1, i, j, k - 1);
+        G3(mu, i, j, k) = G3(mu, i, j, k - 1);
+        G3(lam, i, j, k) = G3(lam, i, j, k - 1);
         if (NVE == 1) {
-          qp[i][j][k] = qp[i][j][k - 1];
-          qs[i][j][k] = qs[i][j][k - 1];
+          G3(qp, i, j, k) = G3(qp, i, j, k - 1);
+          G3(qs, i, j, k) = G3(qs, i, j, k - 1);
         }
       }
 
@@ -353,6 +359,73 @@ void inimesh(int MEDIASTART, Grid3D d1, Grid3D mu, Grid3D lam, Grid3D qp, Grid3D
   return;
 }
 
+// material palette of the padded media grids (ghosts included, so call it after mediaswap): *pmid gets
+// the 16-bit material ID of every point and *ptab the property table of the nmat materials, d1, mu, lam,
+// qp and qs one after the other, each nmat long (qp and qs are 0 if NVE=0). returns nmat, or 0 with
+// nothing allocated if there are more than maxmat materials
+int palmesh(Grid3D d1, Grid3D mu, Grid3D lam, Grid3D qp, Grid3D qs, int NVE, int maxmat, unsigned short **pmid, Grid1D *ptab) {
+  long int pos, npts;
+  int nmat, q, nhash, *hash;
+  unsigned int key[5], h;
+  float *tup;
+  unsigned short *mid;
+  Grid1D tab;
+
+  npts = (long int)d1.nx * d1.slice;
+  mid = (unsigned short *)malloc(sizeof(unsigned short) * npts);
+  tup = (float *)malloc(sizeof(float) * 5 * maxmat);
+  // open addressing on the bit patterns of the 5 properties, at most half full
+  for (nhash = 1; nhash < 2 * maxmat; nhash *= 2)
+    ;
+  hash = (int *)malloc(sizeof(int) * nhash);
+  if (!mid || !tup || !hash) {
+    printf("Cannot allocate material palette\n");
+    exit(-1);
+  }
+  for (q = 0; q < nhash; q++) hash[q] = -1;
+
+  nmat = 0;
+  for (pos = 0; pos < npts; pos++) {
+    memcpy(&key[0], &d1.data[pos], sizeof(float));
+    memcpy(&key[1], &mu.data[pos], sizeof(float));
+    memcpy(&key[2], &lam.data[pos], sizeof(float));
+    key[3] = key[4] = 0;
+    if (NVE == 1) {
+      memcpy(&key[3], &qp.data[pos], sizeof(float));
+      memcpy(&key[4], &qs.data[pos], sizeof(float));
+    }
+    h = 2166136261u;
+    for (q = 0; q < 5; q++) h = (h ^ key[q]) * 16777619u;
+    for (h &= nhash - 1; hash[h] >= 0; h = (h + 1) & (nhash - 1))
+      if (!memcmp(&tup[hash[h] * 5], key, sizeof(key))) break;
+    if (hash[h] < 0) {
+      if (nmat == maxmat) break;
+      memcpy(&tup[nmat * 5], key, sizeof(key));
+      hash[h] = nmat++;
+    }
+    mid[pos] = hash[h];
+  }
+  free(hash);
+  if (pos < npts) {
+    free(tup);
+    free(mid);
+    return 0;
+  }
+
+  tab = Alloc1D(5 * nmat);
+  for (q = 0; q < nmat; q++) {
+    tab[q] = tup[q * 5];
+    tab[nmat + q] = tup[q * 5 + 1];
+    tab[2 * nmat + q] = tup[q * 5 + 2];
+    tab[3 * nmat + q] = tup[q * 5 + 3];
+    tab[4 * nmat + q] = tup[q * 5 + 4];
+  }
+  free(tup);
+  *pmid = mid;
+  *ptab = tab;
+  return nmat;
+}
+
 void tausub(Grid3D tau, float taumin, float taumax) {
   int idx, idy, idz;
   float tautem[2][2][2];
@@ -374,27 +447,8 @@ void tausub(Grid3D tau, float taumin, float taumax) {
         tmp = (tmp - 0.5) / 8.0;
         tmp = 2.0 * tmp - 1.0;
 
-        tau[idx][idy][idz] = exp(0.5 * (log(taumax * taumin) + log(taumax / taumin) * tmp));
+        G3(tau, idx, idy, idz) = exp(0.5 * (log(taumax * taumin) + log(taumax / taumin) * tmp));
       }
 
   return;
 }
-
-void init_texture(int nxt, int nyt, int nzt, Grid3D tau1, Grid3D tau2, Grid3D vx1, Grid3D vx2, int xls, int xre, int yls, int yre) {
-  int i, j, k, itx, ity, itz;
-  itx = 0;
-  ity = 0;
-  itz = (nzt - 1) % 2;
-  for (i = xls; i <= xre; i++) {
-    itx = 1 - itx;
-    for (j = yls; j <= yre; j++) {
-      ity = 1 - ity;
-      for (k = align; k < nzt + align; k++) {
-        itz = 1 - itz;
-        vx1[i][j][k] = tau1[itx][ity][itz];
-        vx2[i][j][k] = tau2[itx][ity][itz];
-      }
-    }
-  }
-  return;
-}
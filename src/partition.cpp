@@ -0,0 +1,144 @@
+/**
+@section LICENSE
+Copyright (c) 2013-2016, Regents of the University of California
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+********************************************************************************
+* partition.cpp                                                                *
+* per-rank extents of the PX x PY x PZ decomposition                           *
+*                                                                              *
+* each axis is split on its own, so ranks sharing a face share its extent. the *
+* cost of a grid plane along an axis is the sum over its cells of the update   *
+* (1 per cell) plus the extra work of sponge cells, free surface columns,      *
+* source points and recording points; the split evens out the plane costs     *
+* summed over each slab.                                                       *
+********************************************************************************
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "pmcl3d.h"
+
+// extra cost relative to the velocity and stress update of one cell, per time step
+#define COST_SPONGE 0.1   // Cerjan/PML damping of a cell within ND of an absorbing boundary
+#define COST_SURFACE 8.0  // free surface images of one (i, j) column, updated outside the SIMD sweep
+#define COST_SOURCE 16.0  // one source point, six stress increments and its share of the source input
+#define COST_OUTPUT 4.0   // one recording point per sample (NTISKP steps), gather and write
+
+// number of the 1-based indices NBG, NBG+NSKP, ... <= NED in [lo, hi]
+static long int nrec(long int lo, long int hi, int NBG, int NED, int NSKP) {
+  if (lo < NBG) lo = NBG;
+  if (hi > NED) hi = NED;
+  if (lo > hi) return 0;
+  return (hi - NBG) / NSKP - (lo - 1 - NBG + NSKP) / NSKP + 1;
+}
+
+// cells of a plane whose own index is not in the sponge, in the sponge of the other two axes
+// (m, n points, sponges at both ends of m, at both ends of n or only at its bottom)
+static double sponge_cells(int m, int n, int ND, int both_n) {
+  long int im = m - 2 * ND, in = n - (both_n ? 2 : 1) * ND;
+  if (im < 0) im = 0;
+  if (in < 0) in = 0;
+  return (double)m * n - (double)im * in;
+}
+
+// split [0, n) into p slabs of at least min_w points (min_w * p <= n), with slab c ending where
+// the running cost first reaches (c+1)/p of the total; start gets the p+1 slab bounds
+static void split(int n, int p, double *cost, int min_w, int *start) {
+  int c, i;
+  double total = 0.0, sum = 0.0;
+
+  for (i = 0; i < n; i++) total += cost[i];
+
+  start[0] = 0;
+  i = 0;
+  for (c = 1; c < p; c++) {
+    while (i < n && sum + 0.5 * cost[i] < total * c / p) sum += cost[i++];
+    if (i < start[c - 1] + min_w) i = start[c - 1] + min_w;
+    if (i > n - (p - c) * min_w) i = n - (p - c) * min_w;
+    start[c] = i;
+    // keep the running cost in step with a clamped bound
+    for (sum = 0.0, i = 0; i < start[c]; i++) sum += cost[i];
+  }
+  start[p] = n;
+  return;
+}
+
+// slab bounds part_x[0..PX], part_y[0..PY] and part_z[0..PZ] (z as depth below the free surface,
+// z rank 0 on top). PART=0 gives even slabs, the remainder of N/P going one point each to the first
+// slabs; PART=1 weights the slabs with the cost model. srcp holds the NSRC source nodes as global
+// 1-based x, y and depth, or is NULL. the halo exchange and the overlapped update take 4*loop planes
+// from each side of a slab, so x and y slabs hold at least 2*4*loop points and z slabs 4*loop;
+// returns -1 if N/P is below that on some axis
+int partition(int PART, int NX, int NY, int NZ, int PX, int PY, int PZ, int ND, int NTISKP, int NBGX, int NEDX, int NSKPX, int NBGY, int NEDY, int NSKPY, int NBGZ, int NEDZ, int NSKPZ, int NSRC, PosInf srcp, int *part_x, int *part_y, int *part_z) {
+  int i, n, rx, ry, rz;
+  double w_out, *cost;
+
+  if (NX / PX < 2 * 4 * loop || NY / PY < 2 * 4 * loop || NZ / PZ < 4 * loop) return -1;
+  if (PART == 0) {
+    for (i = 0; i <= PX; i++) part_x[i] = i * (NX / PX) + (i < NX % PX ? i : NX % PX);
+    for (i = 0; i <= PY; i++) part_y[i] = i * (NY / PY) + (i < NY % PY ? i : NY % PY);
+    for (i = 0; i <= PZ; i++) part_z[i] = i * (NZ / PZ) + (i < NZ % PZ ? i : NZ % PZ);
+    return 0;
+  }
+
+  w_out = COST_OUTPUT / NTISKP;
+  rx = nrec(1, NX, NBGX, NEDX, NSKPX);
+  ry = nrec(1, NY, NBGY, NEDY, NSKPY);
+  rz = nrec(1, NZ, NBGZ, NEDZ, NSKPZ);
+
+  n = (NX > NY ? NX : NY);
+  n = (n > NZ ? n : NZ);
+  cost = (double *)malloc(sizeof(double) * n);
+
+  for (i = 0; i < NX; i++) {
+    cost[i] = (double)NY * NZ + COST_SURFACE * NY;
+    if (i < ND || i >= NX - ND)
+      cost[i] += COST_SPONGE * NY * NZ;
+    else
+      cost[i] += COST_SPONGE * sponge_cells(NY, NZ, ND, 0);
+    cost[i] += w_out * nrec(i + 1, i + 1, NBGX, NEDX, NSKPX) * ry * rz;
+  }
+  for (n = 0; srcp && n < NSRC; n++)
+    if (srcp[n * 3] >= 1 && srcp[n * 3] <= NX) cost[srcp[n * 3] - 1] += COST_SOURCE;
+  split(NX, PX, cost, 2 * 4 * loop, part_x);
+
+  for (i = 0; i < NY; i++) {
+    cost[i] = (double)NX * NZ + COST_SURFACE * NX;
+    if (i < ND || i >= NY - ND)
+      cost[i] += COST_SPONGE * NX * NZ;
+    else
+      cost[i] += COST_SPONGE * sponge_cells(NX, NZ, ND, 0);
+    cost[i] += w_out * nrec(i + 1, i + 1, NBGY, NEDY, NSKPY) * rx * rz;
+  }
+  for (n = 0; srcp && n < NSRC; n++)
+    if (srcp[n * 3 + 1] >= 1 && srcp[n * 3 + 1] <= NY) cost[srcp[n * 3 + 1] - 1] += COST_SOURCE;
+  split(NY, PY, cost, 2 * 4 * loop, part_y);
+
+  for (i = 0; i < NZ; i++) {
+    cost[i] = (double)NX * NY;
+    if (i == 0) cost[i] += COST_SURFACE * NX * NY;
+    if (i >= NZ - ND)
+      cost[i] += COST_SPONGE * NX * NY;
+    else
+      cost[i] += COST_SPONGE * sponge_cells(NX, NY, ND, 1);
+    cost[i] += w_out * nrec(i + 1, i + 1, NBGZ, NEDZ, NSKPZ) * rx * ry;
+  }
+  for (n = 0; srcp && n < NSRC; n++)
+    if (srcp[n * 3 + 2] >= 1 && srcp[n * 3 + 2] <= NZ) cost[srcp[n * 3 + 2] - 1] += COST_SOURCE;
+  split(NZ, PZ, cost, 4 * loop, part_z);
+
+  free(cost);
+  return 0;
+}
@@ -24,15 +24,31 @@ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
 
 const double micro = 1.0e-6;
 
+#ifndef NOCUDA
 void SetDeviceConstValue(float DH, float DT, int nxt, int nyt, int nzt);
-void BindArrayToTexture(float* vx1, float* vx2, int memsize);
-void UnBindArrayFromTexture();
+void SetDeviceTau(float* tau1, float* tau2);
 void dvelcx_H(float* u1, float* v1, float* w1, float* xx, float* yy, float* zz, float* xy, float* xz, float* yz, float* dcrjx, float* dcrjy, float* dcrjz, float* d_1, int nyt, int nzt, cudaStream_t St, int s_i, int e_i);
 void dvelcy_H(float* u1, float* v1, float* w1, float* xx, float* yy, float* zz, float* xy, float* xz, float* yz, float* dcrjx, float* dcrjy, float* dcrjz, float* d_1, int nxt, int nzt, float* s_u1, float* s_v1, float* s_w1, cudaStream_t St, int s_j, int e_j, int rank);
 void dstrqc_H(float* xx, float* yy, float* zz, float* xy, float* xz, float* yz, float* r1, float* r2, float* r3, float* r4, float* r5, float* r6, float* u1, float* v1, float* w1, float* lam, float* mu, float* qp, float* qs, float* dcrjx, float* dcrjy, float* dcrjz, int nyt, int nzt, cudaStream_t St, float* lam_mu, int NX, int rankx, int ranky, int s_i, int e_i, int s_j, int e_j);
 void addsrc_H(int i, int READ_STEP, int dim, int* psrc, int npsrc, cudaStream_t St, float* axx, float* ayy, float* azz, float* axz, float* ayz, float* axy, float* xx, float* yy, float* zz, float* xy, float* yz, float* xz);
-
-void calcRecordingPoints(int* rec_nbgx, int* rec_nedx, int* rec_nbgy, int* rec_nedy, int* rec_nbgz, int* rec_nedz, int* rec_nxt, int* rec_nyt, int* rec_nzt, MPI_Offset* displacement, long int nxt, long int nyt, long int nzt, int rec_NX, int rec_NY, int rec_NZ, int NBGX, int NEDX, int NSKPX, int NBGY, int NEDY, int NSKPY, int NBGZ, int NEDZ, int NSKPZ, int* coord);
+void dsamp_H(float* u1, float* v1, float* w1, int* idx, int n, float* buf, cudaStream_t St, int stride, float* bx, float* by, float* bz);
+#endif
+
+void SetHostConstValue(float DH, float DT, int nxt, int nyt, int nzt, int zls, int zre);
+int SetHostSimd(int SIMD);
+void SetHostMedia(unsigned short* mid);
+void SetHostCoef(float** co);
+void SetHostTau(float* tau1, float* tau2, int offz);
+void SetHostSponge(float* dcrjz);
+long int SetHostPml(float* ax, float* bx, float* ay, float* by, float* az, float* bz);
+void SetHostRhs(int n, long int stride);
+void dcoef_C(float* d_1, float* lam, float* mu, float* qp, float* qs);
+void dsamp_C(float* u1, float* v1, float* w1, int* idx, int n, int stride, float* bx, float* by, float* bz);
+void dtile_C(float* u1, float* v1, float* w1, float* xx, float* yy, float* zz, float* xy, float* xz, float* yz, float* r1, float* r2, float* r3, float* r4, float* r5, float* r6, float* lam, float* mu, float* qp, float* qs, float* dcrjx, float* dcrjy, float* dcrjz, float* d_1, float* lam_mu, int NX, int offx, int offy, int s_i, int e_i, int s_j, int e_j, int nstep, int tile, int src_step, int src_nstep, int npsrc, int* psrc, int dim, int READ_STEP, float* axx, float* ayy, float* azz, float* axz, float* ayz, float* axy, float DH, float DT);
+void dvelcx_C(float* u1, float* v1, float* w1, float* xx, float* yy, float* zz, float* xy, float* xz, float* yz, float* dcrjx, float* dcrjy, float* dcrjz, float* d_1, int s_i, int e_i, int s_j, int e_j);
+void dstrqc_C(float* xx, float* yy, float* zz, float* xy, float* xz, float* yz, float* r1, float* r2, float* r3, float* r4, float* r5, float* r6, float* u1, float* v1, float* w1, float* lam, float* mu, float* qp, float* qs, float* dcrjx, float* dcrjy, float* dcrjz, float* lam_mu, int NX, int offx, int offy, int s_i, int e_i, int s_j, int e_j);
+
+void calcRecordingPoints(int* rec_nbgx, int* rec_nedx, int* rec_nbgy, int* rec_nedy, int* rec_nbgz, int* rec_nedz, int* rec_nxt, int* rec_nyt, int* rec_nzt, MPI_Offset* displacement, long int nxt, long int nyt, long int nzt, int rec_NX, int rec_NY, int rec_NZ, int NBGX, int NEDX, int NSKPX, int NBGY, int NEDY, int NSKPY, int NBGZ, int NEDZ, int NSKPZ, int* offs);
 
 double gethrtime() {
   struct timeval TV;
@@ -50,94 +66,162 @@ int main(int argc, char** argv) {
   //  variable definition begins
   float TMAX, DH, DT, ARBC, PHT;
   int NPC, ND, NSRC, NST;
-  int NVE, NVAR, MEDIASTART, IFAULT, READ_STEP, READ_STEP_GPU;
-  int NX, NY, NZ, PX, PY, IDYNA, SoCalQ;
+  int NVE, NVAR, MEDIASTART, IFAULT, READ_STEP, READ_STEP_GPU, BACKEND, SIMD, TBLOCK, TILE, HUGEPAGE, OVERLAP, SHMEM, PART, MATPAL, MEDCOEF;
+  int NX, NY, NZ, PX, PY, PZ, IDYNA, SoCalQ;
   int NBGX, NEDX, NSKPX, NBGY, NEDY, NSKPY, NBGZ, NEDZ, NSKPZ;
   int nxt, nyt, nzt;
   MPI_Offset displacement;
   float FL, FH, FP;
-  char INSRC[50], INVEL[50], OUT[50], INSRC_I2[50], CHKFILE[50];
+  char INSRC[50], INVEL[50], OUT[50], INSRC_I2[50], CHKFILE[50], ENSEMBLE[50], STATIONS[50];
+  int nens = 1, ens, NRHS, nrhs, nrun, r;
   double GFLOPS = 1.0;
   double GFLOPS_SUM = 0.0;
-  Grid3D u1 = NULL, v1 = NULL, w1 = NULL;
-  Grid3D d1 = NULL, mu = NULL, lam = NULL;
-  Grid3D xx = NULL, yy = NULL, zz = NULL, xy = NULL, yz = NULL, xz = NULL;
-  Grid3D r1 = NULL, r2 = NULL, r3 = NULL, r4 = NULL, r5 = NULL, r6 = NULL;
-  Grid3D qp = NULL, qs = NULL;
-  PosInf tpsrc = NULL;
-  Grid1D taxx = NULL, tayy = NULL, tazz = NULL, taxz = NULL, tayz = NULL, taxy = NULL;
+  Grid3D u1 = {NULL}, v1 = {NULL}, w1 = {NULL};
+  Grid3D u1_in, v1_in, w1_in, vel[3 * MAXRHS];
+  Grid3D vel_L[3], vel_R[3], vel_F[3], vel_B[3];  // velocity grids of on-node neighbours (SHMEM)
+  Grid3D d1 = {NULL}, mu = {NULL}, lam = {NULL};
+  Grid3D xx = {NULL}, yy = {NULL}, zz = {NULL}, xy = {NULL}, yz = {NULL}, xz = {NULL};
+  Grid3D r1 = {NULL}, r2 = {NULL}, r3 = {NULL}, r4 = {NULL}, r5 = {NULL}, r6 = {NULL};
+  Grid3D qp = {NULL}, qs = {NULL};
+  int nmat = 0;
+  unsigned short* mid = NULL;  // material IDs and property table of the palette (MATPAL)
+  Grid1D mtab = NULL;
+  Grid3D coef[NCOEF];  // staggered media coefficients (MEDCOEF)
+  float* co[NCOEF];
+  // sources of the wavefields of a sweep (NRHS), the GPU backend only uses the first
+  PosInf tpsrc[MAXRHS];
+  Grid1D taxx[MAXRHS], tayy[MAXRHS], tazz[MAXRHS], taxz[MAXRHS], tayz[MAXRHS], taxy[MAXRHS];
   Grid1D Bufx = NULL;
   Grid1D Bufy = NULL, Bufz = NULL;
-  Grid3D vx1 = NULL, vx2 = NULL, lam_mu = NULL;
+  // station recording (STATIONS): padded i, j, k and list index of the stations on this rank
+  int nsta = 0, nsloc = 0, nsamp, s, c;
+  PosInf staloc = NULL, stagid = NULL;
+  Grid1D stabuf[3] = {NULL, NULL, NULL};
+  MPI_Aint* stadisp;
+  MPI_Datatype statype;
+  // grid offsets of the recording points in output order, packed by the backend every NTISKP steps
+  int nsidx = 0;
+  PosInf sidx = NULL;
+  long int rhs_stride;
+  // output double buffering: the half being filled, the size of a half and the writes in flight
+  Grid1D obuf[3];
+  long int obsz;
+  int half = 0, nwreq = 0;
+  MPI_Request* wreq;
+  MPI_File* wfh;
+  // output aggregators (IORANKS): ranks of MPI_COMM_WORLD past the compute ranks, file hints and
+  // the window they are handed
+  int IORANKS, STRIPE, nio = 0;
+  MPI_Info oinfo;
+  IoWin iowin;
+  // output container of each run of the sweep (OUTFMT=1): header, file type of the three chunks
+  // of a window and memory type of the three buffers
+  OutHeader ohdr;
+  MPI_File cfh[MAXRHS];
+  MPI_Datatype ctype, mtype, cpart[3];
+  MPI_Aint cdisp[3];
+  int clen[3];
+  // compressed container (COMPRESS): tile records of the ranks, coded tiles of each run of the
+  // sweep, and per run the window index entry followed by the sizes of all tiles of the window
+  int COMPRESS, t, *ztile = NULL, zbl[6];
+  float CTOL;
+  unsigned char* zbuf = NULL;
+  long int zcap = 0;
+  long long zlen[3], *zall = NULL, zraw = 0, zout = 0;
+  MPI_Offset ztop[MAXRHS];
+  MPI_Aint zfd[5], zmd[5];
+  MPI_Datatype zftype;
+  const char* staname[3] = {"STX", "STY", "STZ"};
+  Grid3D lam_mu = {NULL};
   Grid1D dcrjx = NULL, dcrjy = NULL, dcrjz = NULL;
+  Grid1D pmlax = NULL, pmlbx = NULL, pmlay = NULL, pmlby = NULL, pmlaz = NULL, pmlbz = NULL;
   float vse[2], vpe[2], dde[2];
-  FILE* fchk;
+  FILE* fchk = NULL;
   //  GPU variables
   long int num_bytes;
-  float* d_d1;
-  float* d_u1;
-  float* d_v1;
-  float* d_w1;
+  float* d_d1 = NULL;
+  float* d_u1 = NULL;
+  float* d_v1 = NULL;
+  float* d_w1 = NULL;
+#ifndef NOCUDA
   float* d_f_u1;
   float* d_f_v1;
   float* d_f_w1;
   float* d_b_u1;
   float* d_b_v1;
   float* d_b_w1;
-  float* d_dcrjx;
-  float* d_dcrjy;
-  float* d_dcrjz;
-  float* d_lam;
-  float* d_mu;
-  float* d_qp;
-  float* d_qs;
-  float* d_vx1;
-  float* d_vx2;
-  float* d_xx;
-  float* d_yy;
-  float* d_zz;
-  float* d_xy;
-  float* d_xz;
-  float* d_yz;
-  float* d_r1;
-  float* d_r2;
-  float* d_r3;
-  float* d_r4;
-  float* d_r5;
-  float* d_r6;
-  float* d_lam_mu;
+#endif
+  float* d_dcrjx = NULL;
+  float* d_dcrjy = NULL;
+  float* d_dcrjz = NULL;
+  float* d_lam = NULL;
+  float* d_mu = NULL;
+  float* d_qp = NULL;
+  float* d_qs = NULL;
+  float* d_xx = NULL;
+  float* d_yy = NULL;
+  float* d_zz = NULL;
+  float* d_xy = NULL;
+  float* d_xz = NULL;
+  float* d_yz = NULL;
+  // r1..r6, qp and qs stay NULL for an elastic run (NVE=0)
+  float* d_r1 = NULL;
+  float* d_r2 = NULL;
+  float* d_r3 = NULL;
+  float* d_r4 = NULL;
+  float* d_r5 = NULL;
+  float* d_r6 = NULL;
+  float* d_lam_mu = NULL;
+#ifndef NOCUDA
   int* d_tpsrc;
+  int* d_sidx = NULL;
+  float* d_samp = NULL;
   float* d_taxx;
   float* d_tayy;
   float* d_tazz;
   float* d_taxz;
   float* d_tayz;
   float* d_taxy;
+#endif
   //  end of GPU variables
-  int i, j, k, idx, idy, idz;
+  int i, j, k;
   long int idtmp;
   long int tmpInd;
   const int maxdim = 3;
   float taumax, taumin, tauu;
-  Grid3D tau = NULL, tau1 = NULL, tau2 = NULL;
-  int npsrc;
-  long int nt, cur_step, source_step;
+  Grid3D tau = {NULL}, tau1 = {NULL}, tau2 = {NULL};
+  int npsrc[MAXRHS];
+  long int nt, cur_step = 0, source_step;
   double time_un = 0.0;
   //  MPI+CUDA variables
+#ifndef NOCUDA
   cudaError_t cerr;
   cudaStream_t stream_1, stream_2, stream_i;
-  int rank, size, err, srcproc, rank_gpu;
-  int dim[2], period[2], coord[2], reorder;
+#endif
+  int tb_n, tb_left = 0, src_n;
+  int rank, size, err, srcproc[MAXRHS];
+#ifndef NOCUDA
+  int rank_gpu;
+#endif
+  int dim[3], period[3], coord[3], offs[3], reorder;
+  PosInf srcp = NULL, part_x = NULL, part_y = NULL, part_z = NULL;
   // int   fmtype[3], fptype[3], foffset[3];
-  int x_rank_L = -1, x_rank_R = -1, y_rank_F = -1, y_rank_B = -1;
-  MPI_Comm MCW, MC1;
-  MPI_Request request_x[4], request_y[4];
-  MPI_Status status_x[4], status_y[4], filestatus;
-  MPI_Datatype filetype;
-  MPI_File fh;
-  int msg_v_size_x, msg_v_size_y, count_x = 0, count_y = 0;
+  int x_rank_L = -1, x_rank_R = -1, y_rank_F = -1, y_rank_B = -1, z_rank_D = -1, z_rank_U = -1;
+  int chk_rank, chk_coord[3];
+  float chk_vel[3];
+  MPI_Comm MCW, MC1, MCS;
+  MPI_Win win_vel;
+  int shm_nbr[4] = {-1, -1, -1, -1};  // node ranks of the left, right, front, back neighbour, -1 if off node
+  MPI_Request request_x[4], request_y[4], request_z[4];
+  MPI_Status status_x[4], status_y[4], status_z[4];
+#if !(MPI_VERSION > 3 || (MPI_VERSION == 3 && MPI_SUBVERSION >= 1))
+  MPI_Status filestatus;
+#endif
+  MPI_Datatype filetype, type_x[4], type_y[4], type_z[4];
+  int msg_v_size_x, msg_v_size_y;
   int xls, xre, xvs, xve, xss1, xse1, xss2, xse2, xss3, xse3;
   int yfs, yfe, ybs, ybe, yls, yre;
+  int zls, zre;
   float* SL_vel;  // Velocity to be sent to   Left  in x direction (u1,v1,w1)
   float* SR_vel;  // Velocity to be Sent to   Right in x direction (u1,v1,w1)
   float* RL_vel;  // Velocity to be Recv from Left  in x direction (u1,v1,w1)
@@ -150,6 +234,7 @@ int main(int argc, char** argv) {
 
   int tmpSize;
   int WRITE_STEP;
+  int OUTFMT;
   int NTISKP;
   int rec_NX;
   int rec_NY;
@@ -164,16 +249,13 @@ int main(int argc, char** argv) {
   int rec_nbgz;  // 0-based indexing
   int rec_nedz;  // 0-based indexing
   char filename[50];
-  char filenamebasex[50];
-  char filenamebasey[50];
-  char filenamebasez[50];
+  char filenamebasex[MAXRHS][50];
+  char filenamebasey[MAXRHS][50];
+  char filenamebasez[MAXRHS][50];
+  char ensrc[MAXRHS][50], ensout[MAXRHS][50];
 
   //  variable initialization begins
-  command(argc, argv, &TMAX, &DH, &DT, &ARBC, &PHT, &NPC, &ND, &NSRC, &NST, &NVAR, &NVE, &MEDIASTART, &IFAULT, &READ_STEP, &READ_STEP_GPU, &NTISKP, &WRITE_STEP, &NX, &NY, &NZ, &PX, &PY, &NBGX, &NEDX, &NSKPX, &NBGY, &NEDY, &NSKPY, &NBGZ, &NEDZ, &NSKPZ, &FL, &FH, &FP, &IDYNA, &SoCalQ, INSRC, INVEL, OUT, INSRC_I2, CHKFILE);
-
-  sprintf(filenamebasex, "%s/SX", OUT);
-  sprintf(filenamebasey, "%s/SY", OUT);
-  sprintf(filenamebasez, "%s/SZ", OUT);
+  command(argc, argv, &TMAX, &DH, &DT, &ARBC, &PHT, &NPC, &ND, &NSRC, &NST, &NVAR, &NVE, &MEDIASTART, &IFAULT, &READ_STEP, &READ_STEP_GPU, &BACKEND, &SIMD, &TBLOCK, &TILE, &HUGEPAGE, &OVERLAP, &SHMEM, &PART, &MATPAL, &MEDCOEF, &NRHS, &NTISKP, &WRITE_STEP, &OUTFMT, &COMPRESS, &CTOL, &IORANKS, &STRIPE, &NX, &NY, &NZ, &PX, &PY, &PZ, &NBGX, &NEDX, &NSKPX, &NBGY, &NEDY, &NSKPY, &NBGZ, &NEDZ, &NSKPZ, &FL, &FH, &FP, &IDYNA, &SoCalQ, INSRC, INVEL, OUT, INSRC_I2, CHKFILE, ENSEMBLE, STATIONS);
 
   // printf("After command.\n");
   //  Below 12 lines are NOT for HPGPU4 machine!
@@ -196,21 +278,46 @@ int main(int argc, char** argv) {
   MPI_Init(&argc, &argv);
   MPI_Comm_rank(MPI_COMM_WORLD, &rank);
   MPI_Comm_size(MPI_COMM_WORLD, &size);
-  MPI_Comm_dup(MPI_COMM_WORLD, &MCW);
+  // temporal blocking needs all stencil neighbours on this rank, the halos are one step deep
+  if (BACKEND == BACKEND_CPU && TBLOCK > 1 && (PX * PY * PZ > 1 || NRHS > 1 || TILE < 1)) {
+    if (rank == 0) printf("TBLOCK=%d needs PX=PY=PZ=1, NRHS=1 and TILE>0\n", TBLOCK);
+    MPI_Finalize();
+    return -1;
+  }
+  // IORANKS: the last ranks only gather and write the output, MCW holds the compute ranks; they
+  // write the per window box files, not the container or the station series
+  if (IORANKS > 0 && (OUTFMT == 1 || COMPRESS || STATIONS[0])) {
+    if (rank == 0) printf("IORANKS=%d writes the per window box files, not OUTFMT=1, COMPRESS or STATIONS\n", IORANKS);
+    MPI_Finalize();
+    return -1;
+  }
+  if (IORANKS > 0 && IORANKS < size) nio = IORANKS;
+  MPI_Comm_split(MPI_COMM_WORLD, rank >= size - nio, rank, &MCW);
+  if (rank >= size - nio) {
+    oinfo = outinfo(STRIPE, nio);
+    iorun(MCW, size - nio, oinfo);
+    if (oinfo != MPI_INFO_NULL) MPI_Info_free(&oinfo);
+    MPI_Finalize();
+    return 0;
+  }
+  if (rank == 0 && IORANKS > 0 && !nio) printf("IORANKS=%d leaves no compute ranks, using 0\n", IORANKS);
+  size -= nio;
+  oinfo = outinfo(STRIPE, 0);
   MPI_Barrier(MCW);
-  nxt = NX / PX;
-  nyt = NY / PY;
-  nzt = NZ;
   nt = (int)(TMAX / DT) + 1;
+  // z rank 0 is the top slab holding the free surface; z coordinates grow with depth
   dim[0] = PX;
   dim[1] = PY;
+  dim[2] = PZ;
   period[0] = 0;
   period[1] = 0;
+  period[2] = 0;
   reorder = 1;
-  err = MPI_Cart_create(MCW, 2, dim, period, reorder, &MC1);
+  err = MPI_Cart_create(MCW, 3, dim, period, reorder, &MC1);
   err = MPI_Cart_shift(MC1, 0, 1, &x_rank_L, &x_rank_R);
   err = MPI_Cart_shift(MC1, 1, 1, &y_rank_F, &y_rank_B);
-  err = MPI_Cart_coords(MC1, rank, 2, coord);
+  err = MPI_Cart_shift(MC1, 2, 1, &z_rank_U, &z_rank_D);
+  err = MPI_Cart_coords(MC1, rank, 3, coord);
   err = MPI_Barrier(MCW);
 
   // If any neighboring rank is out of bounds, then MPI_Cart_shift sets the
@@ -231,11 +338,32 @@ int main(int argc, char** argv) {
   if (y_rank_B < 0) {
     y_rank_B = -1;
   }
+
+  if (z_rank_D < 0) {
+    z_rank_D = -1;
+  }
+
+  if (z_rank_U < 0) {
+    z_rank_U = -1;
+  }
   // Below line is only for HPGPU4 machine!
   //    rank_gpu = rank%4;
+#ifdef NOCUDA
+  if (BACKEND == BACKEND_GPU) {
+    if (rank == 0) printf("GPU backend is not available in this build, using the CPU backend\n");
+    BACKEND = BACKEND_CPU;
+  }
+#else
   // Below line is for 1 GPU/node systems
   rank_gpu = 0;
-  cudaSetDevice(rank_gpu);
+  if (BACKEND == BACKEND_GPU) cudaSetDevice(rank_gpu);
+#endif
+  // the CUDA kernels keep the whole z column on one rank
+  if (BACKEND == BACKEND_GPU && PZ > 1) {
+    if (rank == 0) printf("PZ=%d needs the CPU backend\n", PZ);
+    MPI_Finalize();
+    return -1;
+  }
 
   printf("\n\nrank=%d) RS=%d, RSG=%d, NST=%d, IF=%d\n\n\n", rank, READ_STEP, READ_STEP_GPU, NST, IFAULT);
 
@@ -254,9 +382,101 @@ int main(int argc, char** argv) {
   rec_NY = (NEDY - NBGY) / NSKPY + 1;
   rec_NZ = (NEDZ - NBGZ) / NSKPZ + 1;
 
+  // slab extents of all ranks; per-rank media and IFAULT=2 source files are cut in even slabs,
+  // and the CUDA kernels assume them too
+  if (PART && (MEDIASTART == 3 || IFAULT == 2 || BACKEND == BACKEND_GPU)) {
+    if (rank == 0) printf("PART=%d needs the CPU backend, MEDIASTART<3 and IFAULT<2, using even slabs\n", PART);
+    PART = 0;
+  }
+  if (NPC == 1 && BACKEND == BACKEND_GPU) {
+    if (rank == 0) printf("NPC=1 (PML) needs the CPU backend, using the Cerjan sponge\n");
+    NPC = 0;
+  }
+  // ARBC is -log10 of the PML reflection coefficient, a Cerjan value below 1 would leave it open
+  if (NPC == 1 && ARBC < 1.0) {
+    if (rank == 0) printf("ARBC=%g is a Cerjan coefficient, using 3 for the PML\n", ARBC);
+    ARBC = 3.0;
+  }
+  if (BACKEND == BACKEND_GPU && (NX % PX || NY % PY)) {
+    if (rank == 0) printf("NX=%d, NY=%d must be multiples of PX=%d, PY=%d on the GPU backend\n", NX, NY, PX, PY);
+    MPI_Finalize();
+    return -1;
+  }
+  // ensemble: the runs of the list share the mesh and everything set up from it, the first one
+  // takes the place of INSRC and OUT
+  if (ENSEMBLE[0]) {
+    nens = readens(ENSEMBLE, 0, MCW, INSRC, OUT, INSRC_I2);
+    if (nens == 0) {
+      if (rank == 0) printf("ensemble list %s holds no runs\n", ENSEMBLE);
+      MPI_Finalize();
+      return -1;
+    }
+    if (rank == 0) printf("ensemble of %d runs from %s\n", nens, ENSEMBLE);
+  }
+  // NRHS: runs of the ensemble stepped together, each column of the media is used for all of
+  // them while it is in cache; the time blocked, shared memory and GPU paths step one wavefield
+  if (NRHS > 1 && (BACKEND == BACKEND_GPU || !ENSEMBLE[0] || IFAULT == 2)) {
+    if (rank == 0) printf("NRHS=%d needs the CPU backend, an ENSEMBLE list and IFAULT<2, using 1\n", NRHS);
+    NRHS = 1;
+  }
+  if (NRHS > MAXRHS) {
+    if (rank == 0) printf("NRHS=%d is above %d, using %d\n", NRHS, MAXRHS, MAXRHS);
+    NRHS = MAXRHS;
+  }
+  nrhs = (NRHS < nens ? NRHS : nens);
+  if (nrhs < 1) nrhs = 1;
+  if (nrhs > 1 && SHMEM) {
+    if (rank == 0) printf("NRHS=%d steps without SHMEM\n", nrhs);
+    SHMEM = 0;
+  }
+  // COMPRESS: the box output, coded into the container; station series are small and stay raw
+  if (COMPRESS && (COMPRESS > 2 || STATIONS[0] || (COMPRESS == 2 && CTOL <= 0.))) {
+    if (rank == 0) printf("COMPRESS=%d needs the box output and CTOL>0 for COMPRESS=2, using 0\n", COMPRESS);
+    COMPRESS = 0;
+  }
+  if (COMPRESS && OUTFMT != 1) {
+    if (rank == 0) printf("COMPRESS=%d writes the container, using OUTFMT=1\n", COMPRESS);
+    OUTFMT = 1;
+  }
+  if (PART) srcp = srcpos(rank, IFAULT, NSRC, READ_STEP, NST, MCW, INSRC);
+  part_x = Alloc1P(PX + 1);
+  part_y = Alloc1P(PY + 1);
+  part_z = Alloc1P(PZ + 1);
+  if (partition(PART, NX, NY, NZ, PX, PY, PZ, ND, NTISKP, NBGX, NEDX, NSKPX, NBGY, NEDY, NSKPY, NBGZ, NEDZ, NSKPZ, NSRC, srcp, part_x, part_y, part_z)) {
+    if (rank == 0) printf("NX/PX=%d, NY/PY=%d and NZ/PZ=%d are below the slabs of %d, %d and %d points the halos need\n", NX / PX, NY / PY, NZ / PZ, 2 * 4 * loop, 2 * 4 * loop, 4 * loop);
+    MPI_Finalize();
+    return -1;
+  }
+  Delloc1P(srcp);
+  nxt = part_x[coord[0] + 1] - part_x[coord[0]];
+  nyt = part_y[coord[1] + 1] - part_y[coord[1]];
+  nzt = part_z[coord[2] + 1] - part_z[coord[2]];
+  // global x and y index of the first interior point, and its depth below the free surface
+  offs[0] = part_x[coord[0]];
+  offs[1] = part_y[coord[1]];
+  offs[2] = part_z[coord[2]];
+
   // specific to each processor:
-  calcRecordingPoints(&rec_nbgx, &rec_nedx, &rec_nbgy, &rec_nedy, &rec_nbgz, &rec_nedz, &rec_nxt, &rec_nyt, &rec_nzt, &displacement, (long int)nxt, (long int)nyt, (long int)nzt, rec_NX, rec_NY, rec_NZ, NBGX, NEDX, NSKPX, NBGY, NEDY, NSKPY, NBGZ, NEDZ, NSKPZ, coord);
-  printf("%d = (%d,%d)) NX,NY,NZ=%d,%d,%d\nnxt,nyt,nzt=%d,%d,%d\nrec_N=(%d,%d,%d)\nrec_nxt,=%d,%d,%d\nNBGX,SKP,END=(%d:%d:%d),(%d:%d:%d),(%d:%d:%d)\nrec_nbg,ed=(%d,%d),(%d,%d),(%d,%d)\ndisp=%ld\n", rank, coord[0], coord[1], NX, NY, NZ, nxt, nyt, nzt, rec_NX, rec_NY, rec_NZ, rec_nxt, rec_nyt, rec_nzt, NBGX, NSKPX, NEDX, NBGY, NSKPY, NEDY, NBGZ, NSKPZ, NEDZ, rec_nbgx, rec_nedx, rec_nbgy, rec_nedy, rec_nbgz, rec_nedz, (long int)displacement);
+  calcRecordingPoints(&rec_nbgx, &rec_nedx, &rec_nbgy, &rec_nedy, &rec_nbgz, &rec_nedz, &rec_nxt, &rec_nyt, &rec_nzt, &displacement, (long int)nxt, (long int)nyt, (long int)nzt, rec_NX, rec_NY, rec_NZ, NBGX, NEDX, NSKPX, NBGY, NEDY, NSKPY, NBGZ, NEDZ, NSKPZ, offs);
+  printf("%d = (%d,%d,%d)) NX,NY,NZ=%d,%d,%d\nnxt,nyt,nzt=%d,%d,%d\nrec_N=(%d,%d,%d)\nrec_nxt,=%d,%d,%d\nNBGX,SKP,END=(%d:%d:%d),(%d:%d:%d),(%d:%d:%d)\nrec_nbg,ed=(%d,%d),(%d,%d),(%d,%d)\ndisp=%ld\n", rank, coord[0], coord[1], coord[2], NX, NY, NZ, nxt, nyt, nzt, rec_NX, rec_NY, rec_NZ, rec_nxt, rec_nyt, rec_nzt, NBGX, NSKPX, NEDX, NBGY, NSKPY, NEDY, NBGZ, NSKPZ, NEDZ, rec_nbgx, rec_nedx, rec_nbgy, rec_nedy, rec_nbgz, rec_nedz, (long int)displacement);
+
+  // each station a time series of nsamp samples in the files, this rank's WRITE_STEP samples of
+  // each of its stations are one block of the file type
+  nsamp = nt / NTISKP;
+  if (STATIONS[0]) {
+    nsloc = readsta(STATIONS, MCW, NX, NY, NZ, PX, PY, PZ, part_x, part_y, part_z, coord, nzt, &nsta, &staloc, &stagid);
+    if (nsta <= 0) {
+      if (rank == 0) printf("station list %s holds no stations in the mesh\n", STATIONS);
+      MPI_Finalize();
+      return -1;
+    }
+    if (rank == 0) printf("%d stations from %s, %d samples each\n", nsta, STATIONS, nsamp);
+    stadisp = (MPI_Aint*)malloc(sizeof(MPI_Aint) * (nsloc + 1));
+    for (s = 0; s < nsloc; s++) stadisp[s] = (MPI_Aint)sizeof(float) * stagid[s] * nsamp;
+    MPI_Type_create_hindexed_block(nsloc, WRITE_STEP, stadisp, MPI_FLOAT, &statype);
+    MPI_Type_commit(&statype);
+    free(stadisp);
+  }
 
   int maxNX_NY_NZ_WS = (rec_NX > rec_NY ? rec_NX : rec_NY);
   maxNX_NY_NZ_WS = (maxNX_NY_NZ_WS > rec_NZ ? maxNX_NY_NZ_WS : rec_NZ);
@@ -291,6 +511,85 @@ int main(int argc, char** argv) {
   MPI_Type_size(filetype, &tmpSize);
   if (rank == 0) printf("filetype size (supposedly=rec_nxt*nyt*nzt*WS*4=%d) =%d\n", rec_nxt * rec_nyt * rec_nzt * WRITE_STEP * 4, tmpSize);
 
+  // output container: the header is the same for every run, the file type puts the three components
+  // of a window (box) or of a WRITE_STEP block of samples (stations) at their chunks
+  if (OUTFMT == 1) {
+    memset(&ohdr, 0, sizeof(OutHeader));
+    ohdr.kind = nsta > 0;
+    ohdr.ncomp = 3;
+    ohdr.nx = NX;
+    ohdr.ny = NY;
+    ohdr.nz = NZ;
+    ohdr.nbg[0] = NBGX;
+    ohdr.ned[0] = NEDX;
+    ohdr.nskp[0] = NSKPX;
+    ohdr.nbg[1] = NBGY;
+    ohdr.ned[1] = NEDY;
+    ohdr.nskp[1] = NSKPY;
+    ohdr.nbg[2] = NBGZ;
+    ohdr.ned[2] = NEDZ;
+    ohdr.nskp[2] = NSKPZ;
+    ohdr.rec_n[0] = nsta > 0 ? nsta : rec_NX;
+    ohdr.rec_n[1] = nsta > 0 ? 1 : rec_NY;
+    ohdr.rec_n[2] = nsta > 0 ? 1 : rec_NZ;
+    ohdr.ntiskp = NTISKP;
+    ohdr.write_step = WRITE_STEP;
+    ohdr.nsamp = nsamp;
+    ohdr.nwin = nsamp / WRITE_STEP;
+    ohdr.dh = DH;
+    ohdr.dt = DT;
+    ohdr.dts = DT * NTISKP;
+    if (nsta > 0)
+      ohdr.chunk = (long long)sizeof(float) * nsta * nsamp;
+    else
+      ohdr.chunk = (long long)sizeof(float) * rec_NX * rec_NY * rec_NZ * WRITE_STEP;
+    for (c = 0; c < 3; c++) {
+      cpart[c] = nsta > 0 ? statype : filetype;
+      cdisp[c] = c * ohdr.chunk;
+      clen[c] = 1;
+    }
+    MPI_Type_create_struct(3, clen, cdisp, cpart, &ctype);
+    MPI_Type_commit(&ctype);
+    ohdr.codec = COMPRESS;
+    ohdr.tol = (COMPRESS == 2 ? CTOL : 0.f);
+    ohdr.ntile = size;
+  }
+  if (COMPRESS || nio) {
+    // tile of this rank: offset of the first recording point in the box and size
+    ztile = Alloc1P(6 * size);
+    tmpInd = displacement / sizeof(float);
+    zbl[0] = tmpInd % rec_NX;
+    zbl[1] = tmpInd / rec_NX % rec_NY;
+    zbl[2] = tmpInd / rec_NX / rec_NY;
+    zbl[3] = rec_nxt;
+    zbl[4] = rec_nyt;
+    zbl[5] = rec_nzt;
+    MPI_Allgather(zbl, 6, MPI_INT, ztile, 6, MPI_INT, MCW);
+  }
+  if (COMPRESS) {
+    zcap = zbound((long int)rec_nxt * rec_nyt * rec_nzt * WRITE_STEP);
+    zbuf = (unsigned char*)malloc(3 * zcap * nrhs + 1);
+    zall = (long long*)malloc(sizeof(long long) * (2 + 3 * size) * nrhs);
+  }
+  if (nio) {
+    // the aggregators get the box and the tiles
+    zbl[0] = rec_NX;
+    zbl[1] = rec_NY;
+    zbl[2] = rec_NZ;
+    zbl[3] = WRITE_STEP;
+    zbl[4] = nrhs;
+    if (rank == 0) {
+      for (t = 0; t < nio; t++) {
+        MPI_Send(zbl, 5, MPI_INT, size + t, IOTAG, MPI_COMM_WORLD);
+        MPI_Send(ztile, 6 * size, MPI_INT, size + t, IOTAG, MPI_COMM_WORLD);
+      }
+    }
+  }
+  // a window in flight: the files of every run and component, or the window description and the
+  // parts of the tiles sent to each aggregator
+  wreq = (MPI_Request*)malloc(sizeof(MPI_Request) * (3 * MAXRHS + 1) * (nio > 0 ? nio : 1));
+  wfh = (MPI_File*)malloc(sizeof(MPI_File) * (3 * MAXRHS + 1) * (nio > 0 ? nio : 1));
+
   /*
       fmtype[0]  = WRITE_STEP;
       //fmtype[1]  = NZ;
@@ -307,7 +606,7 @@ int main(int argc, char** argv) {
       err = MPI_Type_create_subarray(3, fmtype, fptype, foffset, MPI_ORDER_C, MPI_FLOAT, &filetype);
       err = MPI_Type_commit(&filetype);
   */
-  printf("rank=%d, x_rank_L=%d, x_rank_R=%d, y_rank_F=%d, y_rank_B=%d\n", rank, x_rank_L, x_rank_R, y_rank_F, y_rank_B);
+  printf("rank=%d, x_rank_L=%d, x_rank_R=%d, y_rank_F=%d, y_rank_B=%d, z_rank_D=%d, z_rank_U=%d\n", rank, x_rank_L, x_rank_R, y_rank_F, y_rank_B, z_rank_D, z_rank_U);
 
   if (x_rank_L < 0)
     xls = 2 + 4 * loop;
@@ -344,80 +643,141 @@ int main(int argc, char** argv) {
   ybs = nyt + 2;
   ybe = nyt + 4 * loop + 1;
 
+  // stress k range: 2 ghost layers past a side with a z neighbour, like xls/xre
+  if (z_rank_D < 0)
+    zls = align;
+  else
+    zls = align - 2;
+
+  if (z_rank_U < 0)
+    zre = nzt + align - 1;
+  else
+    zre = nzt + align + 1;
+
   if (rank == 0) printf("Before inisource\n");
-  err = inisource(rank, IFAULT, NSRC, READ_STEP, NST, &srcproc, NZ, MCW, nxt, nyt, nzt, coord, maxdim, &npsrc, &tpsrc, &taxx, &tayy, &tazz, &taxz, &tayz, &taxy, INSRC, INSRC_I2);
-  if (err) {
-    printf("source initialization failed\n");
-    return -1;
+  for (r = 0; r < nrhs; r++) {
+    if (r > 0) readens(ENSEMBLE, r, MCW, INSRC, OUT, INSRC_I2);
+    strcpy(ensrc[r], INSRC);
+    strcpy(ensout[r], OUT);
+    // the longest name is the file of the last window
+    if (strlen(OUT) + snprintf(NULL, 0, "/SX%07ld", nt) >= sizeof(filename)) {
+      if (rank == 0) printf("output directory %s is too long for the names of its files\n", OUT);
+      fflush(stdout);
+      MPI_Barrier(MCW);
+      MPI_Abort(MPI_COMM_WORLD, 1);
+      return -1;
+    }
+    snprintf(filenamebasex[r], sizeof(filenamebasex[r]), "%s/SX", OUT);
+    snprintf(filenamebasey[r], sizeof(filenamebasey[r]), "%s/SY", OUT);
+    snprintf(filenamebasez[r], sizeof(filenamebasez[r]), "%s/SZ", OUT);
+    err = inisource(rank, IFAULT, NSRC, READ_STEP, NST, &srcproc[r], NZ, MCW, nxt, nyt, nzt, offs, maxdim, &npsrc[r], &tpsrc[r], &taxx[r], &tayy[r], &tazz[r], &taxz[r], &tayz[r], &taxy[r], INSRC, INSRC_I2);
+    if (err) {
+      printf("source initialization failed\n");
+      return -1;
+    }
   }
   if (rank == 0) printf("After inisource\n");
 
-  if (rank == srcproc) {
-    printf("rank=%d, source rank, npsrc=%d\n", rank, npsrc);
-    num_bytes = sizeof(float) * npsrc * READ_STEP_GPU;
+#ifndef NOCUDA
+  if (BACKEND == BACKEND_GPU && rank == srcproc[0]) {
+    printf("rank=%d, source rank, npsrc=%d\n", rank, npsrc[0]);
+    num_bytes = sizeof(float) * npsrc[0] * READ_STEP_GPU;
     cudaMalloc((void**)&d_taxx, num_bytes);
     cudaMalloc((void**)&d_tayy, num_bytes);
     cudaMalloc((void**)&d_tazz, num_bytes);
     cudaMalloc((void**)&d_taxz, num_bytes);
     cudaMalloc((void**)&d_tayz, num_bytes);
     cudaMalloc((void**)&d_taxy, num_bytes);
-    cudaMemcpy(d_taxx, taxx, num_bytes, cudaMemcpyHostToDevice);
-    cudaMemcpy(d_tayy, tayy, num_bytes, cudaMemcpyHostToDevice);
-    cudaMemcpy(d_tazz, tazz, num_bytes, cudaMemcpyHostToDevice);
-    cudaMemcpy(d_taxz, taxz, num_bytes, cudaMemcpyHostToDevice);
-    cudaMemcpy(d_tayz, tayz, num_bytes, cudaMemcpyHostToDevice);
-    cudaMemcpy(d_taxy, taxy, num_bytes, cudaMemcpyHostToDevice);
-    num_bytes = sizeof(int) * npsrc * maxdim;
+    cudaMemcpy(d_taxx, taxx[0], num_bytes, cudaMemcpyHostToDevice);
+    cudaMemcpy(d_tayy, tayy[0], num_bytes, cudaMemcpyHostToDevice);
+    cudaMemcpy(d_tazz, tazz[0], num_bytes, cudaMemcpyHostToDevice);
+    cudaMemcpy(d_taxz, taxz[0], num_bytes, cudaMemcpyHostToDevice);
+    cudaMemcpy(d_tayz, tayz[0], num_bytes, cudaMemcpyHostToDevice);
+    cudaMemcpy(d_taxy, taxy[0], num_bytes, cudaMemcpyHostToDevice);
+    num_bytes = sizeof(int) * npsrc[0] * maxdim;
     cudaMalloc((void**)&d_tpsrc, num_bytes);
-    cudaMemcpy(d_tpsrc, tpsrc, num_bytes, cudaMemcpyHostToDevice);
+    cudaMemcpy(d_tpsrc, tpsrc[0], num_bytes, cudaMemcpyHostToDevice);
   }
+#endif
 
-  d1 = Alloc3D(nxt + 4 + 8 * loop, nyt + 4 + 8 * loop, nzt + 2 * align);
-  mu = Alloc3D(nxt + 4 + 8 * loop, nyt + 4 + 8 * loop, nzt + 2 * align);
-  lam = Alloc3D(nxt + 4 + 8 * loop, nyt + 4 + 8 * loop, nzt + 2 * align);
+  SetAlloc3D(HUGEPAGE);
+  d1 = AllocPad3D(nxt, nyt, nzt);
+  mu = AllocPad3D(nxt, nyt, nzt);
+  lam = AllocPad3D(nxt, nyt, nzt);
   lam_mu = Alloc3D(nxt + 4 + 8 * loop, nyt + 4 + 8 * loop, 1);
 
   if (NVE == 1) {
-    qp = Alloc3D(nxt + 4 + 8 * loop, nyt + 4 + 8 * loop, nzt + 2 * align);
-    qs = Alloc3D(nxt + 4 + 8 * loop, nyt + 4 + 8 * loop, nzt + 2 * align);
+    qp = AllocPad3D(nxt, nyt, nzt);
+    qs = AllocPad3D(nxt, nyt, nzt);
   }
 
   if (rank == 0) printf("Before inimesh\n");
-  inimesh(MEDIASTART, d1, mu, lam, qp, qs, &taumax, &taumin, NVAR, FP, FL, FH, nxt, nyt, nzt, PX, PY, NX, NY, NZ, coord, MCW, IDYNA, NVE, SoCalQ, INVEL, vse, vpe, dde);
+  inimesh(MEDIASTART, d1, mu, lam, qp, qs, &taumax, &taumin, NVAR, FP, FL, FH, nxt, nyt, nzt, PX, PY, PZ, NX, NY, NZ, offs, MCW, IDYNA, NVE, SoCalQ, INVEL, vse, vpe, dde);
   if (rank == 0) printf("After inimesh\n");
   if (rank == 0)
     writeCHK(CHKFILE, NTISKP, DT, DH, nxt, nyt, nzt, nt, ARBC, NPC, NVE, FL, FH, FP, vse, vpe, dde);
 
-  mediaswap(d1, mu, lam, qp, qs, rank, x_rank_L, x_rank_R, y_rank_F, y_rank_B, nxt, nyt, nzt, MCW);
+  mediaswap(d1, mu, lam, qp, qs, rank, x_rank_L, x_rank_R, y_rank_F, y_rank_B, z_rank_D, z_rank_U, nxt, nyt, nzt, MCW);
+
+  if (NPC == 1) {
+    // the profiles scale with the fastest P velocity, taken from the media before they may be freed
+    pmlax = Alloc1D(nxt + 4 + 8 * loop);
+    pmlbx = Alloc1D(nxt + 4 + 8 * loop);
+    pmlay = Alloc1D(nyt + 4 + 8 * loop);
+    pmlby = Alloc1D(nyt + 4 + 8 * loop);
+    pmlaz = Alloc1D(nzt + 2 * align);
+    pmlbz = Alloc1D(nzt + 2 * align);
+    inipml(d1, mu, lam, ARBC, FP, DH, DT, offs, nxt, nyt, nzt, NX, NY, NZ, ND, MCW, pmlax, pmlbx, pmlay, pmlby, pmlaz, pmlbz);
+  }
 
   for (i = xls; i < xre + 1; i++)
     for (j = yls; j < yre + 1; j++) {
       float t_xl, t_xl2m;
-      t_xl = 1.0 / lam[i][j][nzt + align - 1];
-      t_xl2m = 2.0 / mu[i][j][nzt + align - 1] + t_xl;
-      lam_mu[i][j][0] = t_xl / t_xl2m;
+      t_xl = 1.0 / G3(lam, i, j, nzt + align - 1);
+      t_xl2m = 2.0 / G3(mu, i, j, nzt + align - 1) + t_xl;
+      G3(lam_mu, i, j, 0) = t_xl / t_xl2m;
     }
 
-  num_bytes = sizeof(float) * (nxt + 4 + 8 * loop) * (nyt + 4 + 8 * loop);
-  cudaMalloc((void**)&d_lam_mu, num_bytes);
-  cudaMemcpy(d_lam_mu, &lam_mu[0][0][0], num_bytes, cudaMemcpyHostToDevice);
+  if (MATPAL && BACKEND != BACKEND_CPU) {
+    if (rank == 0) printf("MATPAL=%d needs the CPU backend, keeping the media arrays\n", MATPAL);
+  } else if (MATPAL) {
+    // the kernels decode the media from 16-bit material IDs; a rank with more than MAXMAT
+    // materials keeps its full arrays
+    nmat = palmesh(d1, mu, lam, qp, qs, NVE, MAXMAT, &mid, &mtab);
+    if (nmat > 0) {
+      Delloc3D(d1);
+      Delloc3D(mu);
+      Delloc3D(lam);
+      Delloc3D(qp);
+      Delloc3D(qs);
+      d1.data = mu.data = lam.data = qp.data = qs.data = NULL;
+    }
+    MPI_Allreduce(&nmat, &i, 1, MPI_INT, MPI_MIN, MCW);
+    MPI_Allreduce(&nmat, &j, 1, MPI_INT, MPI_MAX, MCW);
+    if (rank == 0) printf("material palette: %d to %d materials per rank%s\n", i, j, i == 0 ? ", full media arrays on some ranks" : "");
+  }
 
-  vx1 = Alloc3D(nxt + 4 + 8 * loop, nyt + 4 + 8 * loop, nzt + 2 * align);
-  vx2 = Alloc3D(nxt + 4 + 8 * loop, nyt + 4 + 8 * loop, nzt + 2 * align);
-  if (NPC == 0) {
-    dcrjx = Alloc1D(nxt + 4 + 8 * loop);
-    dcrjy = Alloc1D(nyt + 4 + 8 * loop);
-    dcrjz = Alloc1D(nzt + 2 * align);
+#ifndef NOCUDA
+  if (BACKEND == BACKEND_GPU) {
+    num_bytes = sizeof(float) * (nxt + 4 + 8 * loop) * (nyt + 4 + 8 * loop);
+    cudaMalloc((void**)&d_lam_mu, num_bytes);
+    cudaMemcpy(d_lam_mu, lam_mu.data, num_bytes, cudaMemcpyHostToDevice);
+  }
+#endif
 
-    for (i = 0; i < nxt + 4 + 8 * loop; i++)
-      dcrjx[i] = 1.0;
-    for (j = 0; j < nyt + 4 + 8 * loop; j++)
-      dcrjy[j] = 1.0;
-    for (k = 0; k < nzt + 2 * align; k++)
-      dcrjz[k] = 1.0;
+  // with the PML the Cerjan factors stay 1 and the kernels skip them
+  dcrjx = Alloc1D(nxt + 4 + 8 * loop);
+  dcrjy = Alloc1D(nyt + 4 + 8 * loop);
+  dcrjz = Alloc1D(nzt + 2 * align);
 
-    inicrj(ARBC, coord, nxt, nyt, nzt, NX, NY, ND, dcrjx, dcrjy, dcrjz);
-  }
+  for (i = 0; i < nxt + 4 + 8 * loop; i++)
+    dcrjx[i] = 1.0;
+  for (j = 0; j < nyt + 4 + 8 * loop; j++)
+    dcrjy[j] = 1.0;
+  for (k = 0; k < nzt + 2 * align; k++)
+    dcrjz[k] = 1.0;
+
+  if (NPC == 0) inicrj(ARBC, offs, nxt, nyt, nzt, NX, NY, NZ, ND, dcrjx, dcrjy, dcrjz);
 
   if (NVE == 1) {
     tau = Alloc3D(2, 2, 2);
@@ -428,419 +788,969 @@ int main(int argc, char** argv) {
     for (i = 0; i < 2; i++)
       for (j = 0; j < 2; j++)
         for (k = 0; k < 2; k++) {
-          tauu = tau[i][j][k];
-          tau1[i][j][k] = 1.0 / ((tauu * dt1) + (1.0 / 2.0));
-          tau2[i][j][k] = (tauu * dt1) - (1.0 / 2.0);
+          tauu = G3(tau, i, j, k);
+          G3(tau1, i, j, k) = 1.0 / ((tauu * dt1) + (1.0 / 2.0));
+          G3(tau2, i, j, k) = (tauu * dt1) - (1.0 / 2.0);
         }
-
-    init_texture(nxt, nyt, nzt, tau1, tau2, vx1, vx2, xls, xre, yls, yre);
-
+    // the kernels pick tau1/tau2 by the parity of each point
     Delloc3D(tau);
-    Delloc3D(tau1);
-    Delloc3D(tau2);
   }
 
-  if (rank == 0) printf("Allocate device media pointers and copy.\n");
-  num_bytes = sizeof(float) * (nxt + 4 + 8 * loop) * (nyt + 4 + 8 * loop) * (nzt + 2 * align);
-  cudaMalloc((void**)&d_d1, num_bytes);
-  cudaMemcpy(d_d1, &d1[0][0][0], num_bytes, cudaMemcpyHostToDevice);
-  cudaMalloc((void**)&d_lam, num_bytes);
-  cudaMemcpy(d_lam, &lam[0][0][0], num_bytes, cudaMemcpyHostToDevice);
-  cudaMalloc((void**)&d_mu, num_bytes);
-  cudaMemcpy(d_mu, &mu[0][0][0], num_bytes, cudaMemcpyHostToDevice);
-  cudaMalloc((void**)&d_qp, num_bytes);
-  cudaMemcpy(d_qp, &qp[0][0][0], num_bytes, cudaMemcpyHostToDevice);
-  cudaMalloc((void**)&d_qs, num_bytes);
-  cudaMemcpy(d_qs, &qs[0][0][0], num_bytes, cudaMemcpyHostToDevice);
-  cudaMalloc((void**)&d_vx1, num_bytes);
-  cudaMemcpy(d_vx1, &vx1[0][0][0], num_bytes, cudaMemcpyHostToDevice);
-  cudaMalloc((void**)&d_vx2, num_bytes);
-  cudaMemcpy(d_vx2, &vx2[0][0][0], num_bytes, cudaMemcpyHostToDevice);
-  BindArrayToTexture(d_vx1, d_vx2, num_bytes);
-  if (NPC == 0) {
-    num_bytes = sizeof(float) * (nxt + 4 + 8 * loop);
-    cudaMalloc((void**)&d_dcrjx, num_bytes);
-    cudaMemcpy(d_dcrjx, dcrjx, num_bytes, cudaMemcpyHostToDevice);
-    num_bytes = sizeof(float) * (nyt + 4 + 8 * loop);
-    cudaMalloc((void**)&d_dcrjy, num_bytes);
-    cudaMemcpy(d_dcrjy, dcrjy, num_bytes, cudaMemcpyHostToDevice);
-    num_bytes = sizeof(float) * (nzt + 2 * align);
-    cudaMalloc((void**)&d_dcrjz, num_bytes);
-    cudaMemcpy(d_dcrjz, dcrjz, num_bytes, cudaMemcpyHostToDevice);
+#ifndef NOCUDA
+  if (BACKEND == BACKEND_GPU) {
+    if (rank == 0) printf("Allocate device media pointers and copy.\n");
+    num_bytes = sizeof(float) * (nxt + 4 + 8 * loop) * (nyt + 4 + 8 * loop) * (nzt + 2 * align);
+    cudaMalloc((void**)&d_d1, num_bytes);
+    cudaMemcpy(d_d1, d1.data, num_bytes, cudaMemcpyHostToDevice);
+    cudaMalloc((void**)&d_lam, num_bytes);
+    cudaMemcpy(d_lam, lam.data, num_bytes, cudaMemcpyHostToDevice);
+    cudaMalloc((void**)&d_mu, num_bytes);
+    cudaMemcpy(d_mu, mu.data, num_bytes, cudaMemcpyHostToDevice);
+    if (NVE == 1) {
+      cudaMalloc((void**)&d_qp, num_bytes);
+      cudaMemcpy(d_qp, qp.data, num_bytes, cudaMemcpyHostToDevice);
+      cudaMalloc((void**)&d_qs, num_bytes);
+      cudaMemcpy(d_qs, qs.data, num_bytes, cudaMemcpyHostToDevice);
+      SetDeviceTau(tau1.data, tau2.data);
+    }
+    if (NPC == 0) {
+      num_bytes = sizeof(float) * (nxt + 4 + 8 * loop);
+      cudaMalloc((void**)&d_dcrjx, num_bytes);
+      cudaMemcpy(d_dcrjx, dcrjx, num_bytes, cudaMemcpyHostToDevice);
+      num_bytes = sizeof(float) * (nyt + 4 + 8 * loop);
+      cudaMalloc((void**)&d_dcrjy, num_bytes);
+      cudaMemcpy(d_dcrjy, dcrjy, num_bytes, cudaMemcpyHostToDevice);
+      num_bytes = sizeof(float) * (nzt + 2 * align);
+      cudaMalloc((void**)&d_dcrjz, num_bytes);
+      cudaMemcpy(d_dcrjz, dcrjz, num_bytes, cudaMemcpyHostToDevice);
+    }
   }
+#endif
 
   if (rank == 0) printf("Allocate host velocity and stress pointers.\n");
-  u1 = Alloc3D(nxt + 4 + 8 * loop, nyt + 4 + 8 * loop, nzt + 2 * align);
-  v1 = Alloc3D(nxt + 4 + 8 * loop, nyt + 4 + 8 * loop, nzt + 2 * align);
-  w1 = Alloc3D(nxt + 4 + 8 * loop, nyt + 4 + 8 * loop, nzt + 2 * align);
-  xx = Alloc3D(nxt + 4 + 8 * loop, nyt + 4 + 8 * loop, nzt + 2 * align);
-  yy = Alloc3D(nxt + 4 + 8 * loop, nyt + 4 + 8 * loop, nzt + 2 * align);
-  zz = Alloc3D(nxt + 4 + 8 * loop, nyt + 4 + 8 * loop, nzt + 2 * align);
-  xy = Alloc3D(nxt + 4 + 8 * loop, nyt + 4 + 8 * loop, nzt + 2 * align);
-  yz = Alloc3D(nxt + 4 + 8 * loop, nyt + 4 + 8 * loop, nzt + 2 * align);
-  xz = Alloc3D(nxt + 4 + 8 * loop, nyt + 4 + 8 * loop, nzt + 2 * align);
+  if (BACKEND == BACKEND_CPU && SHMEM) {
+    // velocity grids in a node shared window, on-node neighbours read each other's boundary planes
+    MPI_Comm_split_type(MCW, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL, &MCS);
+    AllocShared3D(vel, 3, nxt, nyt, nzt, MCS, &win_vel);
+    u1 = vel[0];
+    v1 = vel[1];
+    w1 = vel[2];
+    shm_nbr[0] = ShmRank(MCW, MCS, x_rank_L);
+    shm_nbr[1] = ShmRank(MCW, MCS, x_rank_R);
+    shm_nbr[2] = ShmRank(MCW, MCS, y_rank_F);
+    shm_nbr[3] = ShmRank(MCW, MCS, y_rank_B);
+    if (shm_nbr[0] >= 0) SharedQuery3D(win_vel, shm_nbr[0], 3, part_x[coord[0]] - part_x[coord[0] - 1], nyt, nzt, vel_L);
+    if (shm_nbr[1] >= 0) SharedQuery3D(win_vel, shm_nbr[1], 3, part_x[coord[0] + 2] - part_x[coord[0] + 1], nyt, nzt, vel_R);
+    if (shm_nbr[2] >= 0) SharedQuery3D(win_vel, shm_nbr[2], 3, nxt, part_y[coord[1]] - part_y[coord[1] - 1], nzt, vel_F);
+    if (shm_nbr[3] >= 0) SharedQuery3D(win_vel, shm_nbr[3], 3, nxt, part_y[coord[1] + 2] - part_y[coord[1] + 1], nzt, vel_B);
+  } else {
+    SHMEM = 0;
+    u1 = AllocRhs3D(nrhs, nxt, nyt, nzt);
+    v1 = AllocRhs3D(nrhs, nxt, nyt, nzt);
+    w1 = AllocRhs3D(nrhs, nxt, nyt, nzt);
+  }
+  // interior views used by the output gather
+  u1_in = View3D(u1, halo_xy, halo_xy, halo_z, nxt, nyt, nzt);
+  v1_in = View3D(v1, halo_xy, halo_xy, halo_z, nxt, nyt, nzt);
+  w1_in = View3D(w1, halo_xy, halo_xy, halo_z, nxt, nyt, nzt);
+  xx = AllocRhs3D(nrhs, nxt, nyt, nzt);
+  yy = AllocRhs3D(nrhs, nxt, nyt, nzt);
+  zz = AllocRhs3D(nrhs, nxt, nyt, nzt);
+  xy = AllocRhs3D(nrhs, nxt, nyt, nzt);
+  yz = AllocRhs3D(nrhs, nxt, nyt, nzt);
+  xz = AllocRhs3D(nrhs, nxt, nyt, nzt);
   if (NVE == 1) {
-    r1 = Alloc3D(nxt + 4 + 8 * loop, nyt + 4 + 8 * loop, nzt + 2 * align);
-    r2 = Alloc3D(nxt + 4 + 8 * loop, nyt + 4 + 8 * loop, nzt + 2 * align);
-    r3 = Alloc3D(nxt + 4 + 8 * loop, nyt + 4 + 8 * loop, nzt + 2 * align);
-    r4 = Alloc3D(nxt + 4 + 8 * loop, nyt + 4 + 8 * loop, nzt + 2 * align);
-    r5 = Alloc3D(nxt + 4 + 8 * loop, nyt + 4 + 8 * loop, nzt + 2 * align);
-    r6 = Alloc3D(nxt + 4 + 8 * loop, nyt + 4 + 8 * loop, nzt + 2 * align);
+    r1 = AllocRhs3D(nrhs, nxt, nyt, nzt);
+    r2 = AllocRhs3D(nrhs, nxt, nyt, nzt);
+    r3 = AllocRhs3D(nrhs, nxt, nyt, nzt);
+    r4 = AllocRhs3D(nrhs, nxt, nyt, nzt);
+    r5 = AllocRhs3D(nrhs, nxt, nyt, nzt);
+    r6 = AllocRhs3D(nrhs, nxt, nyt, nzt);
   }
 
   source_step = 1;
-  if (rank == srcproc) {
-    printf("%d) add initial src\n", rank);
-    addsrc(source_step, DH, DT, NST, npsrc, READ_STEP, maxdim, tpsrc, taxx, tayy, tazz, taxz, tayz, taxy, xx, yy, zz, xy, yz, xz);
-  }
-
-  if (rank == 0) printf("Allocate device velocity and stress pointers and copy.\n");
-  num_bytes = sizeof(float) * (nxt + 4 + 8 * loop) * (nyt + 4 + 8 * loop) * (nzt + 2 * align);
-  cudaMalloc((void**)&d_u1, num_bytes);
-  cudaMemcpy(d_u1, &u1[0][0][0], num_bytes, cudaMemcpyHostToDevice);
-  cudaMalloc((void**)&d_v1, num_bytes);
-  cudaMemcpy(d_v1, &v1[0][0][0], num_bytes, cudaMemcpyHostToDevice);
-  cudaMalloc((void**)&d_w1, num_bytes);
-  cudaMemcpy(d_w1, &w1[0][0][0], num_bytes, cudaMemcpyHostToDevice);
-  cudaMalloc((void**)&d_xx, num_bytes);
-  cudaMemcpy(d_xx, &xx[0][0][0], num_bytes, cudaMemcpyHostToDevice);
-  cudaMalloc((void**)&d_yy, num_bytes);
-  cudaMemcpy(d_yy, &yy[0][0][0], num_bytes, cudaMemcpyHostToDevice);
-  cudaMalloc((void**)&d_zz, num_bytes);
-  cudaMemcpy(d_zz, &zz[0][0][0], num_bytes, cudaMemcpyHostToDevice);
-  cudaMalloc((void**)&d_xy, num_bytes);
-  cudaMemcpy(d_xy, &xy[0][0][0], num_bytes, cudaMemcpyHostToDevice);
-  cudaMalloc((void**)&d_xz, num_bytes);
-  cudaMemcpy(d_xz, &xz[0][0][0], num_bytes, cudaMemcpyHostToDevice);
-  cudaMalloc((void**)&d_yz, num_bytes);
-  cudaMemcpy(d_yz, &yz[0][0][0], num_bytes, cudaMemcpyHostToDevice);
-  if (NVE == 1) {
-    if (rank == 0) printf("Allocate additional device pointers (r) and copy.\n");
-    cudaMalloc((void**)&d_r1, num_bytes);
-    cudaMemcpy(d_r1, &r1[0][0][0], num_bytes, cudaMemcpyHostToDevice);
-    cudaMalloc((void**)&d_r2, num_bytes);
-    cudaMemcpy(d_r2, &r2[0][0][0], num_bytes, cudaMemcpyHostToDevice);
-    cudaMalloc((void**)&d_r3, num_bytes);
-    cudaMemcpy(d_r3, &r3[0][0][0], num_bytes, cudaMemcpyHostToDevice);
-    cudaMalloc((void**)&d_r4, num_bytes);
-    cudaMemcpy(d_r4, &r4[0][0][0], num_bytes, cudaMemcpyHostToDevice);
-    cudaMalloc((void**)&d_r5, num_bytes);
-    cudaMemcpy(d_r5, &r5[0][0][0], num_bytes, cudaMemcpyHostToDevice);
-    cudaMalloc((void**)&d_r6, num_bytes);
-    cudaMemcpy(d_r6, &r6[0][0][0], num_bytes, cudaMemcpyHostToDevice);
+  nrun = nrhs;
+  for (r = 0; r < nrun; r++) {
+    if (rank == srcproc[r]) {
+      printf("%d) add initial src\n", rank);
+      addsrc(source_step, DH, DT, NST, npsrc[r], READ_STEP, maxdim, tpsrc[r], taxx[r], tayy[r], tazz[r], taxz[r], tayz[r], taxy[r], Rhs3D(xx, r, nxt), Rhs3D(yy, r, nxt), Rhs3D(zz, r, nxt), Rhs3D(xy, r, nxt), Rhs3D(yz, r, nxt), Rhs3D(xz, r, nxt));
+    }
+  }
+
+#ifndef NOCUDA
+  if (BACKEND == BACKEND_GPU) {
+    if (rank == 0) printf("Allocate device velocity and stress pointers and copy.\n");
+    num_bytes = sizeof(float) * (nxt + 4 + 8 * loop) * (nyt + 4 + 8 * loop) * (nzt + 2 * align);
+    cudaMalloc((void**)&d_u1, num_bytes);
+    cudaMemcpy(d_u1, u1.data, num_bytes, cudaMemcpyHostToDevice);
+    cudaMalloc((void**)&d_v1, num_bytes);
+    cudaMemcpy(d_v1, v1.data, num_bytes, cudaMemcpyHostToDevice);
+    cudaMalloc((void**)&d_w1, num_bytes);
+    cudaMemcpy(d_w1, w1.data, num_bytes, cudaMemcpyHostToDevice);
+    cudaMalloc((void**)&d_xx, num_bytes);
+    cudaMemcpy(d_xx, xx.data, num_bytes, cudaMemcpyHostToDevice);
+    cudaMalloc((void**)&d_yy, num_bytes);
+    cudaMemcpy(d_yy, yy.data, num_bytes, cudaMemcpyHostToDevice);
+    cudaMalloc((void**)&d_zz, num_bytes);
+    cudaMemcpy(d_zz, zz.data, num_bytes, cudaMemcpyHostToDevice);
+    cudaMalloc((void**)&d_xy, num_bytes);
+    cudaMemcpy(d_xy, xy.data, num_bytes, cudaMemcpyHostToDevice);
+    cudaMalloc((void**)&d_xz, num_bytes);
+    cudaMemcpy(d_xz, xz.data, num_bytes, cudaMemcpyHostToDevice);
+    cudaMalloc((void**)&d_yz, num_bytes);
+    cudaMemcpy(d_yz, yz.data, num_bytes, cudaMemcpyHostToDevice);
+    if (NVE == 1) {
+      if (rank == 0) printf("Allocate additional device pointers (r) and copy.\n");
+      cudaMalloc((void**)&d_r1, num_bytes);
+      cudaMemcpy(d_r1, r1.data, num_bytes, cudaMemcpyHostToDevice);
+      cudaMalloc((void**)&d_r2, num_bytes);
+      cudaMemcpy(d_r2, r2.data, num_bytes, cudaMemcpyHostToDevice);
+      cudaMalloc((void**)&d_r3, num_bytes);
+      cudaMemcpy(d_r3, r3.data, num_bytes, cudaMemcpyHostToDevice);
+      cudaMalloc((void**)&d_r4, num_bytes);
+      cudaMemcpy(d_r4, r4.data, num_bytes, cudaMemcpyHostToDevice);
+      cudaMalloc((void**)&d_r5, num_bytes);
+      cudaMemcpy(d_r5, r5.data, num_bytes, cudaMemcpyHostToDevice);
+      cudaMalloc((void**)&d_r6, num_bytes);
+      cudaMemcpy(d_r6, r6.data, num_bytes, cudaMemcpyHostToDevice);
+    }
+  }
+#endif
+  if (BACKEND == BACKEND_CPU) {
+    // the CPU backend works in place on the host arrays
+    d_u1 = u1.data;
+    d_v1 = v1.data;
+    d_w1 = w1.data;
+    d_xx = xx.data;
+    d_yy = yy.data;
+    d_zz = zz.data;
+    d_xy = xy.data;
+    d_xz = xz.data;
+    d_yz = yz.data;
+    d_d1 = d1.data;
+    d_lam = lam.data;
+    d_mu = mu.data;
+    if (mid) {
+      d_d1 = mtab;
+      d_mu = mtab + nmat;
+      d_lam = mtab + 2 * nmat;
+    }
+    d_lam_mu = lam_mu.data;
+    d_dcrjx = dcrjx;
+    d_dcrjy = dcrjy;
+    d_dcrjz = dcrjz;
+    if (NVE == 1) {
+      d_qp = mid ? mtab + 3 * nmat : qp.data;
+      d_qs = mid ? mtab + 4 * nmat : qs.data;
+      d_r1 = r1.data;
+      d_r2 = r2.data;
+      d_r3 = r3.data;
+      d_r4 = r4.data;
+      d_r5 = r5.data;
+      d_r6 = r6.data;
+    }
   }
   //  variable initialization ends
-  if (rank == 0) printf("Allocate buffers of #elements: %d\n", rec_nxt * rec_nyt * rec_nzt * WRITE_STEP);
-  Bufx = Alloc1D(rec_nxt * rec_nyt * rec_nzt * WRITE_STEP);
-  Bufy = Alloc1D(rec_nxt * rec_nyt * rec_nzt * WRITE_STEP);
-  Bufz = Alloc1D(rec_nxt * rec_nyt * rec_nzt * WRITE_STEP);
-  num_bytes = sizeof(float) * 3 * (4 * loop) * (nyt + 4 + 8 * loop) * (nzt + 2 * align);
-  cudaMallocHost((void**)&SL_vel, num_bytes);
-  cudaMallocHost((void**)&SR_vel, num_bytes);
-  cudaMallocHost((void**)&RL_vel, num_bytes);
-  cudaMallocHost((void**)&RR_vel, num_bytes);
-  num_bytes = sizeof(float) * 3 * (4 * loop) * (nxt + 4 + 8 * loop) * (nzt + 2 * align);
-  cudaMallocHost((void**)&SF_vel, num_bytes);
-  cudaMallocHost((void**)&SB_vel, num_bytes);
-  cudaMallocHost((void**)&RF_vel, num_bytes);
-  cudaMallocHost((void**)&RB_vel, num_bytes);
-  num_bytes = sizeof(float) * (4 * loop) * (nxt + 4 + 8 * loop) * (nzt + 2 * align);
-  cudaMalloc((void**)&d_f_u1, num_bytes);
-  cudaMalloc((void**)&d_f_v1, num_bytes);
-  cudaMalloc((void**)&d_f_w1, num_bytes);
-  cudaMalloc((void**)&d_b_u1, num_bytes);
-  cudaMalloc((void**)&d_b_v1, num_bytes);
-  cudaMalloc((void**)&d_b_w1, num_bytes);
-  msg_v_size_x = 3 * (4 * loop) * (nyt + 4 + 8 * loop) * (nzt + 2 * align);
-  msg_v_size_y = 3 * (4 * loop) * (nxt + 4 + 8 * loop) * (nzt + 2 * align);
-  SetDeviceConstValue(DH, DT, nxt, nyt, nzt);
-  cudaStreamCreate(&stream_1);
-  cudaStreamCreate(&stream_2);
-  cudaStreamCreate(&stream_i);
+  // two halves per buffer: one is filled while the writes of the other drain
+  if (nsta > 0) {
+    obsz = (long int)nrhs * nsloc * WRITE_STEP;
+    for (c = 0; c < 3; c++) obuf[c] = stabuf[c] = Alloc1D(2 * obsz + 1);
+  } else {
+    obsz = (long int)nrhs * rec_nxt * rec_nyt * rec_nzt * WRITE_STEP;
+    if (rank == 0) printf("Allocate buffers of #elements: %ld\n", 2 * obsz);
+    obuf[0] = Bufx = Alloc1D(2 * obsz);
+    obuf[1] = Bufy = Alloc1D(2 * obsz);
+    obuf[2] = Bufz = Alloc1D(2 * obsz);
+  }
+  // recording points as offsets into the padded grids, in the order of the buffers; the box goes
+  // from the surface down, then j, then i fastest as in the files
+  if (nsta > 0) {
+    nsidx = nsloc;
+    sidx = Alloc1P(nsidx + 1);
+    for (s = 0; s < nsloc; s++) sidx[s] = &G3(u1, staloc[3 * s], staloc[3 * s + 1], staloc[3 * s + 2]) - u1.data;
+  } else {
+    nsidx = rec_nxt * rec_nyt * rec_nzt;
+    sidx = Alloc1P(nsidx + 1);
+    s = 0;
+    for (k = nzt - 1 - rec_nbgz; k >= nzt - 1 - rec_nedz; k = k - NSKPZ)
+      for (j = rec_nbgy; j <= rec_nedy; j = j + NSKPY)
+        for (i = rec_nbgx; i <= rec_nedx; i = i + NSKPX) sidx[s++] = &G3(u1_in, i, j, k) - u1.data;
+  }
+  rhs_stride = (long int)(nxt + 2 * halo_xy) * u1.slice;
+#ifndef NOCUDA
+  if (BACKEND == BACKEND_GPU) {
+    cudaMalloc((void**)&d_sidx, sizeof(int) * (nsidx + 1));
+    cudaMemcpy(d_sidx, sidx, sizeof(int) * nsidx, cudaMemcpyHostToDevice);
+    cudaMalloc((void**)&d_samp, sizeof(float) * 3 * (nsidx + 1));
+  }
+#endif
+  if (BACKEND == BACKEND_CPU) {
+    // halo messages go in place from the velocity grids (MPI_BOTTOM), trimmed to what dstrqc reads:
+    // y rows over the interior i range, x planes over the y ghost rows too, no z padding;
+    // z planes go last and carry the x and y ghost columns
+    // with NRHS the messages carry the velocities of all wavefields of the sweep
+    for (r = 0; r < nrhs; r++) {
+      vel[3 * r] = Rhs3D(u1, r, nxt);
+      vel[3 * r + 1] = Rhs3D(v1, r, nxt);
+      vel[3 * r + 2] = Rhs3D(w1, r, nxt);
+    }
+    HaloType_X(vel, 3 * nrhs, nxt, 2, nyt + 8 * loop, align, nzt, type_x);
+    HaloType_Y(vel, 3 * nrhs, nyt, 2 + 4 * loop, nxt, align, nzt, type_y);
+    HaloType_Z(vel, 3 * nrhs, nzt, 2, nxt + 8 * loop, 2, nyt + 8 * loop, type_z);
+    SL_vel = SR_vel = RL_vel = RR_vel = (float*)MPI_BOTTOM;
+    SF_vel = SB_vel = RF_vel = RB_vel = (float*)MPI_BOTTOM;
+    msg_v_size_x = msg_v_size_y = 1;
+    SetHostConstValue(DH, DT, nxt, nyt, nzt, zls, zre);
+    SetHostMedia(mid);
+    if (NVE == 1) SetHostTau(tau1.data, tau2.data, offs[2]);
+    // the kernels apply the Cerjan factors in the sponge layers only
+    SetHostSponge(d_dcrjz);
+    SetHostRhs(nrhs, (long int)(nxt + 2 * halo_xy) * xx.slice);
+    if (NPC == 1) {
+      num_bytes = sizeof(float) * SetHostPml(pmlax, pmlbx, pmlay, pmlby, pmlaz, pmlbz);
+      if (rank == 0) printf("PML memory variables: %ld bytes on rank 0\n", num_bytes);
+    }
+    if (MEDCOEF) {
+      // the kernels read the precomputed coefficients, the media are not needed any more;
+      // an elastic run only needs them up to CO_XMU3
+      for (i = 0; i < NCOEF; i++) {
+        coef[i].data = NULL;
+        if (NVE == 1 || i < CO_H) coef[i] = AllocPad3D(nxt, nyt, nzt);
+        co[i] = coef[i].data;
+      }
+      SetHostCoef(co);
+      dcoef_C(d_d1, d_lam, d_mu, d_qp, d_qs);
+      SetHostMedia(NULL);
+      Delloc3D(d1);
+      Delloc3D(mu);
+      Delloc3D(lam);
+      Delloc3D(qp);
+      Delloc3D(qs);
+      d1.data = mu.data = lam.data = qp.data = qs.data = NULL;
+      if (mid) {
+        free(mid);
+        Delloc1D(mtab);
+        mid = NULL;
+      }
+      d_d1 = d_lam = d_mu = d_qp = d_qs = NULL;
+    } else
+      MEDCOEF = 0;
+    i = SetHostSimd(SIMD);
+    if (rank == 0) printf("CPU backend SIMD level %d (requested %d)\n", i, SIMD);
+    // the z halo needs the x and y ghost columns, so it cannot travel under the interior stress update
+    if (OVERLAP && PZ > 1) {
+      if (rank == 0) printf("OVERLAP needs PZ=1, halo exchange is not overlapped\n");
+      OVERLAP = 0;
+    }
+    // the 4*loop rows next to the front and back (planes next to the left and right) are updated
+    // after the interior; in a slab thinner than 2*4*loop they would meet and be updated twice
+    for (k = NX, i = 0; i < PX; i++) k = (part_x[i + 1] - part_x[i] < k ? part_x[i + 1] - part_x[i] : k);
+    for (i = 0; i < PY; i++) k = (part_y[i + 1] - part_y[i] < k ? part_y[i + 1] - part_y[i] : k);
+    if (OVERLAP && k < 2 * 4 * loop) {
+      if (rank == 0) printf("OVERLAP needs x and y slabs of %d points, halo exchange is not overlapped\n", 2 * 4 * loop);
+      OVERLAP = 0;
+    }
+  } else
+    TBLOCK = 1;
+#ifndef NOCUDA
+  if (BACKEND == BACKEND_GPU) {
+    msg_v_size_x = 3 * (4 * loop) * (nyt + 4 + 8 * loop) * (nzt + 2 * align);
+    msg_v_size_y = 3 * (4 * loop) * (nxt + 4 + 8 * loop) * (nzt + 2 * align);
+    for (i = 0; i < 4; i++) type_x[i] = type_y[i] = MPI_FLOAT;
+    num_bytes = sizeof(float) * 3 * (4 * loop) * (nyt + 4 + 8 * loop) * (nzt + 2 * align);
+    cudaMallocHost((void**)&SL_vel, num_bytes);
+    cudaMallocHost((void**)&SR_vel, num_bytes);
+    cudaMallocHost((void**)&RL_vel, num_bytes);
+    cudaMallocHost((void**)&RR_vel, num_bytes);
+    num_bytes = sizeof(float) * 3 * (4 * loop) * (nxt + 4 + 8 * loop) * (nzt + 2 * align);
+    cudaMallocHost((void**)&SF_vel, num_bytes);
+    cudaMallocHost((void**)&SB_vel, num_bytes);
+    cudaMallocHost((void**)&RF_vel, num_bytes);
+    cudaMallocHost((void**)&RB_vel, num_bytes);
+    num_bytes = sizeof(float) * (4 * loop) * (nxt + 4 + 8 * loop) * (nzt + 2 * align);
+    cudaMalloc((void**)&d_f_u1, num_bytes);
+    cudaMalloc((void**)&d_f_v1, num_bytes);
+    cudaMalloc((void**)&d_f_w1, num_bytes);
+    cudaMalloc((void**)&d_b_u1, num_bytes);
+    cudaMalloc((void**)&d_b_v1, num_bytes);
+    cudaMalloc((void**)&d_b_w1, num_bytes);
+    SetDeviceConstValue(DH, DT, nxt, nyt, nzt);
+    cudaStreamCreate(&stream_1);
+    cudaStreamCreate(&stream_2);
+    cudaStreamCreate(&stream_i);
+  }
+#endif
+  // the velocity halo always moves between the same buffers and neighbours
+  // on-node neighbours are served through the shared window instead (SHMEM)
+  InitMsg_Y(RF_vel, RB_vel, SF_vel, SB_vel, MCW, request_y, msg_v_size_y, type_y, shm_nbr[2] < 0 ? y_rank_F : -1, shm_nbr[3] < 0 ? y_rank_B : -1, rank);
+  InitMsg_X(RL_vel, RR_vel, SL_vel, SR_vel, MCW, request_x, msg_v_size_x, type_x, shm_nbr[0] < 0 ? x_rank_L : -1, shm_nbr[1] < 0 ? x_rank_R : -1, rank);
+  InitMsg_Z((float*)MPI_BOTTOM, (float*)MPI_BOTTOM, (float*)MPI_BOTTOM, (float*)MPI_BOTTOM, MCW, request_z, 1, type_z, z_rank_D, z_rank_U, rank);
+
+  // the chk file point (ND, ND) lies ND below the surface, on whichever rank holds it
+  for (chk_coord[0] = 0; part_x[chk_coord[0] + 1] <= ND; chk_coord[0]++)
+    ;
+  for (chk_coord[1] = 0; part_y[chk_coord[1] + 1] <= ND; chk_coord[1]++)
+    ;
+  for (chk_coord[2] = 0; part_z[chk_coord[2] + 1] <= ND; chk_coord[2]++)
+    ;
+  MPI_Cart_rank(MC1, chk_coord, &chk_rank);
 
   if (rank == 0)
     fchk = fopen(CHKFILE, "a+");
   //  Main Loop Starts
-  if (NPC == 0 && NVE == 1) {
+  for (ens = 0; ens < nens; ens += nrun) {
+    if (ens > 0) {
+      // next runs of the ensemble: new source and output names, wavefields and memory variables
+      // back to zero; media, absorbing boundary and communication stay as they are
+      if (OUTFMT == 1) {
+        // the last window of the containers has to be in before they are closed
+        MPI_Waitall(nwreq, wreq, MPI_STATUSES_IGNORE);
+        for (c = 0; c < nwreq; c++)
+          if (wfh[c] != MPI_FILE_NULL) MPI_File_close(&wfh[c]);
+        nwreq = 0;
+        for (r = 0; r < nrun; r++) MPI_File_close(&cfh[r]);
+      }
+      MPI_Barrier(MCW);
+      for (r = 0; r < nrun; r++) {
+        if (rank == srcproc[r]) {
+          Delloc1D(taxx[r]);
+          Delloc1D(tayy[r]);
+          Delloc1D(tazz[r]);
+          Delloc1D(taxz[r]);
+          Delloc1D(tayz[r]);
+          Delloc1D(taxy[r]);
+          Delloc1P(tpsrc[r]);
+#ifndef NOCUDA
+          if (BACKEND == BACKEND_GPU) {
+            cudaFree(d_taxx);
+            cudaFree(d_tayy);
+            cudaFree(d_tazz);
+            cudaFree(d_taxz);
+            cudaFree(d_tayz);
+            cudaFree(d_taxy);
+            cudaFree(d_tpsrc);
+          }
+#endif
+        }
+      }
+      // the last sweep may hold fewer runs, the kernels then skip the spare wavefields
+      nrun = (nens - ens < nrhs ? nens - ens : nrhs);
+      for (r = 0; r < nrun; r++) {
+        readens(ENSEMBLE, ens + r, MCW, INSRC, OUT, INSRC_I2);
+        strcpy(ensrc[r], INSRC);
+        strcpy(ensout[r], OUT);
+        if (strlen(OUT) + snprintf(NULL, 0, "/SX%07ld", nt) >= sizeof(filename)) {
+          if (rank == 0) printf("output directory %s is too long for the names of its files\n", OUT);
+          fflush(stdout);
+          MPI_Barrier(MCW);
+          MPI_Abort(MPI_COMM_WORLD, 1);
+          return -1;
+        }
+        snprintf(filenamebasex[r], sizeof(filenamebasex[r]), "%s/SX", OUT);
+        snprintf(filenamebasey[r], sizeof(filenamebasey[r]), "%s/SY", OUT);
+        snprintf(filenamebasez[r], sizeof(filenamebasez[r]), "%s/SZ", OUT);
+        err = inisource(rank, IFAULT, NSRC, READ_STEP, NST, &srcproc[r], NZ, MCW, nxt, nyt, nzt, offs, maxdim, &npsrc[r], &tpsrc[r], &taxx[r], &tayy[r], &tazz[r], &taxz[r], &tayz[r], &taxy[r], INSRC, INSRC_I2);
+        if (err) {
+          printf("source initialization failed\n");
+          return -1;
+        }
+      }
+
+      num_bytes = sizeof(float) * nrhs * (nxt + 4 + 8 * loop) * (nyt + 4 + 8 * loop) * (nzt + 2 * align);
+      memset(u1.data, 0, num_bytes);
+      memset(v1.data, 0, num_bytes);
+      memset(w1.data, 0, num_bytes);
+      memset(xx.data, 0, num_bytes);
+      memset(yy.data, 0, num_bytes);
+      memset(zz.data, 0, num_bytes);
+      memset(xy.data, 0, num_bytes);
+      memset(yz.data, 0, num_bytes);
+      memset(xz.data, 0, num_bytes);
+      if (NVE == 1) {
+        memset(r1.data, 0, num_bytes);
+        memset(r2.data, 0, num_bytes);
+        memset(r3.data, 0, num_bytes);
+        memset(r4.data, 0, num_bytes);
+        memset(r5.data, 0, num_bytes);
+        memset(r6.data, 0, num_bytes);
+      }
+      if (BACKEND == BACKEND_CPU) {
+        SetHostRhs(nrun, (long int)(nxt + 2 * halo_xy) * xx.slice);
+        if (NPC == 1) SetHostPml(pmlax, pmlbx, pmlay, pmlby, pmlaz, pmlbz);
+      }
+      source_step = 1;
+      tb_left = 0;
+      for (r = 0; r < nrun; r++)
+        if (rank == srcproc[r]) addsrc(source_step, DH, DT, NST, npsrc[r], READ_STEP, maxdim, tpsrc[r], taxx[r], tayy[r], tazz[r], taxz[r], tayz[r], taxy[r], Rhs3D(xx, r, nxt), Rhs3D(yy, r, nxt), Rhs3D(zz, r, nxt), Rhs3D(xy, r, nxt), Rhs3D(yz, r, nxt), Rhs3D(xz, r, nxt));
+#ifndef NOCUDA
+      if (BACKEND == BACKEND_GPU) {
+        if (rank == srcproc[0]) {
+          num_bytes = sizeof(float) * npsrc[0] * READ_STEP_GPU;
+          cudaMalloc((void**)&d_taxx, num_bytes);
+          cudaMalloc((void**)&d_tayy, num_bytes);
+          cudaMalloc((void**)&d_tazz, num_bytes);
+          cudaMalloc((void**)&d_taxz, num_bytes);
+          cudaMalloc((void**)&d_tayz, num_bytes);
+          cudaMalloc((void**)&d_taxy, num_bytes);
+          cudaMemcpy(d_taxx, taxx[0], num_bytes, cudaMemcpyHostToDevice);
+          cudaMemcpy(d_tayy, tayy[0], num_bytes, cudaMemcpyHostToDevice);
+          cudaMemcpy(d_tazz, tazz[0], num_bytes, cudaMemcpyHostToDevice);
+          cudaMemcpy(d_taxz, taxz[0], num_bytes, cudaMemcpyHostToDevice);
+          cudaMemcpy(d_tayz, tayz[0], num_bytes, cudaMemcpyHostToDevice);
+          cudaMemcpy(d_taxy, taxy[0], num_bytes, cudaMemcpyHostToDevice);
+          num_bytes = sizeof(int) * npsrc[0] * maxdim;
+          cudaMalloc((void**)&d_tpsrc, num_bytes);
+          cudaMemcpy(d_tpsrc, tpsrc[0], num_bytes, cudaMemcpyHostToDevice);
+        }
+        num_bytes = sizeof(float) * (nxt + 4 + 8 * loop) * (nyt + 4 + 8 * loop) * (nzt + 2 * align);
+        cudaMemcpy(d_u1, u1.data, num_bytes, cudaMemcpyHostToDevice);
+        cudaMemcpy(d_v1, v1.data, num_bytes, cudaMemcpyHostToDevice);
+        cudaMemcpy(d_w1, w1.data, num_bytes, cudaMemcpyHostToDevice);
+        cudaMemcpy(d_xx, xx.data, num_bytes, cudaMemcpyHostToDevice);
+        cudaMemcpy(d_yy, yy.data, num_bytes, cudaMemcpyHostToDevice);
+        cudaMemcpy(d_zz, zz.data, num_bytes, cudaMemcpyHostToDevice);
+        cudaMemcpy(d_xy, xy.data, num_bytes, cudaMemcpyHostToDevice);
+        cudaMemcpy(d_xz, xz.data, num_bytes, cudaMemcpyHostToDevice);
+        cudaMemcpy(d_yz, yz.data, num_bytes, cudaMemcpyHostToDevice);
+        if (NVE == 1) {
+          cudaMemcpy(d_r1, r1.data, num_bytes, cudaMemcpyHostToDevice);
+          cudaMemcpy(d_r2, r2.data, num_bytes, cudaMemcpyHostToDevice);
+          cudaMemcpy(d_r3, r3.data, num_bytes, cudaMemcpyHostToDevice);
+          cudaMemcpy(d_r4, r4.data, num_bytes, cudaMemcpyHostToDevice);
+          cudaMemcpy(d_r5, r5.data, num_bytes, cudaMemcpyHostToDevice);
+          cudaMemcpy(d_r6, r6.data, num_bytes, cudaMemcpyHostToDevice);
+        }
+      }
+#endif
+      MPI_Barrier(MCW);
+    }
+    if (OUTFMT == 1) {
+      for (r = 0; r < nrun; r++) {
+        if (snprintf(filename, sizeof(filename), "%s/%s", ensout[r], nsta > 0 ? "STXYZ" : "SXYZ") >= (int)sizeof(filename)) {
+          if (rank == 0) printf("output directory %s is too long for the container name\n", ensout[r]);
+          MPI_Finalize();
+          return -1;
+        }
+        if (openout(filename, MCW, oinfo, &ohdr, ztile, &cfh[r])) {
+          MPI_Finalize();
+          return -1;
+        }
+        ztop[r] = ohdr.data;
+      }
+    }
+    if (rank == 0 && ENSEMBLE[0]) {
+      for (r = 0; r < nrun; r++) {
+        printf("ensemble run %d of %d: %s -> %s\n", ens + r + 1, nens, ensrc[r], ensout[r]);
+        fprintf(fchk, "ENSEMBLE RUN %d:\t%s\t%s\n", ens + r + 1, ensrc[r], ensout[r]);
+      }
+    }
     time_un -= gethrtime();
-    // This loop has no loverlapping because there is source input
+    // with OVERLAP the halo messages travel while the interior is updated; sources are added
+    // after the last stress slab, so the overlap holds while they are active
     for (cur_step = 1; cur_step <= nt; cur_step++) {
       if (rank == 0) {
         printf("Time Step =                   %ld    OF  Total Timesteps = %ld\n", cur_step, nt);
         if (cur_step == 100 || cur_step % 1000 == 0)
           printf("Time per timestep:\t%lf seconds\n", (gethrtime() + time_un) / cur_step);
       }
-      cerr = cudaGetLastError();
-      if (cerr != cudaSuccess) printf("CUDA ERROR! rank=%d before timestep: %s\n", rank, cudaGetErrorString(cerr));
-      // pre-post MPI Message
-      PostRecvMsg_Y(RF_vel, RB_vel, MCW, request_y, &count_y, msg_v_size_y, y_rank_F, y_rank_B);
-      PostRecvMsg_X(RL_vel, RR_vel, MCW, request_x, &count_x, msg_v_size_x, x_rank_L, x_rank_R);
-      // velocity computation in y boundary, two ghost cell regions
-      dvelcy_H(d_u1, d_v1, d_w1, d_xx, d_yy, d_zz, d_xy, d_xz, d_yz, d_dcrjx, d_dcrjy, d_dcrjz, d_d1, nxt, nzt, d_f_u1, d_f_v1, d_f_w1, stream_i, yfs, yfe, y_rank_F);
-      dvelcy_H(d_u1, d_v1, d_w1, d_xx, d_yy, d_zz, d_xy, d_xz, d_yz, d_dcrjx, d_dcrjy, d_dcrjz, d_d1, nxt, nzt, d_b_u1, d_b_v1, d_b_w1, stream_i, ybs, ybe, y_rank_B);
-      Cpy2Host_VY(d_f_u1, d_f_v1, d_f_w1, SF_vel, nxt, nzt, stream_i, y_rank_F);
-      Cpy2Host_VY(d_b_u1, d_b_v1, d_b_w1, SB_vel, nxt, nzt, stream_i, y_rank_B);
-      cudaThreadSynchronize();
-      // velocity communication in y direction
-      PostSendMsg_Y(SF_vel, SB_vel, MCW, request_y, &count_y, msg_v_size_y, y_rank_F, y_rank_B, rank, Both);
-      MPI_Waitall(count_y, request_y, status_y);
-      Cpy2Device_VY(d_u1, d_v1, d_w1, d_f_u1, d_f_v1, d_f_w1, d_b_u1, d_b_v1, d_b_w1, RF_vel, RB_vel, nxt, nyt, nzt, stream_i, stream_i, y_rank_F, y_rank_B);
-      // velocity computation whole 3D Grid (nxt, nyt, nzt)
-      dvelcx_H(d_u1, d_v1, d_w1, d_xx, d_yy, d_zz, d_xy, d_xz, d_yz, d_dcrjx, d_dcrjy, d_dcrjz, d_d1, nyt, nzt, stream_i, xvs, xve);
-      Cpy2Host_VX(d_u1, d_v1, d_w1, SL_vel, nxt, nyt, nzt, stream_i, x_rank_L, Left);
-      Cpy2Host_VX(d_u1, d_v1, d_w1, SR_vel, nxt, nyt, nzt, stream_i, x_rank_R, Right);
-      cudaThreadSynchronize();
-      // velocity communication in x direction
-      PostSendMsg_X(SL_vel, SR_vel, MCW, request_x, &count_x, msg_v_size_x, x_rank_L, x_rank_R, rank, Both);
-      MPI_Waitall(count_x, request_x, status_x);
-      Cpy2Device_VX(d_u1, d_v1, d_w1, RL_vel, RR_vel, nxt, nyt, nzt, stream_i, stream_i, x_rank_L, x_rank_R);
-      // stress computation whole 3D Grid (nxt+4, nyt+4, nzt)
-      dstrqc_H(d_xx, d_yy, d_zz, d_xy, d_xz, d_yz, d_r1, d_r2, d_r3, d_r4, d_r5, d_r6, d_u1, d_v1, d_w1, d_lam, d_mu, d_qp, d_qs, d_dcrjx, d_dcrjy, d_dcrjz, nyt, nzt, stream_i, d_lam_mu, NX, coord[0], coord[1], xls, xre, yls, yre);
-      // update source input
-      if (rank == srcproc && cur_step < NST) {
-        ++source_step;
-        addsrc_H(source_step, READ_STEP_GPU, maxdim, d_tpsrc, npsrc, stream_i, d_taxx, d_tayy, d_tazz, d_taxz, d_tayz, d_taxy, d_xx, d_yy, d_zz, d_xy, d_yz, d_xz);
+      if (BACKEND == BACKEND_CPU && TBLOCK > 1) {
+        // temporal blocking: advance up to TBLOCK steps at once, ending each block on a step
+        // after which the wavefield is sampled for output or new source data is loaded
+        if (tb_left == 0) {
+          tb_n = 1;
+          while (tb_n < TBLOCK && cur_step + tb_n - 1 < nt && (cur_step + tb_n - 1) % NTISKP != 0 && !(IFAULT == 2 && (cur_step + tb_n) % READ_STEP_GPU == 0)) tb_n++;
+          src_n = 0;
+          if (rank == srcproc[0] && cur_step < NST) src_n = (NST - cur_step < tb_n ? NST - cur_step : tb_n);
+          dtile_C(d_u1, d_v1, d_w1, d_xx, d_yy, d_zz, d_xy, d_xz, d_yz, d_r1, d_r2, d_r3, d_r4, d_r5, d_r6, d_lam, d_mu, d_qp, d_qs, d_dcrjx, d_dcrjy, d_dcrjz, d_d1, d_lam_mu, NX, offs[0], offs[1], xls, xre, yls, yre, tb_n, TILE, source_step, src_n, npsrc[0], tpsrc[0], maxdim, READ_STEP, taxx[0], tayy[0], tazz[0], taxz[0], tayz[0], taxy[0], DH, DT);
+          source_step += src_n;
+          tb_left = tb_n;
+        }
+        tb_left--;
+      } else if (BACKEND == BACKEND_CPU && OVERLAP) {
+        // on-node neighbours are done reading last step's boundary planes
+        if (SHMEM) ShmSync(MCS, win_vel, shm_nbr);
+        // pre-post MPI Message
+        StartRecvMsg(request_y);
+        StartRecvMsg(request_x);
+        // velocity computation in y boundary first, the y messages are sent from the grid
+        dvelcx_C(d_u1, d_v1, d_w1, d_xx, d_yy, d_zz, d_xy, d_xz, d_yz, d_dcrjx, d_dcrjy, d_dcrjz, d_d1, xvs, xve, yfs, yfe);
+        dvelcx_C(d_u1, d_v1, d_w1, d_xx, d_yy, d_zz, d_xy, d_xz, d_yz, d_dcrjx, d_dcrjy, d_dcrjz, d_d1, xvs, xve, ybs, ybe);
+        StartSendMsg(request_y, Both);
+        // velocity computation in the rest of the 3D Grid only reads stress, overlapping y communication
+        dvelcx_C(d_u1, d_v1, d_w1, d_xx, d_yy, d_zz, d_xy, d_xz, d_yz, d_dcrjx, d_dcrjy, d_dcrjz, d_d1, xvs, xve, yfe + 1, ybs - 1);
+        if (SHMEM) {
+          ShmSync(MCS, win_vel, shm_nbr);
+          ShmCopy_Y(vel, vel_F, vel_B, 3, nyt, 2 + 4 * loop, nxt, align, nzt, shm_nbr[2], shm_nbr[3]);
+        }
+        MPI_Waitall(4, request_y, status_y);
+        // x messages carry the y ghost rows as well, so they start after the y receives
+        StartSendMsg(request_x, Both);
+        if (SHMEM) {
+          ShmSync(MCS, win_vel, shm_nbr);
+          ShmCopy_X(vel, vel_L, vel_R, 3, nxt, 2, nyt + 8 * loop, align, nzt, shm_nbr[0], shm_nbr[1]);
+        }
+        // stress computation in the inner part, which needs no x ghost velocities, overlapping x communication
+        dstrqc_C(d_xx, d_yy, d_zz, d_xy, d_xz, d_yz, d_r1, d_r2, d_r3, d_r4, d_r5, d_r6, d_u1, d_v1, d_w1, d_lam, d_mu, d_qp, d_qs, d_dcrjx, d_dcrjy, d_dcrjz, d_lam_mu, NX, offs[0], offs[1], xss2, xse2, yls, yre);
+        MPI_Waitall(4, request_x, status_x);
+        // stress computation in the left and right slabs, including the ghost cells
+        dstrqc_C(d_xx, d_yy, d_zz, d_xy, d_xz, d_yz, d_r1, d_r2, d_r3, d_r4, d_r5, d_r6, d_u1, d_v1, d_w1, d_lam, d_mu, d_qp, d_qs, d_dcrjx, d_dcrjy, d_dcrjz, d_lam_mu, NX, offs[0], offs[1], xss1, xse1, yls, yre);
+        dstrqc_C(d_xx, d_yy, d_zz, d_xy, d_xz, d_yz, d_r1, d_r2, d_r3, d_r4, d_r5, d_r6, d_u1, d_v1, d_w1, d_lam, d_mu, d_qp, d_qs, d_dcrjx, d_dcrjy, d_dcrjz, d_lam_mu, NX, offs[0], offs[1], xss3, xse3, yls, yre);
+        // update source input once every slab has its new stress
+        if (cur_step < NST) {
+          ++source_step;
+          for (r = 0; r < nrun; r++)
+            if (rank == srcproc[r]) addsrc(source_step, DH, DT, NST, npsrc[r], READ_STEP, maxdim, tpsrc[r], taxx[r], tayy[r], tazz[r], taxz[r], tayz[r], taxy[r], Rhs3D(xx, r, nxt), Rhs3D(yy, r, nxt), Rhs3D(zz, r, nxt), Rhs3D(xy, r, nxt), Rhs3D(yz, r, nxt), Rhs3D(xz, r, nxt));
+        }
+      } else if (BACKEND == BACKEND_CPU) {
+        if (SHMEM) ShmSync(MCS, win_vel, shm_nbr);
+        // pre-post MPI Message
+        StartRecvMsg(request_y);
+        StartRecvMsg(request_x);
+        StartRecvMsg(request_z);
+        // velocity computation whole 3D Grid (nxt, nyt, nzt)
+        dvelcx_C(d_u1, d_v1, d_w1, d_xx, d_yy, d_zz, d_xy, d_xz, d_yz, d_dcrjx, d_dcrjy, d_dcrjz, d_d1, xvs, xve, yfs, ybe);
+        // velocity communication in y direction
+        StartSendMsg(request_y, Both);
+        if (SHMEM) {
+          ShmSync(MCS, win_vel, shm_nbr);
+          ShmCopy_Y(vel, vel_F, vel_B, 3, nyt, 2 + 4 * loop, nxt, align, nzt, shm_nbr[2], shm_nbr[3]);
+        }
+        MPI_Waitall(4, request_y, status_y);
+        // velocity communication in x direction
+        StartSendMsg(request_x, Both);
+        if (SHMEM) {
+          ShmSync(MCS, win_vel, shm_nbr);
+          ShmCopy_X(vel, vel_L, vel_R, 3, nxt, 2, nyt + 8 * loop, align, nzt, shm_nbr[0], shm_nbr[1]);
+        }
+        MPI_Waitall(4, request_x, status_x);
+        // velocity communication in z direction, including the x and y ghost columns
+        StartSendMsg(request_z, Both);
+        MPI_Waitall(4, request_z, status_z);
+        // stress computation whole 3D Grid (nxt+4, nyt+4, nzt), plus the z ghost layers of a stacked rank
+        dstrqc_C(d_xx, d_yy, d_zz, d_xy, d_xz, d_yz, d_r1, d_r2, d_r3, d_r4, d_r5, d_r6, d_u1, d_v1, d_w1, d_lam, d_mu, d_qp, d_qs, d_dcrjx, d_dcrjy, d_dcrjz, d_lam_mu, NX, offs[0], offs[1], xls, xre, yls, yre);
+        // update source input
+        if (cur_step < NST) {
+          ++source_step;
+          for (r = 0; r < nrun; r++)
+            if (rank == srcproc[r]) addsrc(source_step, DH, DT, NST, npsrc[r], READ_STEP, maxdim, tpsrc[r], taxx[r], tayy[r], tazz[r], taxz[r], tayz[r], taxy[r], Rhs3D(xx, r, nxt), Rhs3D(yy, r, nxt), Rhs3D(zz, r, nxt), Rhs3D(xy, r, nxt), Rhs3D(yz, r, nxt), Rhs3D(xz, r, nxt));
+        }
+      }
+#ifndef NOCUDA
+      if (BACKEND == BACKEND_GPU && OVERLAP) {
+        cerr = cudaGetLastError();
+        if (cerr != cudaSuccess) printf("CUDA ERROR! rank=%d before timestep: %s\n", rank, cudaGetErrorString(cerr));
+        // pre-post MPI Message
+        StartRecvMsg(request_y);
+        StartRecvMsg(request_x);
+        // velocity computation in y boundary, two ghost cell regions, two different streams to control
+        dvelcy_H(d_u1, d_v1, d_w1, d_xx, d_yy, d_zz, d_xy, d_xz, d_yz, d_dcrjx, d_dcrjy, d_dcrjz, d_d1, nxt, nzt, d_f_u1, d_f_v1, d_f_w1, stream_1, yfs, yfe, y_rank_F);
+        Cpy2Host_VY(d_f_u1, d_f_v1, d_f_w1, SF_vel, nxt, nzt, stream_1, y_rank_F);
+        dvelcy_H(d_u1, d_v1, d_w1, d_xx, d_yy, d_zz, d_xy, d_xz, d_yz, d_dcrjx, d_dcrjy, d_dcrjz, d_d1, nxt, nzt, d_b_u1, d_b_v1, d_b_w1, stream_2, ybs, ybe, y_rank_B);
+        Cpy2Host_VY(d_b_u1, d_b_v1, d_b_w1, SB_vel, nxt, nzt, stream_2, y_rank_B);
+        // velocity computation whole 3D Grid (nxt, nyt, nzt), overlapping the copies and y communication
+        dvelcx_H(d_u1, d_v1, d_w1, d_xx, d_yy, d_zz, d_xy, d_xz, d_yz, d_dcrjx, d_dcrjy, d_dcrjz, d_d1, nyt, nzt, stream_i, xvs, xve);
+        cudaStreamSynchronize(stream_1);
+        StartSendMsg(request_y, Front);
+        cudaStreamSynchronize(stream_2);
+        StartSendMsg(request_y, Back);
+        MPI_Waitall(4, request_y, status_y);
+        Cpy2Device_VY(d_u1, d_v1, d_w1, d_f_u1, d_f_v1, d_f_w1, d_b_u1, d_b_v1, d_b_w1, RF_vel, RB_vel, nxt, nyt, nzt, stream_1, stream_2, y_rank_F, y_rank_B);
+        cudaThreadSynchronize();
+        // x messages carry the y ghost rows; copy them out before the stress kernels rewrite the free surface ghosts
+        Cpy2Host_VX(d_u1, d_v1, d_w1, SL_vel, nxt, nyt, nzt, stream_1, x_rank_L, Left);
+        Cpy2Host_VX(d_u1, d_v1, d_w1, SR_vel, nxt, nyt, nzt, stream_2, x_rank_R, Right);
+        cudaStreamSynchronize(stream_1);
+        StartSendMsg(request_x, Left);
+        cudaStreamSynchronize(stream_2);
+        StartSendMsg(request_x, Right);
+        // stress computation in the inner part, overlapping x communication
+        dstrqc_H(d_xx, d_yy, d_zz, d_xy, d_xz, d_yz, d_r1, d_r2, d_r3, d_r4, d_r5, d_r6, d_u1, d_v1, d_w1, d_lam, d_mu, d_qp, d_qs, d_dcrjx, d_dcrjy, d_dcrjz, nyt, nzt, stream_i, d_lam_mu, NX, coord[0], coord[1], xss2, xse2, yls, yre);
+        MPI_Waitall(4, request_x, status_x);
+        Cpy2Device_VX(d_u1, d_v1, d_w1, RL_vel, RR_vel, nxt, nyt, nzt, stream_1, stream_2, x_rank_L, x_rank_R);
+        // stress computation in ghost cells
+        dstrqc_H(d_xx, d_yy, d_zz, d_xy, d_xz, d_yz, d_r1, d_r2, d_r3, d_r4, d_r5, d_r6, d_u1, d_v1, d_w1, d_lam, d_mu, d_qp, d_qs, d_dcrjx, d_dcrjy, d_dcrjz, nyt, nzt, stream_1, d_lam_mu, NX, coord[0], coord[1], xss1, xse1, yls, yre);
+        dstrqc_H(d_xx, d_yy, d_zz, d_xy, d_xz, d_yz, d_r1, d_r2, d_r3, d_r4, d_r5, d_r6, d_u1, d_v1, d_w1, d_lam, d_mu, d_qp, d_qs, d_dcrjx, d_dcrjy, d_dcrjz, nyt, nzt, stream_2, d_lam_mu, NX, coord[0], coord[1], xss3, xse3, yls, yre);
+        // update source input once all three stress kernels are done
+        if (rank == srcproc[0] && cur_step < NST) {
+          cudaThreadSynchronize();
+          ++source_step;
+          addsrc_H(source_step, READ_STEP_GPU, maxdim, d_tpsrc, npsrc[0], stream_i, d_taxx, d_tayy, d_tazz, d_taxz, d_tayz, d_taxy, d_xx, d_yy, d_zz, d_xy, d_yz, d_xz);
+        }
+        cudaThreadSynchronize();
+      } else if (BACKEND == BACKEND_GPU) {
+        cerr = cudaGetLastError();
+        if (cerr != cudaSuccess) printf("CUDA ERROR! rank=%d before timestep: %s\n", rank, cudaGetErrorString(cerr));
+        // pre-post MPI Message
+        StartRecvMsg(request_y);
+        StartRecvMsg(request_x);
+        // velocity computation in y boundary, two ghost cell regions
+        dvelcy_H(d_u1, d_v1, d_w1, d_xx, d_yy, d_zz, d_xy, d_xz, d_yz, d_dcrjx, d_dcrjy, d_dcrjz, d_d1, nxt, nzt, d_f_u1, d_f_v1, d_f_w1, stream_i, yfs, yfe, y_rank_F);
+        dvelcy_H(d_u1, d_v1, d_w1, d_xx, d_yy, d_zz, d_xy, d_xz, d_yz, d_dcrjx, d_dcrjy, d_dcrjz, d_d1, nxt, nzt, d_b_u1, d_b_v1, d_b_w1, stream_i, ybs, ybe, y_rank_B);
+        Cpy2Host_VY(d_f_u1, d_f_v1, d_f_w1, SF_vel, nxt, nzt, stream_i, y_rank_F);
+        Cpy2Host_VY(d_b_u1, d_b_v1, d_b_w1, SB_vel, nxt, nzt, stream_i, y_rank_B);
+        cudaThreadSynchronize();
+        // velocity communication in y direction
+        StartSendMsg(request_y, Both);
+        MPI_Waitall(4, request_y, status_y);
+        Cpy2Device_VY(d_u1, d_v1, d_w1, d_f_u1, d_f_v1, d_f_w1, d_b_u1, d_b_v1, d_b_w1, RF_vel, RB_vel, nxt, nyt, nzt, stream_i, stream_i, y_rank_F, y_rank_B);
+        // velocity computation whole 3D Grid (nxt, nyt, nzt)
+        dvelcx_H(d_u1, d_v1, d_w1, d_xx, d_yy, d_zz, d_xy, d_xz, d_yz, d_dcrjx, d_dcrjy, d_dcrjz, d_d1, nyt, nzt, stream_i, xvs, xve);
+        Cpy2Host_VX(d_u1, d_v1, d_w1, SL_vel, nxt, nyt, nzt, stream_i, x_rank_L, Left);
+        Cpy2Host_VX(d_u1, d_v1, d_w1, SR_vel, nxt, nyt, nzt, stream_i, x_rank_R, Right);
+        cudaThreadSynchronize();
+        // velocity communication in x direction
+        StartSendMsg(request_x, Both);
+        MPI_Waitall(4, request_x, status_x);
+        Cpy2Device_VX(d_u1, d_v1, d_w1, RL_vel, RR_vel, nxt, nyt, nzt, stream_i, stream_i, x_rank_L, x_rank_R);
+        // stress computation whole 3D Grid (nxt+4, nyt+4, nzt)
+        dstrqc_H(d_xx, d_yy, d_zz, d_xy, d_xz, d_yz, d_r1, d_r2, d_r3, d_r4, d_r5, d_r6, d_u1, d_v1, d_w1, d_lam, d_mu, d_qp, d_qs, d_dcrjx, d_dcrjy, d_dcrjz, nyt, nzt, stream_i, d_lam_mu, NX, coord[0], coord[1], xls, xre, yls, yre);
+        // update source input
+        if (rank == srcproc[0] && cur_step < NST) {
+          ++source_step;
+          addsrc_H(source_step, READ_STEP_GPU, maxdim, d_tpsrc, npsrc[0], stream_i, d_taxx, d_tayy, d_tazz, d_taxz, d_tayz, d_taxy, d_xx, d_yy, d_zz, d_xy, d_yz, d_xz);
+        }
+        cudaThreadSynchronize();
       }
-      cudaThreadSynchronize();
+#endif
 
       if (cur_step % NTISKP == 0) {
-        num_bytes = sizeof(float) * (nxt + 4 + 8 * loop) * (nyt + 4 + 8 * loop) * (nzt + 2 * align);
-        cudaMemcpy(&u1[0][0][0], d_u1, num_bytes, cudaMemcpyDeviceToHost);
-        cudaMemcpy(&v1[0][0][0], d_v1, num_bytes, cudaMemcpyDeviceToHost);
-        cudaMemcpy(&w1[0][0][0], d_w1, num_bytes, cudaMemcpyDeviceToHost);
-        idtmp = ((cur_step / NTISKP + WRITE_STEP - 1) % WRITE_STEP);
-        idtmp = idtmp * rec_nxt * rec_nyt * rec_nzt;
-        tmpInd = idtmp;
-        // if(rank==0) printf("idtmp=%ld\n", idtmp);
-        //  surface: k=nzt+align-1;
-        for (k = nzt + align - 1 - rec_nbgz; k >= nzt + align - 1 - rec_nedz; k = k - NSKPZ)
-          for (j = 2 + 4 * loop + rec_nbgy; j <= 2 + 4 * loop + rec_nedy; j = j + NSKPY)
-            for (i = 2 + 4 * loop + rec_nbgx; i <= 2 + 4 * loop + rec_nedx; i = i + NSKPX) {
-              // idx = (i-2-4*loop)/NSKPX;
-              // idy = (j-2-4*loop)/NSKPY;
-              // idz = ((nzt+align-1) - k)/NSKPZ;
-              // tmpInd = idtmp + idz*rec_nxt*rec_nyt + idy*rec_nxt + idx;
-              // if(rank==0) printf("%ld:%d,%d,%d\t",tmpInd,i,j,k);
-              Bufx[tmpInd] = u1[i][j][k];
-              Bufy[tmpInd] = v1[i][j][k];
-              Bufz[tmpInd] = w1[i][j][k];
-              tmpInd++;
-            }
+        // the backend packs the recording points of each wavefield straight into the half of the output
+        // buffers being filled: stations as [wavefield][station][WRITE_STEP], the box as
+        // [wavefield][WRITE_STEP][point]
+        for (r = 0; r < nrun; r++) {
+          if (nsta > 0)
+            idtmp = (long int)r * nsloc * WRITE_STEP + (cur_step / NTISKP + WRITE_STEP - 1) % WRITE_STEP;
+          else
+            idtmp = (r * WRITE_STEP + ((cur_step / NTISKP + WRITE_STEP - 1) % WRITE_STEP)) * (long int)rec_nxt * rec_nyt * rec_nzt;
+          idtmp += half * obsz;
+#ifndef NOCUDA
+          if (BACKEND == BACKEND_GPU) dsamp_H(d_u1, d_v1, d_w1, d_sidx, nsidx, d_samp, stream_i, nsta > 0 ? WRITE_STEP : 1, obuf[0] + idtmp, obuf[1] + idtmp, obuf[2] + idtmp);
+#endif
+          if (BACKEND == BACKEND_CPU) dsamp_C(d_u1 + r * rhs_stride, d_v1 + r * rhs_stride, d_w1 + r * rhs_stride, sidx, nsidx, nsta > 0 ? WRITE_STEP : 1, obuf[0] + idtmp, obuf[1] + idtmp, obuf[2] + idtmp);
+        }
+        // keeps the writes of the previous window moving
+        if (nwreq) MPI_Testall(nwreq, wreq, &i, MPI_STATUSES_IGNORE);
         if ((cur_step / NTISKP) % WRITE_STEP == 0) {
-          cudaThreadSynchronize();
-          sprintf(filename, "%s%07ld", filenamebasex, cur_step);
-          err = MPI_File_open(MCW, filename, MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &fh);
-          err = MPI_File_set_view(fh, displacement, MPI_FLOAT, filetype, "native", MPI_INFO_NULL);
-          err = MPI_File_write_all(fh, Bufx, rec_nxt * rec_nyt * rec_nzt * WRITE_STEP, MPI_FLOAT, &filestatus);
-          err = MPI_File_close(&fh);
-          sprintf(filename, "%s%07ld", filenamebasey, cur_step);
-          err = MPI_File_open(MCW, filename, MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &fh);
-          err = MPI_File_set_view(fh, displacement, MPI_FLOAT, filetype, "native", MPI_INFO_NULL);
-          err = MPI_File_write_all(fh, Bufy, rec_nxt * rec_nyt * rec_nzt * WRITE_STEP, MPI_FLOAT, &filestatus);
-          err = MPI_File_close(&fh);
-          sprintf(filename, "%s%07ld", filenamebasez, cur_step);
-          err = MPI_File_open(MCW, filename, MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &fh);
-          err = MPI_File_set_view(fh, displacement, MPI_FLOAT, filetype, "native", MPI_INFO_NULL);
-          err = MPI_File_write_all(fh, Bufz, rec_nxt * rec_nyt * rec_nzt * WRITE_STEP, MPI_FLOAT, &filestatus);
-          err = MPI_File_close(&fh);
+          // the previous window had WRITE_STEP samples of stepping to drain; it has to be done before
+          // its half is filled again, then this window goes out from the half just filled
+          MPI_Waitall(nwreq, wreq, MPI_STATUSES_IGNORE);
+          for (c = 0; c < nwreq; c++)
+            if (wfh[c] != MPI_FILE_NULL) MPI_File_close(&wfh[c]);
+          nwreq = 0;
+          if (nio) {
+            // the aggregators write the files: the window goes to them, then the samples of the tile
+            // that each one writes, without waiting
+            iowin.step = cur_step;
+            iowin.nrun = nrun;
+            for (r = 0; r < nrun; r++) {
+              snprintf(iowin.name[r][0], sizeof(iowin.name[r][0]), "%s%07ld", filenamebasex[r], cur_step);
+              snprintf(iowin.name[r][1], sizeof(iowin.name[r][1]), "%s%07ld", filenamebasey[r], cur_step);
+              snprintf(iowin.name[r][2], sizeof(iowin.name[r][2]), "%s%07ld", filenamebasez[r], cur_step);
+            }
+            for (t = 0; t < nio; t++) {
+              if (rank == 0) {
+                wfh[nwreq] = MPI_FILE_NULL;
+                MPI_Isend(&iowin, sizeof(IoWin), MPI_BYTE, size + t, IOTAG, MPI_COMM_WORLD, &wreq[nwreq++]);
+              }
+              tmpInd = (long int)rec_nxt * rec_nyt * rec_nzt * ((t + 1) * WRITE_STEP / nio - t * WRITE_STEP / nio);
+              if (tmpInd == 0) continue;
+              for (r = 0; r < nrun; r++) {
+                idtmp = half * obsz + ((long int)r * WRITE_STEP + t * WRITE_STEP / nio) * rec_nxt * rec_nyt * rec_nzt;
+                for (c = 0; c < 3; c++) {
+                  wfh[nwreq] = MPI_FILE_NULL;
+                  MPI_Isend(obuf[c] + idtmp, tmpInd, MPI_FLOAT, size + t, 3 * r + c, MPI_COMM_WORLD, &wreq[nwreq++]);
+                }
+              }
+            }
+          }
+          for (r = 0; r < (nio ? 0 : nrun); r++) {
+            if (COMPRESS) {
+              // compressed: every rank codes its tile of the three components, the sizes of all
+              // tiles go ahead of the window so that a reader can seek to any tile
+              idtmp = half * obsz + (long int)r * rec_nxt * rec_nyt * rec_nzt * WRITE_STEP;
+              tmpInd = rec_nxt * rec_nyt * rec_nzt;
+#pragma omp parallel for
+              for (c = 0; c < 3; c++) zlen[c] = zpack(obuf[c] + idtmp, tmpInd, WRITE_STEP, COMPRESS, CTOL, zbuf + (r * 3 + c) * zcap);
+              MPI_Allgather(zlen, 3, MPI_LONG_LONG, zall + r * (2 + 3 * size) + 2, 3, MPI_LONG_LONG, MCW);
+              // rank 0 adds the window index entry and the sizes
+              zall[r * (2 + 3 * size)] = cur_step;
+              zall[r * (2 + 3 * size) + 1] = ztop[r];
+              i = 0;
+              if (rank == 0) {
+                zfd[0] = ohdr.index + 2 * sizeof(long long) * (cur_step / NTISKP / WRITE_STEP - 1);
+                zbl[0] = 2 * sizeof(long long);
+                zfd[1] = ztop[r];
+                zbl[1] = 3 * sizeof(long long) * size;
+                MPI_Get_address(zall + r * (2 + 3 * size), &zmd[0]);
+                zmd[1] = zmd[0] + zbl[0];
+                i = 2;
+              }
+              ztop[r] += 3 * sizeof(long long) * size;
+              for (c = 0; c < 3; c++) {
+                for (t = 0; t < size; t++) {
+                  if (t == rank) zfd[i + c] = ztop[r];
+                  ztop[r] += zall[r * (2 + 3 * size) + 2 + 3 * t + c];
+                }
+                zbl[i + c] = zlen[c];
+                MPI_Get_address(zbuf + (r * 3 + c) * zcap, &zmd[i + c]);
+                zraw += sizeof(float) * tmpInd * WRITE_STEP;
+                zout += zlen[c];
+              }
+              MPI_Type_create_hindexed(i + 3, zbl, zfd, MPI_BYTE, &zftype);
+              MPI_Type_commit(&zftype);
+              MPI_Type_create_hindexed(i + 3, zbl, zmd, MPI_BYTE, &mtype);
+              MPI_Type_commit(&mtype);
+              err = MPI_File_set_view(cfh[r], 0, MPI_BYTE, zftype, "native", MPI_INFO_NULL);
+              wfh[nwreq] = MPI_FILE_NULL;
+              tmpInd = (rank == 0 ? zbl[0] + zbl[1] : 0) + zlen[0] + zlen[1] + zlen[2];
+#if MPI_VERSION > 3 || (MPI_VERSION == 3 && MPI_SUBVERSION >= 1)
+              err = MPI_File_iwrite_all(cfh[r], MPI_BOTTOM, tmpInd > 0, mtype, &wreq[nwreq]);
+#else
+              err = MPI_File_write_all(cfh[r], MPI_BOTTOM, tmpInd > 0, mtype, &filestatus);
+              wreq[nwreq] = MPI_REQUEST_NULL;
+#endif
+              MPI_Type_free(&zftype);
+              MPI_Type_free(&mtype);
+              nwreq++;
+              continue;
+            }
+            if (OUTFMT == 1) {
+              // container: the three components of this window in one write, from the three buffers
+              if (nsta > 0) {
+                err = MPI_File_set_view(cfh[r], ohdr.data + (MPI_Offset)sizeof(float) * (cur_step / NTISKP - WRITE_STEP), MPI_FLOAT, ctype, "native", MPI_INFO_NULL);
+                idtmp = half * obsz + (long int)r * nsloc * WRITE_STEP;
+                tmpInd = nsloc * WRITE_STEP;
+              } else {
+                err = MPI_File_set_view(cfh[r], ohdr.data + (MPI_Offset)(cur_step / NTISKP / WRITE_STEP - 1) * ohdr.ncomp * ohdr.chunk + displacement, MPI_FLOAT, ctype, "native", MPI_INFO_NULL);
+                idtmp = half * obsz + (long int)r * rec_nxt * rec_nyt * rec_nzt * WRITE_STEP;
+                tmpInd = rec_nxt * rec_nyt * rec_nzt * WRITE_STEP;
+              }
+              for (c = 0; c < 3; c++) {
+                MPI_Get_address(obuf[c] + idtmp, &cdisp[c]);
+                clen[c] = tmpInd;
+              }
+              MPI_Type_create_hindexed(3, clen, cdisp, MPI_FLOAT, &mtype);
+              MPI_Type_commit(&mtype);
+              wfh[nwreq] = MPI_FILE_NULL;
+#if MPI_VERSION > 3 || (MPI_VERSION == 3 && MPI_SUBVERSION >= 1)
+              err = MPI_File_iwrite_all(cfh[r], MPI_BOTTOM, tmpInd > 0, mtype, &wreq[nwreq]);
+#else
+              err = MPI_File_write_all(cfh[r], MPI_BOTTOM, tmpInd > 0, mtype, &filestatus);
+              wreq[nwreq] = MPI_REQUEST_NULL;
+#endif
+              MPI_Type_free(&mtype);
+              nwreq++;
+              continue;
+            }
+            for (c = 0; c < 3; c++) {
+              if (nsta > 0) {
+                // stations: each station's block at its place in the time series
+                snprintf(filename, sizeof(filename), "%s/%s", ensout[r], staname[c]);
+                err = MPI_File_open(MCW, filename, MPI_MODE_CREATE | MPI_MODE_WRONLY, oinfo, &wfh[nwreq]);
+                err = MPI_File_set_view(wfh[nwreq], (MPI_Offset)sizeof(float) * (cur_step / NTISKP - WRITE_STEP), MPI_FLOAT, statype, "native", MPI_INFO_NULL);
+                idtmp = half * obsz + (long int)r * nsloc * WRITE_STEP;
+                tmpInd = nsloc * WRITE_STEP;
+              } else {
+                snprintf(filename, sizeof(filename), "%s%07ld", c == 0 ? filenamebasex[r] : (c == 1 ? filenamebasey[r] : filenamebasez[r]), cur_step);
+                err = MPI_File_open(MCW, filename, MPI_MODE_CREATE | MPI_MODE_WRONLY, oinfo, &wfh[nwreq]);
+                err = MPI_File_set_view(wfh[nwreq], displacement, MPI_FLOAT, filetype, "native", MPI_INFO_NULL);
+                idtmp = half * obsz + (long int)r * rec_nxt * rec_nyt * rec_nzt * WRITE_STEP;
+                tmpInd = rec_nxt * rec_nyt * rec_nzt * WRITE_STEP;
+              }
+#if MPI_VERSION > 3 || (MPI_VERSION == 3 && MPI_SUBVERSION >= 1)
+              err = MPI_File_iwrite_all(wfh[nwreq], obuf[c] + idtmp, tmpInd, MPI_FLOAT, &wreq[nwreq]);
+#else
+              err = MPI_File_write_all(wfh[nwreq], obuf[c] + idtmp, tmpInd, MPI_FLOAT, &filestatus);
+              wreq[nwreq] = MPI_REQUEST_NULL;
+#endif
+              nwreq++;
+            }
+          }
+          half = 1 - half;
         }
         // else
         // cudaThreadSynchronize();
         // write-statistics to chk file:
+        if (rank == chk_rank) {
+          i = ND - offs[0] + 2 + 4 * loop;
+          j = ND - offs[1] + 2 + 4 * loop;
+          k = nzt + align - 1 - (ND - offs[2]);
+#ifndef NOCUDA
+          if (BACKEND == BACKEND_GPU) {
+            tmpInd = &G3(u1, i, j, k) - u1.data;
+            cudaMemcpy(&chk_vel[0], d_u1 + tmpInd, sizeof(float), cudaMemcpyDeviceToHost);
+            cudaMemcpy(&chk_vel[1], d_v1 + tmpInd, sizeof(float), cudaMemcpyDeviceToHost);
+            cudaMemcpy(&chk_vel[2], d_w1 + tmpInd, sizeof(float), cudaMemcpyDeviceToHost);
+          }
+#endif
+          if (BACKEND == BACKEND_CPU) {
+            chk_vel[0] = G3(u1, i, j, k);
+            chk_vel[1] = G3(v1, i, j, k);
+            chk_vel[2] = G3(w1, i, j, k);
+          }
+          if (rank != 0) MPI_Send(chk_vel, 3, MPI_FLOAT, 0, 0, MCW);
+        }
         if (rank == 0) {
-          i = ND + 2 + 4 * loop;
-          j = i;
-          k = nzt + align - 1 - ND;
-          fprintf(fchk, "%ld :\t%e\t%e\t%e\n", cur_step, u1[i][j][k], v1[i][j][k], w1[i][j][k]);
+          if (chk_rank != 0) MPI_Recv(chk_vel, 3, MPI_FLOAT, chk_rank, 0, MCW, MPI_STATUS_IGNORE);
+          fprintf(fchk, "%ld :\t%e\t%e\t%e\n", cur_step, chk_vel[0], chk_vel[1], chk_vel[2]);
           fflush(fchk);
         }
       }
       // else
       // cudaThreadSynchronize();
 
-      if ((cur_step < NST - 1) && (IFAULT == 2) && ((cur_step + 1) % READ_STEP_GPU == 0) && (rank == srcproc)) {
+      if ((cur_step < NST - 1) && (IFAULT == 2) && ((cur_step + 1) % READ_STEP_GPU == 0) && (rank == srcproc[0])) {
         printf("%d) Read new source from CPU.\n", rank);
         if ((cur_step + 1) % READ_STEP == 0) {
           printf("%d) Read new source from file.\n", rank);
-          read_src_ifault_2(rank, READ_STEP, INSRC, INSRC_I2, maxdim, coord, NZ, nxt, nyt, nzt, &npsrc, &srcproc, &tpsrc, &taxx, &tayy, &tazz, &taxz, &tayz, &taxy, (cur_step + 1) / READ_STEP + 1);
+          read_src_ifault_2(rank, READ_STEP, INSRC, INSRC_I2, maxdim, coord, NZ, nxt, nyt, nzt, &npsrc[0], &srcproc[0], &tpsrc[0], &taxx[0], &tayy[0], &tazz[0], &taxz[0], &tayz[0], &taxy[0], (cur_step + 1) / READ_STEP + 1);
+        }
+        printf("%d) SOURCE: taxx,xy,xz:%e,%e,%e\n", rank, taxx[0][cur_step % READ_STEP], taxy[0][cur_step % READ_STEP], taxz[0][cur_step % READ_STEP]);
+#ifndef NOCUDA
+        if (BACKEND == BACKEND_GPU) {
+          // Synchronous copy!
+          Cpy2Device_source(npsrc[0], READ_STEP_GPU, ((cur_step + 1) % READ_STEP), taxx[0], tayy[0], tazz[0], taxz[0], tayz[0], taxy[0], d_taxx, d_tayy, d_tazz, d_taxz, d_tayz, d_taxy);
+          source_step = 0;
         }
-        printf("%d) SOURCE: taxx,xy,xz:%e,%e,%e\n", rank, taxx[cur_step % READ_STEP], taxy[cur_step % READ_STEP], taxz[cur_step % READ_STEP]);
-        // Synchronous copy!
-        Cpy2Device_source(npsrc, READ_STEP_GPU, ((cur_step + 1) % READ_STEP), taxx, tayy, tazz, taxz, tayz, taxy, d_taxx, d_tayy, d_tazz, d_taxz, d_tayz, d_taxy);
-        source_step = 0;
+#endif
+        // the CPU backend indexes the host source arrays directly
+        if (BACKEND == BACKEND_CPU && (cur_step + 1) % READ_STEP == 0) source_step = 0;
       } /*
        if((cur_step<NST) && (cur_step%25==0) && (rank==srcproc)){
          printf("%d) SOURCE: taxx,xy,xz:%e,%e,%e\n",rank,
              taxx[cur_step],taxy[cur_step],taxz[cur_step]);
        }*/
     }
-    // This loop is purly stencil computation, overlapping are utilized here
-    // time_un  -= gethrtime();
-    /*
-           for(cur_step=cur_step;cur_step<=nt;cur_step++)
-           {
-             if(rank==0) printf("Time Step =                   %ld    OF  Total Timesteps = %ld\n", cur_step, nt);
-             //pre-post MPI Message
-             PostRecvMsg_Y(RF_vel, RB_vel, MCW, request_y, &count_y, msg_v_size_y, y_rank_F, y_rank_B);
-             PostRecvMsg_X(RL_vel, RR_vel, MCW, request_x, &count_x, msg_v_size_x, x_rank_L, x_rank_R);
-             //velocity computation in y boundary, two ghost cell region, two different streams to control
-             dvelcy_H(d_u1, d_v1, d_w1, d_xx,   d_yy,   d_zz,   d_xy,       d_xz, d_yz, d_dcrjx, d_dcrjy, d_dcrjz,
-                      d_d1, nxt,  nzt,  d_f_u1, d_f_v1, d_f_w1, stream_1,   yfs,  yfe,  y_rank_F);
-             Cpy2Host_VY(d_f_u1, d_f_v1, d_f_w1,  SF_vel, nxt, nzt, stream_1, y_rank_F);
-             dvelcy_H(d_u1, d_v1, d_w1, d_xx,   d_yy,   d_zz,   d_xy,       d_xz, d_yz, d_dcrjx, d_dcrjy, d_dcrjz,
-                      d_d1, nxt,  nzt,  d_b_u1, d_b_v1, d_b_w1, stream_2,   ybs,  ybe,  y_rank_B);
-             Cpy2Host_VY(d_b_u1, d_b_v1, d_b_w1,  SB_vel, nxt, nzt, stream_2, y_rank_B);
-             //Memory copy from GPU to CPU, and velocity computation at the same time
-             dvelcx_H(d_u1, d_v1, d_w1, d_xx, d_yy, d_zz, d_xy, d_xz, d_yz, d_dcrjx, d_dcrjy, d_dcrjz,
-                      d_d1, nyt,  nzt,  stream_i,   xvs,  xve);
-             //MPI overlapping velocity computation
-             cudaStreamSynchronize(stream_1);
-             PostSendMsg_Y(SF_vel, SB_vel, MCW, request_y, &count_y, msg_v_size_y, y_rank_F, y_rank_B, rank, Front);
-             cudaStreamSynchronize(stream_2);
-             PostSendMsg_Y(SF_vel, SB_vel, MCW, request_y, &count_y, msg_v_size_y, y_rank_F, y_rank_B, rank, Back);
-             MPI_Waitall(count_y, request_y, status_y);
-             Cpy2Device_VY(d_u1,     d_v1,     d_w1,     d_f_u1, d_f_v1, d_f_w1, d_b_u1, d_b_v1, d_b_w1, RF_vel, RB_vel, nxt, nyt, nzt,
-                           stream_1, stream_2, y_rank_F, y_rank_B);
-             cudaThreadSynchronize();
-             //start stress computation in insider part
-             dstrqc_H(d_xx, d_yy, d_zz, d_xy,    d_xz,    d_yz,    d_r1, d_r2, d_r3,     d_r4,     d_r5, d_r6,     d_u1, d_v1, d_w1, d_lam,
-                      d_mu, d_qp, d_qs, d_dcrjx, d_dcrjy, d_dcrjz, nyt,  nzt,  stream_i, d_lam_mu, NX,   coord[0], coord[1],   xss2, xse2,
-                      yls,  yre);
-             Cpy2Host_VX(d_u1, d_v1, d_w1, SL_vel, nxt, nyt, nzt, stream_1, x_rank_L, Left);
-             Cpy2Host_VX(d_u1, d_v1, d_w1, SR_vel, nxt, nyt, nzt, stream_2, x_rank_R, Right);
-             //MPI overlapping stress computation
-             cudaStreamSynchronize(stream_1);
-             PostSendMsg_X(SL_vel, SR_vel, MCW, request_x, &count_x, msg_v_size_x, x_rank_L, x_rank_R, rank, Left);
-             cudaStreamSynchronize(stream_2);
-             PostSendMsg_X(SL_vel, SR_vel, MCW, request_x, &count_x, msg_v_size_x, x_rank_L, x_rank_R, rank, Right);
-             MPI_Waitall(count_x, request_x, status_x);
-             Cpy2Device_VX(d_u1, d_v1, d_w1, RL_vel, RR_vel, nxt, nyt, nzt, stream_1, stream_2, x_rank_L, x_rank_R);
-       //stress computation in ghost cells
-             dstrqc_H(d_xx, d_yy, d_zz, d_xy,    d_xz,    d_yz,    d_r1, d_r2, d_r3,     d_r4,     d_r5, d_r6,     d_u1, d_v1, d_w1, d_lam,
-                      d_mu, d_qp, d_qs, d_dcrjx, d_dcrjy, d_dcrjz, nyt,  nzt,  stream_1, d_lam_mu, NX,   coord[0], coord[1],   xss1, xse1,
-          yls,  yre);
-             dstrqc_H(d_xx, d_yy, d_zz, d_xy,    d_xz,    d_yz,    d_r1, d_r2, d_r3,     d_r4,     d_r5, d_r6,     d_u1, d_v1, d_w1, d_lam,
-                      d_mu, d_qp, d_qs, d_dcrjx, d_dcrjy, d_dcrjz, nyt,  nzt,  stream_2, d_lam_mu, NX,   coord[0], coord[1],   xss3, xse3,
-                      yls,  yre);
-             //cudaThreadSynchronize();
-
-             if(cur_step%NTISKP == 0){
-              num_bytes = sizeof(float)*(nxt+4+8*loop)*(nyt+4+8*loop)*(nzt+2*align);
-              cudaMemcpy(&u1[0][0][0],d_u1,num_bytes,cudaMemcpyDeviceToHost);
-              cudaMemcpy(&v1[0][0][0],d_v1,num_bytes,cudaMemcpyDeviceToHost);
-              cudaMemcpy(&w1[0][0][0],d_w1,num_bytes,cudaMemcpyDeviceToHost);
-              idtmp = ((cur_step/NTISKP+WRITE_STEP-1)%WRITE_STEP);
-              idtmp = idtmp*rec_nxt*rec_nyt*rec_nzt;
-              tmpInd = idtmp;
-              // surface: k=nzt+align-1;
-              for(k=nzt+align-1 - rec_nbgz; k>=nzt+align-1 - rec_nedz; k=k-NSKPZ)
-                for(j=2+4*loop + rec_nbgy; j<=2+4*loop + rec_nedy; j=j+NSKPY)
-                  for(i=2+4*loop + rec_nbgx; i<=2+4*loop + rec_nedx; i=i+NSKPX)
-                  {
-                    //idx = (i-2-4*loop)/NSKPX;
-                    //idy = (j-2-4*loop)/NSKPY;
-                    //idz = ((nzt+align-1) - k)/NSKPZ;
-                    //tmpInd = idtmp + idz*rec_nxt*rec_nyt + idy*rec_nxt + idx;
-                    Bufx[tmpInd] = u1[i][j][k];
-                    Bufy[tmpInd] = v1[i][j][k];
-                    Bufz[tmpInd] = w1[i][j][k];
-                    tmpInd++;
-                  }
-              if((cur_step/NTISKP)%WRITE_STEP == 0){
-                cudaThreadSynchronize();
-                //printf("I'm %d, my disp=%ld\n", rank, displacement);
-                sprintf(filename, "%s%07ld", filenamebasex, cur_step);
-                err = MPI_File_open(MCW,filename,MPI_MODE_CREATE|MPI_MODE_WRONLY,MPI_INFO_NULL,&fh);
-                err = MPI_File_set_view(fh, displacement, MPI_FLOAT, filetype, "native", MPI_INFO_NULL);
-                err = MPI_File_write_all(fh, Bufx, rec_nxt*rec_nyt*rec_nzt*WRITE_STEP, MPI_FLOAT, &filestatus);
-                err = MPI_File_close(&fh);
-                sprintf(filename, "%s%07ld", filenamebasey, cur_step);
-                err = MPI_File_open(MCW,filename,MPI_MODE_CREATE|MPI_MODE_WRONLY,MPI_INFO_NULL,&fh);
-                err = MPI_File_set_view(fh, displacement, MPI_FLOAT, filetype, "native", MPI_INFO_NULL);
-                err = MPI_File_write_all(fh, Bufy, rec_nxt*rec_nyt*rec_nzt*WRITE_STEP, MPI_FLOAT, &filestatus);
-                err = MPI_File_close(&fh);
-                sprintf(filename, "%s%07ld", filenamebasez, cur_step);
-                err = MPI_File_open(MCW,filename,MPI_MODE_CREATE|MPI_MODE_WRONLY,MPI_INFO_NULL,&fh);
-                err = MPI_File_set_view(fh, displacement, MPI_FLOAT, filetype, "native", MPI_INFO_NULL);
-                err = MPI_File_write_all(fh, Bufz, rec_nxt*rec_nyt*rec_nzt*WRITE_STEP, MPI_FLOAT, &filestatus);
-                err = MPI_File_close(&fh);
-              }
-              else
-                cudaThreadSynchronize();
-              if(rank==0){
-                i = ND+2+4*loop;
-                j = i;
-                k = nzt+align-1-ND;
-                fprintf(fchk,"%ld :\t%e\t%e\t%e\n",cur_step,u1[i][j][k],v1[i][j][k],w1[i][j][k]);
-                fflush(fchk);
-              }
-             }
-             else
-               cudaThreadSynchronize();
-
-           }
-    */
     time_un += gethrtime();
   }
+  // the only blocking wait on the output: the last window still in flight
+  MPI_Waitall(nwreq, wreq, MPI_STATUSES_IGNORE);
+  for (c = 0; c < nwreq; c++)
+    if (wfh[c] != MPI_FILE_NULL) MPI_File_close(&wfh[c]);
+  if (nio && rank == 0) {
+    iowin.nrun = 0;
+    for (t = 0; t < nio; t++) MPI_Send(&iowin, sizeof(IoWin), MPI_BYTE, size + t, IOTAG, MPI_COMM_WORLD);
+  }
+  if (oinfo != MPI_INFO_NULL) MPI_Info_free(&oinfo);
+  free(wreq);
+  free(wfh);
+  if (OUTFMT == 1) {
+    for (r = 0; r < nrun; r++) MPI_File_close(&cfh[r]);
+    MPI_Type_free(&ctype);
+  }
+  if (COMPRESS) {
+    MPI_Reduce(rank == 0 ? MPI_IN_PLACE : &zraw, &zraw, 1, MPI_LONG_LONG, MPI_SUM, 0, MCW);
+    MPI_Reduce(rank == 0 ? MPI_IN_PLACE : &zout, &zout, 1, MPI_LONG_LONG, MPI_SUM, 0, MCW);
+    if (rank == 0) printf("output compressed from %lld to %lld bytes (%.2fx)\n", zraw, zout, zout > 0 ? (double)zraw / zout : 0.);
+    free(zbuf);
+    free(zall);
+  }
+  if (ztile != NULL) Delloc1P(ztile);
   if (rank == 0) {
     fprintf(fchk, "END\n");
     fclose(fchk);
   }
 
-  cudaStreamDestroy(stream_1);
-  cudaStreamDestroy(stream_2);
-  cudaStreamDestroy(stream_i);
-  cudaFreeHost(SL_vel);
-  cudaFreeHost(SR_vel);
-  cudaFreeHost(RL_vel);
-  cudaFreeHost(RR_vel);
-  cudaFreeHost(SF_vel);
-  cudaFreeHost(SB_vel);
-  cudaFreeHost(RF_vel);
-  cudaFreeHost(RB_vel);
+  FreeMsg(request_x);
+  FreeMsg(request_y);
+  FreeMsg(request_z);
+  if (BACKEND == BACKEND_CPU) {
+    FreeHaloType(type_x);
+    FreeHaloType(type_y);
+    FreeHaloType(type_z);
+  }
+#ifndef NOCUDA
+  if (BACKEND == BACKEND_GPU) {
+    cudaStreamDestroy(stream_1);
+    cudaStreamDestroy(stream_2);
+    cudaStreamDestroy(stream_i);
+    cudaFreeHost(SL_vel);
+    cudaFreeHost(SR_vel);
+    cudaFreeHost(RL_vel);
+    cudaFreeHost(RR_vel);
+    cudaFreeHost(SF_vel);
+    cudaFreeHost(SB_vel);
+    cudaFreeHost(RF_vel);
+    cudaFreeHost(RB_vel);
+  }
+#endif
   GFLOPS = 1.0;
   GFLOPS = GFLOPS * 307.0 * (xre - xls) * (yre - yls) * nzt;
   GFLOPS = GFLOPS / (1000 * 1000 * 1000);
-  time_un = time_un / cur_step;
+  time_un = time_un / (cur_step * nens);
   GFLOPS = GFLOPS / time_un;
   MPI_Allreduce(&GFLOPS, &GFLOPS_SUM, 1, MPI_DOUBLE, MPI_SUM, MCW);
   if (rank == 0) {
-    printf("GPU benchmark size NX=%d, NY=%d, NZ=%d, ReadStep=%d\n", NX, NY, NZ, READ_STEP);
-    printf("GPU computing flops=%1.18f GFLOPS, time = %1.18f secs per timestep\n", GFLOPS_SUM, time_un);
+    printf("%s benchmark size NX=%d, NY=%d, NZ=%d, ReadStep=%d\n", (BACKEND == BACKEND_GPU ? "GPU" : "CPU"), NX, NY, NZ, READ_STEP);
+    printf("%s computing flops=%1.18f GFLOPS, time = %1.18f secs per timestep\n", (BACKEND == BACKEND_GPU ? "GPU" : "CPU"), GFLOPS_SUM, time_un);
   }
   //  Main Loop Ends
 
   //  program ends, free all memories
-  UnBindArrayFromTexture();
-  Delloc3D(u1);
-  Delloc3D(v1);
-  Delloc3D(w1);
+#ifndef NOCUDA
+  if (BACKEND == BACKEND_GPU) {
+    cudaFree(d_u1);
+    cudaFree(d_v1);
+    cudaFree(d_w1);
+    cudaFree(d_f_u1);
+    cudaFree(d_f_v1);
+    cudaFree(d_f_w1);
+    cudaFree(d_b_u1);
+    cudaFree(d_b_v1);
+    cudaFree(d_b_w1);
+    cudaFree(d_xx);
+    cudaFree(d_yy);
+    cudaFree(d_zz);
+    cudaFree(d_xy);
+    cudaFree(d_yz);
+    cudaFree(d_xz);
+    if (NVE == 1) {
+      cudaFree(d_r1);
+      cudaFree(d_r2);
+      cudaFree(d_r3);
+      cudaFree(d_r4);
+      cudaFree(d_r5);
+      cudaFree(d_r6);
+      cudaFree(d_qp);
+      cudaFree(d_qs);
+    }
+    if (NPC == 0) {
+      cudaFree(d_dcrjx);
+      cudaFree(d_dcrjy);
+      cudaFree(d_dcrjz);
+    }
+    cudaFree(d_d1);
+    cudaFree(d_mu);
+    cudaFree(d_lam);
+    cudaFree(d_lam_mu);
+    cudaFree(d_sidx);
+    cudaFree(d_samp);
+    if (rank == srcproc[0]) {
+      cudaFree(d_taxx);
+      cudaFree(d_tayy);
+      cudaFree(d_tazz);
+      cudaFree(d_taxz);
+      cudaFree(d_tayz);
+      cudaFree(d_taxy);
+      cudaFree(d_tpsrc);
+    }
+  }
+#endif
+
+  if (SHMEM) {
+    FreeShared3D(&win_vel);
+    MPI_Comm_free(&MCS);
+  } else {
+    Delloc3D(u1);
+    Delloc3D(v1);
+    Delloc3D(w1);
+  }
   Delloc3D(xx);
   Delloc3D(yy);
   Delloc3D(zz);
   Delloc3D(xy);
   Delloc3D(yz);
   Delloc3D(xz);
-  Delloc3D(vx1);
-  Delloc3D(vx2);
-
-  cudaFree(d_u1);
-  cudaFree(d_v1);
-  cudaFree(d_w1);
-  cudaFree(d_f_u1);
-  cudaFree(d_f_v1);
-  cudaFree(d_f_w1);
-  cudaFree(d_b_u1);
-  cudaFree(d_b_v1);
-  cudaFree(d_b_w1);
-  cudaFree(d_xx);
-  cudaFree(d_yy);
-  cudaFree(d_zz);
-  cudaFree(d_xy);
-  cudaFree(d_yz);
-  cudaFree(d_xz);
-  cudaFree(d_vx1);
-  cudaFree(d_vx2);
 
   if (NVE == 1) {
     Delloc3D(r1);
@@ -849,114 +1759,99 @@ int main(int argc, char** argv) {
     Delloc3D(r4);
     Delloc3D(r5);
     Delloc3D(r6);
-    cudaFree(d_r1);
-    cudaFree(d_r2);
-    cudaFree(d_r3);
-    cudaFree(d_r4);
-    cudaFree(d_r5);
-    cudaFree(d_r6);
-
     Delloc3D(qp);
     Delloc3D(qs);
-    cudaFree(d_qp);
-    cudaFree(d_qs);
+    Delloc3D(tau1);
+    Delloc3D(tau2);
   }
 
-  if (NPC == 0) {
-    Delloc1D(dcrjx);
-    Delloc1D(dcrjy);
-    Delloc1D(dcrjz);
-    cudaFree(d_dcrjx);
-    cudaFree(d_dcrjy);
-    cudaFree(d_dcrjz);
+  Delloc1D(dcrjx);
+  Delloc1D(dcrjy);
+  Delloc1D(dcrjz);
+  if (NPC == 1) {
+    SetHostPml(NULL, NULL, NULL, NULL, NULL, NULL);
+    Delloc1D(pmlax);
+    Delloc1D(pmlbx);
+    Delloc1D(pmlay);
+    Delloc1D(pmlby);
+    Delloc1D(pmlaz);
+    Delloc1D(pmlbz);
   }
 
   Delloc3D(d1);
   Delloc3D(mu);
   Delloc3D(lam);
   Delloc3D(lam_mu);
-  cudaFree(d_d1);
-  cudaFree(d_mu);
-  cudaFree(d_lam);
-  cudaFree(d_lam_mu);
-
-  if (rank == srcproc) {
-    Delloc1D(taxx);
-    Delloc1D(tayy);
-    Delloc1D(tazz);
-    Delloc1D(taxz);
-    Delloc1D(tayz);
-    Delloc1D(taxy);
-    cudaFree(d_taxx);
-    cudaFree(d_tayy);
-    cudaFree(d_tazz);
-    cudaFree(d_taxz);
-    cudaFree(d_tayz);
-    cudaFree(d_taxy);
-    Delloc1P(tpsrc);
-    cudaFree(d_tpsrc);
+  if (MEDCOEF)
+    for (i = 0; i < NCOEF; i++) Delloc3D(coef[i]);
+  if (mid) {
+    free(mid);
+    Delloc1D(mtab);
   }
 
+  for (r = 0; r < nrun; r++) {
+    if (rank == srcproc[r]) {
+      Delloc1D(taxx[r]);
+      Delloc1D(tayy[r]);
+      Delloc1D(tazz[r]);
+      Delloc1D(taxz[r]);
+      Delloc1D(tayz[r]);
+      Delloc1D(taxy[r]);
+      Delloc1P(tpsrc[r]);
+    }
+  }
+
+  Delloc1P(sidx);
+  if (nsta > 0) {
+    MPI_Type_free(&statype);
+    for (c = 0; c < 3; c++) Delloc1D(stabuf[c]);
+    Delloc1P(staloc);
+    Delloc1P(stagid);
+  }
+  Delloc1P(part_x);
+  Delloc1P(part_y);
+  Delloc1P(part_z);
   MPI_Comm_free(&MC1);
   MPI_Finalize();
   return (0);
 }
 
+// recorded points NBG, NBG+NSKP, ..., NED (1-based) within the n points after offset off: 0-based
+// local first and last point, and the number of points recorded ahead of them along the axis
+static int recRange(long int off, long int n, int NBG, int NED, int NSKP, int* nbg, int* ned, int* skip) {
+  long int g0, g1;
+
+  g0 = (off + 1 > NBG) ? NBG + (off + 1 - NBG + NSKP - 1) / NSKP * NSKP : NBG;
+  g1 = (off + n < NED) ? off + n : NED;
+  if (g1 < NBG || g0 > g1) return 0;
+  g1 = NBG + (g1 - NBG) / NSKP * NSKP;
+  *nbg = g0 - off - 1;
+  *ned = g1 - off - 1;
+  *skip = (g0 - NBG) / NSKP;
+  return (g1 - g0) / NSKP + 1;
+}
+
 // Calculates recording points for each core
 // rec_nbgxyz rec_nedxyz...
-// WARNING: Assumes NPZ = 1! Only surface outputs are needed!
-void calcRecordingPoints(int* rec_nbgx, int* rec_nedx, int* rec_nbgy, int* rec_nedy, int* rec_nbgz, int* rec_nedz, int* rec_nxt, int* rec_nyt, int* rec_nzt, MPI_Offset* displacement, long int nxt, long int nyt, long int nzt, int rec_NX, int rec_NY, int rec_NZ, int NBGX, int NEDX, int NSKPX, int NBGY, int NEDY, int NSKPY, int NBGZ, int NEDZ, int NSKPZ, int* coord) {
-  *displacement = 0;
-
-  if (NBGX > nxt * (coord[0] + 1))
-    *rec_nxt = 0;
-  else if (NEDX < nxt * coord[0] + 1)
-    *rec_nxt = 0;
-  else {
-    if (nxt * coord[0] >= NBGX) {
-      *rec_nbgx = (nxt * coord[0] + NBGX - 1) % NSKPX;
-      *displacement += (nxt * coord[0] - NBGX) / NSKPX + 1;
-    } else
-      *rec_nbgx = NBGX - nxt * coord[0] - 1;  // since rec_nbgx is 0-based
-    if (nxt * (coord[0] + 1) <= NEDX)
-      *rec_nedx = (nxt * (coord[0] + 1) + NBGX - 1) % NSKPX - NSKPX + nxt;
-    else
-      *rec_nedx = NEDX - nxt * coord[0] - 1;
-    *rec_nxt = (*rec_nedx - *rec_nbgx) / NSKPX + 1;
-  }
-
-  if (NBGY > nyt * (coord[1] + 1))
-    *rec_nyt = 0;
-  else if (NEDY < nyt * coord[1] + 1)
-    *rec_nyt = 0;
-  else {
-    if (nyt * coord[1] >= NBGY) {
-      *rec_nbgy = (nyt * coord[1] + NBGY - 1) % NSKPY;
-      *displacement += ((nyt * coord[1] - NBGY) / NSKPY + 1) * rec_NX;
-    } else
-      *rec_nbgy = NBGY - nyt * coord[1] - 1;  // since rec_nbgy is 0-based
-    if (nyt * (coord[1] + 1) <= NEDY)
-      *rec_nedy = (nyt * (coord[1] + 1) + NBGY - 1) % NSKPY - NSKPY + nyt;
-    else
-      *rec_nedy = NEDY - nyt * coord[1] - 1;
-    *rec_nyt = (*rec_nedy - *rec_nbgy) / NSKPY + 1;
-  }
+// offs: global x and y offset of the core and its depth below the free surface (z counts depth)
+void calcRecordingPoints(int* rec_nbgx, int* rec_nedx, int* rec_nbgy, int* rec_nedy, int* rec_nbgz, int* rec_nedz, int* rec_nxt, int* rec_nyt, int* rec_nzt, MPI_Offset* displacement, long int nxt, long int nyt, long int nzt, int rec_NX, int rec_NY, int rec_NZ, int NBGX, int NEDX, int NSKPX, int NBGY, int NEDY, int NSKPY, int NBGZ, int NEDZ, int NSKPZ, int* offs) {
+  int skipx = 0, skipy = 0, skipz = 0;
 
-  if (NBGZ > nzt)
-    *rec_nzt = 0;
-  else {
-    *rec_nbgz = NBGZ - 1;  // since rec_nbgz is 0-based
-    *rec_nedz = NEDZ - 1;
-    *rec_nzt = (*rec_nedz - *rec_nbgz) / NSKPZ + 1;
-  }
+  *rec_nxt = recRange(offs[0], nxt, NBGX, NEDX, NSKPX, rec_nbgx, rec_nedx, &skipx);
+  *rec_nyt = recRange(offs[1], nyt, NBGY, NEDY, NSKPY, rec_nbgy, rec_nedy, &skipy);
+  *rec_nzt = recRange(offs[2], nzt, NBGZ, NEDZ, NSKPZ, rec_nbgz, rec_nedz, &skipz);
+  *displacement = skipx + (MPI_Offset)skipy * rec_NX + (MPI_Offset)skipz * rec_NX * rec_NY;
 
   if (*rec_nxt == 0 || *rec_nyt == 0 || *rec_nzt == 0) {
     *rec_nxt = 0;
     *rec_nyt = 0;
     *rec_nzt = 0;
+    // empty ranges, so the sampling loops do nothing on this core
+    *rec_nbgx = *rec_nbgy = *rec_nbgz = 0;
+    *rec_nedx = *rec_nedy = *rec_nedz = -1;
+    *displacement = 0;
   }
 
-  // displacement assumes NPZ=1!
   *displacement *= sizeof(float);
 
   return;
@@ -19,8 +19,10 @@ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
  * all pmcl3d data types are defined here                                       *
  ********************************************************************************
  */
-#include <cuda.h>
-#include <cuda_runtime.h>
+#ifndef NOCUDA
+  #include <cuda.h>
+  #include <cuda_runtime.h>
+#endif
 #include <mpi.h>
 
 #include "pmcl3d_cons.h"
@@ -34,34 +36,88 @@ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
 #ifndef _PMCL3D_H
   #define _PMCL3D_H
 
-typedef float *RESTRICT *RESTRICT *RESTRICT Grid3D;
+// flat 3D grid, or a sub-box view of one: element (i, j, k) is data[i * slice + j * yline + k]
+typedef struct {
+  float *RESTRICT data;
+  int nx, ny, nz;
+  long int slice, yline;
+} Grid3D;
+
+  #define G3(U, i, j, k) ((U).data[(i) * (U).slice + (j) * (U).yline + (k)])
+
 typedef float *RESTRICT Grid1D;
 typedef int *RESTRICT PosInf;
 
-void command(int argc, char **argv, float *TMAX, float *DH, float *DT, float *ARBC, float *PHT, int *NPC, int *ND, int *NSRC, int *NST, int *NVAR, int *NVE, int *MEDIASTART, int *IFAULT, int *READ_STEP, int *READ_STEP_GPU, int *NTISKP, int *WRITE_STEP, int *NX, int *NY, int *NZ, int *PX, int *PY, int *NBGX, int *NEDX, int *NSKPX, int *NBGY, int *NEDY, int *NSKPY, int *NBGZ, int *NEDZ, int *NSKPZ, float *FL, float *FH, float *FP, int *IDYNA, int *SoCalQ, char *INSRC, char *INVEL, char *OUT, char *INSRC_I2, char *CHKFILE);
+// header of the output container of a run (OUTFMT=1), native byte order. it is followed at index by
+// nwin pairs of 64-bit integers, the last time step of window w and the byte offset of its first
+// sample, and at data by the velocities. the box holds window after window, each one chunk of
+// rec_n[0] * rec_n[1] * rec_n[2] * write_step floats per component in the order of the SX files;
+// the stations hold one chunk per component of rec_n[0] series of nsamp samples (the STX file).
+// a compressed box (codec > 0, see zpack) has at tiles the ntile records of 6 ints of the ranks,
+// offset in the box and size in recording points (x, y, z, nx, ny, nz), and its windows follow
+// each other from data: 3 * ntile 64-bit sizes of the coded tiles, rank after rank (x, y, z),
+// then the coded tiles, component after component and rank after rank. a tile holds write_step
+// samples of nz planes of ny rows of nx floats
+typedef struct {
+  char magic[8];  // "AWPOUT1"
+  int kind;       // 0: box, 1: stations
+  int ncomp;      // 3: x, y and z velocity
+  int nx, ny, nz;
+  int nbg[3], ned[3], nskp[3];  // box, 1-based
+  int rec_n[3];                 // rec_NX, rec_NY, rec_NZ of the box, number of stations, 1, 1
+  int ntiskp, write_step, nsamp, nwin;
+  float dh, dt, dts;  // dts = DT * NTISKP
+  long long index, data, chunk;  // byte offsets of the window index and the data, bytes per chunk
+  int codec;                     // 0: raw, 1: lossless, 2: lossy within tol
+  float tol;
+  int ntile, pad;
+  long long tiles;  // byte offset of the tile records
+} OutHeader;
+
+// window handed to the output aggregators (IORANKS) by compute rank 0: last time step, runs of the
+// sweep (0 ends the output) and the SX/SY/SZ file of each run
+typedef struct {
+  long int step;
+  int nrun, pad;
+  char name[MAXRHS][3][50];
+} IoWin;
+
+void command(int argc, char **argv, float *TMAX, float *DH, float *DT, float *ARBC, float *PHT, int *NPC, int *ND, int *NSRC, int *NST, int *NVAR, int *NVE, int *MEDIASTART, int *IFAULT, int *READ_STEP, int *READ_STEP_GPU, int *BACKEND, int *SIMD, int *TBLOCK, int *TILE, int *HUGEPAGE, int *OVERLAP, int *SHMEM, int *PART, int *MATPAL, int *MEDCOEF, int *NRHS, int *NTISKP, int *WRITE_STEP, int *OUTFMT, int *COMPRESS, float *CTOL, int *IORANKS, int *STRIPE, int *NX, int *NY, int *NZ, int *PX, int *PY, int *PZ, int *NBGX, int *NEDX, int *NSKPX, int *NBGY, int *NEDY, int *NSKPY, int *NBGZ, int *NEDZ, int *NSKPZ, float *FL, float *FH, float *FP, int *IDYNA, int *SoCalQ, char *INSRC, char *INVEL, char *OUT, char *INSRC_I2, char *CHKFILE, char *ENSEMBLE, char *STATIONS);
+
+int read_src_ifault_2(int rank, int READ_STEP, char *INSRC, char *INSRC_I2, int maxdim, int *offs, int NZ, int nxt, int nyt, int nzt, int *NPSRC, int *SRCPROC, PosInf *psrc, Grid1D *axx, Grid1D *ayy, Grid1D *azz, Grid1D *axz, Grid1D *ayz, Grid1D *axy, int idx);
+
+PosInf srcpos(int rank, int IFAULT, int NSRC, int READ_STEP, int NST, MPI_Comm MCW, char *INSRC);
+
+int inisource(int rank, int IFAULT, int NSRC, int READ_STEP, int NST, int *SRCPROC, int NZ, MPI_Comm MCW, int nxt, int nyt, int nzt, int *offs, int maxdim, int *NPSRC, PosInf *ptpsrc, Grid1D *ptaxx, Grid1D *ptayy, Grid1D *ptazz, Grid1D *ptaxz, Grid1D *ptayz, Grid1D *ptaxy, char *INSRC, char *INSRC_I2);
+
+int partition(int PART, int NX, int NY, int NZ, int PX, int PY, int PZ, int ND, int NTISKP, int NBGX, int NEDX, int NSKPX, int NBGY, int NEDY, int NSKPY, int NBGZ, int NEDZ, int NSKPZ, int NSRC, PosInf srcp, int *part_x, int *part_y, int *part_z);
 
-int read_src_ifault_2(int rank, int READ_STEP, char *INSRC, char *INSRC_I2, int maxdim, int *coords, int NZ, int nxt, int nyt, int nzt, int *NPSRC, int *SRCPROC, PosInf *psrc, Grid1D *axx, Grid1D *ayy, Grid1D *azz, Grid1D *axz, Grid1D *ayz, Grid1D *axy, int idx);
+void addsrc(int i, float DH, float DT, int NST, int npsrc, int READ_STEP, int dim, PosInf psrc, Grid1D axx, Grid1D ayy, Grid1D azz, Grid1D axz, Grid1D ayz, Grid1D axy, Grid3D xx, Grid3D yy, Grid3D zz, Grid3D xy, Grid3D yz, Grid3D xz);
 
-int inisource(int rank, int IFAULT, int NSRC, int READ_STEP, int NST, int *SRCPROC, int NZ, MPI_Comm MCW, int nxt, int nyt, int nzt, int *coords, int maxdim, int *NPSRC, PosInf *ptpsrc, Grid1D *ptaxx, Grid1D *ptayy, Grid1D *ptazz, Grid1D *ptaxz, Grid1D *ptayz, Grid1D *ptaxy, char *INSRC, char *INSRC_I2);
+void inimesh(int MEDIASTART, Grid3D d1, Grid3D mu, Grid3D lam, Grid3D qp, Grid3D qs, float *taumax, float *taumin, int nvar, float FP, float FL, float FH, int nxt, int nyt, int nzt, int PX, int PY, int PZ, int NX, int NY, int NZ, int *offs, MPI_Comm MCW, int IDYNA, int NVE, int SoCalQ, char *INVEL, float *vse, float *vpe, float *dde);
 
-void addsrc(int i, float DH, float DT, int NST, int npsrc, int READ_STEP, int dim, PosInf psrc, Grid1D axx, Grid1D ayy, Grid1D azz, Grid1D axz, Grid1D ayz, Grid1D axy, Grid3D xx, Grid3D yy, Grid3D zz, Grid3D xy, Grid3D yz, Grid3D xz);
+int palmesh(Grid3D d1, Grid3D mu, Grid3D lam, Grid3D qp, Grid3D qs, int NVE, int maxmat, unsigned short **pmid, Grid1D *ptab);
 
-void inimesh(int MEDIASTART, Grid3D d1, Grid3D mu, Grid3D lam, Grid3D qp, Grid3D qs, float *taumax, float *taumin, int nvar, float FP, float FL, float FH, int nxt, int nyt, int nzt, int PX, int PY, int NX, int NY, int NZ, int *coords, MPI_Comm MCW, int IDYNA, int NVE, int SoCalQ, char *INVEL, float *vse, float *vpe, float *dde);
+int readens(char *ENSEMBLE, int n, MPI_Comm MCW, char *INSRC, char *OUT, char *INSRC_I2);
+int openout(char *name, MPI_Comm MCW, MPI_Info info, OutHeader *hdr, int *tile, MPI_File *fh);
+MPI_Info outinfo(int STRIPE, int cbnodes);
+void iorun(MPI_Comm MA, int ncr, MPI_Info info);
+long zbound(long n);
+long zpack(float *in, long m, int ns, int codec, float tol, unsigned char *out);
+long zunpack(unsigned char *in, long m, int ns, int codec, float tol, float *out);
+int readsta(char *STATIONS, MPI_Comm MCW, int NX, int NY, int NZ, int PX, int PY, int PZ, int *part_x, int *part_y, int *part_z, int *coord, int nzt, int *nsta, PosInf *loc, PosInf *gid);
 
 int writeCHK(char *chkfile, int ntiskp, float dt, float dh, int nxt, int nyt, int nzt, int nt, float arbc, int npc, int nve, float fl, float fh, float fp, float *vse, float *vpe, float *dde);
 
-void mediaswap(Grid3D d1, Grid3D mu, Grid3D lam, Grid3D qp, Grid3D qs, int rank, int x_rank_L, int x_rank_R, int y_rank_F, int y_rank_B, int nxt, int nyt, int nzt, MPI_Comm MCW);
+void mediaswap(Grid3D d1, Grid3D mu, Grid3D lam, Grid3D qp, Grid3D qs, int rank, int x_rank_L, int x_rank_R, int y_rank_F, int y_rank_B, int z_rank_D, int z_rank_U, int nxt, int nyt, int nzt, MPI_Comm MCW);
 
 void tausub(Grid3D tau, float taumin, float taumax);
 
-void inicrj(float ARBC, int *coords, int nxt, int nyt, int nzt, int NX, int NY, int ND, Grid1D dcrjx, Grid1D dcrjy, Grid1D dcrjz);
+void inicrj(float ARBC, int *offs, int nxt, int nyt, int nzt, int NX, int NY, int NZ, int ND, Grid1D dcrjx, Grid1D dcrjy, Grid1D dcrjz);
+void inipml(Grid3D d1, Grid3D mu, Grid3D lam, float ARBC, float FP, float DH, float DT, int *offs, int nxt, int nyt, int nzt, int NX, int NY, int NZ, int ND, MPI_Comm MCW, Grid1D pmlax, Grid1D pmlbx, Grid1D pmlay, Grid1D pmlby, Grid1D pmlaz, Grid1D pmlbz);
 
-void init_texture(int nxt, int nyt, int nzt, Grid3D tau1, Grid3D tau2, Grid3D vx1, Grid3D vx2, int xls, int xre, int yls, int yre);
-
-void PostRecvMsg_X(float *RL_M, float *RR_M, MPI_Comm MCW, MPI_Request *request, int *count, int msg_size, int rank_L, int rank_R);
-
-void PostRecvMsg_Y(float *RF_M, float *RB_M, MPI_Comm MCW, MPI_Request *request, int *count, int msg_size, int rank_F, int rank_B);
 
+#ifndef NOCUDA
 void Cpy2Device_source(int npsrc, int READ_STEP, int index_offset, Grid1D taxx, Grid1D tayy, Grid1D tazz, Grid1D taxz, Grid1D tayz, Grid1D taxy, float *d_taxx, float *d_tayy, float *d_tazz, float *d_taxz, float *d_tayz, float *d_taxy);
 
 void Cpy2Host_VX(float *u1, float *v1, float *w1, float *h_m, int nxt, int nyt, int nzt, cudaStream_t St, int rank, int flag);
@@ -71,12 +127,45 @@ void Cpy2Host_VY(float *s_u1, float *s_v1, float *s_w1, float *h_m, int nxt, int
 void Cpy2Device_VX(float *u1, float *v1, float *w1, float *L_m, float *R_m, int nxt, int nyt, int nzt, cudaStream_t St1, cudaStream_t St2, int rank_L, int rank_R);
 
 void Cpy2Device_VY(float *u1, float *v1, float *w1, float *f_u1, float *f_v1, float *f_w1, float *b_u1, float *b_v1, float *b_w1, float *F_m, float *B_m, int nxt, int nyt, int nzt, cudaStream_t St1, cudaStream_t St2, int rank_F, int rank_B);
+#endif
+
+void HaloType_X(Grid3D *U, int n, int nxt, int j0, int nj, int k0, int nk, MPI_Datatype *type);
+
+void HaloType_Y(Grid3D *U, int n, int nyt, int i0, int ni, int k0, int nk, MPI_Datatype *type);
+
+void HaloType_Z(Grid3D *U, int n, int nzt, int i0, int ni, int j0, int nj, MPI_Datatype *type);
+
+void FreeHaloType(MPI_Datatype *type);
+
+void InitMsg_X(float *RL_M, float *RR_M, float *SL_M, float *SR_M, MPI_Comm MCW, MPI_Request *request, int msg_size, MPI_Datatype *type, int rank_L, int rank_R, int rank);
+
+void InitMsg_Y(float *RF_M, float *RB_M, float *SF_M, float *SB_M, MPI_Comm MCW, MPI_Request *request, int msg_size, MPI_Datatype *type, int rank_F, int rank_B, int rank);
+
+void InitMsg_Z(float *RD_M, float *RU_M, float *SD_M, float *SU_M, MPI_Comm MCW, MPI_Request *request, int msg_size, MPI_Datatype *type, int rank_D, int rank_U, int rank);
+
+int ShmRank(MPI_Comm MCW, MPI_Comm MCS, int rank);
+
+void ShmSync(MPI_Comm MCS, MPI_Win win, int *shm_rank);
+
+void ShmCopy_X(Grid3D *U, Grid3D *L, Grid3D *R, int n, int nxt, int j0, int nj, int k0, int nk, int shm_L, int shm_R);
+
+void ShmCopy_Y(Grid3D *U, Grid3D *F, Grid3D *B, int n, int nyt, int i0, int ni, int k0, int nk, int shm_F, int shm_B);
+
+void StartRecvMsg(MPI_Request *request);
 
-void PostSendMsg_X(float *SL_M, float *SR_M, MPI_Comm MCW, MPI_Request *request, int *count, int msg_size, int rank_L, int rank_R, int rank, int flag);
+void StartSendMsg(MPI_Request *request, int flag);
 
-void PostSendMsg_Y(float *SF_M, float *SB_M, MPI_Comm MCW, MPI_Request *request, int *count, int msg_size, int rank_F, int rank_B, int rank, int flag);
+void FreeMsg(MPI_Request *request);
 
 Grid3D Alloc3D(int nx, int ny, int nz);
+void SetAlloc3D(int HUGEPAGE);
+Grid3D AllocPad3D(int nxt, int nyt, int nzt);
+Grid3D AllocRhs3D(int n, int nxt, int nyt, int nzt);
+Grid3D Rhs3D(Grid3D U, int r, int nxt);
+void AllocShared3D(Grid3D *U, int n, int nxt, int nyt, int nzt, MPI_Comm MCS, MPI_Win *win);
+void SharedQuery3D(MPI_Win win, int shm_rank, int n, int nxt, int nyt, int nzt, Grid3D *V);
+void FreeShared3D(MPI_Win *win);
+Grid3D View3D(Grid3D U, int i0, int j0, int k0, int nx, int ny, int nz);
 Grid1D Alloc1D(int nx);
 PosInf Alloc1P(int nx);
 
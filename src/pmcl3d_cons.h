@@ -18,9 +18,48 @@ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
 #define BLOCK_SIZE_Z 256
 #define align 32
 #define loop 1
+// ghost/padding width on each side of the padded wavefield and media grids
+#define halo_xy (2 + 4 * loop)
+#define halo_z align
+#define HUGEPAGE_SIZE (2L * 1024 * 1024)
 
 #define Both 0
 #define Left 1
 #define Right 2
 #define Front 3
 #define Back 4
+
+#define BACKEND_GPU 0
+#define BACKEND_CPU 1
+
+#define SIMD_AUTO -1
+#define SIMD_SCALAR 0
+#define SIMD_AVX2 1
+#define SIMD_AVX512 2
+
+// largest material palette, IDs are 16 bit (see palmesh)
+#define MAXMAT 65535
+
+// most wavefields per sweep (NRHS)
+#define MAXRHS 16
+
+// tag of the window description sent to the output aggregators (IORANKS), the tiles of run r and
+// component c go with tag 3 * r + c
+#define IOTAG (3 * MAXRHS)
+
+// precomputed staggered media coefficients (see dcoef_C): dth over the densities of u1, v1, w1,
+// the moduli of the stress update times dth and the anelastic terms
+#define CO_D1 0
+#define CO_D2 1
+#define CO_D3 2
+#define CO_XL 3
+#define CO_XM 4
+#define CO_XMU1 5
+#define CO_XMU2 6
+#define CO_XMU3 7
+#define CO_H 8
+#define CO_H1 9
+#define CO_H2 10
+#define CO_H3 11
+#define CO_QPA 12
+#define NCOEF 13
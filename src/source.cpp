@@ -16,7 +16,7 @@ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
 
 #include "pmcl3d.h"
 
-int read_src_ifault_2(int rank, int READ_STEP, char *INSRC, char *INSRC_I2, int maxdim, int *coords, int NZ, int nxt, int nyt, int nzt, int *NPSRC, int *SRCPROC, PosInf *psrc, Grid1D *axx, Grid1D *ayy, Grid1D *azz, Grid1D *axz, Grid1D *ayz, Grid1D *axy, int idx) {
+int read_src_ifault_2(int rank, int READ_STEP, char *INSRC, char *INSRC_I2, int maxdim, int *offs, int NZ, int nxt, int nyt, int nzt, int *NPSRC, int *SRCPROC, PosInf *psrc, Grid1D *axx, Grid1D *ayy, Grid1D *azz, Grid1D *axz, Grid1D *ayz, Grid1D *axy, int idx) {
   FILE *f;
   char fname[150];
   int dummy[2], i, j;
@@ -37,8 +37,8 @@ int read_src_ifault_2(int rank, int READ_STEP, char *INSRC, char *INSRC_I2, int
       return 0;
     }
     *SRCPROC = rank;
-    nbx = nxt * coords[0] + 1 - 2 * loop;
-    nby = nyt * coords[1] + 1 - 2 * loop;
+    nbx = offs[0] + 1 - 2 * loop;
+    nby = offs[1] + 1 - 2 * loop;
     // not sure what happens if maxdim != 3
     fread(NPSRC, sizeof(int), 1, f);
     fread(dummy, sizeof(int), 2, f);
@@ -47,14 +47,14 @@ int read_src_ifault_2(int rank, int READ_STEP, char *INSRC, char *INSRC_I2, int
 
     tpsrc = Alloc1P((*NPSRC) * maxdim);
     fread(tpsrc, sizeof(int), (*NPSRC) * maxdim, f);
-    // assuming nzt=NZ
+    // depth in the file, height above the bottom of this z rank in psrc (z rank 0 holds the surface)
     for (i = 0; i < *NPSRC; i++) {
       // tpsrc[i*maxdim] = (tpsrc[i*maxdim]-1)%nxt+1;
       // tpsrc[i*maxdim+1] = (tpsrc[i*maxdim+1]-1)%nyt+1;
       // tpsrc[i*maxdim+2] = NZ+1 - tpsrc[i*maxdim+2];
       tpsrc[i * maxdim] = tpsrc[i * maxdim] - nbx - 1;
       tpsrc[i * maxdim + 1] = tpsrc[i * maxdim + 1] - nby - 1;
-      tpsrc[i * maxdim + 2] = NZ + 1 - tpsrc[i * maxdim + 2];
+      tpsrc[i * maxdim + 2] = offs[2] + nzt + 1 - tpsrc[i * maxdim + 2];
     }
     *psrc = tpsrc;
     fclose(f);
@@ -123,7 +123,45 @@ int read_src_ifault_2(int rank, int READ_STEP, char *INSRC, char *INSRC_I2, int
   return 0;
 }
 
-int inisource(int rank, int IFAULT, int NSRC, int READ_STEP, int NST, int *SRCPROC, int NZ, MPI_Comm MCW, int nxt, int nyt, int nzt, int *coords, int maxdim, int *NPSRC, PosInf *ptpsrc, Grid1D *ptaxx, Grid1D *ptayy, Grid1D *ptazz, Grid1D *ptaxz, Grid1D *ptayz, Grid1D *ptaxy, char *INSRC, char *INSRC_I2) {
+// global 1-based x, y and depth of the NSRC source nodes on every rank, read ahead of inisource for the
+// partition cost model; NULL when they are not known before the decomposition (IFAULT=2 splits them per rank)
+PosInf srcpos(int rank, int IFAULT, int NSRC, int READ_STEP, int NST, MPI_Comm MCW, char *INSRC) {
+  int i, j, err = 0, master = 0;
+  float tmp;
+  PosInf srcp;
+  FILE *file;
+
+  if (NSRC < 1 || IFAULT > 1) return NULL;
+
+  srcp = Alloc1P(NSRC * 3);
+  if (rank == master) {
+    file = fopen(INSRC, IFAULT == 1 ? "rb" : "r");
+    if (!file)
+      err = 1;
+    else {
+      for (i = 0; i < NSRC && !err; i++) {
+        if (IFAULT == 1) {
+          if (fread(&srcp[i * 3], sizeof(int), 3, file) != 3 || fseek(file, sizeof(float) * NST * 6, SEEK_CUR)) err = 1;
+        } else {
+          if (fscanf(file, " %d %d %d ", &srcp[i * 3], &srcp[i * 3 + 1], &srcp[i * 3 + 2]) != 3) err = 1;
+          for (j = 0; j < READ_STEP * 6 && !err; j++)
+            if (fscanf(file, " %f ", &tmp) != 1) err = 1;
+        }
+      }
+      fclose(file);
+    }
+  }
+  MPI_Bcast(&err, 1, MPI_INT, master, MCW);
+  if (err) {
+    Delloc1P(srcp);
+    return NULL;
+  }
+  MPI_Bcast(srcp, NSRC * 3, MPI_INT, master, MCW);
+
+  return srcp;
+}
+
+int inisource(int rank, int IFAULT, int NSRC, int READ_STEP, int NST, int *SRCPROC, int NZ, MPI_Comm MCW, int nxt, int nyt, int nzt, int *offs, int maxdim, int *NPSRC, PosInf *ptpsrc, Grid1D *ptaxx, Grid1D *ptayy, Grid1D *ptazz, Grid1D *ptaxz, Grid1D *ptayz, Grid1D *ptaxy, char *INSRC, char *INSRC_I2) {
   int i, j, k, npsrc, srcproc, master = 0;
   int nbx, nex, nby, ney, nbz, nez;
   PosInf tpsrc = NULL, tpsrcp = NULL;
@@ -134,12 +172,13 @@ int inisource(int rank, int IFAULT, int NSRC, int READ_STEP, int NST, int *SRCPR
   npsrc = 0;
   srcproc = -1;
   // Indexing is based on 1: [1, nxt], etc. Include 1st layer ghost cells
-  nbx = nxt * coords[0] + 1 - 2 * loop;
+  nbx = offs[0] + 1 - 2 * loop;
   nex = nbx + nxt + 4 * loop - 1;
-  nby = nyt * coords[1] + 1 - 2 * loop;
+  nby = offs[1] + 1 - 2 * loop;
   ney = nby + nyt + 4 * loop - 1;
-  nbz = 1;
-  nez = nzt;
+  // heights above the model bottom; z rank 0 holds the free surface
+  nbz = NZ - offs[2] - nzt + 1 - 2 * loop;
+  nez = nbz + nzt + 4 * loop - 1;
   // IFAULT=1 has bug! READ_STEP does not work, it tries to read NST all at once - Efe
   if (IFAULT <= 1) {
     tpsrc = Alloc1P(NSRC * maxdim);
@@ -221,7 +260,7 @@ int inisource(int rank, int IFAULT, int NSRC, int READ_STEP, int NST, int *SRCPR
         if (tpsrc[i * maxdim] >= nbx && tpsrc[i * maxdim] <= nex && tpsrc[i * maxdim + 1] >= nby && tpsrc[i * maxdim + 1] <= ney && tpsrc[i * maxdim + 2] >= nbz && tpsrc[i * maxdim + 2] <= nez) {
           tpsrcp[k * maxdim] = tpsrc[i * maxdim] - nbx - 1;
           tpsrcp[k * maxdim + 1] = tpsrc[i * maxdim + 1] - nby - 1;
-          tpsrcp[k * maxdim + 2] = tpsrc[i * maxdim + 2] - nbz + 1;
+          tpsrcp[k * maxdim + 2] = tpsrc[i * maxdim + 2] - nbz + 1 - 2 * loop;
           for (j = 0; j < READ_STEP; j++) {
             taxxp[k * READ_STEP + j] = taxx[i * READ_STEP + j];
             tayyp[k * READ_STEP + j] = tayy[i * READ_STEP + j];
@@ -252,7 +291,7 @@ int inisource(int rank, int IFAULT, int NSRC, int READ_STEP, int NST, int *SRCPR
     *ptayz = tayzp;
     *ptaxy = taxyp;
   } else if (IFAULT == 2) {
-    return read_src_ifault_2(rank, READ_STEP, INSRC, INSRC_I2, maxdim, coords, NZ, nxt, nyt, nzt, NPSRC, SRCPROC, ptpsrc, ptaxx, ptayy, ptazz, ptaxz, ptayz, ptaxy, 1);
+    return read_src_ifault_2(rank, READ_STEP, INSRC, INSRC_I2, maxdim, offs, NZ, nxt, nyt, nzt, NPSRC, SRCPROC, ptpsrc, ptaxx, ptayy, ptazz, ptaxz, ptayz, ptaxy, 1);
   }
   return 0;
 }
@@ -267,19 +306,19 @@ void addsrc(int i, float DH, float DT, int NST, int npsrc, int READ_STEP, int di
     idx = psrc[j * dim] + 1 + 4 * loop;
     idy = psrc[j * dim + 1] + 1 + 4 * loop;
     idz = psrc[j * dim + 2] + align - 1;
-    xx[idx][idy][idz] = xx[idx][idy][idz] - vtst * axx[j * READ_STEP + i];
-    yy[idx][idy][idz] = yy[idx][idy][idz] - vtst * ayy[j * READ_STEP + i];
-    zz[idx][idy][idz] = zz[idx][idy][idz] - vtst * azz[j * READ_STEP + i];
-    xz[idx][idy][idz] = xz[idx][idy][idz] - vtst * axz[j * READ_STEP + i];
-    yz[idx][idy][idz] = yz[idx][idy][idz] - vtst * ayz[j * READ_STEP + i];
-    xy[idx][idy][idz] = xy[idx][idy][idz] - vtst * axy[j * READ_STEP + i];
+    G3(xx, idx, idy, idz) = G3(xx, idx, idy, idz) - vtst * axx[j * READ_STEP + i];
+    G3(yy, idx, idy, idz) = G3(yy, idx, idy, idz) - vtst * ayy[j * READ_STEP + i];
+    G3(zz, idx, idy, idz) = G3(zz, idx, idy, idz) - vtst * azz[j * READ_STEP + i];
+    G3(xz, idx, idy, idz) = G3(xz, idx, idy, idz) - vtst * axz[j * READ_STEP + i];
+    G3(yz, idx, idy, idz) = G3(yz, idx, idy, idz) - vtst * ayz[j * READ_STEP + i];
+    G3(xy, idx, idy, idz) = G3(xy, idx, idy, idz) - vtst * axy[j * READ_STEP + i];
     /*
-         printf("xx=%1.6g\n",xx[idx][idy][idz]);
-         printf("yy=%1.6g\n",yy[idx][idy][idz]);
-         printf("zz=%1.6g\n",zz[idx][idy][idz]);
-         printf("xz=%1.6g\n",xz[idx][idy][idz]);
-         printf("yz=%1.6g\n",yz[idx][idy][idz]);
-         printf("xy=%1.6g\n",xy[idx][idy][idz]);
+         printf("xx=%1.6g\n",G3(xx, idx, idy, idz));
+         printf("yy=%1.6g\n",G3(yy, idx, idy, idz));
+         printf("zz=%1.6g\n",G3(zz, idx, idy, idz));
+         printf("xz=%1.6g\n",G3(xz, idx, idy, idz));
+         printf("yz=%1.6g\n",G3(yz, idx, idy, idz));
+         printf("xy=%1.6g\n",G3(xy, idx, idy, idz));
     */
   }
   return;
@@ -13,297 +13,299 @@ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
 */
 
 #include <stdio.h>
+#include <string.h>
 
 #include "pmcl3d.h"
 #define MPIRANKX 100000
 #define MPIRANKY 50000
+#define MPIRANKZ 150000
 
+#ifndef NOCUDA
 void update_bound_y_H(float* u1, float* v1, float* w1, float* f_u1, float* f_v1, float* f_w1, float* b_u1, float* b_v1, float* b_w1, int nxt, int nzt, cudaStream_t St1, cudaStream_t St2, int rank_f, int rank_b);
-
-void mediaswap(Grid3D d1, Grid3D mu, Grid3D lam, Grid3D qp, Grid3D qs, int rank, int x_rank_L, int x_rank_R, int y_rank_F, int y_rank_B, int nxt, int nyt, int nzt, MPI_Comm MCW) {
-  int i, j, k, idx, idy, idz;
-  int media_count_x, media_count_y;
-  int media_size_x, media_size_y;
-  MPI_Request request_x[4], request_y[4];
-  MPI_Status status_x[4], status_y[4];
-  Grid1D mediaL_S = NULL, mediaR_S = NULL, mediaF_S = NULL, mediaB_S = NULL;
-  Grid1D mediaL_R = NULL, mediaR_R = NULL, mediaF_R = NULL, mediaB_R = NULL;
-
-  if (x_rank_L < 0 && x_rank_R < 0 && y_rank_F < 0 && y_rank_B < 0)
+#endif
+
+// exchange the media ghost planes once after inimesh, straight from the grids (see HaloType_X/Y/Z);
+// qp/qs take part only when they are allocated. z goes last, so its planes carry the x/y ghost columns
+void mediaswap(Grid3D d1, Grid3D mu, Grid3D lam, Grid3D qp, Grid3D qs, int rank, int x_rank_L, int x_rank_R, int y_rank_F, int y_rank_B, int z_rank_D, int z_rank_U, int nxt, int nyt, int nzt, MPI_Comm MCW) {
+  int n;
+  Grid3D media[5];
+  MPI_Request request_x[4], request_y[4], request_z[4];
+  MPI_Status status_x[4], status_y[4], status_z[4];
+  MPI_Datatype type_x[4], type_y[4], type_z[4];
+
+  if (x_rank_L < 0 && x_rank_R < 0 && y_rank_F < 0 && y_rank_B < 0 && z_rank_D < 0 && z_rank_U < 0)
     return;
 
+  media[0] = d1;
+  media[1] = mu;
+  media[2] = lam;
+  media[3] = qp;
+  media[4] = qs;
+  n = qp.data ? 5 : 3;
+
   if (y_rank_F >= 0 || y_rank_B >= 0) {
-    mediaF_S = Alloc1D(5 * 4 * loop * (nxt + 2) * (nzt + 2));
-    mediaB_S = Alloc1D(5 * 4 * loop * (nxt + 2) * (nzt + 2));
-    mediaF_R = Alloc1D(5 * 4 * loop * (nxt + 2) * (nzt + 2));
-    mediaB_R = Alloc1D(5 * 4 * loop * (nxt + 2) * (nzt + 2));
-    media_size_y = 5 * (4 * loop) * (nxt + 2) * (nzt + 2);
-    media_count_y = 0;
-
-    PostRecvMsg_Y(mediaF_R, mediaB_R, MCW, request_y, &media_count_y, media_size_y, y_rank_F, y_rank_B);
-
-    if (y_rank_F >= 0) {
-      for (i = 1 + 4 * loop; i < nxt + 3 + 4 * loop; i++)
-        for (j = 2 + 4 * loop; j < 2 + 8 * loop; j++)
-          for (k = align - 1; k < nzt + align + 1; k++) {
-            idx = i - 1 - 4 * loop;
-            idy = (j - 2 - 4 * loop) * 5;
-            idz = k - align + 1;
-            mediaF_S[idx * 5 * (4 * loop) * (nzt + 2) + idy * (nzt + 2) + idz] = d1[i][j][k];
-            idy++;
-            mediaF_S[idx * 5 * (4 * loop) * (nzt + 2) + idy * (nzt + 2) + idz] = mu[i][j][k];
-            idy++;
-            mediaF_S[idx * 5 * (4 * loop) * (nzt + 2) + idy * (nzt + 2) + idz] = lam[i][j][k];
-            idy++;
-            mediaF_S[idx * 5 * (4 * loop) * (nzt + 2) + idy * (nzt + 2) + idz] = qp[i][j][k];
-            idy++;
-            mediaF_S[idx * 5 * (4 * loop) * (nzt + 2) + idy * (nzt + 2) + idz] = qs[i][j][k];
-          }
-    }
+    HaloType_Y(media, n, nyt, 1 + 4 * loop, nxt + 2, align - 1, nzt + 2, type_y);
+    InitMsg_Y((float*)MPI_BOTTOM, (float*)MPI_BOTTOM, (float*)MPI_BOTTOM, (float*)MPI_BOTTOM, MCW, request_y, 1, type_y, y_rank_F, y_rank_B, rank);
+    StartRecvMsg(request_y);
+    StartSendMsg(request_y, Both);
+    MPI_Waitall(4, request_y, status_y);
+    FreeMsg(request_y);
+    FreeHaloType(type_y);
+  }
 
-    if (y_rank_B >= 0) {
-      for (i = 1 + 4 * loop; i < nxt + 3 + 4 * loop; i++)
-        for (j = nyt + 2; j < nyt + 2 + 4 * loop; j++)
-          for (k = align - 1; k < nzt + align + 1; k++) {
-            idx = i - 1 - 4 * loop;
-            idy = (j - nyt - 2) * 5;
-            idz = k - align + 1;
-            mediaB_S[idx * 5 * (4 * loop) * (nzt + 2) + idy * (nzt + 2) + idz] = d1[i][j][k];
-            idy++;
-            mediaB_S[idx * 5 * (4 * loop) * (nzt + 2) + idy * (nzt + 2) + idz] = mu[i][j][k];
-            idy++;
-            mediaB_S[idx * 5 * (4 * loop) * (nzt + 2) + idy * (nzt + 2) + idz] = lam[i][j][k];
-            idy++;
-            mediaB_S[idx * 5 * (4 * loop) * (nzt + 2) + idy * (nzt + 2) + idz] = qp[i][j][k];
-            idy++;
-            mediaB_S[idx * 5 * (4 * loop) * (nzt + 2) + idy * (nzt + 2) + idz] = qs[i][j][k];
-          }
-    }
+  if (x_rank_L >= 0 || x_rank_R >= 0) {
+    HaloType_X(media, n, nxt, 2, nyt + 8 * loop, align - 1, nzt + 2, type_x);
+    InitMsg_X((float*)MPI_BOTTOM, (float*)MPI_BOTTOM, (float*)MPI_BOTTOM, (float*)MPI_BOTTOM, MCW, request_x, 1, type_x, x_rank_L, x_rank_R, rank);
+    StartRecvMsg(request_x);
+    StartSendMsg(request_x, Both);
+    MPI_Waitall(4, request_x, status_x);
+    FreeMsg(request_x);
+    FreeHaloType(type_x);
+  }
 
-    PostSendMsg_Y(mediaF_S, mediaB_S, MCW, request_y, &media_count_y, media_size_y, y_rank_F, y_rank_B, rank, Both);
-    MPI_Waitall(media_count_y, request_y, status_y);
-
-    if (y_rank_F >= 0) {
-      for (i = 1 + 4 * loop; i < nxt + 3 + 4 * loop; i++)
-        for (j = 2; j < 2 + 4 * loop; j++)
-          for (k = align - 1; k < nzt + align + 1; k++) {
-            idx = i - 1 - 4 * loop;
-            idy = (j - 2) * 5;
-            idz = k - align + 1;
-            d1[i][j][k] = mediaF_R[idx * 5 * (4 * loop) * (nzt + 2) + idy * (nzt + 2) + idz];
-            idy++;
-            mu[i][j][k] = mediaF_R[idx * 5 * (4 * loop) * (nzt + 2) + idy * (nzt + 2) + idz];
-            idy++;
-            lam[i][j][k] = mediaF_R[idx * 5 * (4 * loop) * (nzt + 2) + idy * (nzt + 2) + idz];
-            idy++;
-            qp[i][j][k] = mediaF_R[idx * 5 * (4 * loop) * (nzt + 2) + idy * (nzt + 2) + idz];
-            idy++;
-            qs[i][j][k] = mediaF_R[idx * 5 * (4 * loop) * (nzt + 2) + idy * (nzt + 2) + idz];
-          }
-    }
+  if (z_rank_D >= 0 || z_rank_U >= 0) {
+    HaloType_Z(media, n, nzt, 2, nxt + 8 * loop, 2, nyt + 8 * loop, type_z);
+    InitMsg_Z((float*)MPI_BOTTOM, (float*)MPI_BOTTOM, (float*)MPI_BOTTOM, (float*)MPI_BOTTOM, MCW, request_z, 1, type_z, z_rank_D, z_rank_U, rank);
+    StartRecvMsg(request_z);
+    StartSendMsg(request_z, Both);
+    MPI_Waitall(4, request_z, status_z);
+    FreeMsg(request_z);
+    FreeHaloType(type_z);
+  }
 
-    if (y_rank_B >= 0) {
-      for (i = 1 + 4 * loop; i < nxt + 3 + 4 * loop; i++)
-        for (j = nyt + 2 + 4 * loop; j < nyt + 2 + 8 * loop; j++)
-          for (k = align - 1; k < nzt + align + 1; k++) {
-            idx = i - 1 - 4 * loop;
-            idy = (j - nyt - 2 - 4 * loop) * 5;
-            idz = k - align + 1;
-            d1[i][j][k] = mediaB_R[idx * 5 * (4 * loop) * (nzt + 2) + idy * (nzt + 2) + idz];
-            idy++;
-            mu[i][j][k] = mediaB_R[idx * 5 * (4 * loop) * (nzt + 2) + idy * (nzt + 2) + idz];
-            idy++;
-            lam[i][j][k] = mediaB_R[idx * 5 * (4 * loop) * (nzt + 2) + idy * (nzt + 2) + idz];
-            idy++;
-            qp[i][j][k] = mediaB_R[idx * 5 * (4 * loop) * (nzt + 2) + idy * (nzt + 2) + idz];
-            idy++;
-            qs[i][j][k] = mediaB_R[idx * 5 * (4 * loop) * (nzt + 2) + idy * (nzt + 2) + idz];
-          }
-    }
+  return;
+}
 
-    Delloc1D(mediaF_S);
-    Delloc1D(mediaB_S);
-    Delloc1D(mediaF_R);
-    Delloc1D(mediaB_R);
-  }
+// the same ni x nj x nk sub-box of n grids as one message, addressed from MPI_BOTTOM so it is
+// sent and received in place
+static MPI_Datatype BoxType(Grid3D* U, int n, int i0, int ni, int j0, int nj, int k0, int nk) {
+  int q, sizes[3], subsizes[3], starts[3], blocklen[3 * MAXRHS];
+  MPI_Aint disp[3 * MAXRHS];
+  MPI_Datatype box[3 * MAXRHS], msg;
 
-  if (x_rank_L >= 0 || x_rank_R >= 0) {
-    mediaL_S = Alloc1D(5 * 4 * loop * (nyt + 8 * loop) * (nzt + 2));
-    mediaR_S = Alloc1D(5 * 4 * loop * (nyt + 8 * loop) * (nzt + 2));
-    mediaL_R = Alloc1D(5 * 4 * loop * (nyt + 8 * loop) * (nzt + 2));
-    mediaR_R = Alloc1D(5 * 4 * loop * (nyt + 8 * loop) * (nzt + 2));
-    media_size_x = 5 * (4 * loop) * (nyt + 8 * loop) * (nzt + 2);
-    media_count_x = 0;
-
-    PostRecvMsg_X(mediaL_R, mediaR_R, MCW, request_x, &media_count_x, media_size_x, x_rank_L, x_rank_R);
-    if (x_rank_L >= 0) {
-      for (i = 2 + 4 * loop; i < 2 + 8 * loop; i++)
-        for (j = 2; j < nyt + 2 + 8 * loop; j++)
-          for (k = align - 1; k < nzt + align + 1; k++) {
-            idx = (i - 2 - 4 * loop) * 5;
-            idy = j - 2;
-            idz = k - align + 1;
-            mediaL_S[idx * (nyt + 8 * loop) * (nzt + 2) + idy * (nzt + 2) + idz] = d1[i][j][k];
-            idx++;
-            mediaL_S[idx * (nyt + 8 * loop) * (nzt + 2) + idy * (nzt + 2) + idz] = mu[i][j][k];
-            idx++;
-            mediaL_S[idx * (nyt + 8 * loop) * (nzt + 2) + idy * (nzt + 2) + idz] = lam[i][j][k];
-            idx++;
-            mediaL_S[idx * (nyt + 8 * loop) * (nzt + 2) + idy * (nzt + 2) + idz] = qp[i][j][k];
-            idx++;
-            mediaL_S[idx * (nyt + 8 * loop) * (nzt + 2) + idy * (nzt + 2) + idz] = qs[i][j][k];
-          }
-    }
+  if (n < 1 || n > 3 * MAXRHS) {
+    fprintf(stderr, "halo message of %d grids, at most %d\n", n, 3 * MAXRHS);
+    MPI_Abort(MPI_COMM_WORLD, 1);
+  }
+  subsizes[0] = ni;
+  subsizes[1] = nj;
+  subsizes[2] = nk;
+  starts[0] = i0;
+  starts[1] = j0;
+  starts[2] = k0;
+  for (q = 0; q < n; q++) {
+    sizes[0] = U[q].nx;
+    sizes[1] = U[q].ny;
+    sizes[2] = U[q].nz;
+    MPI_Type_create_subarray(3, sizes, subsizes, starts, MPI_ORDER_C, MPI_FLOAT, &box[q]);
+    MPI_Get_address(U[q].data, &disp[q]);
+    blocklen[q] = 1;
+  }
+  MPI_Type_create_struct(n, blocklen, disp, box, &msg);
+  MPI_Type_commit(&msg);
+  for (q = 0; q < n; q++) MPI_Type_free(&box[q]);
 
-    if (x_rank_R >= 0) {
-      for (i = nxt + 2; i < nxt + 2 + 4 * loop; i++)
-        for (j = 2; j < nyt + 2 + 8 * loop; j++)
-          for (k = align - 1; k < nzt + align + 1; k++) {
-            idx = (i - nxt - 2) * 5;
-            idy = j - 2;
-            idz = k - align + 1;
-            mediaR_S[idx * (nyt + 8 * loop) * (nzt + 2) + idy * (nzt + 2) + idz] = d1[i][j][k];
-            idx++;
-            mediaR_S[idx * (nyt + 8 * loop) * (nzt + 2) + idy * (nzt + 2) + idz] = mu[i][j][k];
-            idx++;
-            mediaR_S[idx * (nyt + 8 * loop) * (nzt + 2) + idy * (nzt + 2) + idz] = lam[i][j][k];
-            idx++;
-            mediaR_S[idx * (nyt + 8 * loop) * (nzt + 2) + idy * (nzt + 2) + idz] = qp[i][j][k];
-            idx++;
-            mediaR_S[idx * (nyt + 8 * loop) * (nzt + 2) + idy * (nzt + 2) + idz] = qs[i][j][k];
-          }
-    }
+  return msg;
+}
 
-    PostSendMsg_X(mediaL_S, mediaR_S, MCW, request_x, &media_count_x, media_size_x, x_rank_L, x_rank_R, rank, Both);
-    MPI_Waitall(media_count_x, request_x, status_x);
-
-    if (x_rank_L >= 0) {
-      for (i = 2; i < 2 + 4 * loop; i++)
-        for (j = 2; j < nyt + 2 + 8 * loop; j++)
-          for (k = align - 1; k < nzt + align + 1; k++) {
-            idx = (i - 2) * 5;
-            idy = j - 2;
-            idz = k - align + 1;
-            d1[i][j][k] = mediaL_R[idx * (nyt + 8 * loop) * (nzt + 2) + idy * (nzt + 2) + idz];
-            idx++;
-            mu[i][j][k] = mediaL_R[idx * (nyt + 8 * loop) * (nzt + 2) + idy * (nzt + 2) + idz];
-            idx++;
-            lam[i][j][k] = mediaL_R[idx * (nyt + 8 * loop) * (nzt + 2) + idy * (nzt + 2) + idz];
-            idx++;
-            qp[i][j][k] = mediaL_R[idx * (nyt + 8 * loop) * (nzt + 2) + idy * (nzt + 2) + idz];
-            idx++;
-            qs[i][j][k] = mediaL_R[idx * (nyt + 8 * loop) * (nzt + 2) + idy * (nzt + 2) + idz];
-          }
-    }
+// halo datatypes of the 4*loop x planes next to each side, over j in [j0, j0+nj) and k in [k0, k0+nk),
+// in the slot order of InitMsg_X: receive left/right, send left/right
+void HaloType_X(Grid3D* U, int n, int nxt, int j0, int nj, int k0, int nk, MPI_Datatype* type) {
+  type[0] = BoxType(U, n, 2, 4 * loop, j0, nj, k0, nk);
+  type[1] = BoxType(U, n, nxt + 2 + 4 * loop, 4 * loop, j0, nj, k0, nk);
+  type[2] = BoxType(U, n, 2 + 4 * loop, 4 * loop, j0, nj, k0, nk);
+  type[3] = BoxType(U, n, nxt + 2, 4 * loop, j0, nj, k0, nk);
+  return;
+}
 
-    if (x_rank_R >= 0) {
-      for (i = nxt + 2 + 4 * loop; i < nxt + 2 + 8 * loop; i++)
-        for (j = 2; j < nyt + 2 + 8 * loop; j++)
-          for (k = align - 1; k < nzt + align + 1; k++) {
-            idx = (i - nxt - 2 - 4 * loop) * 5;
-            idy = j - 2;
-            idz = k - align + 1;
-            d1[i][j][k] = mediaR_R[idx * (nyt + 8 * loop) * (nzt + 2) + idy * (nzt + 2) + idz];
-            idx++;
-            mu[i][j][k] = mediaR_R[idx * (nyt + 8 * loop) * (nzt + 2) + idy * (nzt + 2) + idz];
-            idx++;
-            lam[i][j][k] = mediaR_R[idx * (nyt + 8 * loop) * (nzt + 2) + idy * (nzt + 2) + idz];
-            idx++;
-            qp[i][j][k] = mediaR_R[idx * (nyt + 8 * loop) * (nzt + 2) + idy * (nzt + 2) + idz];
-            idx++;
-            qs[i][j][k] = mediaR_R[idx * (nyt + 8 * loop) * (nzt + 2) + idy * (nzt + 2) + idz];
-          }
-    }
+// halo datatypes of the 4*loop y rows next to each side, over i in [i0, i0+ni) and k in [k0, k0+nk),
+// in the slot order of InitMsg_Y: receive front/back, send front/back
+void HaloType_Y(Grid3D* U, int n, int nyt, int i0, int ni, int k0, int nk, MPI_Datatype* type) {
+  type[0] = BoxType(U, n, i0, ni, 2, 4 * loop, k0, nk);
+  type[1] = BoxType(U, n, i0, ni, nyt + 2 + 4 * loop, 4 * loop, k0, nk);
+  type[2] = BoxType(U, n, i0, ni, 2 + 4 * loop, 4 * loop, k0, nk);
+  type[3] = BoxType(U, n, i0, ni, nyt + 2, 4 * loop, k0, nk);
+  return;
+}
 
-    Delloc1D(mediaL_S);
-    Delloc1D(mediaR_S);
-    Delloc1D(mediaL_R);
-    Delloc1D(mediaR_R);
-  }
+// halo datatypes of the 4*loop z planes below and above the interior, over i in [i0, i0+ni) and
+// j in [j0, j0+nj), in the slot order of InitMsg_Z: receive down/up, send down/up
+void HaloType_Z(Grid3D* U, int n, int nzt, int i0, int ni, int j0, int nj, MPI_Datatype* type) {
+  type[0] = BoxType(U, n, i0, ni, j0, nj, align - 4 * loop, 4 * loop);
+  type[1] = BoxType(U, n, i0, ni, j0, nj, nzt + align, 4 * loop);
+  type[2] = BoxType(U, n, i0, ni, j0, nj, align, 4 * loop);
+  type[3] = BoxType(U, n, i0, ni, j0, nj, nzt + align - 4 * loop, 4 * loop);
+  return;
+}
 
+void FreeHaloType(MPI_Datatype* type) {
+  int i;
+  for (i = 0; i < 4; i++) MPI_Type_free(&type[i]);
   return;
 }
 
-void PostRecvMsg_X(float* RL_M, float* RR_M, MPI_Comm MCW, MPI_Request* request, int* count, int msg_size, int rank_L, int rank_R) {
-  int temp_count = 0;
+// persistent halo requests, set up once before the time loop: slots 0/1 receive from the left/right
+// (front/back) neighbour, slots 2/3 send to it, each as msg_size elements of type[slot] at its buffer
+// (MPI_BOTTOM with HaloType_X/Y); slots without a neighbour stay MPI_REQUEST_NULL
+void InitMsg_X(float* RL_M, float* RR_M, float* SL_M, float* SR_M, MPI_Comm MCW, MPI_Request* request, int msg_size, MPI_Datatype* type, int rank_L, int rank_R, int rank) {
+  int i;
+  for (i = 0; i < 4; i++) request[i] = MPI_REQUEST_NULL;
 
   if (rank_L >= 0) {
-    MPI_Irecv(RL_M, msg_size, MPI_FLOAT, rank_L, MPIRANKX + rank_L, MCW, &request[temp_count]);
-    ++temp_count;
+    MPI_Recv_init(RL_M, msg_size, type[0], rank_L, MPIRANKX + rank_L, MCW, &request[0]);
+    MPI_Send_init(SL_M, msg_size, type[2], rank_L, MPIRANKX + rank, MCW, &request[2]);
   }
 
   if (rank_R >= 0) {
-    MPI_Irecv(RR_M, msg_size, MPI_FLOAT, rank_R, MPIRANKX + rank_R, MCW, &request[temp_count]);
-    ++temp_count;
+    MPI_Recv_init(RR_M, msg_size, type[1], rank_R, MPIRANKX + rank_R, MCW, &request[1]);
+    MPI_Send_init(SR_M, msg_size, type[3], rank_R, MPIRANKX + rank, MCW, &request[3]);
   }
 
-  *count = temp_count;
   return;
 }
 
-void PostSendMsg_X(float* SL_M, float* SR_M, MPI_Comm MCW, MPI_Request* request, int* count, int msg_size, int rank_L, int rank_R, int rank, int flag) {
-  int temp_count, flag_L = -1, flag_R = -1;
-  temp_count = *count;
-  if (rank < 0)
-    return;
-
-  if (flag == Both || flag == Left) flag_L = 1;
-  if (flag == Both || flag == Right) flag_R = 1;
+void InitMsg_Y(float* RF_M, float* RB_M, float* SF_M, float* SB_M, MPI_Comm MCW, MPI_Request* request, int msg_size, MPI_Datatype* type, int rank_F, int rank_B, int rank) {
+  int i;
+  for (i = 0; i < 4; i++) request[i] = MPI_REQUEST_NULL;
 
-  if (rank_L >= 0 && flag_L == 1) {
-    MPI_Isend(SL_M, msg_size, MPI_FLOAT, rank_L, MPIRANKX + rank, MCW, &request[temp_count]);
-    ++temp_count;
+  if (rank_F >= 0) {
+    MPI_Recv_init(RF_M, msg_size, type[0], rank_F, MPIRANKY + rank_F, MCW, &request[0]);
+    MPI_Send_init(SF_M, msg_size, type[2], rank_F, MPIRANKY + rank, MCW, &request[2]);
   }
 
-  if (rank_R >= 0 && flag_R == 1) {
-    MPI_Isend(SR_M, msg_size, MPI_FLOAT, rank_R, MPIRANKX + rank, MCW, &request[temp_count]);
-    ++temp_count;
+  if (rank_B >= 0) {
+    MPI_Recv_init(RB_M, msg_size, type[1], rank_B, MPIRANKY + rank_B, MCW, &request[1]);
+    MPI_Send_init(SB_M, msg_size, type[3], rank_B, MPIRANKY + rank, MCW, &request[3]);
   }
 
-  *count = temp_count;
   return;
 }
 
-void PostRecvMsg_Y(float* RF_M, float* RB_M, MPI_Comm MCW, MPI_Request* request, int* count, int msg_size, int rank_F, int rank_B) {
-  int temp_count = 0;
+// as InitMsg_X for the neighbours below (down, deeper) and above (up, towards the free surface)
+void InitMsg_Z(float* RD_M, float* RU_M, float* SD_M, float* SU_M, MPI_Comm MCW, MPI_Request* request, int msg_size, MPI_Datatype* type, int rank_D, int rank_U, int rank) {
+  int i;
+  for (i = 0; i < 4; i++) request[i] = MPI_REQUEST_NULL;
 
-  if (rank_F >= 0) {
-    MPI_Irecv(RF_M, msg_size, MPI_FLOAT, rank_F, MPIRANKY + rank_F, MCW, &request[temp_count]);
-    ++temp_count;
+  if (rank_D >= 0) {
+    MPI_Recv_init(RD_M, msg_size, type[0], rank_D, MPIRANKZ + rank_D, MCW, &request[0]);
+    MPI_Send_init(SD_M, msg_size, type[2], rank_D, MPIRANKZ + rank, MCW, &request[2]);
   }
 
-  if (rank_B >= 0) {
-    MPI_Irecv(RB_M, msg_size, MPI_FLOAT, rank_B, MPIRANKY + rank_B, MCW, &request[temp_count]);
-    ++temp_count;
+  if (rank_U >= 0) {
+    MPI_Recv_init(RU_M, msg_size, type[1], rank_U, MPIRANKZ + rank_U, MCW, &request[1]);
+    MPI_Send_init(SU_M, msg_size, type[3], rank_U, MPIRANKZ + rank, MCW, &request[3]);
   }
 
-  *count = temp_count;
   return;
 }
 
-void PostSendMsg_Y(float* SF_M, float* SB_M, MPI_Comm MCW, MPI_Request* request, int* count, int msg_size, int rank_F, int rank_B, int rank, int flag) {
-  int temp_count, flag_F = -1, flag_B = -1;
-  temp_count = *count;
-  if (rank < 0)
-    return;
+static void StartMsg(MPI_Request* request, int first, int last) {
+  int i, count = 0;
 
-  if (flag == Both || flag == Front) flag_F = 1;
-  if (flag == Both || flag == Back) flag_B = 1;
+  for (i = first; i <= last; i++)
+    if (request[i] != MPI_REQUEST_NULL) count++;
+  if (count == last - first + 1)
+    MPI_Startall(count, &request[first]);
+  else
+    for (i = first; i <= last; i++)
+      if (request[i] != MPI_REQUEST_NULL) MPI_Start(&request[i]);
 
-  if (rank_F >= 0 && flag_F == 1) {
-    MPI_Isend(SF_M, msg_size, MPI_FLOAT, rank_F, MPIRANKY + rank, MCW, &request[temp_count]);
-    ++temp_count;
-  }
+  return;
+}
 
-  if (rank_B >= 0 && flag_B == 1) {
-    MPI_Isend(SB_M, msg_size, MPI_FLOAT, rank_B, MPIRANKY + rank, MCW, &request[temp_count]);
-    ++temp_count;
-  }
+void StartRecvMsg(MPI_Request* request) {
+  StartMsg(request, 0, 1);
+  return;
+}
+
+// flag selects the neighbour as for PostSendMsg_X/Y: Both, Left/Front (slot 2) or Right/Back (slot 3)
+void StartSendMsg(MPI_Request* request, int flag) {
+  if (flag == Both)
+    StartMsg(request, 2, 3);
+  else if (flag == Left || flag == Front)
+    StartMsg(request, 2, 2);
+  else
+    StartMsg(request, 3, 3);
+
+  return;
+}
+
+void FreeMsg(MPI_Request* request) {
+  int i;
+  for (i = 0; i < 4; i++)
+    if (request[i] != MPI_REQUEST_NULL) MPI_Request_free(&request[i]);
+
+  return;
+}
+
+// rank of the MCW rank `rank` in the node communicator MCS, -1 if there is no such neighbour or it is
+// on another node
+int ShmRank(MPI_Comm MCW, MPI_Comm MCS, int rank) {
+  int shm_rank = MPI_UNDEFINED;
+  MPI_Group group_w, group_s;
+
+  if (rank < 0) return -1;
+  MPI_Comm_group(MCW, &group_w);
+  MPI_Comm_group(MCS, &group_s);
+  MPI_Group_translate_ranks(group_w, 1, &rank, group_s, &shm_rank);
+  MPI_Group_free(&group_w);
+  MPI_Group_free(&group_s);
+
+  return shm_rank == MPI_UNDEFINED ? -1 : shm_rank;
+}
+
+// zero byte handshake with the on-node neighbours shm_rank[0..3] (-1 for none); on return the stores
+// either side made to the shared window before the call are visible to the other
+void ShmSync(MPI_Comm MCS, MPI_Win win, int* shm_rank) {
+  int i, count = 0;
+  MPI_Request request[8];
+  MPI_Status status[8];
+
+  MPI_Win_sync(win);
+  for (i = 0; i < 4; i++)
+    if (shm_rank[i] >= 0) {
+      MPI_Irecv(NULL, 0, MPI_BYTE, shm_rank[i], 0, MCS, &request[count++]);
+      MPI_Isend(NULL, 0, MPI_BYTE, shm_rank[i], 0, MCS, &request[count++]);
+    }
+  MPI_Waitall(count, request, status);
+  MPI_Win_sync(win);
+
+  return;
+}
+
+// read the x ghost planes of n grids U straight from the last/first 4*loop interior planes of the
+// on-node left/right neighbour grids L/R, over j in [j0, j0+nj) and k in [k0, k0+nk) (see HaloType_X)
+void ShmCopy_X(Grid3D* U, Grid3D* L, Grid3D* R, int n, int nxt, int j0, int nj, int k0, int nk, int shm_L, int shm_R) {
+  int q, i, j;
+
+  for (q = 0; q < n; q++)
+#pragma omp parallel for schedule(static) private(i)
+    for (j = j0; j < j0 + nj; j++)
+      for (i = 0; i < 4 * loop; i++) {
+        if (shm_L >= 0) memcpy(&G3(U[q], 2 + i, j, k0), &G3(L[q], L[q].nx - halo_xy - 4 * loop + i, j, k0), sizeof(float) * nk);
+        if (shm_R >= 0) memcpy(&G3(U[q], nxt + halo_xy + i, j, k0), &G3(R[q], halo_xy + i, j, k0), sizeof(float) * nk);
+      }
+
+  return;
+}
+
+// read the y ghost rows of n grids U straight from the last/first 4*loop interior rows of the
+// on-node front/back neighbour grids F/B, over i in [i0, i0+ni) and k in [k0, k0+nk) (see HaloType_Y)
+void ShmCopy_Y(Grid3D* U, Grid3D* F, Grid3D* B, int n, int nyt, int i0, int ni, int k0, int nk, int shm_F, int shm_B) {
+  int q, i, j;
+
+  for (q = 0; q < n; q++)
+#pragma omp parallel for schedule(static) private(j)
+    for (i = i0; i < i0 + ni; i++)
+      for (j = 0; j < 4 * loop; j++) {
+        if (shm_F >= 0) memcpy(&G3(U[q], i, 2 + j, k0), &G3(F[q], i, F[q].ny - halo_xy - 4 * loop + j, k0), sizeof(float) * nk);
+        if (shm_B >= 0) memcpy(&G3(U[q], i, nyt + halo_xy + j, k0), &G3(B[q], i, halo_xy + j, k0), sizeof(float) * nk);
+      }
 
-  *count = temp_count;
   return;
 }
 
+#ifndef NOCUDA
 void Cpy2Device_source(int npsrc, int READ_STEP, int index_offset, Grid1D taxx, Grid1D tayy, Grid1D tazz, Grid1D taxz, Grid1D tayz, Grid1D taxy, float* d_taxx, float* d_tayy, float* d_tazz, float* d_taxz, float* d_tayz, float* d_taxy) {
   long int num_bytes;
   cudaError_t cerr;
@@ -395,3 +397,4 @@ void Cpy2Device_VY(float* u1, float* v1, float* w1, float* f_u1, float* f_v1, fl
   update_bound_y_H(u1, v1, w1, f_u1, f_v1, f_w1, b_u1, b_v1, b_w1, nxt, nzt, St1, St2, rank_F, rank_B);
   return;
 }
+#endif